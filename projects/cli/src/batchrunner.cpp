@@ -0,0 +1,397 @@
+#include "batchrunner.h"
+#include "solution.h"
+#include "solverresults.h"
+#include "enginepool.h"
+#include "engineconfiguration.h"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QTimer>
+#include <QSettings>
+#include <QFileInfo>
+#include <QDir>
+#include <QJsonDocument>
+
+#include <cstdio>
+
+using namespace std;
+
+constexpr static int ENGINE_START_TIMEOUT = 60'000; // [ms]
+
+
+static QString command_name(BatchCommand command)
+{
+	switch (command)
+	{
+	case BatchCommand::Solve:   return "solve";
+	case BatchCommand::Verify:  return "verify";
+	case BatchCommand::Shorten: return "shorten";
+	case BatchCommand::Merge:   return "merge";
+	}
+	return "";
+}
+
+static QString message_type_name(MessageType type)
+{
+	switch (type)
+	{
+	case MessageType::std:     return "std";
+	case MessageType::info:    return "info";
+	case MessageType::warning: return "warning";
+	case MessageType::error:   return "error";
+	case MessageType::success: return "success";
+	}
+	return "";
+}
+
+
+BatchRunner::BatchRunner(const BatchOptions& options, QObject* parent)
+	: QObject(parent)
+	, opt(options)
+	, key_to_evaluate(0)
+	, num_errors(0)
+	, num_successes(0)
+	, is_engine_failed(false)
+{}
+
+BatchRunner::~BatchRunner()
+{
+	solver.reset();
+	engine_pool.reset();
+}
+
+void BatchRunner::run()
+{
+	QElapsedTimer timer;
+	timer.start();
+	list<shared_ptr<Solution>> solutions;
+	int exit_code = select_solutions(solutions);
+	if (exit_code == ExitCode_ok)
+	{
+		init_EGTB();
+		if (opt.command == BatchCommand::Solve)
+			exit_code = start_engines();
+	}
+	if (exit_code == ExitCode_ok)
+	{
+		for (auto& solution : solutions)
+		{
+			int code = run_solution(solution);
+			if (code != ExitCode_ok)
+				exit_code = code;
+			if (code == ExitCode_engine_failed)
+				break;
+		}
+	}
+	solver.reset();
+	if (engine_pool)
+		engine_pool->stop();
+
+	QJsonObject done;
+	done["event"] = "done";
+	done["command"] = command_name(opt.command);
+	done["exit_code"] = exit_code;
+	done["seconds"] = timer.elapsed() / 1000.0;
+	print(done);
+	QCoreApplication::exit(exit_code);
+}
+
+int BatchRunner::select_solutions(std::list<std::shared_ptr<Solution>>& solutions)
+{
+	QString folder = opt.solutions_folder.isEmpty() ? QSettings().value("solutions/path", "").toString() : opt.solutions_folder;
+	if (folder.isEmpty() || !QFileInfo(folder).isDir()) {
+		onMessage(QString("Solution folder not found: %1").arg(folder), MessageType::error);
+		return ExitCode_no_solution;
+	}
+	auto [collection, warning_message] = Solution::loadFolder(folder);
+	if (!warning_message.isEmpty())
+		onMessage(warning_message, MessageType::warning);
+
+	// Names are matched as shown in the GUI: "tag: moves" or just "moves"
+	QStringList names_left = opt.solution_names;
+	for (auto& [tag, tag_solutions] : collection)
+	{
+		for (auto& solution : tag_solutions)
+		{
+			bool is_selected = opt.all_solutions;
+			for (auto& name : opt.solution_names)
+			{
+				if (name == solution->nameToShow(true) || name == solution->nameToShow(false)) {
+					is_selected = true;
+					names_left.removeAll(name);
+				}
+			}
+			if (is_selected)
+				solutions.push_back(solution);
+		}
+	}
+	for (auto& name : names_left)
+		onMessage(QString("Solution not found: %1").arg(name), MessageType::error);
+	if (!names_left.isEmpty())
+		return ExitCode_no_solution;
+	if (solutions.empty()) {
+		onMessage(QString("No solutions in %1").arg(folder), MessageType::error);
+		return ExitCode_no_solution;
+	}
+	return ExitCode_ok;
+}
+
+int BatchRunner::start_engines()
+{
+	/// Configuration
+	QSettings s;
+	s.beginGroup("engine");
+	QString path_exe = QDir::toNativeSeparators(QCoreApplication::applicationDirPath());
+	QString path_engine = opt.engine_path;
+	if (path_engine.isEmpty() && !s.value("filename").toString().isEmpty())
+		path_engine = path_exe + "/engines/" + s.value("filename").toString();
+	QFileInfo fi_engine(path_engine);
+	if (path_engine.isEmpty() || !fi_engine.exists()) {
+		onMessage(QString("Failed to load engine: %1").arg(path_engine), MessageType::error);
+		return ExitCode_engine_failed;
+	}
+	QFileInfo fi_egtb(QDir::toNativeSeparators(path_exe + "/EGTB"));
+	QString path_egtb = fi_egtb.filePath();
+	if (!fi_egtb.exists()) {
+		onMessage(QString("Failed to load EGTB: %1").arg(path_egtb), MessageType::error);
+		return ExitCode_engine_failed;
+	}
+	EngineConfiguration config;
+	config.setCommand(QDir::toNativeSeparators(fi_engine.absoluteFilePath()));
+	config.addArgument("solver");
+	config.setWorkingDirectory(QDir::toNativeSeparators(fi_engine.absolutePath()));
+	config.setProtocol("uci");
+	config.setTimeoutScale(120.0);
+	config.setOption("SyzygyPath", path_egtb);
+	config.setOption("SyzygyProbeLimit", 4);
+	int num_threads = (opt.num_threads > 0) ? opt.num_threads : s.value("threads", 2).toInt();
+	int hash_size = (opt.hash_size > 0) ? opt.hash_size : static_cast<int>(s.value("hash", 1.0).toDouble() * 1024);
+
+	/// Start and wait for the first engine
+	engine_pool = make_shared<EnginePool>(config);
+	connect(engine_pool.get(), &EnginePool::Message, this, &BatchRunner::onMessage);
+	engine_pool->start(max(1, opt.num_engines), num_threads, hash_size);
+	if (engine_pool->size() == 0) {
+		onMessage("Failed to start the engine.", MessageType::error);
+		return ExitCode_engine_failed;
+	}
+	QEventLoop loop;
+	QTimer timer_check;
+	connect(&timer_check, &QTimer::timeout, &loop, [&]() { if (engine_pool->isReady()) loop.quit(); });
+	QTimer::singleShot(ENGINE_START_TIMEOUT, &loop, &QEventLoop::quit);
+	timer_check.start(100);
+	loop.exec();
+	timer_check.stop();
+	if (!engine_pool->isReady()) {
+		onMessage("The engine is not ready.", MessageType::error);
+		return ExitCode_engine_failed;
+	}
+
+	/// Version
+	QString engine_name = engine_pool->engineName();
+	uint8_t engine_version = detect_engine_version(engine_name);
+	if (engine_version == UNKNOWN_ENGINE_VERSION) {
+		onMessage(QString("Unknown engine: %1").arg(engine_name), MessageType::error);
+		return ExitCode_engine_failed;
+	}
+	engine_pool->setEngineVersion(engine_version);
+	onMessage(QString("Engine: %1 v.%2").arg(engine_name).arg(engine_version), MessageType::info);
+	return ExitCode_ok;
+}
+
+int BatchRunner::run_solution(std::shared_ptr<Solution> solution)
+{
+	solution_name = solution->nameToShow(true);
+	num_errors = 0;
+	num_successes = 0;
+	QElapsedTimer timer;
+	timer.start();
+	QJsonObject start;
+	start["event"] = "start";
+	start["command"] = command_name(opt.command);
+	start["solution"] = solution_name;
+	print(start);
+
+	connect(solution.get(), &Solution::Message, this, &BatchRunner::onMessage);
+	solution->activate();
+	solver = make_shared<SolverResults>(solution);
+	connect(solver.get(), &Solver::Message, this, &BatchRunner::onMessage);
+	connect(solver.get(), &Solver::newDataEvaluated, this, &BatchRunner::onDataEvaluated);
+	solver->setEngineTime(opt.std_engine_time, opt.add_engine_time);
+	if (engine_pool) {
+		solver->setEnginePool(engine_pool);
+		connect(solver.get(), &Solver::evaluatePosition, this, &BatchRunner::onEvaluatePosition);
+		connect(engine_pool.get(), &EnginePool::resultReady, this, &BatchRunner::onEnginePoolResult);
+	}
+
+	bool is_done;
+	try
+	{
+		is_done = run_command();
+	}
+	catch (exception& e)
+	{
+		onMessage(QString("Error: %1").arg(e.what()), MessageType::error);
+		is_done = false;
+	}
+
+	if (engine_pool) {
+		disconnect(engine_pool.get(), nullptr, this, nullptr);
+		connect(engine_pool.get(), &EnginePool::Message, this, &BatchRunner::onMessage);
+		solver->setEnginePool(nullptr);
+	}
+	solver.reset();
+	board_to_evaluate.reset();
+	key_to_evaluate = 0;
+	solution->deactivate();
+	disconnect(solution.get(), nullptr, this, nullptr);
+
+	// The merge reports no success message, so it's done if there are no errors
+	bool is_ok = is_done && num_errors == 0 && (num_successes > 0 || opt.command == BatchCommand::Merge);
+	int exit_code = is_engine_failed ? ExitCode_engine_failed : is_ok ? ExitCode_ok : ExitCode_failed;
+	QJsonObject finish;
+	finish["event"] = "finish";
+	finish["solution"] = solution_name;
+	finish["status"] = is_ok ? "ok" : "failed";
+	finish["exit_code"] = exit_code;
+	finish["seconds"] = timer.elapsed() / 1000.0;
+	print(finish);
+	return exit_code;
+}
+
+bool BatchRunner::run_command()
+{
+	auto report = [this](QString text) { onMessage(text, MessageType::error); };
+	switch (opt.command)
+	{
+	case BatchCommand::Solve:
+		solver->start(nullptr, report, opt.mode);
+		return true;
+	case BatchCommand::Shorten:
+		solver->shorten();
+		return true;
+	default:
+		break;
+	}
+
+	FileType type = book_type();
+	if (type == FileType_SIZE || !solver->solution()->fileExists(type)) {
+		report("Failed to open the book.");
+		return false;
+	}
+	if (opt.command == BatchCommand::Verify) {
+		solver->verify(type, opt.num_threads);
+		return true;
+	}
+
+	/// Merge
+	list<QString> books = { solver->solution()->path(type) };
+	for (auto& book : opt.books)
+		books.push_back(book);
+	QString file_to_save = solver->solution()->path(type);
+	QString ext = '.' + Solution::DATA_EXT;
+	if (!file_to_save.endsWith(ext)) {
+		report(QString("Book \"%1\" has an incorrect extension.").arg(file_to_save));
+		return false;
+	}
+	file_to_save = QString("%1_merge%2").arg(file_to_save.left(file_to_save.length() - ext.length())).arg(ext);
+	solver->merge_books(books, file_to_save.toStdString());
+	return true;
+}
+
+FileType BatchRunner::book_type() const
+{
+	if (opt.book_type != FileType_SIZE)
+		return opt.book_type;
+	for (FileType type : { FileType_book_short, FileType_book, FileType_book_upper })
+		if (solver->solution()->fileExists(type))
+			return type;
+	return FileType_SIZE;
+}
+
+void BatchRunner::onMessage(const QString& message, MessageType type)
+{
+	if (type == MessageType::error)
+		num_errors++;
+	else if (type == MessageType::success)
+		num_successes++;
+	QJsonObject object;
+	object["event"] = "message";
+	if (!solution_name.isEmpty())
+		object["solution"] = solution_name;
+	object["type"] = message_type_name(type);
+	object["text"] = message;
+	print(object);
+}
+
+void BatchRunner::onDataEvaluated(quint64 key)
+{
+	QJsonObject object;
+	object["event"] = "evaluated";
+	object["solution"] = solution_name;
+	object["key"] = QString::number(key, 16); // JSON numbers don't hold 64 bits
+	print(object);
+}
+
+void BatchRunner::onEvaluatePosition()
+{
+	// The solver asks for an evaluation when it doesn't take it from the pool itself (e.g. boosted searches),
+	// so it's evaluated by the pool anyway, with the budget of the GUI auto mode
+	if (!solver || !engine_pool || !engine_pool->isReady()) {
+		engine_failed("No engine to evaluate the position.");
+		return;
+	}
+	board_to_evaluate.reset(solver->positionToSolve()->copy());
+	key_to_evaluate = board_to_evaluate->key();
+	quint64 num_nodes = static_cast<quint64>(solver->settings().max_search_time) / 2 * NODES_PER_S;
+	engine_pool->evaluate(board_to_evaluate, num_nodes, true);
+	// It may have been evaluated already while the solver was walking the siblings
+	EngineResult result;
+	if (engine_pool->takeResult(key_to_evaluate, result)) {
+		process_engine_result(result);
+	}
+	else if (!engine_pool->contains(key_to_evaluate)) {
+		// Nothing is queued, so no engine has failed and no result will come
+		board_to_evaluate.reset();
+		key_to_evaluate = 0;
+		onMessage("Failed to queue the position for the engine.", MessageType::error);
+		solver->stop();
+	}
+}
+
+void BatchRunner::onEnginePoolResult(quint64 key)
+{
+	if (!board_to_evaluate || key != key_to_evaluate)
+		return;
+	EngineResult result;
+	if (engine_pool->takeResult(key, result))
+		process_engine_result(result);
+}
+
+void BatchRunner::process_engine_result(const EngineResult& result)
+{
+	auto board = board_to_evaluate;
+	board_to_evaluate.reset();
+	key_to_evaluate = 0;
+	if (!result.data) {
+		engine_failed("The engine failed to evaluate the position.");
+		return;
+	}
+	solver->process(board, result.move, result.data, result.is_only_move);
+}
+
+void BatchRunner::engine_failed(const QString& text)
+{
+	is_engine_failed = true;
+	onMessage(text, MessageType::error);
+	if (solver)
+		solver->stop();
+}
+
+void BatchRunner::print(QJsonObject object)
+{
+	QByteArray line = QJsonDocument(object).toJson(QJsonDocument::Compact);
+	line.append('\n');
+	fwrite(line.constData(), 1, line.size(), stdout);
+	fflush(stdout);
+}
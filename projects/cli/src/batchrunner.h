@@ -0,0 +1,102 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include "positioninfo.h"
+#include "solver.h"
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+#include <QElapsedTimer>
+
+#include <memory>
+#include <list>
+
+
+class Solution;
+class SolverResults;
+class EnginePool;
+struct EngineResult;
+
+enum class BatchCommand
+{
+	Solve,
+	Verify,
+	Shorten,
+	Merge
+};
+
+enum ExitCode : int
+{
+	ExitCode_ok = 0,
+	ExitCode_failed = 1,         // an operation reported an error or didn't complete
+	ExitCode_bad_arguments = 2,
+	ExitCode_no_solution = 3,
+	ExitCode_engine_failed = 4
+};
+
+struct BatchOptions
+{
+	BatchCommand command = BatchCommand::Solve;
+	QString solutions_folder;
+	QStringList solution_names; // as shown in the GUI, with or without the tag
+	bool all_solutions = false;
+	QString engine_path;
+	int num_engines = 1;
+	int num_threads = 0;         // per engine, 0 for the "engine/threads" setting
+	int hash_size = 0;           // [MB] per engine, 0 for the "engine/hash" setting
+	int std_engine_time = 190;   // [s]
+	int add_engine_time = 150;   // [s]
+	SolverMode mode = SolverMode::Standard;
+	FileType book_type = FileType_SIZE; // FileType_SIZE to pick the first existing book as in the GUI
+	QStringList books;           // to merge into the solution book
+};
+
+
+/*
+ * Runs one command on the selected solutions without the GUI.
+ * The progress is printed to stdout as JSON lines, one object per line, with the "event" field:
+ * "start" / "finish" for each solution, "message" for the solver log, "evaluated" for each position
+ * evaluated by the engine, and "done" at the end. The application quits with an ExitCode.
+ */
+class BatchRunner : public QObject
+{
+	Q_OBJECT
+
+public:
+	BatchRunner(const BatchOptions& options, QObject* parent = nullptr);
+	~BatchRunner();
+
+public slots:
+	void run();
+
+private slots:
+	void onMessage(const QString& message, MessageType type = MessageType::std);
+	void onDataEvaluated(quint64 key);
+	void onEvaluatePosition();
+	void onEnginePoolResult(quint64 key);
+
+private:
+	int select_solutions(std::list<std::shared_ptr<Solution>>& solutions);
+	int start_engines();
+	int run_solution(std::shared_ptr<Solution> solution);
+	bool run_command();
+	FileType book_type() const;
+	void process_engine_result(const EngineResult& result);
+	void engine_failed(const QString& text);
+	void print(QJsonObject object);
+
+private:
+	BatchOptions opt;
+	std::shared_ptr<EnginePool> engine_pool;
+	std::shared_ptr<SolverResults> solver;
+	QString solution_name;
+	std::shared_ptr<Chess::Board> board_to_evaluate;
+	quint64 key_to_evaluate;
+	int num_errors;
+	int num_successes;
+	bool is_engine_failed;
+};
+
+#endif // BATCHRUNNER_H
@@ -0,0 +1,170 @@
+#include "batchrunner.h"
+#include "mersenne.h"
+
+#include "board/genericmove.h"
+#include "board/move.h"
+#include "board/side.h"
+#include "board/result.h"
+#include "tb/bitboard.h"
+#include "tb/endgame.h"
+#include "tb/position.h"
+#include "tb/search.h"
+#include "tb/thread.h"
+#include "tb/tt.h"
+#include "tb/uci.h"
+#include "tb/syzygy/tbprobe.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QSettings>
+#include <QTextStream>
+#include <QMetaType>
+#include <QTimer>
+#include <QTime>
+
+#include <map>
+
+namespace PSQT {
+	void init();
+}
+
+
+static bool parse_options(QCoreApplication& app, BatchOptions& opt, QString& error)
+{
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Solves, verifies, shortens or merges the books of the solutions without the GUI.\n"
+	                                 "The progress is printed as JSON lines. Exit codes: 0 - ok, 1 - failed, 2 - bad arguments, "
+	                                 "3 - solution not found, 4 - engine failed.\n"
+	                                 "The other settings are shared with the GUI.");
+	auto opt_help = parser.addHelpOption();
+	auto opt_version = parser.addVersionOption();
+	parser.addPositionalArgument("command", "solve, verify, shorten or merge");
+	QCommandLineOption opt_solutions("solutions", "Solution folder (the GUI one by default).", "folder");
+	QCommandLineOption opt_solution("solution", "Solution to process, e.g. \"e3 b5\" or \"tag: e3 b5\". Can be repeated.", "name");
+	QCommandLineOption opt_all("all", "Process all solutions in the folder.");
+	QCommandLineOption opt_engine("engine", "Engine path (the GUI one by default).", "path");
+	QCommandLineOption opt_engines("engines", "Number of engine processes (1 by default).", "N", "1");
+	QCommandLineOption opt_threads("threads", "Threads per engine, also used to verify.", "N", "0");
+	QCommandLineOption opt_hash("hash", "Hash per engine.", "MB", "0");
+	QCommandLineOption opt_time("time", "Standard engine time.", "s", "190");
+	QCommandLineOption opt_add_time("add-time", "Additional engine time.", "s", "150");
+	QCommandLineOption opt_mode("mode", "Solver mode: standard, watkins, watkins-override or watkins-eg.", "mode", "standard");
+	QCommandLineOption opt_book("book", "Book to verify or merge into: auto, full, upper or short.", "type", "auto");
+	QCommandLineOption opt_books("books", "Books to merge. Can be repeated.", "file");
+	parser.addOptions({ opt_solutions, opt_solution, opt_all, opt_engine, opt_engines, opt_threads, opt_hash,
+	                    opt_time, opt_add_time, opt_mode, opt_book, opt_books });
+	if (!parser.parse(app.arguments())) {
+		error = parser.errorText();
+		return false;
+	}
+	if (parser.isSet(opt_help))
+		parser.showHelp(ExitCode_ok);
+	if (parser.isSet(opt_version))
+		parser.showVersion();
+
+	static const std::map<QString, BatchCommand> commands = {
+		{ "solve", BatchCommand::Solve }, { "verify", BatchCommand::Verify },
+		{ "shorten", BatchCommand::Shorten }, { "merge", BatchCommand::Merge } };
+	static const std::map<QString, SolverMode> modes = {
+		{ "standard", SolverMode::Standard }, { "watkins", SolverMode::Copy_Watkins },
+		{ "watkins-override", SolverMode::Copy_Watkins_Override }, { "watkins-eg", SolverMode::Copy_Watkins_EG } };
+	static const std::map<QString, FileType> book_types = {
+		{ "auto", FileType_SIZE }, { "full", FileType_book }, { "upper", FileType_book_upper }, { "short", FileType_book_short } };
+
+	QStringList args = parser.positionalArguments();
+	if (args.size() != 1 || !commands.count(args.front())) {
+		error = "Expected one command: solve, verify, shorten or merge.";
+		return false;
+	}
+	opt.command = commands.at(args.front());
+	opt.solutions_folder = parser.value(opt_solutions);
+	opt.solution_names = parser.values(opt_solution);
+	opt.all_solutions = parser.isSet(opt_all);
+	if (opt.solution_names.isEmpty() == !opt.all_solutions) {
+		error = "Expected either --solution or --all.";
+		return false;
+	}
+	opt.engine_path = parser.value(opt_engine);
+
+	auto to_int = [&parser, &error](const QCommandLineOption& option, int min_value, int& value)
+	{
+		bool ok;
+		value = parser.value(option).toInt(&ok);
+		if (!ok || value < min_value) {
+			error = QString("Incorrect value of --%1: %2").arg(option.names().front()).arg(parser.value(option));
+			return false;
+		}
+		return true;
+	};
+	if (!to_int(opt_engines, 1, opt.num_engines)
+	    || !to_int(opt_threads, 0, opt.num_threads)
+	    || !to_int(opt_hash, 0, opt.hash_size)
+	    || !to_int(opt_time, 1, opt.std_engine_time)
+	    || !to_int(opt_add_time, 0, opt.add_engine_time))
+		return false;
+
+	auto it_mode = modes.find(parser.value(opt_mode));
+	if (it_mode == modes.end()) {
+		error = QString("Unknown mode: %1").arg(parser.value(opt_mode));
+		return false;
+	}
+	opt.mode = it_mode->second;
+	auto it_book = book_types.find(parser.value(opt_book));
+	if (it_book == book_types.end()) {
+		error = QString("Unknown book type: %1").arg(parser.value(opt_book));
+		return false;
+	}
+	opt.book_type = it_book->second;
+	opt.books = parser.values(opt_books);
+	if (opt.command == BatchCommand::Merge && opt.books.isEmpty()) {
+		error = "Expected --books to merge.";
+		return false;
+	}
+	return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+	// Register types for signal / slot connections
+	qRegisterMetaType<Chess::GenericMove>("Chess::GenericMove");
+	qRegisterMetaType<Chess::Move>("Chess::Move");
+	qRegisterMetaType<Chess::Side>("Chess::Side");
+	qRegisterMetaType<Chess::Result>("Chess::Result");
+
+	CommandLine::init(argc, argv);
+	UCI::init(Options);
+	Tune::init();
+	PSQT::init();
+	Bitboards::init();
+	Position::init();
+	Bitbases::init();
+	Endgames::init();
+	Threads.set(size_t(Options["Threads"]));
+	Search::clear(); // After threads are up
+
+	QCoreApplication app(argc, argv);
+	Mersenne::initialize(QTime(0,0,0).msecsTo(QTime::currentTime()));
+
+	// Same settings as the GUI: solution folder, engine, caches, move order
+	QCoreApplication::setOrganizationName("tolius-solver");
+	QCoreApplication::setOrganizationDomain("antichess.onrender.com");
+	QCoreApplication::setApplicationName("Solver");
+	QCoreApplication::setApplicationVersion(SOLVER_VERSION);
+	QSettings::setDefaultFormat(QSettings::IniFormat);
+
+	BatchOptions opt;
+	QString error;
+	if (!parse_options(app, opt, error)) {
+		QTextStream(stderr) << error << "\nSee --help.\n";
+		return ExitCode_bad_arguments;
+	}
+
+	// The solver runs nested event loops, so it's started from the application loop
+	BatchRunner runner(opt);
+	QTimer::singleShot(0, &runner, &BatchRunner::run);
+	int exit_code = app.exec();
+
+	Threads.set(0);
+	return exit_code;
+}
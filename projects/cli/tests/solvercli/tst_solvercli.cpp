@@ -0,0 +1,81 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QProcess>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+
+class tst_SolverCli: public QObject
+{
+	Q_OBJECT
+
+	private slots:
+		void initTestCase();
+
+		void exitCodes_data() const;
+		void exitCodes();
+
+	private:
+		QTemporaryDir m_dir;
+		QString m_emptyDir;
+};
+
+
+void tst_SolverCli::initTestCase()
+{
+	QVERIFY(m_dir.isValid());
+	m_emptyDir = m_dir.filePath("solutions");
+	QVERIFY(QDir().mkpath(m_emptyDir));
+}
+
+void tst_SolverCli::exitCodes_data() const
+{
+	QTest::addColumn<QStringList>("arguments");
+	QTest::addColumn<int>("exitCode");
+
+	const QString missing_dir = m_dir.filePath("missing");
+
+	QTest::newRow("help") << QStringList{ "--help" } << 0;
+	QTest::newRow("no command") << QStringList{ "--all" } << 2;
+	QTest::newRow("unknown command") << QStringList{ "play", "--all" } << 2;
+	QTest::newRow("two commands") << QStringList{ "solve", "verify", "--all" } << 2;
+	QTest::newRow("unknown option") << QStringList{ "solve", "--all", "--depth", "5" } << 2;
+	QTest::newRow("no solution") << QStringList{ "solve" } << 2;
+	QTest::newRow("solution and all") << QStringList{ "verify", "--all", "--solution", "e3" } << 2;
+	QTest::newRow("no engines") << QStringList{ "solve", "--all", "--engines", "0" } << 2;
+	QTest::newRow("time not a number") << QStringList{ "solve", "--all", "--time", "fast" } << 2;
+	QTest::newRow("unknown mode") << QStringList{ "solve", "--all", "--mode", "fast" } << 2;
+	QTest::newRow("unknown book") << QStringList{ "verify", "--all", "--book", "lower" } << 2;
+	QTest::newRow("merge without books") << QStringList{ "merge", "--all" } << 2;
+	QTest::newRow("missing folder") << QStringList{ "verify", "--all", "--solutions", missing_dir } << 3;
+	QTest::newRow("empty folder") << QStringList{ "verify", "--all", "--solutions", m_emptyDir } << 3;
+	QTest::newRow("unknown solution") << QStringList{ "shorten", "--solution", "e3 b5", "--solutions", m_emptyDir } << 3;
+}
+
+void tst_SolverCli::exitCodes()
+{
+	QFETCH(QStringList, arguments);
+	QFETCH(int, exitCode);
+
+	// The settings shared with the GUI are kept apart from the user ones
+	QProcess process;
+	auto env = QProcessEnvironment::systemEnvironment();
+	env.insert("XDG_CONFIG_HOME", m_dir.filePath("config"));
+	env.insert("HOME", m_dir.path());
+	process.setProcessEnvironment(env);
+	process.start(SOLVER_CLI_PATH, arguments);
+	QVERIFY(process.waitForFinished(60'000));
+	QCOMPARE(process.exitStatus(), QProcess::NormalExit);
+	QCOMPARE(process.exitCode(), exitCode);
+
+	// Once the arguments are accepted, the last line reports the exit code too
+	if (exitCode == 0 || exitCode == 2)
+		return;
+	auto lines = process.readAllStandardOutput().trimmed().split('\n');
+	auto done = QJsonDocument::fromJson(lines.last()).object();
+	QCOMPARE(done["event"].toString(), QString("done"));
+	QCOMPARE(done["exit_code"].toInt(), exitCode);
+}
+
+QTEST_MAIN(tst_SolverCli)
+#include "tst_solvercli.moc"
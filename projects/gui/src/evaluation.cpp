@@ -12,6 +12,7 @@
 #include "enginefactory.h"
 #include "engineoption.h"
 #include "uciengine.h"
+#include "enginepool.h"
 #include "chessplayer.h"
 #include "humanplayer.h"
 #include "enginebuilder.h"
@@ -28,6 +29,7 @@
 #include <QAction>
 #include <QMenu>
 #include <QMessageBox>
+#include <QFileDialog>
 #include <QFileInfo>
 #include <QDir>
 #include <QSettings>
@@ -39,12 +41,10 @@
 using namespace std::chrono;
 
 
-constexpr static quint64 NODES_PER_S = 1'500'000;
 constexpr static int NO_PROGRESS_TIME = 12; // [s]
 constexpr static int NO_PROGRESS_DEPTH = 10;
 constexpr static int EG_WIN_THRESHOLD = 15200;
 constexpr static int START_DEPTH = 10;
-constexpr static uint8_t UNKNOWN_ENGINE_VERSION = 0xFE;
 
 QString score_to_text(int score)
 {
@@ -286,6 +286,7 @@ Evaluation::Evaluation(GameViewer* game_viewer, QWidget* parent)
 	connect(action_start_LL, &QAction::triggered, this, [this]() { setCurrEngine(CurrentEngine::LL); });
 	connect(ui->spin_LLnodes, SIGNAL(valueChanged(int)), this, SLOT(onLLnodesChanged(int)));
 	connect(ui->btn_ClearCaches, SIGNAL(clicked()), this, SLOT(onClearCachesClicked()));
+	connect(ui->btn_TBStats, SIGNAL(clicked()), this, SLOT(onTBStatsClicked()));
 
 	QThread* thread = new QThread;
 	ll->moveToThread(thread);
@@ -495,6 +496,8 @@ void Evaluation::setSolver(std::shared_ptr<Solver> solver)
 		stopEngine();
 	}
 	this->solver = solver;
+	if (solver)
+		solver->setEnginePool(engine_pool);
 	//solver->moveToThread(&solver_thread);
 	connect(solver.get(), &Solver::evaluatePosition, this, &Evaluation::onEvaluatePosition);
 	connect(solver.get(), &Solver::solvingStatusChanged, this, &Evaluation::onSolvingStatusChanged);
@@ -533,6 +536,9 @@ void Evaluation::setEngine(const QString* filename)
 		engine->deleteLater();
 		engine = nullptr;
 	}
+	engine_pool.reset();
+	if (solver)
+		solver->setEnginePool(nullptr);
 
 	/// Configuration
 	QSettings s;
@@ -619,6 +625,16 @@ void Evaluation::setEngine(const QString* filename)
 	//connect(engine, SIGNAL(debugMessage(QString)), this, SIGNAL(Message(const QString&)));
 	connect(engine, SIGNAL(moveMade(const Chess::Move&)), this, SLOT(onEngineFinished()));
 
+	/// Engine pool for parallel evaluation of the positions to solve
+	if (QSettings().value("solver/engine_pool_size", 0).toInt() > 0)
+	{
+		EngineConfiguration pool_config(config);
+		pool_config.setOption("SyzygyPath", path_egtb);
+		pool_config.setOption("SyzygyProbeLimit", 4);
+		engine_pool = std::make_shared<EnginePool>(pool_config);
+		connect(engine_pool.get(), &EnginePool::Message, this, &Evaluation::Message);
+	}
+
 	setMode(SolverStatus::Manual);
 	updateClearCaches();
 }
@@ -642,27 +658,9 @@ void Evaluation::onEngineReady()
 	int i = engine_name.lastIndexOf(' ');
 	if (i > 0)
 	{
-		auto version = engine_name.midRef(i + 1);
-		engine_version = UNKNOWN_ENGINE_VERSION;
-		if (version.length() == 6)
-		{
-			QString str_num = version.right(2) + version.mid(2, 2) + version.left(2);
-			bool ok;
-			int num = str_num.toInt(&ok);
-			if (ok) {
-				engine_version = 
-				      (240903 <= num && num <= 240910) ? LATEST_ENGINE_VERSION // 5 // fix static eval overflow
-				    : (240701 <= num && num <= 240831) ? 4 // fix en passant in endgames
-				    : (240226 <= num && num <= 240630) ? 3 // use F-SF depths, use new EGTB
-				    : (num == 230811)                  ? 2 // increase depth when fast mate and lots of pieces
-				    : (num == 230803)                  ? 1 // add go ... mate xx
-				    : (230409 <= num && num <= 230415) ? 1
-				    : (230301 <= num && num <= 230401) ? 0
-				                                       : UNKNOWN_ENGINE_VERSION;
-				engine_name = engine_name.left(i + 1) + str_num;
-				ui->label_Engine->setText(engine_name);
-			}
-		}
+		QString version = engine_name.mid(i + 1);
+		engine_version = detect_engine_version(engine_name);
+		ui->label_Engine->setText(engine_name);
 		if (engine_version == UNKNOWN_ENGINE_VERSION) {
 			ui->label_EngineVersion->setText("(unknown version)");
 			QMessageBox::critical(this, tr("Engine Error"), tr("Unknown engine.\n\nStatus code %1").arg(version));
@@ -679,6 +677,16 @@ void Evaluation::onEngineReady()
 	{
 		ui->label_EngineVersion->setText("");
 	}
+	if (engine_pool && engine_pool->size() == 0)
+	{
+		QSettings s;
+		int pool_size = s.value("solver/engine_pool_size", 0).toInt();
+		int num_threads = s.value("engine/threads", 2).toInt();
+		engine_pool->setEngineVersion(engine_version);
+		engine_pool->start(pool_size, num_threads / pool_size, engine_hash / pool_size);
+		if (solver)
+			solver->setEnginePool(engine_pool);
+	}
 	positionChanged();
 	setMode(SolverStatus::Manual);
 }
@@ -874,6 +882,34 @@ void Evaluation::onClearCachesClicked()
 	updateClearCaches();
 }
 
+void Evaluation::onTBStatsClicked()
+{
+	QStringList report = EGTB_stats_report();
+	QMessageBox box(this);
+	box.setWindowTitle(QApplication::applicationName());
+	if (report.isEmpty())
+		box.setText("No EGTB probes yet.");
+	else
+		box.setText(QString("<pre>%1</pre>").arg(report.join('\n').toHtmlEscaped()));
+	auto btn_save = box.addButton("Save CSV...", QMessageBox::ActionRole);
+	auto btn_reset = box.addButton("Reset", QMessageBox::ResetRole);
+	box.addButton(QMessageBox::Close);
+	box.exec();
+	if (box.clickedButton() == btn_save)
+	{
+		QString path = QFileDialog::getSaveFileName(this, "Save EGTB probe statistics", QString(), "CSV files (*.csv)");
+		if (path.isEmpty())
+			return;
+		QString error_text;
+		if (!save_EGTB_stats(path, error_text))
+			QMessageBox::warning(this, QApplication::applicationName(), QString("Failed to save EGTB probe statistics: %1").arg(error_text));
+	}
+	else if (box.clickedButton() == btn_reset)
+	{
+		reset_EGTB_stats();
+	}
+}
+
 void Evaluation::engineHashChanged(int hash_size)
 {
 	if (!engine)
@@ -1431,7 +1467,7 @@ void Evaluation::processEngineOutput(const MoveEvaluation& eval, const QString&
 	quint64 nodeCount = eval.nodeCount();
 	quint64 nodes = nodeCount + eval.tbHits() * 100;
 	const SolverSettings* s = solver ? &solver->settings() : nullptr;
-	bool is_bad_move = (curr_score < -10'000);
+	bool is_bad_move = (curr_score < BAD_MOVE_SCORE);
 	if (pv == 1)
 	{
 		quint64 curr_time = nodes / NODES_PER_S;
@@ -1480,9 +1516,7 @@ void Evaluation::processEngineOutput(const MoveEvaluation& eval, const QString&
 	}
 	else if (!is_endgame && (move_score == NULL_SCORE || !solver || abs(move_score) < s->score_limit - 1))
 	{
-		if (pv == 2)
-			is_only_move = true;
-		is_only_move = is_only_move && is_bad_move;
+		is_only_move = update_only_move(is_only_move, pv, curr_score);
 	}
 	if (/* session.multi_mode > 0 &&*/ !is_endgame && (!solver || s->show_gui) && game && game->board() && game->board()->key() == board_->key())
 	{
@@ -48,6 +48,7 @@ namespace Chess
 class FlowLayout;
 class Solution;
 class Solver;
+class EnginePool;
 class QHBoxLayout;
 class QLabel;
 class QAction;
@@ -193,6 +194,7 @@ private slots:
 	void onLLprogress(const LLdata&);
 	void onLLfinished();
 	void onClearCachesClicked();
+	void onTBStatsClicked();
 private:
 	void onEngineToggled(bool flag);
 
@@ -243,6 +245,7 @@ private:
 	SolverStatus solver_status;
 	std::shared_ptr<Solver> solver;
 	UciEngine* engine;
+	std::shared_ptr<EnginePool> engine_pool;
 	QString engine_name;
 	uint8_t engine_version;
 	ChessGame* game;
@@ -37,6 +37,8 @@
 #endif
 #include <QSysInfo>
 #include <QScrollBar>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include "board/boardfactory.h"
 #include "chessgame.h"
@@ -161,6 +163,7 @@ MainWindow::MainWindow(ChessGame* game, SettingsDialog* settingsDlg)
 	init_EGTB();
 	readSettings();
 	addGame(game);
+	preloadEGTB();
 }
 
 MainWindow::~MainWindow()
@@ -1338,6 +1341,23 @@ void MainWindow::setTint(QColor tint, bool to_color_move_buttons)
 	this->centralWidget()->setStyleSheet(style);
 }
 
+void MainWindow::preloadEGTB()
+{
+	if (!QSettings().value("solver/egtb_preload", false).toBool())
+		return;
+	// The tables are probed from disk until they are loaded
+	logMessage(tr("Loading EGTBs into RAM..."), MessageType::std);
+	auto watcher = new QFutureWatcher<QStringList>(this);
+	connect(watcher, &QFutureWatcher<QStringList>::finished, this, [this, watcher]()
+	{
+		auto log = watcher->result();
+		for (int i = 0; i < log.size(); i++)
+			logMessage(log[i], (i == log.size() - 1) ? MessageType::info : MessageType::std);
+		watcher->deleteLater();
+	});
+	watcher->setFuture(QtConcurrent::run(preload_EGTB, size_t(4)));
+}
+
 void MainWindow::logMessage(const QString& message, MessageType type)
 {
 	auto style = [this](int red, int green, int blue)
@@ -130,6 +130,7 @@ class MainWindow : public QMainWindow
 		void createSolutionsModel();
 		void createDockWindows();
 		void readSettings();
+		void preloadEGTB();
 		void writeSettings();
 		QString genericTitle(const TabData& gameData) const;
 		QString nameOnClock(const QString& name, Chess::Side side) const;
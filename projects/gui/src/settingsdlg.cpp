@@ -130,6 +130,20 @@ SettingsDialog::SettingsDialog(QWidget* parent)
 			emit bookCacheChanged(static_cast<int>(val * 1024));
 		}
 	);
+	ui->m_egtbCache->setValue(s.value("egtb_cache", 0.25).toDouble());
+	connect(ui->m_egtbCache, qOverload<double>(&QDoubleSpinBox::valueChanged), this,
+		[=](double val)
+		{
+			QSettings().setValue("solver/egtb_cache", val);
+			set_EGTB_cache_size(val);
+		}
+	);
+	ui->m_egtbPreload->setChecked(s.value("egtb_preload", false).toBool());
+	connect(ui->m_egtbPreload, &QCheckBox::toggled, this,
+		[=](bool checked) {
+			QSettings().setValue("solver/egtb_preload", checked);
+		}
+	);
 
 	auto set_label = [](QLabel* label, int val)
 	{
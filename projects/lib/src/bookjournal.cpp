@@ -0,0 +1,86 @@
+#include "bookjournal.h"
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+
+using namespace std;
+using namespace std::chrono;
+
+
+BookJournal::BookJournal(const QString& filepath, size_t sync_rows, std::chrono::seconds sync_time)
+	: filepath(filepath)
+	, file(filepath)
+	, num_unsynced(0)
+	, sync_rows(max<size_t>(sync_rows, 1))
+	, sync_time(sync_time)
+	, t_sync(steady_clock::now())
+{}
+
+BookJournal::~BookJournal()
+{
+	close();
+}
+
+bool BookJournal::append(const EntryRow& row)
+{
+	buffer.insert(buffer.end(), row.begin(), row.end());
+	if (!write_buffer())
+		return false;
+	if (is_sync_due())
+		return sync();
+	return true;
+}
+
+bool BookJournal::sync()
+{
+	t_sync = steady_clock::now();
+	if (!buffer.empty() && !write_buffer())
+		return false;
+	if (num_unsynced == 0)
+		return true;
+#ifdef Q_OS_WIN
+	bool is_ok = _commit(file.handle()) == 0;
+#else
+	bool is_ok = fsync(file.handle()) == 0;
+#endif
+	if (is_ok)
+		num_unsynced = 0;
+	return is_ok;
+}
+
+bool BookJournal::is_sync_due() const
+{
+	return num_unsynced >= sync_rows || (num_unsynced && steady_clock::now() - t_sync >= sync_time);
+}
+
+void BookJournal::close()
+{
+	sync();
+	if (file.isOpen())
+		file.close();
+}
+
+bool BookJournal::write_buffer()
+{
+	// Unbuffered: each write goes to the OS right away
+	if (!file.isOpen() && !file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered))
+		return false;
+	auto n = file.write(buffer.data(), static_cast<qint64>(buffer.size()));
+	if (n < 0)
+		return false;
+	if (n != static_cast<qint64>(buffer.size())) {
+		// Cut a partially written row so that the file consists of whole rows
+		qint64 tail = n % static_cast<qint64>(sizeof(EntryRow));
+		file.resize(file.size() - tail);
+		buffer.erase(buffer.begin(), buffer.begin() + (n - tail));
+		num_unsynced += (n - tail) / sizeof(EntryRow);
+		return false;
+	}
+	num_unsynced += buffer.size() / sizeof(EntryRow);
+	buffer.clear();
+	return true;
+}
@@ -0,0 +1,44 @@
+#ifndef BOOK_JOURNAL_H
+#define BOOK_JOURNAL_H
+
+#include "positioninfo.h"
+
+#include <QString>
+#include <QFile>
+
+#include <vector>
+#include <chrono>
+
+
+/*
+ * Append-only writer for the "_new" data files.
+ * Each row is written to the OS as soon as it's added, as the "_new" files always were,
+ * so a crash of the app loses nothing. Only the fsync is batched: it follows every
+ * sync_rows rows, every sync_time, and an explicit sync or close. Only whole rows are
+ * written, so the file stays readable by Solution::mergeFiles().
+ */
+class LIB_EXPORT BookJournal
+{
+public:
+	BookJournal(const QString& filepath, size_t sync_rows, std::chrono::seconds sync_time);
+	~BookJournal();
+
+	bool append(const EntryRow& row); // false if the row couldn't be written, it's retried with the next one
+	bool sync();
+	bool is_sync_due() const;
+	void close();
+
+private:
+	bool write_buffer();
+
+private:
+	QString filepath;
+	QFile file;
+	std::vector<char> buffer; // rows that failed to be written
+	size_t num_unsynced;
+	size_t sync_rows;
+	std::chrono::seconds sync_time;
+	std::chrono::steady_clock::time_point t_sync;
+};
+
+#endif // BOOK_JOURNAL_H
@@ -0,0 +1,574 @@
+#include "bookmerge.h"
+#include "positioninfo.h"
+
+#include <QFile>
+
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+
+using namespace std;
+
+constexpr static size_t ROW_SIZE = 16;
+constexpr static size_t BUFFER_ROWS = 1 << 16;
+constexpr static size_t SMALL_SORT_ROWS = 64;   // smaller parts are sorted by comparison
+constexpr static size_t PARALLEL_SORT_ROWS = 1 << 16;
+constexpr static char PATCH_LOG_TAG[8] = { 'B', 'O', 'O', 'K', 'P', 'A', 'T', 'C' };
+constexpr static size_t PATCH_LOG_ROW_SIZE = 8 + ROW_SIZE; // offset in the book + row
+
+
+BookRowReader::BookRowReader(const std::string& filepath)
+	: filepath(filepath)
+	, file(filepath, ios::binary | ios::in)
+	, buf(BUFFER_ROWS * ROW_SIZE)
+	, buf_pos(0)
+	, buf_size(0)
+	, in_memory(false)
+	, idx(0)
+	, row(0, 0)
+	, is_end(false)
+	, sorted(true)
+	, ok(true)
+{
+	// A missing file is read as an empty book
+	is_end = !file || !read_row();
+}
+
+BookRowReader::BookRowReader(std::vector<BookRow> rows, bool keep_last)
+	: buf_pos(0)
+	, buf_size(0)
+	, in_memory(true)
+	, idx(0)
+	, row(0, 0)
+	, is_end(false)
+	, sorted(true)
+	, ok(true)
+{
+	set_rows(move(rows), keep_last);
+}
+
+bool BookRowReader::at_end() const
+{
+	return is_end;
+}
+
+uint64_t BookRowReader::key() const
+{
+	return row.first;
+}
+
+uint64_t BookRowReader::value() const
+{
+	return row.second;
+}
+
+void BookRowReader::next_key()
+{
+	if (is_end)
+		return;
+	uint64_t prev_key = row.first;
+	do {
+		if (!read_row()) {
+			is_end = true;
+			return;
+		}
+	} while (row.first == prev_key);
+	if (row.first < prev_key) {
+		sorted = false;
+		is_end = true;
+	}
+}
+
+bool BookRowReader::is_sorted() const
+{
+	return sorted;
+}
+
+bool BookRowReader::is_ok() const
+{
+	return ok;
+}
+
+bool BookRowReader::load_sorted()
+{
+	if (in_memory) {
+		rewind();
+		return true;
+	}
+	file.close();
+	buf.clear();
+	buf.shrink_to_fit();
+	error_code ec;
+	auto filesize = filesystem::file_size(filepath, ec);
+	if (ec)
+		return false;
+	auto all_rows = read_rows(filepath, static_cast<qint64>(filesize));
+	if (all_rows.size() != filesize / ROW_SIZE) {
+		ok = false;
+		return false;
+	}
+	in_memory = true;
+	sorted = true;
+	set_rows(move(all_rows), false);
+	return true;
+}
+
+void BookRowReader::rewind()
+{
+	sorted = true;
+	if (in_memory) {
+		idx = 0;
+		is_end = !read_row();
+		return;
+	}
+	file.clear();
+	file.seekg(0);
+	buf_pos = buf_size = 0;
+	is_end = !file || !read_row();
+}
+
+bool BookRowReader::read_row()
+{
+	if (in_memory) {
+		if (idx >= rows.size())
+			return false;
+		row = rows[idx++];
+		return true;
+	}
+	if (buf_pos + ROW_SIZE > buf_size) {
+		file.read(buf.data(), buf.size());
+		buf_size = static_cast<size_t>(file.gcount());
+		buf_size -= buf_size % ROW_SIZE; // ignore an incomplete last row
+		buf_pos = 0;
+		if (file.bad())
+			ok = false;
+		if (!buf_size)
+			return false;
+	}
+	row.first = load_bigendian(&buf[buf_pos]);
+	row.second = load_bigendian(&buf[buf_pos + 8]);
+	buf_pos += ROW_SIZE;
+	return true;
+}
+
+void BookRowReader::set_rows(std::vector<BookRow> new_rows, bool keep_last)
+{
+	rows = move(new_rows);
+	stable_sort(rows.begin(), rows.end(), [](const BookRow& a, const BookRow& b) { return a.first < b.first; });
+	if (keep_last)
+		reverse(rows.begin(), rows.end());
+	auto it = unique(rows.begin(), rows.end(), [](const BookRow& a, const BookRow& b) { return a.first == b.first; });
+	rows.erase(it, rows.end());
+	if (keep_last)
+		reverse(rows.begin(), rows.end());
+	rows.shrink_to_fit();
+	idx = 0;
+	is_end = !read_row();
+}
+
+
+BookRowWriter::BookRowWriter(const std::string& filepath)
+	: file(filepath, ios::binary | ios::out | ios::trunc)
+	, buf(BUFFER_ROWS * ROW_SIZE)
+	, buf_pos(0)
+	, num_bytes(0)
+	, ok(static_cast<bool>(file))
+{}
+
+BookRowWriter::~BookRowWriter()
+{
+	close();
+}
+
+void BookRowWriter::write(uint64_t key, uint64_t value)
+{
+	if (buf_pos == buf.size())
+		flush();
+	save_bigendian(key, &buf[buf_pos]);
+	save_bigendian(value, &buf[buf_pos + 8]);
+	buf_pos += ROW_SIZE;
+}
+
+void BookRowWriter::write_rows(const char* rows, size_t num_rows)
+{
+	flush();
+	size_t size = num_rows * ROW_SIZE;
+	for (size_t pos = 0; pos < size && ok; pos += buf.size())
+	{
+		size_t n = min(buf.size(), size - pos);
+		file.write(rows + pos, n);
+		if (!file)
+			ok = false;
+		num_bytes += n;
+	}
+}
+
+bool BookRowWriter::close()
+{
+	if (!file.is_open())
+		return ok;
+	flush();
+	file.close();
+	ok = ok && !file.fail();
+	return ok;
+}
+
+uintmax_t BookRowWriter::size() const
+{
+	return num_bytes;
+}
+
+bool BookRowWriter::flush()
+{
+	if (buf_pos) {
+		file.write(buf.data(), buf_pos);
+		if (!file)
+			ok = false;
+		num_bytes += buf_pos;
+		buf_pos = 0;
+	}
+	return ok;
+}
+
+
+BookRowFinder::BookRowFinder(const std::string& filepath)
+	: file(filepath, ios::binary | ios::in)
+	, size(0)
+	, ok(static_cast<bool>(file))
+{
+	error_code ec;
+	auto filesize = filesystem::file_size(filepath, ec);
+	if (ec)
+		ok = false;
+	else
+		size = filesize / ROW_SIZE;
+}
+
+bool BookRowFinder::is_ok() const
+{
+	return ok;
+}
+
+uint64_t BookRowFinder::num_rows() const
+{
+	return size;
+}
+
+std::vector<BookRow> BookRowFinder::rows(uint64_t key, uint64_t* first)
+{
+	vector<BookRow> found;
+	uint64_t lo = 0;
+	uint64_t hi = size;
+	BookRow row;
+	while (lo < hi && ok)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (!read_row(mid, row))
+			break;
+		if (row.first < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (first)
+		*first = lo;
+	for (uint64_t i = lo; i < size && read_row(i, row) && row.first == key; i++)
+		found.push_back(row);
+	return found;
+}
+
+bool BookRowFinder::read_row(uint64_t i, BookRow& row)
+{
+	char bytes[ROW_SIZE];
+	file.seekg(static_cast<streamoff>(i * ROW_SIZE));
+	file.read(bytes, ROW_SIZE);
+	if (file.gcount() != ROW_SIZE) {
+		ok = false;
+		return false;
+	}
+	row.first = load_bigendian(bytes);
+	row.second = load_bigendian(bytes + 8);
+	return true;
+}
+
+
+std::vector<BookRow> read_rows(const std::string& filepath, qint64 filesize)
+{
+	vector<BookRow> rows;
+	if (filesize < 0) {
+		error_code ec;
+		filesize = static_cast<qint64>(filesystem::file_size(filepath, ec));
+		if (ec)
+			return rows;
+	}
+	if (filesize < static_cast<qint64>(ROW_SIZE))
+		return rows;
+
+	vector<char> buf(BUFFER_ROWS * ROW_SIZE);
+	ifstream file(filepath, ios::binary | ios::in);
+	rows.reserve(filesize / ROW_SIZE);
+	while (rows.size() < static_cast<size_t>(filesize) / ROW_SIZE && file)
+	{
+		file.read(buf.data(), buf.size());
+		size_t n = static_cast<size_t>(file.gcount()) / ROW_SIZE;
+		n = min<size_t>(n, filesize / ROW_SIZE - rows.size());
+		for (size_t i = 0; i < n; i++)
+			rows.emplace_back(load_bigendian(&buf[i * ROW_SIZE]), load_bigendian(&buf[i * ROW_SIZE + 8]));
+	}
+	return rows;
+}
+
+
+using EntryBytes = array<char, 16>;
+
+// The i-th digit of the sort order: the key, the weight (inverted, so that it's descending), the move, the learn value
+static inline uint8_t entry_digit(const EntryBytes& row, size_t i)
+{
+	constexpr static uint8_t BYTE_POS[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 10, 11, 8, 9, 12, 13, 14, 15 };
+	uint8_t byte = static_cast<uint8_t>(row[BYTE_POS[i]]);
+	return (i == 8 || i == 9) ? static_cast<uint8_t>(~byte) : byte;
+}
+
+static bool entry_less(const EntryBytes& a, const EntryBytes& b, size_t first_digit)
+{
+	for (size_t i = first_digit; i < ROW_SIZE; i++)
+	{
+		uint8_t da = entry_digit(a, i);
+		uint8_t db = entry_digit(b, i);
+		if (da != db)
+			return da < db;
+	}
+	return false;
+}
+
+// Splits the rows by the digit in place (American flag sort), returns the starts of the 256 parts and the end
+static array<size_t, 257> split_entries(EntryBytes* rows, size_t num_rows, size_t digit)
+{
+	array<size_t, 257> starts{};
+	for (size_t i = 0; i < num_rows; i++)
+		starts[entry_digit(rows[i], digit) + 1]++;
+	for (size_t b = 1; b <= 256; b++)
+		starts[b] += starts[b - 1];
+	array<size_t, 256> next;
+	copy(starts.begin(), starts.end() - 1, next.begin());
+	for (size_t b = 0; b < 256; b++)
+	{
+		while (next[b] < starts[b + 1])
+		{
+			uint8_t d = entry_digit(rows[next[b]], digit);
+			if (d == b)
+				next[b]++;
+			else
+				swap(rows[next[b]], rows[next[d]++]);
+		}
+	}
+	return starts;
+}
+
+static void sort_entries(EntryBytes* rows, size_t num_rows, size_t digit)
+{
+	if (num_rows < SMALL_SORT_ROWS) {
+		sort(rows, rows + num_rows, [digit](const EntryBytes& a, const EntryBytes& b) { return entry_less(a, b, digit); });
+		return;
+	}
+	if (digit == ROW_SIZE)
+		return;
+	auto starts = split_entries(rows, num_rows, digit);
+	for (size_t b = 0; b < 256; b++)
+		sort_entries(rows + starts[b], starts[b + 1] - starts[b], digit + 1);
+}
+
+void sort_entry_rows(std::vector<std::array<char, 16>>& rows, size_t num_threads)
+{
+	if (num_threads == 0)
+		num_threads = max(1u, thread::hardware_concurrency());
+	if (num_threads == 1 || rows.size() < PARALLEL_SORT_ROWS) {
+		sort_entries(rows.data(), rows.size(), 0);
+		return;
+	}
+	// The keys are Zobrist hashes, so the parts by the first byte are of about the same size
+	auto starts = split_entries(rows.data(), rows.size(), 0);
+	atomic<size_t> next_part = 0;
+	auto sort_parts = [&]()
+	{
+		for (size_t b = next_part++; b < 256; b = next_part++)
+			sort_entries(rows.data() + starts[b], starts[b + 1] - starts[b], 1);
+	};
+	vector<thread> threads;
+	for (size_t i = 1; i < num_threads; i++)
+		threads.emplace_back(sort_parts);
+	sort_parts();
+	for (auto& t : threads)
+		t.join();
+}
+
+static bool sync_file(QFile& file)
+{
+	if (!file.flush())
+		return false;
+#ifdef Q_OS_WIN
+	return _commit(file.handle()) == 0;
+#else
+	return fsync(file.handle()) == 0;
+#endif
+}
+
+static bool write_rows_at(QFile& book, const char* log_rows, uint64_t num_rows)
+{
+	for (uint64_t i = 0; i < num_rows; i++)
+	{
+		const char* log_row = log_rows + i * PATCH_LOG_ROW_SIZE;
+		if (!book.seek(static_cast<qint64>(load_bigendian(log_row)))
+		    || book.write(log_row + 8, ROW_SIZE) != static_cast<qint64>(ROW_SIZE))
+			return false;
+	}
+	return sync_file(book);
+}
+
+bool overwrite_entry_rows(const std::string& filepath, const std::string& path_log, const std::vector<std::array<char, 16>>& rows)
+{
+	if (rows.empty())
+		return true;
+	/// Find all the rows first, so that nothing is written if one of them is missing
+	vector<char> log(sizeof(PATCH_LOG_TAG) + 8 + rows.size() * PATCH_LOG_ROW_SIZE + 8);
+	char* p = log.data();
+	copy(begin(PATCH_LOG_TAG), end(PATCH_LOG_TAG), p);
+	save_bigendian(static_cast<uint64_t>(rows.size()), p + 8);
+	p += 16;
+	{
+		BookRowFinder finder(filepath);
+		uint64_t prev_key = 0;
+		for (size_t i = 0; i < rows.size(); i++)
+		{
+			uint64_t key = load_bigendian(rows[i].data());
+			if (i > 0 && key == prev_key)
+				return false;
+			prev_key = key;
+			uint64_t first;
+			if (finder.rows(key, &first).size() != 1 || !finder.is_ok())
+				return false;
+			save_bigendian(static_cast<uint64_t>(first * ROW_SIZE), p);
+			copy(rows[i].begin(), rows[i].end(), p + 8);
+			p += PATCH_LOG_ROW_SIZE;
+		}
+	}
+	save_bigendian(static_cast<uint64_t>(rows.size()), p);
+
+	/// The log is complete on disk before the book is touched
+	QString qpath_log = QString::fromStdString(path_log);
+	{
+		QFile file(qpath_log);
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+		    || file.write(log.data(), static_cast<qint64>(log.size())) != static_cast<qint64>(log.size())
+		    || !sync_file(file)) {
+			file.close();
+			QFile::remove(qpath_log);
+			return false;
+		}
+	}
+
+	/// Overwrite the rows. If it fails, the log stays for replay_entry_rows()
+	QFile book(QString::fromStdString(filepath));
+	if (!book.open(QIODevice::ReadWrite) || !write_rows_at(book, log.data() + 16, rows.size()))
+		return false;
+	book.close();
+	return QFile::remove(qpath_log);
+}
+
+bool replay_entry_rows(const std::string& filepath, const std::string& path_log)
+{
+	QString qpath_log = QString::fromStdString(path_log);
+	QFile file(qpath_log);
+	if (!file.exists())
+		return true;
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+	char header[16];
+	if (file.read(header, sizeof(header)) != static_cast<qint64>(sizeof(header)) || !equal(begin(PATCH_LOG_TAG), end(PATCH_LOG_TAG), header))
+		return true; // not a patch log, e.g. the temporary file of a full save
+	uint64_t num_rows = load_bigendian(header + 8);
+	uint64_t size = 16 + num_rows * PATCH_LOG_ROW_SIZE + 8;
+	bool is_complete = (static_cast<uint64_t>(file.size()) == size);
+	vector<char> log;
+	if (is_complete)
+	{
+		log.resize(num_rows * PATCH_LOG_ROW_SIZE + 8);
+		is_complete = file.read(log.data(), static_cast<qint64>(log.size())) == static_cast<qint64>(log.size())
+		              && load_bigendian(log.data() + num_rows * PATCH_LOG_ROW_SIZE) == num_rows;
+	}
+	file.close();
+	// An incomplete log was being written when the app stopped, so the book hasn't been touched yet
+	if (is_complete)
+	{
+		QFile book(QString::fromStdString(filepath));
+		if (!book.open(QIODevice::ReadWrite) || !write_rows_at(book, log.data(), num_rows))
+			return false;
+	}
+	return QFile::remove(qpath_log);
+}
+
+bool merge_entry_rows(const std::string& path_in, const std::string& path_out, const std::vector<std::array<char, 16>>& rows,
+                      const std::vector<uint64_t>& removed_keys)
+{
+	error_code ec;
+	auto filesize = filesystem::file_size(path_in, ec);
+	if (ec)
+		return false;
+	ifstream file(path_in, ios::binary | ios::in);
+	if (!file)
+		return false;
+	BookRowWriter book(path_out);
+	auto write_row = [&book](const char* row) { book.write(load_bigendian(row), load_bigendian(row + 8)); };
+
+	size_t p = 0; // next patch row
+	size_t r = 0; // next removed key
+	bool is_replaced = false;
+	uint64_t replaced_key = 0;
+	uintmax_t num_read = 0;
+	vector<char> buf(BUFFER_ROWS * ROW_SIZE);
+	while (num_read < filesize / ROW_SIZE * ROW_SIZE)
+	{
+		file.read(buf.data(), buf.size());
+		size_t n = static_cast<size_t>(file.gcount()) / ROW_SIZE;
+		if (!n)
+			break;
+		num_read += n * ROW_SIZE;
+		for (size_t i = 0; i < n; i++)
+		{
+			const char* row = &buf[i * ROW_SIZE];
+			uint64_t key = load_bigendian(row);
+			if (is_replaced && key == replaced_key)
+				continue;
+			for (; p < rows.size(); p++)
+			{
+				uint64_t patch_key = load_bigendian(rows[p].data());
+				if (patch_key > key)
+					break;
+				if (patch_key == key) {
+					is_replaced = true;
+					replaced_key = key;
+				}
+				write_row(rows[p].data());
+			}
+			if (is_replaced && key == replaced_key)
+				continue;
+			while (r < removed_keys.size() && removed_keys[r] < key)
+				r++;
+			if (r < removed_keys.size() && removed_keys[r] == key)
+				continue;
+			write_row(row);
+		}
+	}
+	for (; p < rows.size(); p++)
+		write_row(rows[p].data());
+	bool is_ok = book.close();
+	return is_ok && num_read == filesize / ROW_SIZE * ROW_SIZE;
+}
@@ -0,0 +1,127 @@
+#ifndef BOOK_MERGE_H
+#define BOOK_MERGE_H
+
+#include <QtGlobal>
+
+#include <vector>
+#include <array>
+#include <string>
+#include <fstream>
+#include <utility>
+#include <cstdint>
+
+
+using BookRow = std::pair<uint64_t, uint64_t>;
+
+/*
+ * Sequential reader of a book file sorted by key (16-byte rows: key + value).
+ * Only one row per key is returned: the first one for files, or the first/last one for rows loaded in memory.
+ * The file is read in chunks, so the memory use doesn't depend on the file size.
+ * If the file turns out to be unsorted, the reader stops and is_sorted() returns false.
+ * In that case load_sorted() loads the whole file into memory and sorts it.
+ */
+class LIB_EXPORT BookRowReader
+{
+public:
+	explicit BookRowReader(const std::string& filepath);
+	BookRowReader(std::vector<BookRow> rows, bool keep_last);
+
+	bool at_end() const;
+	uint64_t key() const;
+	uint64_t value() const;
+	void next_key();
+	bool is_sorted() const;
+	bool is_ok() const;
+	bool load_sorted();
+	void rewind();
+
+private:
+	bool read_row();
+	void set_rows(std::vector<BookRow> rows, bool keep_last);
+
+private:
+	std::string filepath;
+	std::ifstream file;
+	std::vector<char> buf;
+	size_t buf_pos;
+	size_t buf_size;
+	std::vector<BookRow> rows;
+	bool in_memory;
+	size_t idx;
+	BookRow row;
+	bool is_end;
+	bool sorted;
+	bool ok;
+};
+
+/*
+ * Buffered writer of 16-byte book rows.
+ */
+class LIB_EXPORT BookRowWriter
+{
+public:
+	explicit BookRowWriter(const std::string& filepath);
+	~BookRowWriter();
+
+	void write(uint64_t key, uint64_t value);
+	void write_rows(const char* rows, size_t num_rows); // rows in the file format
+	bool close();
+	uintmax_t size() const;
+
+private:
+	bool flush();
+
+private:
+	std::ofstream file;
+	std::vector<char> buf;
+	size_t buf_pos;
+	uintmax_t num_bytes;
+	bool ok;
+};
+
+/*
+ * Lookup of the rows of a key in a book file sorted by key, by a binary search in the file.
+ */
+class LIB_EXPORT BookRowFinder
+{
+public:
+	explicit BookRowFinder(const std::string& filepath);
+
+	bool is_ok() const;
+	uint64_t num_rows() const;
+	std::vector<BookRow> rows(uint64_t key, uint64_t* first = nullptr); // first is the index of the first row
+
+private:
+	bool read_row(uint64_t i, BookRow& row);
+
+private:
+	std::ifstream file;
+	uint64_t size;
+	bool ok;
+};
+
+std::vector<BookRow> read_rows(const std::string& filepath, qint64 filesize = -1);
+
+/*
+ * Sorts the rows in the file format (big-endian key, move, weight, learn) in place: by the key,
+ * then by the weight in descending order, then by the move and the learn value.
+ * It's an MSD radix sort: the rows are split by the first byte of the key, and the parts are sorted
+ * on num_threads threads (0 to use all the cores).
+ */
+void sort_entry_rows(std::vector<std::array<char, 16>>& rows, size_t num_threads = 0);
+
+/*
+ * Patching of a book file in the file format sorted as by sort_entry_rows. The patch rows are sorted the same way.
+ * overwrite_entry_rows() writes the rows in place, if each key of the patch has exactly one row in the file and
+ * one row in the patch. Otherwise nothing is written and it returns false. The rows and their offsets are first
+ * written and synced to path_log, which is removed once the book is patched. If the app stops in between,
+ * replay_entry_rows() finishes the patch from the log; it returns false only if a complete log couldn't be applied.
+ * merge_entry_rows() writes the book to path_out: the patch rows of a key replace all the rows of the key,
+ * and the rows of removed_keys (sorted) are dropped.
+ */
+bool overwrite_entry_rows(const std::string& filepath, const std::string& path_log, const std::vector<std::array<char, 16>>& rows);
+bool replay_entry_rows(const std::string& filepath, const std::string& path_log);
+bool merge_entry_rows(const std::string& path_in, const std::string& path_out, const std::vector<std::array<char, 16>>& rows,
+                      const std::vector<uint64_t>& removed_keys);
+
+#endif // BOOK_MERGE_H
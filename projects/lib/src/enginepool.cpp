@@ -0,0 +1,250 @@
+#include "enginepool.h"
+#include "enginebuilder.h"
+#include "uciengine.h"
+#include "humanplayer.h"
+#include "openingbook.h"
+#include "board/boardfactory.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+EnginePool::EnginePool(const EngineConfiguration& config, QObject* parent)
+	: QObject(parent)
+	, config(config)
+	, engine_version(LATEST_ENGINE_VERSION)
+	, opponent(new HumanPlayer(this))
+{}
+
+EnginePool::~EnginePool()
+{
+	stop();
+}
+
+void EnginePool::setEngineVersion(uint8_t engine_version)
+{
+	this->engine_version = engine_version;
+}
+
+void EnginePool::start(int num_engines, int num_threads, int hash_size)
+{
+	stop();
+	EngineConfiguration pool_config(config);
+	pool_config.setOption("Threads", max(1, num_threads));
+	pool_config.setOption("Hash", max(16, hash_size));
+	pool_config.setOption("MultiPV", 2); // to detect only moves
+	workers.reserve(num_engines);
+	for (int i = 0; i < num_engines; i++)
+	{
+		EngineBuilder builder(pool_config);
+		QString error;
+		auto engine = qobject_cast<UciEngine*>(builder.create(nullptr, nullptr, this, &error));
+		if (!engine) {
+			emit Message(QString("Failed to start pool engine #%1: %2").arg(i + 1).arg(error), MessageType::warning);
+			break;
+		}
+		Worker w;
+		w.engine = engine;
+		w.board.reset(Chess::BoardFactory::create("antichess"));
+		w.board->setFenString(w.board->defaultFenString());
+		w.is_ready = false;
+		w.is_busy = false;
+		w.is_only_move = false;
+		workers.push_back(w);
+		connect(engine, SIGNAL(ready()), this, SLOT(onEngineReady()));
+		connect(engine, SIGNAL(disconnected()), this, SLOT(onEngineQuit()));
+		connect(engine, SIGNAL(thinking(const MoveEvaluation&)), this, SLOT(onEngineEval(const MoveEvaluation&)));
+		connect(engine, SIGNAL(moveMade(const Chess::Move&)), this, SLOT(onEngineFinished(const Chess::Move&)));
+	}
+}
+
+void EnginePool::stop()
+{
+	for (auto& w : workers)
+	{
+		if (!w.engine)
+			continue;
+		disconnect(w.engine, nullptr, this, nullptr);
+		w.engine->quit();
+		w.engine->deleteLater();
+	}
+	workers.clear();
+	clear();
+}
+
+int EnginePool::size() const
+{
+	return static_cast<int>(workers.size());
+}
+
+bool EnginePool::isReady() const
+{
+	return any_of(workers.begin(), workers.end(), [](const Worker& w) { return w.engine && w.is_ready; });
+}
+
+QString EnginePool::engineName() const
+{
+	auto it = find_if(workers.begin(), workers.end(), [](const Worker& w) { return w.engine && w.is_ready; });
+	return (it == workers.end()) ? QString() : it->engine->name();
+}
+
+bool EnginePool::contains(quint64 key) const
+{
+	return pending.count(key) || results.count(key);
+}
+
+void EnginePool::evaluate(std::shared_ptr<Chess::Board> board, quint64 num_nodes, bool is_urgent)
+{
+	quint64 key = board->key();
+	if (contains(key)) {
+		if (is_urgent) {
+			// Move the queued job to the front
+			auto it = find_if(jobs.begin(), jobs.end(), [key](const Job& job) { return job.key == key; });
+			if (it != jobs.end() && it != jobs.begin()) {
+				Job job = *it;
+				jobs.erase(it);
+				jobs.push_front(job);
+			}
+		}
+		return;
+	}
+	Job job{ key, shared_ptr<Chess::Board>(board->copy()), num_nodes };
+	if (is_urgent)
+		jobs.push_front(job);
+	else
+		jobs.push_back(job);
+	pending.insert(key);
+	dispatch();
+}
+
+bool EnginePool::takeResult(quint64 key, EngineResult& result)
+{
+	auto it = results.find(key);
+	if (it == results.end())
+		return false;
+	result = it->second;
+	results.erase(it);
+	return true;
+}
+
+void EnginePool::clear()
+{
+	// Running searches are left to finish: their results are keyed by position, so they stay valid
+	for (auto& job : jobs)
+		pending.erase(job.key);
+	jobs.clear();
+	results.clear();
+}
+
+void EnginePool::onEngineReady()
+{
+	auto w = worker(sender());
+	if (!w || w->is_ready)
+		return;
+	w->engine->newGame(Chess::Side::NoSide, opponent, w->board.get());
+	w->is_ready = true;
+	dispatch();
+}
+
+void EnginePool::onEngineEval(const MoveEvaluation& eval)
+{
+	auto w = worker(sender());
+	if (!w || !w->is_busy || eval.score() == MoveEvaluation::NULL_SCORE)
+		return;
+	int pv = max(1, eval.pvNumber());
+	if (pv == 1)
+		w->best_eval = eval;
+	else
+		w->is_only_move = update_only_move(w->is_only_move, pv, eval.score());
+}
+
+void EnginePool::onEngineFinished(const Chess::Move& move)
+{
+	auto w = worker(sender());
+	if (!w || !w->is_busy)
+		return;
+	finish_job(*w, move);
+	dispatch();
+}
+
+void EnginePool::onEngineQuit()
+{
+	auto w = worker(sender());
+	if (!w)
+		return;
+	w->engine->deleteLater();
+	w->engine = nullptr;
+	w->is_ready = false;
+	emit Message("Pool engine has quit unexpectedly.", MessageType::warning);
+	if (w->is_busy) {
+		w->is_busy = false;
+		fail_job(w->job.key);
+		w->job = Job();
+	}
+	if (!isReady()) {
+		// No engines left => the solver falls back to the main engine
+		auto failed_jobs = std::move(jobs);
+		jobs.clear();
+		for (auto& job : failed_jobs)
+			fail_job(job.key);
+	}
+}
+
+EnginePool::Worker* EnginePool::worker(QObject* engine)
+{
+	for (auto& w : workers)
+		if (w.engine && w.engine == engine)
+			return &w;
+	return nullptr;
+}
+
+void EnginePool::dispatch()
+{
+	for (auto& w : workers)
+	{
+		if (jobs.empty())
+			return;
+		if (!w.engine || !w.is_ready || w.is_busy)
+			continue;
+		w.job = jobs.front();
+		jobs.pop_front();
+		w.is_busy = true;
+		w.best_eval.clear();
+		w.is_only_move = false;
+		w.engine->write(QString("position fen %1").arg(w.job.board->fenString()));
+		w.engine->go(w.job.board.get(), w.job.num_nodes);
+	}
+}
+
+void EnginePool::fail_job(quint64 key)
+{
+	if (!pending.erase(key))
+		return;
+	results[key] = { nullptr, Chess::Move(), false };
+	emit resultReady(key);
+}
+
+void EnginePool::finish_job(Worker& w, const Chess::Move& move)
+{
+	w.is_busy = false;
+	const Job& job = w.job; // the board is kept until the next job as the engine still refers to it
+	if (!pending.erase(job.key))
+		return; // the engine has been restarted meanwhile
+
+	EngineResult result{ nullptr, move, false };
+	const auto& eval = w.best_eval;
+	if (!move.isNull() && !eval.isEmpty() && eval.score() != MoveEvaluation::NULL_SCORE
+	    && -MATE_VALUE <= eval.score() && eval.score() <= MATE_VALUE && eval.depth() >= 2)
+	{
+		auto pgMove = OpeningBook::moveToBits(job.board->genericMove(move));
+		quint64 nodes = eval.nodeCount() + eval.tbHits() * 100;
+		quint32 depth_time = static_cast<quint32>(min(static_cast<int>(REAL_DEPTH_LIMIT), eval.depth()));
+		depth_time |= static_cast<quint32>(min<quint64>(0xFFFF, nodes / NODES_PER_S)) << 16;
+		depth_time |= static_cast<quint32>(engine_version) << 8;
+		result.data = make_shared<SolutionEntry>(pgMove, static_cast<qint16>(eval.score()), depth_time);
+		result.is_only_move = w.is_only_move;
+	}
+	results[job.key] = result;
+	emit resultReady(job.key);
+}
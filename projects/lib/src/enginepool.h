@@ -0,0 +1,98 @@
+#ifndef ENGINEPOOL_H
+#define ENGINEPOOL_H
+
+#include "engineconfiguration.h"
+#include "moveevaluation.h"
+#include "positioninfo.h"
+#include "board/move.h"
+#include "board/board.h"
+
+#include <QObject>
+
+#include <memory>
+#include <deque>
+#include <vector>
+#include <map>
+#include <set>
+
+
+class UciEngine;
+class HumanPlayer;
+
+
+struct LIB_EXPORT EngineResult
+{
+	std::shared_ptr<SolutionEntry> data; // nullptr if the engine failed to evaluate the position
+	Chess::Move move;
+	bool is_only_move;
+};
+
+
+/*
+ * Pool of engine processes that evaluate independent positions in parallel.
+ * Positions are queued with evaluate() and searched with a fixed node budget; the results are kept
+ * until the solver takes them, so the solver still consumes them in its own (deterministic) order.
+ */
+class LIB_EXPORT EnginePool : public QObject
+{
+	Q_OBJECT
+
+public:
+	EnginePool(const EngineConfiguration& config, QObject* parent = nullptr);
+	~EnginePool();
+
+	void setEngineVersion(uint8_t engine_version);
+	void start(int num_engines, int num_threads, int hash_size);
+	void stop();
+	int size() const;
+	bool isReady() const;
+	QString engineName() const; // empty if no engine is ready
+	bool contains(quint64 key) const;
+	void evaluate(std::shared_ptr<Chess::Board> board, quint64 num_nodes, bool is_urgent = false);
+	bool takeResult(quint64 key, EngineResult& result);
+	void clear();
+
+signals:
+	void resultReady(quint64 key);
+	void Message(const QString& message, MessageType type = MessageType::std);
+
+private slots:
+	void onEngineReady();
+	void onEngineEval(const MoveEvaluation& eval);
+	void onEngineFinished(const Chess::Move& move);
+	void onEngineQuit();
+
+private:
+	struct Job
+	{
+		quint64 key;
+		std::shared_ptr<Chess::Board> board;
+		quint64 num_nodes;
+	};
+	struct Worker
+	{
+		UciEngine* engine;
+		std::shared_ptr<Chess::Board> board;
+		bool is_ready;
+		bool is_busy;
+		Job job;
+		MoveEvaluation best_eval;
+		bool is_only_move;
+	};
+
+	Worker* worker(QObject* engine);
+	void dispatch();
+	void fail_job(quint64 key);
+	void finish_job(Worker& w, const Chess::Move& move);
+
+private:
+	EngineConfiguration config;
+	uint8_t engine_version;
+	HumanPlayer* opponent;
+	std::vector<Worker> workers;
+	std::deque<Job> jobs;
+	std::set<quint64> pending;
+	std::map<quint64, EngineResult> results;
+};
+
+#endif // ENGINEPOOL_H
@@ -0,0 +1,205 @@
+#ifndef FLAT_HASH_H
+#define FLAT_HASH_H
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * Open-addressing hash map keyed by 64-bit Zobrist keys.
+ * Entries are stored in one flat array with linear probing, so a lookup touches one or two cache lines
+ * and there's no per-entry allocation. The key 0 marks an empty slot; a real key 0 is stored in an extra
+ * slot at the end of the array. Entries can't be erased individually, only all at once with clear().
+ */
+template<typename V>
+class FlatHashMap
+{
+public:
+	using value_type = std::pair<uint64_t, V>;
+
+	template<typename T, typename P>
+	class basic_iterator
+	{
+	public:
+		basic_iterator(P map, size_t idx) : map(map), idx(idx) { skip_empty(); }
+		T& operator*() const { return map->slots[idx]; }
+		T* operator->() const { return &map->slots[idx]; }
+		basic_iterator& operator++() { idx++; skip_empty(); return *this; }
+		bool operator==(const basic_iterator& other) const { return idx == other.idx; }
+		bool operator!=(const basic_iterator& other) const { return idx != other.idx; }
+
+	private:
+		void skip_empty() { while (idx < map->slots.size() && !map->is_occupied(idx)) idx++; }
+
+	private:
+		P map;
+		size_t idx;
+		friend class FlatHashMap;
+	};
+	using iterator = basic_iterator<value_type, FlatHashMap*>;
+	using const_iterator = basic_iterator<const value_type, const FlatHashMap*>;
+
+public:
+	FlatHashMap() : num_elements(0), has_zero(false), mask(0) {}
+
+	size_t size() const { return num_elements; }
+	bool empty() const { return num_elements == 0; }
+	size_t capacity() const { return slots.empty() ? 0 : mask + 1; }
+	size_t memory_usage() const { return slots.capacity() * sizeof(value_type); }
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, slots.size()); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, slots.size()); }
+
+	void clear()
+	{
+		slots.clear();
+		slots.shrink_to_fit();
+		num_elements = 0;
+		has_zero = false;
+		mask = 0;
+	}
+
+	void reserve(size_t n)
+	{
+		size_t new_capacity = MIN_CAPACITY;
+		while (new_capacity * MAX_LOAD_NUM < n * MAX_LOAD_DEN)
+			new_capacity *= 2;
+		if (new_capacity > capacity())
+			rehash(new_capacity);
+	}
+
+	iterator find(uint64_t key)
+	{
+		return iterator(this, find_idx(key));
+	}
+
+	const_iterator find(uint64_t key) const
+	{
+		return const_iterator(this, find_idx(key));
+	}
+
+	size_t count(uint64_t key) const
+	{
+		return find_idx(key) == slots.size() ? 0 : 1;
+	}
+
+	std::pair<iterator, bool> insert(const value_type& value)
+	{
+		if (value.first == 0) {
+			if (slots.empty())
+				rehash(MIN_CAPACITY);
+			bool is_new = !has_zero;
+			if (is_new) {
+				slots[mask + 1] = value;
+				has_zero = true;
+				num_elements++;
+			}
+			return { iterator(this, mask + 1), is_new };
+		}
+		if ((num_elements + 1) * MAX_LOAD_DEN > capacity() * MAX_LOAD_NUM)
+			rehash(capacity() ? 2 * capacity() : MIN_CAPACITY);
+		size_t idx = slot_idx(value.first);
+		for (;;)
+		{
+			if (slots[idx].first == value.first)
+				return { iterator(this, idx), false };
+			if (slots[idx].first == 0)
+				break;
+			idx = (idx + 1) & mask;
+		}
+		slots[idx] = value;
+		num_elements++;
+		return { iterator(this, idx), true };
+	}
+
+	V& operator[](uint64_t key)
+	{
+		return insert(value_type(key, V())).first->second;
+	}
+
+private:
+	constexpr static size_t MIN_CAPACITY = 1024;
+	constexpr static size_t MAX_LOAD_NUM = 7;   // the maximum load factor is 7/10
+	constexpr static size_t MAX_LOAD_DEN = 10;
+
+	size_t slot_idx(uint64_t key) const
+	{
+		// Zobrist keys are already random, but mix them anyway in case of sequential keys
+		return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+	}
+
+	bool is_occupied(size_t idx) const
+	{
+		return (idx <= mask) ? (slots[idx].first != 0) : has_zero;
+	}
+
+	size_t find_idx(uint64_t key) const
+	{
+		if (slots.empty())
+			return slots.size();
+		if (key == 0)
+			return has_zero ? mask + 1 : slots.size();
+		size_t idx = slot_idx(key);
+		for (;;)
+		{
+			if (slots[idx].first == key)
+				return idx;
+			if (slots[idx].first == 0)
+				return slots.size();
+			idx = (idx + 1) & mask;
+		}
+	}
+
+	void rehash(size_t new_capacity)
+	{
+		std::vector<value_type> old_slots(new_capacity + 1, value_type(0, V()));
+		old_slots.swap(slots);
+		size_t old_mask = mask;
+		mask = new_capacity - 1;
+		if (old_slots.empty())
+			return;
+		if (has_zero)
+			slots[mask + 1] = old_slots[old_mask + 1];
+		for (size_t i = 0; i <= old_mask; i++)
+		{
+			if (old_slots[i].first == 0)
+				continue;
+			size_t idx = slot_idx(old_slots[i].first);
+			while (slots[idx].first != 0)
+				idx = (idx + 1) & mask;
+			slots[idx] = old_slots[i];
+		}
+	}
+
+private:
+	std::vector<value_type> slots; // mask + 1 slots + the slot for key 0
+	size_t num_elements;
+	bool has_zero;
+	size_t mask;
+};
+
+
+/*
+ * Open-addressing hash set of 64-bit Zobrist keys (see FlatHashMap).
+ */
+class FlatHashSet
+{
+public:
+	size_t size() const { return keys.size(); }
+	bool empty() const { return keys.empty(); }
+	size_t memory_usage() const { return keys.memory_usage(); }
+	void clear() { keys.clear(); }
+	void reserve(size_t n) { keys.reserve(n); }
+	bool insert(uint64_t key) { return keys.insert({ key, Empty() }).second; }
+	size_t count(uint64_t key) const { return keys.count(key); }
+
+private:
+	struct Empty {};
+	FlatHashMap<Empty> keys;
+};
+
+#endif // FLAT_HASH_H
@@ -1,6 +1,7 @@
 #include "ll_api.h"
 #include "losing.h"
 #include "tb.h"
+#include "ll_threads.h"
 
 #include <math.h>
 
@@ -9,27 +10,47 @@
 #define LOST_VALUE -WON_VALUE
 #define INF_VALUE ((short)32000)
 #define FlagEP (1 << 15)
+#define LL_MAX_THREADS 64
+#define VIRTUAL_VALUE (MY_INFoo / 2) // keeps the other threads away from a node being expanded
 
 uint64 ZOBRIST[14][64];
 uint64 ZobristEP[8];
 type_MM ROOK_MM[64], BISHOP_MM[64];
 uint64 MM_ORTHO[102400], MM_DIAG[5248];
 uint64 AttN[64], AttK[64];
-int HASH_MASK;
 int REV_LIMIT;
 
-static typePOS RPOS[1];
-static boolean llInitialized = FALSE;
-static uint64 randkey = 1;
-static PN_NODE* searchTree = NULL;
-static boolean searchInitialized = FALSE;
-static uint32 search_nodes = 10000000;
-static uint32 search_step = 1000000;
-static uint32 max_nodes;
-static uint32 NEXT_NODE;
-static uint64 TB_HITS = 0;
-static typePOS ROOT[1];
-static typeDYNAMIC DYN[1];
+// All the state of one search, so that several searches can run side by side
+struct LL_CONTEXT
+{
+	typePOS RPOS[1];
+	uint64 randkey;
+	uint64 max_ram; // 0 if unlimited
+	PN_NODE* searchTree;
+	boolean searchInitialized;
+	uint32 search_nodes;
+	uint32 search_step;
+	uint32 max_nodes;
+	uint32 NEXT_NODE;
+	uint32 num_nodes; // searched, can be more than NEXT_NODE after reclaiming the solved subtrees
+	uint64 TB_HITS;
+	typePOS ROOT[1];
+	typeDYNAMIC DYN[1];
+	uint32 tree_size;
+	unsigned int num_threads;
+	LL_LOCK* tree_lock;
+	uint32 num_busy;
+	boolean stop_search;
+	boolean tree_full; // stopped at the end of the tree
+	boolean tree_exhausted; // ... and reclaiming doesn't help
+};
+
+typedef struct
+{
+	ll_context_t* ctx;
+	typePOS POS[1];
+	CHILD_INFO ci[256];
+} WORKER;
 
 
 static void board_fen(typePOS* POSITION, char* I)
@@ -109,25 +130,61 @@ static void init_position(typePOS* POS)
 static void init_ll()
 {
 	magic_mult_init();
-	RPOS->DYN_ROOT = CALLOC(MAX_PLY, sizeof(typeDYNAMIC));
-	RPOS->DYN = RPOS->DYN_ROOT + 1;
-	init_position(RPOS);
-	RPOS->ZTAB = NULL;
-	llInitialized = TRUE;
+}
+
+ll_context_t* ll_new_context(unsigned long long max_ram)
+{
+	ll_context_t* ctx;
+	ll_once(init_ll);
+	ctx = CALLOC(1, sizeof(ll_context_t));
+	if (!ctx)
+		return NULL;
+	memset(ctx, 0, sizeof(ll_context_t));
+	ctx->RPOS->DYN_ROOT = CALLOC(MAX_PLY, sizeof(typeDYNAMIC));
+	ctx->tree_lock = ll_lock_new();
+	if (!ctx->RPOS->DYN_ROOT || !ctx->tree_lock)
+	{
+		ll_free_context(ctx);
+		return NULL;
+	}
+	ctx->RPOS->DYN = ctx->RPOS->DYN_ROOT + 1;
+	init_position(ctx->RPOS);
+	ctx->RPOS->ZTAB = NULL;
+	ctx->randkey = 1;
+	ctx->max_ram = max_ram;
+	ctx->search_nodes = 10000000;
+	ctx->search_step = 1000000;
+	ctx->num_threads = 1;
+	return ctx;
+}
+
+void ll_free_context(ll_context_t* ctx)
+{
+	if (!ctx)
+		return;
+	ll_clear_data(ctx);
+	free(ctx->RPOS->DYN_ROOT);
+	ll_lock_free(ctx->tree_lock);
+	free(ctx);
+}
+
+void ll_set_max_ram(ll_context_t* ctx, unsigned long long max_ram)
+{
+	ctx->max_ram = max_ram;
 }
 
 #define RAND_MULT 8765432181103515245ULL
 #define RAND_ADD 1234567891ULL
 // #define RAND_MULT 0x953188fab960c301ULL
 // #define RAND_ADD 0xc8a2dd7eULL
-static uint16 RAND16()
+static uint16 RAND16(uint64* randkey)
 {
-	randkey = randkey * RAND_MULT + RAND_ADD;
-	return ((randkey >> 32) % 65536);
+	*randkey = *randkey * RAND_MULT + RAND_ADD;
+	return ((*randkey >> 32) % 65536);
 }
-static uint64 GET_RAND()
+static uint64 GET_RAND(uint64* randkey)
 {
-	return (((uint64)RAND16()) << 48) | (((uint64)RAND16()) << 32) | (((uint64)RAND16()) << 16) | (((uint64)RAND16()) << 0);
+	return (((uint64)RAND16(randkey)) << 48) | (((uint64)RAND16(randkey)) << 32) | (((uint64)RAND16(randkey)) << 16) | (((uint64)RAND16(randkey)) << 0);
 }
 
 static inline boolean are_moves_identical(unsigned short mv1, unsigned short mv2)
@@ -163,30 +220,61 @@ int set_moves(typePOS* POS, const unsigned short* mv, unsigned int num_moves)
 	return 0;
 }
 
-unsigned long long ll_required_ram(unsigned int total_nodes)
+unsigned long long ll_required_ram(const ll_context_t* ctx, unsigned int total_nodes)
 {
-	uint64 size_tree = (2ULL * MAX_PLY + total_nodes) * sizeof(PN_NODE);
+	unsigned int num_threads = ctx ? ctx->num_threads : 1;
+	uint64 size_tree = (2ULL * MAX_PLY + 256ULL * LL_MAX_THREADS + total_nodes) * sizeof(PN_NODE);
 	uint64 size_hash = (2ULL << BSR(total_nodes)) * sizeof(HASH);
-	uint64 size_other = MAX_PLY * sizeof(typeDYNAMIC) + 256 * sizeof(uint16);
+	uint64 size_other = MAX_PLY * sizeof(typeDYNAMIC) + 256 * sizeof(uint16)
+	                  + num_threads * (MAX_PLY * sizeof(typeDYNAMIC) + sizeof(WORKER))
+	                  + reclaim_memory(2 * MAX_PLY + 256 * LL_MAX_THREADS + total_nodes);
 	return size_tree + size_hash + size_other;
 }
 
-int ll_init_search(unsigned int total_nodes, unsigned int step_nodes, const unsigned short* moves, unsigned int num_moves)
+// Number of the nodes that the tree can hold within the memory budget
+static uint32 tree_nodes(const ll_context_t* ctx, uint32 total_nodes)
 {
-	if (!llInitialized)
-		init_ll();
-	searchInitialized = FALSE;
-	ll_clear_data();
+	uint32 lo = 0, hi = total_nodes;
+	if (!ctx->max_ram || ll_required_ram(ctx, total_nodes) <= ctx->max_ram)
+		return total_nodes;
+	while (lo < hi)
+	{
+		uint32 mid = lo + (hi - lo + 1) / 2;
+		if (ll_required_ram(ctx, mid) <= ctx->max_ram)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+int ll_init_search(ll_context_t* ctx, unsigned int total_nodes, unsigned int step_nodes,
+                   const unsigned short* moves, unsigned int num_moves)
+{
+	typePOS* RPOS = ctx->RPOS;
+	ctx->searchInitialized = FALSE;
+	ll_clear_data(ctx);
 	init_position(RPOS);
-	search_nodes = total_nodes;
-	search_step = step_nodes;
+	// A tree smaller than total_nodes relies on reclaiming the solved subtrees
+	uint32 nodes = tree_nodes(ctx, total_nodes);
+	if (nodes < step_nodes || nodes < 2)
+		return LL_ERROR_RAM;
+	ctx->search_nodes = total_nodes;
+	ctx->search_step = step_nodes;
 	int ec = set_moves(RPOS, moves, num_moves);
 	if (ec)
 		return ec;
-	searchTree = MALLOC((2 * MAX_PLY + search_nodes), sizeof(PN_NODE)); // HASH_MASK is excessive
-	HASH_MASK = (2 << BSR(search_nodes)) - 1;
-	RPOS->ZTAB = CALLOC((HASH_MASK + 1), sizeof(HASH));
-	uint64 ZOB = GET_RAND();
+	ctx->tree_size = 2 * MAX_PLY + 256 * LL_MAX_THREADS + nodes; // each thread can add 256 nodes over the limit
+	ctx->searchTree = MALLOC(ctx->tree_size, sizeof(PN_NODE)); // HASH_MASK is excessive
+	RPOS->HASH_MASK = (2 << BSR(nodes)) - 1;
+	RPOS->ZTAB = CALLOC((RPOS->HASH_MASK + 1), sizeof(HASH));
+	if (!ctx->searchTree || !RPOS->ZTAB)
+	{
+		ll_clear_data(ctx);
+		return LL_ERROR_RAM;
+	}
+	memset(RPOS->ZTAB, 0, (RPOS->HASH_MASK + 1) * sizeof(HASH)); // CALLOC is malloc, so the memory may still hold the entries of a freed table
+	uint64 ZOB = GET_RAND(&ctx->randkey);
 	RPOS->DYN->HASH ^= ZOB; // bug fix, else re-use HASH
 	return 0;
 }
@@ -243,68 +331,180 @@ static void set_results(PN_NODE* tree, unsigned int k, unsigned int* len_moves,
 	}
 }
 
-uint32 walk_tree(typePOS* POS, PN_NODE* tree);
-uint32 expand_node(typePOS* POS, PN_NODE* tree, uint32 node, uint32 next);
+void ll_set_num_threads(ll_context_t* ctx, unsigned int num_threads)
+{
+	ctx->num_threads = num_threads < 1 ? 1 : num_threads > LL_MAX_THREADS ? LL_MAX_THREADS : num_threads;
+}
+
+static boolean search_finished(const ll_context_t* ctx)
+{
+	const PN_NODE* tree = ctx->searchTree;
+	return ctx->num_nodes >= ctx->max_nodes
+	    || ctx->tree_exhausted
+	    || tree[1].size >= BILLION
+	    || !tree[1].bad || !tree[1].good
+	    || (tree[1].bad == MY_INFoo && tree[1].good == MY_INFoo)
+	    || ctx->max_nodes > ctx->search_nodes;
+}
+
+static void restore_root(const ll_context_t* ctx, typePOS* POS)
+{
+	typeDYNAMIC* dyn_root = POS->DYN_ROOT;
+	memcpy(POS, ctx->ROOT, sizeof(typePOS));
+	POS->DYN_ROOT = dyn_root;
+	POS->DYN = dyn_root + (ctx->ROOT->DYN - ctx->ROOT->DYN_ROOT);
+	memcpy(POS->DYN, ctx->DYN, sizeof(typeDYNAMIC));
+}
+
+// Expands the most proving nodes until the step is done. The tree is only walked and updated under
+// the lock; the moves and TBs of the leaf are evaluated outside of it while the leaf is marked busy.
+// Its virtual value makes the other threads pick the next most proving nodes meanwhile.
+static void search_worker(void* arg)
+{
+	WORKER* W = (WORKER*)arg;
+	ll_context_t* ctx = W->ctx;
+	typePOS* POS = W->POS;
+	PN_NODE* tree = ctx->searchTree;
+	uint32 node, good, bad;
+	int u;
+	ll_lock(ctx->tree_lock);
+	while (!ctx->stop_search)
+	{
+		if (search_finished(ctx))
+		{
+			if (!ctx->num_busy) // otherwise the root can have a virtual value
+				break;
+			ll_unlock(ctx->tree_lock);
+			ll_yield();
+			ll_lock(ctx->tree_lock);
+			continue;
+		}
+		restore_root(ctx, POS);
+		node = walk_tree(POS, tree);
+		if (!node)
+		{
+			ctx->stop_search = TRUE;
+			break;
+		}
+		if (tree[node].flags & NODE_BUSY) // all the other leaves look worse
+		{
+			ll_unlock(ctx->tree_lock);
+			ll_yield();
+			ll_lock(ctx->tree_lock);
+			continue;
+		}
+		tree[node].flags |= NODE_BUSY;
+		ctx->num_busy++;
+		good = tree[node].good;
+		bad = tree[node].bad;
+		if (ctx->num_threads > 1)
+			set_leaf_value(tree, node, VIRTUAL_VALUE, bad);
+		ll_unlock(ctx->tree_lock);
+		u = prepare_children(POS, W->ci);
+		ll_lock(ctx->tree_lock);
+		tree[node].flags &= ~NODE_BUSY;
+		ctx->num_busy--;
+		if (ctx->NEXT_NODE + u > ctx->tree_size)
+		{
+			set_leaf_value(tree, node, good, bad);
+			ctx->tree_full = TRUE;
+			ctx->stop_search = TRUE;
+			break;
+		}
+		ctx->NEXT_NODE += commit_children(tree, POS, node, ctx->NEXT_NODE, W->ci, u);
+		ctx->num_nodes += u;
+		ctx->TB_HITS += POS->tb_hits;
+		POS->tb_hits = 0;
+	}
+	ll_unlock(ctx->tree_lock);
+}
+
+static void run_search(ll_context_t* ctx)
+{
+	WORKER* workers = MALLOC(ctx->num_threads, sizeof(WORKER));
+	void* args[LL_MAX_THREADS];
+	int depth = (int)(ctx->ROOT->DYN - ctx->ROOT->DYN_ROOT);
+	unsigned int i;
+	for (i = 0; i < ctx->num_threads; i++)
+	{
+		workers[i].POS->DYN_ROOT = MALLOC(MAX_PLY, sizeof(typeDYNAMIC));
+		memcpy(workers[i].POS->DYN_ROOT, ctx->RPOS->DYN_ROOT, (depth + 1) * sizeof(typeDYNAMIC)); // for repetitions
+		workers[i].ctx = ctx;
+		args[i] = workers + i;
+	}
+	while (TRUE)
+	{
+		ctx->stop_search = FALSE;
+		ctx->tree_full = FALSE;
+		ctx->num_busy = 0;
+		ll_run_threads(search_worker, args, ctx->num_threads);
+		if (!ctx->tree_full)
+			break;
+		ctx->NEXT_NODE = reclaim_solved(ctx->searchTree, ctx->RPOS, ctx->NEXT_NODE);
+		if (ctx->tree_size - ctx->NEXT_NODE < ctx->tree_size / 16) // not worth going on
+		{
+			ctx->tree_exhausted = TRUE;
+			break;
+		}
+	}
+	for (i = 0; i < ctx->num_threads; i++)
+		free(workers[i].POS->DYN_ROOT);
+	free(workers);
+}
 
-void ll_do_search(unsigned int* len_moves, MoveRes* move_res, unsigned int max_moves,
+void ll_do_search(ll_context_t* ctx, unsigned int* len_moves, MoveRes* move_res, unsigned int max_moves,
                   unsigned long long* tb_hits, unsigned int* len_main_line, unsigned short* main_line)
 {
 	// Info about the parent node is added to move_res[*len_moves]
-	PN_NODE* tree = searchTree;
-	typePOS* POS = RPOS;
-	uint32 node;
+	PN_NODE* tree = ctx->searchTree;
+	typePOS* POS = ctx->RPOS;
 	uint16 ml[256];
 	uint32 n;
 	uint32 k;
-	if (!searchInitialized)
+	if (!tree)
 	{
-		NEXT_NODE = 1;
-		max_nodes = 0;
-		memcpy(ROOT, POS, sizeof(typePOS));
-		memcpy(DYN, POS->DYN, sizeof(typeDYNAMIC));
+		*len_moves = 0;
+		*tb_hits = 0;
+		*len_main_line = 0;
+		return;
+	}
+	if (!ctx->searchInitialized)
+	{
+		ctx->NEXT_NODE = 1;
+		ctx->max_nodes = 0;
+		ctx->tree_exhausted = FALSE;
+		memcpy(ctx->ROOT, POS, sizeof(typePOS));
+		memcpy(ctx->DYN, POS->DYN, sizeof(typeDYNAMIC));
 		tree[0].trans = 0;
 		tree[1].move = 0;
 		tree[1].child = tree[1].parent = tree[1].size = 0;
 		tree[1].trans = 1;
 		tree[1].loop = 0;
+		tree[1].flags = 0;
 		tree[1].bad = 1;
 		tree[1].good = GenMoves(POS, ml);
-		NEXT_NODE++;
+		ctx->NEXT_NODE++;
+		ctx->num_nodes = ctx->NEXT_NODE;
 		if (!tree[1].good)
 		{
 			tree[1].good = MY_INFoo;
 			tree[1].bad = 0;
 		}
-		TB_HITS = 0;
+		ctx->TB_HITS = 0;
 		POS->tb_hits = 0;
 		tree[0].killer = tree[1].killer = 0;
-		searchInitialized = TRUE;
-	}
-	max_nodes += search_step;
-	while (NEXT_NODE < max_nodes 
-	       && tree[1].size < BILLION
-	       && tree[1].bad && tree[1].good
-	       && (tree[1].bad != MY_INFoo || tree[1].good != MY_INFoo)
-	       && max_nodes <= search_nodes)
-	{
-		memcpy(POS, ROOT, sizeof(typePOS));
-		memcpy(POS->DYN, DYN, sizeof(typeDYNAMIC));
-		node = walk_tree(POS, tree);
-		if (!node)
-			break;
-		NEXT_NODE += expand_node(POS, tree, node, NEXT_NODE);
-		TB_HITS += POS->tb_hits;
-		POS->tb_hits = 0;
+		ctx->searchInitialized = TRUE;
 	}
-	memcpy(POS, ROOT, sizeof(typePOS));
-	memcpy(POS->DYN, DYN, sizeof(typeDYNAMIC));
+	ctx->max_nodes += ctx->search_step;
+	if (!search_finished(ctx))
+		run_search(ctx);
 	final_sort_children(tree, 1);
 
 	k = tree[1].child;
 	set_results(tree, k, len_moves, move_res, max_moves);
-	*tb_hits = TB_HITS;
+	*tb_hits = ctx->TB_HITS;
 	set_move_eval(tree + 1, move_res + *len_moves);
-	move_res[*len_moves].size = NEXT_NODE;
+	move_res[*len_moves].size = ctx->num_nodes;
 
 	*len_main_line = 0;
 	n = 1;
@@ -316,27 +516,27 @@ void ll_do_search(unsigned int* len_moves, MoveRes* move_res, unsigned int max_m
 		n = k;
 	}
 
-	tree[0].size = NEXT_NODE;
+	tree[0].size = ctx->NEXT_NODE;
 }
 
-int ll_has_results()
+int ll_has_results(const ll_context_t* ctx)
 {
-	if (!llInitialized || !searchInitialized)
+	if (!ctx || !ctx->searchInitialized)
 		return FALSE;
-	if (!searchTree || !searchTree[1].child)
+	if (!ctx->searchTree || !ctx->searchTree[1].child)
 		return FALSE;
 	return TRUE;
 }
 
-void ll_get_results(unsigned int* len_moves, MoveRes* move_res, unsigned int max_moves,
+void ll_get_results(const ll_context_t* ctx, unsigned int* len_moves, MoveRes* move_res, unsigned int max_moves,
                     const unsigned short* moves, unsigned int num_moves)
 {
 	unsigned int i;
 	uint32 k;
-	PN_NODE* tree = searchTree;
+	PN_NODE* tree = ctx->searchTree;
 
 	*len_moves = 0;
-	if (!ll_has_results() || num_moves >= MAX_PLY)
+	if (!ll_has_results(ctx) || num_moves >= MAX_PLY)
 		return;
 
 	k = tree[1].child;
@@ -357,14 +557,14 @@ void ll_get_results(unsigned int* len_moves, MoveRes* move_res, unsigned int max
 	set_results(tree, k, len_moves, move_res, max_moves);
 }
 
-void ll_clear_data()
+void ll_clear_data(ll_context_t* ctx)
 {
-	if (searchTree) {
-		free(searchTree);
-		searchTree = NULL;
+	if (ctx->searchTree) {
+		free(ctx->searchTree);
+		ctx->searchTree = NULL;
 	}
-	if (RPOS->ZTAB) {
-		free(RPOS->ZTAB);
-		RPOS->ZTAB = NULL;
+	if (ctx->RPOS->ZTAB) {
+		free(ctx->RPOS->ZTAB);
+		ctx->RPOS->ZTAB = NULL;
 	}
 }
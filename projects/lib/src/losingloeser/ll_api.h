@@ -2,17 +2,30 @@
 #define _LL_API_H_
 
 #define LL_NULL_MOVE 0xfedc
+#define LL_ERROR_RAM -4 // the memory budget of the context cannot hold a search step, or the allocation failed
 
 typedef struct { unsigned short move; unsigned int size; short eval; } MoveRes;
 
-unsigned long long ll_required_ram(unsigned int total_nodes);
-int ll_init_search(unsigned int total_nodes, unsigned int step_nodes,
+// All the state of a search; the contexts are independent, so several searches can run side by side.
+// A context itself must not be used by several threads at once.
+typedef struct LL_CONTEXT ll_context_t;
+
+// max_ram is 0 if unlimited. If a search needs more, its tree is smaller and reclaims the solved subtrees when full.
+// Reclaiming keeps the main line of a solved root move, but the main line of an unsolved one stops at the first
+// solved node whose subtree was reclaimed.
+ll_context_t* ll_new_context(unsigned long long max_ram); // NULL on failure
+void ll_free_context(ll_context_t* ctx);
+void ll_set_max_ram(ll_context_t* ctx, unsigned long long max_ram);
+void ll_set_num_threads(ll_context_t* ctx, unsigned int num_threads); // for the next searches, 1 by default
+
+unsigned long long ll_required_ram(const ll_context_t* ctx, unsigned int total_nodes);
+int ll_init_search(ll_context_t* ctx, unsigned int total_nodes, unsigned int step_nodes,
                    const unsigned short* moves, unsigned int num_moves);
-void ll_do_search(unsigned int* len_moves, MoveRes* move_res, unsigned int max_moves,
+void ll_do_search(ll_context_t* ctx, unsigned int* len_moves, MoveRes* move_res, unsigned int max_moves,
                   unsigned long long* tb_hits, unsigned int* len_main_line, unsigned short* main_line);
-int ll_has_results();
-void ll_get_results(unsigned int* len_moves, MoveRes* move_res, unsigned int max_moves,
+int ll_has_results(const ll_context_t* ctx);
+void ll_get_results(const ll_context_t* ctx, unsigned int* len_moves, MoveRes* move_res, unsigned int max_moves,
                     const unsigned short* moves, unsigned int num_moves);
-void ll_clear_data();
+void ll_clear_data(ll_context_t* ctx);
 
 #endif
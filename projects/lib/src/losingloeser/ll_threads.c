@@ -0,0 +1,150 @@
+#include "ll_threads.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+struct LL_LOCK { SRWLOCK srw; };
+
+LL_LOCK* ll_lock_new()
+{
+	LL_LOCK* lock = malloc(sizeof(LL_LOCK));
+	if (lock)
+		InitializeSRWLock(&lock->srw);
+	return lock;
+}
+
+void ll_lock_free(LL_LOCK* lock)
+{
+	free(lock);
+}
+
+void ll_lock(LL_LOCK* lock)
+{
+	AcquireSRWLockExclusive(&lock->srw);
+}
+
+void ll_unlock(LL_LOCK* lock)
+{
+	ReleaseSRWLockExclusive(&lock->srw);
+}
+
+void ll_yield()
+{
+	SwitchToThread();
+}
+
+static BOOL CALLBACK once_main(PINIT_ONCE once, PVOID init, PVOID* context)
+{
+	((void (*)())init)();
+	return TRUE;
+}
+
+void ll_once(void (*init)())
+{
+	static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+	InitOnceExecuteOnce(&once, once_main, (PVOID)init, NULL);
+}
+
+typedef struct { void (*worker)(void*); void* arg; } THREAD_ARG;
+
+static DWORD WINAPI thread_main(LPVOID p)
+{
+	THREAD_ARG* a = (THREAD_ARG*)p;
+	a->worker(a->arg);
+	return 0;
+}
+
+void ll_run_threads(void (*worker)(void*), void** args, int num_threads)
+{
+	HANDLE threads[64];
+	THREAD_ARG thread_args[64];
+	int i;
+	int n = 0;
+	for (i = 1; i < num_threads && n < 64; i++)
+	{
+		thread_args[n].worker = worker;
+		thread_args[n].arg = args[i];
+		threads[n] = CreateThread(NULL, 0, thread_main, &thread_args[n], 0, NULL);
+		if (threads[n])
+			n++;
+	}
+	worker(args[0]);
+	for (i = 0; i < n; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+}
+
+#else
+#include <pthread.h>
+#include <sched.h>
+
+struct LL_LOCK { pthread_mutex_t mutex; };
+
+LL_LOCK* ll_lock_new()
+{
+	LL_LOCK* lock = malloc(sizeof(LL_LOCK));
+	if (lock)
+		pthread_mutex_init(&lock->mutex, NULL);
+	return lock;
+}
+
+void ll_lock_free(LL_LOCK* lock)
+{
+	if (!lock)
+		return;
+	pthread_mutex_destroy(&lock->mutex);
+	free(lock);
+}
+
+void ll_lock(LL_LOCK* lock)
+{
+	pthread_mutex_lock(&lock->mutex);
+}
+
+void ll_unlock(LL_LOCK* lock)
+{
+	pthread_mutex_unlock(&lock->mutex);
+}
+
+void ll_yield()
+{
+	sched_yield();
+}
+
+void ll_once(void (*init)())
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, init);
+}
+
+typedef struct { void (*worker)(void*); void* arg; } THREAD_ARG;
+
+static void* thread_main(void* p)
+{
+	THREAD_ARG* a = (THREAD_ARG*)p;
+	a->worker(a->arg);
+	return NULL;
+}
+
+void ll_run_threads(void (*worker)(void*), void** args, int num_threads)
+{
+	pthread_t threads[64];
+	THREAD_ARG thread_args[64];
+	int i;
+	int n = 0;
+	for (i = 1; i < num_threads && n < 64; i++)
+	{
+		thread_args[n].worker = worker;
+		thread_args[n].arg = args[i];
+		if (pthread_create(&threads[n], NULL, thread_main, &thread_args[n]) == 0)
+			n++;
+	}
+	worker(args[0]);
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+}
+#endif
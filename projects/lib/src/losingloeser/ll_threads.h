@@ -0,0 +1,19 @@
+#ifndef _LL_THREADS_H_
+#define _LL_THREADS_H_
+
+// Minimal portable threads for the parallel search; kept apart from losing.h so that
+// the system headers don't meet its macros
+
+typedef struct LL_LOCK LL_LOCK;
+
+LL_LOCK* ll_lock_new();
+void ll_lock_free(LL_LOCK* lock);
+void ll_lock(LL_LOCK* lock);
+void ll_unlock(LL_LOCK* lock);
+void ll_yield();
+void ll_once(void (*init)()); // the first call runs init, the others wait for it
+
+// Runs worker(args[i]) for each i in its own thread (args[0] in the calling one) and waits for all of them
+void ll_run_threads(void (*worker)(void*), void** args, int num_threads);
+
+#endif
@@ -179,7 +179,6 @@ typedef struct
 #define BILLION 1000000000
 
 //extern double TIME_LIMIT; // should make a local arg to pn_search()
-extern int HASH_MASK; // sort of a place holder with SEARCH_SIZE ?
 
 typedef struct { uint64 key; uint32 node; } HASH;
 
@@ -194,6 +193,7 @@ struct TP
 	typeDYNAMIC* DYN;
 	typeDYNAMIC* DYN_ROOT;
 	HASH* ZTAB;
+	uint32 HASH_MASK;
 };
 typedef struct TP typePOS;
 
@@ -210,10 +210,9 @@ typedef struct
 	uint16 move;
 	uint8 killer;
 	uint8 flags;
-	float rat;
-	uint64 hash;
-} PN_NODE;
-// flags: 1 is TB5, 4 is trans result, 16 is wtm, 64 is exterior result
+} PN_NODE; // 36 bytes, the nodes of a solved subtree are reclaimed when the tree is full
+// flags: 1 is TB5, 4 is trans result, 16 is wtm, 64 is exterior result, 128 is being expanded
+#define NODE_BUSY 128
 // 64 is not currently used, 1 can also be used by other protocols (TB6)
 // could add a flag for user-specified result - flaky if the node has a child
 
@@ -230,9 +229,28 @@ void Validate(typePOS* POS); // sanity
 
 // pn_search.c -- tree can be NULL
 void pn_search(PN_NODE* tree, typePOS* POS, uint32 max_nodes, boolean SILENT);
+typedef struct
+{
+	uint64 hash;
+	uint32 good;
+	uint32 bad;
+	uint16 move;
+	uint8 flags;
+} CHILD_INFO; // a child evaluated by prepare_children() but not in the tree yet
+#define CHILD_HASHED 1 // the child is stored in the hash
+#define CHILD_PROBED 2 // ... and can be a transposition of a stored one (rev is 0)
+uint32 walk_tree(typePOS* POS, PN_NODE* tree);
+uint32 expand_node(typePOS* POS, PN_NODE* tree, uint32 node, uint32 next); // prepare + commit
+int prepare_children(typePOS* POS, CHILD_INFO* ci); // doesn't touch the tree, can run in parallel
+uint32 commit_children(PN_NODE* tree, typePOS* POS, uint32 node, uint32 next, const CHILD_INFO* ci, int u);
+void set_leaf_value(PN_NODE* tree, uint32 node, uint32 good, uint32 bad); // and backtracks it
+
+// pn_reclaim.c
+#define IS_SOLVED(N) (!(N)->good || !(N)->bad || ((N)->good == MY_INFoo && (N)->bad == MY_INFoo))
+uint64 reclaim_memory(uint32 tree_size); // for reclaim_solved()
+uint32 reclaim_solved(PN_NODE* tree, typePOS* POS, uint32 next); // returns the new next node
 
 // pn_sort.c // most of these have variants in cluster_master and others
-void ratio_sort_children(PN_NODE* tree, uint32 node);
 void final_sort_children(PN_NODE* tree, uint32 node);
 void sort_children(PN_NODE* tree, uint32 node);
 void ensure_first_child(PN_NODE* tree, uint32 node);
@@ -0,0 +1,132 @@
+#include "losing.h"
+
+// The children of a solved node are never walked again, so when the tree is full, they are dropped
+// and the remaining nodes are slid down. The children of the root and the first-child chain of the
+// solved root moves (their main line) are kept. The order of the nodes is kept, so a parent still comes
+// before its children, and the new index of a node is the number of the kept nodes before it.
+
+typedef struct
+{
+	uint64* bits; // kept nodes
+	uint32* rank; // number of the kept nodes before each word of bits
+} LIVE_MAP;
+
+#define IS_LIVE(L, n) (((L)->bits[(n) >> 6] >> ((n) & 63)) & 1)
+
+static uint32 new_index(const LIVE_MAP* L, uint32 n)
+{
+	return L->rank[n >> 6] + (uint32)POPCNT(L->bits[n >> 6] & ((1ULL << (n & 63)) - 1));
+}
+
+uint64 reclaim_memory(uint32 tree_size)
+{
+	uint64 num_words = tree_size / 64 + 1;
+	return num_words * (sizeof(uint64) + sizeof(uint32));
+}
+
+uint32 reclaim_solved(PN_NODE* tree, typePOS* POS, uint32 next)
+{
+	LIVE_MAP L[1];
+	uint32 num_words = next / 64 + 1;
+	uint32 n, k, prev, num_live;
+	uint32 i;
+	L->bits = CALLOC(num_words, sizeof(uint64));
+	L->rank = CALLOC(num_words, sizeof(uint32));
+	if (!L->bits || !L->rank)
+	{
+		free(L->bits);
+		free(L->rank);
+		return next;
+	}
+	memset(L->bits, 0, num_words * sizeof(uint64));
+	L->bits[0] = 3; // the sentinel and the root
+	for (n = tree[1].child; n; n = tree[n].sibling)
+	{
+		if (!IS_SOLVED(tree + n))
+			continue;
+		for (k = tree[n].child; k && k < next; k = tree[k].child)
+			L->bits[k >> 6] |= 1ULL << (k & 63);
+	}
+	for (n = 2; n < next; n++)
+	{
+		uint32 p = tree[n].parent;
+		if (IS_LIVE(L, p) && (p == 1 || !IS_SOLVED(tree + p)))
+			L->bits[n >> 6] |= 1ULL << (n & 63);
+	}
+	num_live = 0;
+	for (i = 0; i < num_words; i++)
+	{
+		L->rank[i] = num_live;
+		num_live += (uint32)POPCNT(L->bits[i]);
+	}
+	if (num_live == next)
+	{
+		free(L->bits);
+		free(L->rank);
+		return next;
+	}
+
+	// Transpositions: a kept node whose position was expanded in a dropped subtree becomes a leaf
+	// with the last values; the rings of the kept positions skip the dropped nodes
+	for (n = 2; n < next; n++)
+	{
+		if (!IS_LIVE(L, n))
+			continue;
+		k = tree[n].trans;
+		if (k != n && !IS_LIVE(L, k))
+		{
+			tree[n].trans = n;
+			tree[n].loop = 0;
+		}
+	}
+	for (n = 1; n < next; n++)
+	{
+		if (!IS_LIVE(L, n) || tree[n].trans != n || !tree[n].loop)
+			continue;
+		prev = n;
+		k = tree[n].loop;
+		while (k != n)
+		{
+			uint32 m = tree[k].loop;
+			if (IS_LIVE(L, k) && tree[k].trans == n)
+			{
+				tree[prev].loop = k;
+				prev = k;
+			}
+			k = m;
+		}
+		tree[prev].loop = (prev == n) ? 0 : n;
+	}
+
+	for (n = 1; n < next; n++)
+	{
+		PN_NODE* N;
+		if (!IS_LIVE(L, n))
+			continue;
+		N = tree + new_index(L, n);
+		*N = tree[n];
+		N->parent = new_index(L, N->parent);
+		N->sibling = (N->sibling && IS_LIVE(L, N->sibling)) ? new_index(L, N->sibling) : 0;
+		N->child = (N->child && IS_LIVE(L, N->child)) ? new_index(L, N->child) : 0;
+		N->trans = new_index(L, N->trans);
+		N->loop = N->loop ? new_index(L, N->loop) : 0;
+	}
+
+	for (i = 0; i <= POS->HASH_MASK; i++)
+	{
+		n = POS->ZTAB[i].node;
+		if (!n)
+			continue;
+		if (n < next && IS_LIVE(L, n))
+			POS->ZTAB[i].node = new_index(L, n);
+		else
+		{
+			POS->ZTAB[i].key = 0;
+			POS->ZTAB[i].node = 0;
+		}
+	}
+
+	free(L->bits);
+	free(L->rank);
+	return num_live;
+}
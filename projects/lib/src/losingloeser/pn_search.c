@@ -71,18 +71,18 @@ static void backtrack_loop(PN_NODE* tree, uint32 node, boolean fs)
 
 ////////////////////////////////////////////////////////////////////////
 
-static uint32 hash_hit(typePOS* POS)
+static uint32 hash_hit(const typePOS* POS, uint64 hash)
 {
-	uint32 k = POSITION->DYN->HASH & HASH_MASK; // return 0;
-	if (POS->DYN->rev || POS->ZTAB[k].key != POS->DYN->HASH)
+	uint32 k = hash & POS->HASH_MASK; // return 0;
+	if (POS->ZTAB[k].key != hash)
 		return 0;
 	return POS->ZTAB[k].node;
 }
 
-static void new_hash(uint32 node, typePOS* POS)
+static void new_hash(typePOS* POS, uint64 hash, uint32 node)
 {
-	uint32 k = POS->DYN->HASH & HASH_MASK;
-	POS->ZTAB[k].key = POS->DYN->HASH;
+	uint32 k = hash & POS->HASH_MASK;
+	POS->ZTAB[k].key = hash;
 	POS->ZTAB[k].node = node;
 }
 
@@ -92,76 +92,52 @@ static void new_hash(uint32 node, typePOS* POS)
 #define USE_OPP_BISHOP
 #define WHITE_MUST_WIN TRUE
 
-uint32 expand_node(typePOS* POS, PN_NODE* tree, uint32 node, uint32 next)
+static void must_win_adjust(uint32* good, uint32* bad, boolean wtm)
+{
+	if (WHITE_MUST_WIN)
+	{
+		if (!wtm && *bad == MY_INFoo)
+			*good = 0;
+		if (wtm && *good == MY_INFoo)
+			*bad = 0;
+	}
+}
+
+// Generates and evaluates the children of the current position without touching the tree,
+// so that several threads can do it at once; the transpositions are resolved in commit_children()
+int prepare_children(typePOS* POS, CHILD_INFO* ci)
 {
 	uint16 ml[256], mm[256];
 	int i, v;
 	int u = GenMoves(POS, ml);
-	uint32 k;
 	uint8 va;
-#if 0 // joint rules
-	if (!u) // stalemate, combines FICS and International rules,
-		// only a White win if POS->wtm and wc<bc
-	{
-		int wc = POPCNT(wBitboardOcc);
-		int bc = POPCNT(bBitboardOcc);
-		if (POS->wtm && wc < bc)
-		{ 
-			tree[node].bad = 0;
-			tree[node].good = MY_INFoo;
-		}
-		else if (POS->wtm && wc >= bc)
-		{
-			tree[node].good = 0;
-			tree[node].bad = MY_INFoo;
-		}
-		else if (!POS->wtm)
-		{
-			tree[node].bad = 0;
-			tree[node].good = MY_INFoo;
-		}
-		goto BACK_TRACK;
-	}
-#else // International only
-	if (!u)
-	{
-		tree[node].bad = 0;
-		tree[node].good = MY_INFoo;
-		goto BACK_TRACK;
-	}
-#endif
-	tree[node].child = next;
 	for (i = 0; i < u; i++)
 	{
-		tree[next + i].bad = 1;
-		tree[next + i].move = ml[i];
-		tree[next + i].killer = 0;
-		tree[next + i].loop = 0;
-		tree[next + i].trans = next + i;
-		tree[next + i].parent = node;
-		tree[next + i].child = tree[next + i].size = 0;
+		ci[i].move = ml[i];
+		ci[i].flags = 0;
+		ci[i].bad = 1;
 		if (!MakeMove(POS, ml[i])) // causes a repetition
 		{
-			tree[next + i].good = MY_INFoo;
-			tree[next + i].bad = MY_INFoo;
+			ci[i].good = MY_INFoo;
+			ci[i].bad = MY_INFoo;
 			goto SIBLINGS;
 		}
 		if (POPCNT(wBitboardOcc | bBitboardOcc) <= 4 && Get_TB_Score(POS, &va, TRUE))
 		{
 			if (va == 1)
 			{
-				tree[next + i].good = MY_INFoo;
-				tree[next + i].bad = 0;
+				ci[i].good = MY_INFoo;
+				ci[i].bad = 0;
 			}
 			else if (va == 2)
 			{
-				tree[next + i].good = MY_INFoo;
-				tree[next + i].bad = MY_INFoo;
+				ci[i].good = MY_INFoo;
+				ci[i].bad = MY_INFoo;
 			}
 			else if (va == 3)
 			{
-				tree[next + i].good = 0;
-				tree[next + i].bad = MY_INFoo;
+				ci[i].good = 0;
+				ci[i].bad = MY_INFoo;
 			}
 			POS->tb_hits++;
 			UnmakeMove(POS, ml[i], TRUE);
@@ -169,20 +145,11 @@ uint32 expand_node(typePOS* POS, PN_NODE* tree, uint32 node, uint32 next)
 		}
 		v = GenMoves(POS, mm);
 		if (POS->DYN->rev == 0 || (v && POS->sq[TO(mm[v - 1])])) // ep in rev
-		{
-			if ((k = hash_hit(POS)))                       // every move is cap [or pawn]
-			{
-				tree[next + i].trans = k;
-				tree[next + i].loop = tree[k].loop ? tree[k].loop : k;
-				tree[k].loop = next + i;
-				tree[next + i].good = tree[k].good;
-				tree[next + i].bad = tree[k].bad;
-				UnmakeMove(POS, ml[i], TRUE);
-				goto SIBLINGS;
-			}
-			else new_hash(next + i, POS);
+		{                                                     // every move is cap [or pawn]
+			ci[i].flags = CHILD_HASHED | (POS->DYN->rev == 0 ? CHILD_PROBED : 0);
+			ci[i].hash = POS->DYN->HASH;
 		}
-		tree[next + i].good = v; // corrected below if 0, .bad=1 from above
+		ci[i].good = v; // corrected below if 0, .bad=1 from above
 #define BLACK_SQUARES 0xaa55aa55aa55aa55
 #define WHITE_SQUARES 0x55aa55aa55aa55aa
 		if (wBitboardOcc == wBitboardB && !WHITE_MUST_WIN)
@@ -191,9 +158,9 @@ uint32 expand_node(typePOS* POS, PN_NODE* tree, uint32 node, uint32 next)
 				((!(wBitboardB & WHITE_SQUARES) && bBitboardB & WHITE_SQUARES)))
 			{
 				if (POS->wtm)
-					tree[next + i].good = MY_INFoo;
+					ci[i].good = MY_INFoo;
 				else
-					tree[next + i].bad = MY_INFoo;
+					ci[i].bad = MY_INFoo;
 			}
 		}
 		if (bBitboardOcc == bBitboardB)
@@ -202,9 +169,9 @@ uint32 expand_node(typePOS* POS, PN_NODE* tree, uint32 node, uint32 next)
 				((!(bBitboardB & WHITE_SQUARES) && wBitboardB & WHITE_SQUARES)))
 			{
 				if (POS->wtm)
-					tree[next + i].bad = MY_INFoo;
+					ci[i].bad = MY_INFoo;
 				else
-					tree[next + i].good = MY_INFoo;
+					ci[i].good = MY_INFoo;
 			}
 		}
 #if 0 // combined rules
@@ -214,35 +181,69 @@ uint32 expand_node(typePOS* POS, PN_NODE* tree, uint32 node, uint32 next)
 			int bc = POPCNT(bBitboardOcc);
 			if (POS->wtm && wc < bc)
 			{
-				tree[next + i].bad = 0;
-				tree[next + i].good = MY_INFoo;
+				ci[i].bad = 0;
+				ci[i].good = MY_INFoo;
 			}
 			if (POS->wtm && wc >= bc)
 			{
-				tree[next + i].good = 0;
-				tree[next + i].bad = MY_INFoo;
+				ci[i].good = 0;
+				ci[i].bad = MY_INFoo;
 			}
 			if (!POS->wtm)
 			{
-				tree[next + i].bad = 0;
-				tree[next + i].good = MY_INFoo;
+				ci[i].bad = 0;
+				ci[i].good = MY_INFoo;
 			}
 		}
 #else // International only
 		if (!v)
 		{
-			tree[next + i].good = MY_INFoo;
-			tree[next + i].bad = 0;
+			ci[i].good = MY_INFoo;
+			ci[i].bad = 0;
 		}
 #endif
 		UnmakeMove(POS, ml[i], TRUE); // after oppB check
 	SIBLINGS:
-		if (WHITE_MUST_WIN)
+		must_win_adjust(&ci[i].good, &ci[i].bad, POS->wtm);
+	}
+	return u;
+}
+
+// Links the prepared children to the node, POS is at the node
+uint32 commit_children(PN_NODE* tree, typePOS* POS, uint32 node, uint32 next, const CHILD_INFO* ci, int u)
+{
+	int i;
+	uint32 k;
+	if (!u) // stalemate, International rules only
+	{
+		tree[node].bad = 0;
+		tree[node].good = MY_INFoo;
+		goto BACK_TRACK;
+	}
+	tree[node].child = next;
+	for (i = 0; i < u; i++)
+	{
+		tree[next + i].good = ci[i].good;
+		tree[next + i].bad = ci[i].bad;
+		tree[next + i].move = ci[i].move;
+		tree[next + i].killer = 0;
+		tree[next + i].flags = 0;
+		tree[next + i].loop = 0;
+		tree[next + i].trans = next + i;
+		tree[next + i].parent = node;
+		tree[next + i].child = tree[next + i].size = 0;
+		if (ci[i].flags & CHILD_HASHED)
 		{
-			if (!POS->wtm && tree[next + i].bad == MY_INFoo)
-				tree[next + i].good = 0;
-			if (POS->wtm && tree[next + i].good == MY_INFoo)
-				tree[next + i].bad = 0;
+			if ((ci[i].flags & CHILD_PROBED) && (k = hash_hit(POS, ci[i].hash)))
+			{
+				tree[next + i].trans = k;
+				tree[next + i].loop = tree[k].loop ? tree[k].loop : k;
+				tree[k].loop = next + i;
+				tree[next + i].good = tree[k].good;
+				tree[next + i].bad = tree[k].bad;
+				must_win_adjust(&tree[next + i].good, &tree[next + i].bad, POS->wtm);
+			}
+			else new_hash(POS, ci[i].hash, next + i);
 		}
 		if (i != (u - 1))
 			tree[next + i].sibling = next + i + 1;
@@ -259,6 +260,20 @@ BACK_TRACK:
 	return u;
 }
 
+void set_leaf_value(PN_NODE* tree, uint32 node, uint32 good, uint32 bad)
+{
+	tree[node].good = good;
+	tree[node].bad = bad;
+	backtrack_loop(tree, node, FALSE);
+}
+
+uint32 expand_node(typePOS* POS, PN_NODE* tree, uint32 node, uint32 next)
+{
+	CHILD_INFO ci[256];
+	int u = prepare_children(POS, ci);
+	return commit_children(tree, POS, node, next, ci, u);
+}
+
 /*
 static void info_node (PN_NODE *tree,uint32 n,boolean verbose)
 {uint32 k=tree[n].child; char A[8];
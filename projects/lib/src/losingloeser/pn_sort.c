@@ -1,46 +1,6 @@
 
 #include "losing.h"
 
-typedef struct {float rat; uint32 n;} RSORTER;
-
-static int ratio_sort_compare(const void* x, const void* y)
-{
-	RSORTER A = *((RSORTER*)x);
-	RSORTER B = *((RSORTER*)y);
-	if (A.rat > B.rat)
-		return 1;
-	if (A.rat < B.rat)
-		return -1;
-	return 0;
-}
-
-void ratio_sort_children(PN_NODE* tree, uint32 node)
-{
-	RSORTER S[256];
-	int i;
-	int u = 0;
-	uint32 n = tree[node].child;
-	S[u].rat = tree[n].rat;
-	S[u++].n = n;
-	while (tree[n].sibling)
-	{
-		n = tree[n].sibling;
-		S[u].rat = tree[n].rat;
-		S[u++].n = n;
-	}
-	qsort(S, u, sizeof(RSORTER), ratio_sort_compare);
-	n = S[0].n;
-	tree[node].child = S[0].n;
-	for (i = 1; i < u; i++)
-	{
-		tree[n].sibling = S[i].n;
-		n = S[i].n;
-	}
-	tree[n].sibling = 0;
-}
-
-////////////////////////////////////////////////////////////////////////
-
 typedef struct {uint32 n,good,bad,size;} FSORTER;
 
 static int fsort_compare(const void* x, const void* y) // decreasing bad
@@ -24,6 +24,26 @@
 #include "pgngame.h"
 #include "pgnstream.h"
 #include "mersenne.h"
+#include <algorithm>
+#include <numeric>
+#include <mutex>
+
+
+namespace {
+
+// Number of rows read from disk at once
+const qint64 DiskBlockRows = 256;
+// Maximum number of keys in the sparse index of a Disk mode book
+const qint64 MaxIndexSize = 16384;
+
+} // anonymous namespace
+
+struct OpeningBook::DiskBlock
+{
+	qint64 first = 0;
+	qint64 rows = 0;
+	QByteArray data;
+};
 
 
 QDataStream& operator>>(QDataStream& in, OpeningBook* book)
@@ -82,7 +102,11 @@ Chess::GenericMove OpeningBook::Entry::move() const
 }
 
 OpeningBook::OpeningBook(AccessMode mode)
-	: m_mode(mode)
+	: m_mode(mode),
+	  m_fileMutex(std::make_shared<std::mutex>()),
+	  m_data(nullptr),
+	  m_size(0),
+	  m_indexStep(DiskBlockRows)
 {
 }
 
@@ -90,9 +114,18 @@ OpeningBook::~OpeningBook()
 {
 }
 
+OpeningBook::AccessMode OpeningBook::accessMode() const
+{
+	return m_mode;
+}
+
 bool OpeningBook::read(const QString& filename)
 {
 	m_filename = filename;
+	m_data = nullptr;
+	m_size = 0;
+	m_file.reset();
+	m_index.clear();
 	QFile file(filename);
 	if (!file.open(QIODevice::ReadOnly))
 		return false;
@@ -105,7 +138,36 @@ bool OpeningBook::read(const QString& filename)
 	}
 
 	if (m_mode == Disk)
+	{
+		m_size = file.size();
+		m_file = std::make_shared<QFile>(filename);
+		if (!m_file->open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+		{
+			m_file.reset();
+			return false;
+		}
+		buildIndex();
 		return true;
+	}
+
+	if (m_mode == Mmap)
+	{
+		m_size = file.size();
+		if (m_size == 0)
+			return true;
+		m_file = std::make_shared<QFile>(filename);
+		if (m_file->open(QIODevice::ReadOnly))
+			m_data = m_file->map(0, m_size);
+		if (m_data)
+			return true;
+
+		// The mapping can fail e.g. if the address space is exhausted
+		qWarning("Could not map book file %s, reading it from disk",
+			 qUtf8Printable(filename));
+		m_mode = Disk;
+		m_file.reset();
+		return read(filename);
+	}
 
 	m_map.clear();
 	QDataStream in(&file);
@@ -126,6 +188,13 @@ bool OpeningBook::write(const QString& filename) const
 	return true;
 }
 
+OpeningBook::Entry OpeningBook::readEntry(const uchar* data, quint64* key) const
+{
+	QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(data), entrySize());
+	QDataStream in(bytes);
+	return readEntry(in, key);
+}
+
 void OpeningBook::addEntry(const Entry& entry, quint64 key)
 {
 	Map::iterator it = m_map.find(key);
@@ -196,58 +265,144 @@ int OpeningBook::import(PgnStream& in, int maxMoves)
 	return moveCount;
 }
 
-QList<OpeningBook::Entry> OpeningBook::entriesFromDisk(quint64 key) const
+void OpeningBook::buildIndex()
 {
-	QList<Entry> entries;
-	QFile file(m_filename);
-	if (!file.open(QIODevice::ReadOnly))
+	qint64 n = m_size / entrySize();
+	m_indexStep = DiskBlockRows;
+	while (n / m_indexStep > MaxIndexSize)
+		m_indexStep *= 2;
+
+	// Keys of every m_indexStep-th row, so that a lookup only has to
+	// search the rows between two neighbouring samples
+	m_index.reserve(static_cast<int>((n + m_indexStep - 1) / m_indexStep));
+	QByteArray data;
+	for (qint64 row = 0; row < n; row += m_indexStep)
 	{
-		qWarning("Could not open book file %s",
+		if (!m_file->seek(row * entrySize()))
+			break;
+		data = m_file->read(entrySize());
+		if (data.size() != entrySize())
+			break;
+		quint64 key;
+		readEntry(reinterpret_cast<const uchar*>(data.constData()), &key);
+		m_index << key;
+	}
+	if (m_index.size() * m_indexStep < n)
+	{
+		qWarning("Could not index book file %s",
 			 qUtf8Printable(m_filename));
-		return entries;
+		m_index.clear();
+	}
+}
+
+const uchar* OpeningBook::rowFromDisk(qint64 row, DiskBlock& block) const
+{
+	if (row < block.first || row >= block.first + block.rows)
+	{
+		qint64 step = entrySize();
+		qint64 n = m_size / step;
+		if (!m_file || row < 0 || row >= n)
+			return nullptr;
+
+		block.first = row - row % DiskBlockRows;
+		block.rows = qMin(DiskBlockRows, n - block.first);
+		block.data.clear();
+		{
+			std::lock_guard<std::mutex> lock(*m_fileMutex);
+			if (m_file->seek(block.first * step))
+				block.data = m_file->read(block.rows * step);
+		}
+		if (block.data.size() != block.rows * step)
+		{
+			qWarning("Could not read book file %s",
+				 qUtf8Printable(m_filename));
+			block.rows = 0;
+			return nullptr;
+		}
 	}
-	QDataStream in(&file);
+
+	return reinterpret_cast<const uchar*>(block.data.constData())
+		+ (row - block.first) * entrySize();
+}
+
+qint64 OpeningBook::lowerBoundOnDisk(quint64 key, qint64 first, DiskBlock& block) const
+{
+	qint64 last = m_size / entrySize();
+
+	// Narrow the range down with the sparse index
+	if (!m_index.isEmpty())
+	{
+		auto it = std::lower_bound(m_index.cbegin(), m_index.cend(), key);
+		qint64 i = it - m_index.cbegin();
+		if (i > 0)
+			first = qMax(first, (i - 1) * m_indexStep + 1);
+		if (i < m_index.size())
+			last = qMin(last, i * m_indexStep);
+	}
+
+	// Binary search
+	quint64 entryKey = 0;
+	while (first < last)
+	{
+		qint64 middle = (first + last) / 2;
+		const uchar* row = rowFromDisk(middle, block);
+		if (!row)
+			return m_size / entrySize();
+		readEntry(row, &entryKey);
+		if (entryKey < key)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	return first;
+}
+
+QList<OpeningBook::Entry> OpeningBook::entriesFromDisk(quint64 key, qint64& pos, DiskBlock& block) const
+{
+	QList<Entry> entries;
+	pos = lowerBoundOnDisk(key, pos, block);
+
+	quint64 entryKey = 0;
+	for (qint64 i = pos; const uchar* row = rowFromDisk(i, block); i++)
+	{
+		Entry entry = readEntry(row, &entryKey);
+		if (entryKey != key)
+			break;
+		entries << entry;
+	}
+
+	return entries;
+}
+
+QList<OpeningBook::Entry> OpeningBook::entriesFromMemory(quint64 key) const
+{
+	QList<Entry> entries;
+	if (!m_data)
+		return entries;
 
 	quint64 entryKey = 0;
 	qint64 step = entrySize();
-	qint64 n = file.size() / step;
 	qint64 first = 0;
-	qint64 last = n - 1;
-	qint64 middle = (first + last) / 2;
+	qint64 last = m_size / step;
 
-	// Binary search
-	while (first <= last)
+	// Binary search for the first entry with a matching key
+	while (first < last)
 	{
-		qint64 pos = middle * step;
-		file.seek(pos);
-		Entry entry = readEntry(in, &entryKey);
+		qint64 middle = (first + last) / 2;
+		readEntry(m_data + middle * step, &entryKey);
 		if (entryKey < key)
 			first = middle + 1;
-		else if (entryKey == key)
-		{
-			entries << entry;
-			for (qint64 i = pos - step; i >= 0; i -= step)
-			{
-				file.seek(i);
-				entry = readEntry(in, &entryKey);
-				if (entryKey != key)
-					break;
-				entries << entry;
-			}
-			qint64 maxPos = (n - 1) * step;
-			for (qint64 i = pos + step; i <= maxPos; i += step)
-			{
-				file.seek(i);
-				entry = readEntry(in, &entryKey);
-				if (entryKey != key)
-					break;
-				entries << entry;
-			}
-			return entries;
-		}
 		else
-			last = middle - 1;
-		middle = (first + last) / 2;
+			last = middle;
+	}
+
+	for (qint64 pos = first * step; pos < m_size; pos += step)
+	{
+		Entry entry = readEntry(m_data + pos, &entryKey);
+		if (entryKey != key)
+			break;
+		entries << entry;
 	}
 
 	return entries;
@@ -257,7 +412,39 @@ QList<OpeningBook::Entry> OpeningBook::entries(quint64 key) const
 {
 	if (m_mode == Ram)
 		return m_map.values(key);
-	return entriesFromDisk(key);
+	if (m_mode == Mmap)
+		return entriesFromMemory(key);
+
+	DiskBlock block;
+	qint64 pos = 0;
+	return entriesFromDisk(key, pos, block);
+}
+
+QVector<QList<OpeningBook::Entry>> OpeningBook::entries(const QVector<quint64>& keys) const
+{
+	QVector<QList<Entry>> ret(keys.size());
+	if (m_mode != Disk)
+	{
+		for (int i = 0; i < keys.size(); i++)
+			ret[i] = entries(keys[i]);
+		return ret;
+	}
+
+	QVector<int> order(keys.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&keys](int a, int b)
+	{
+		return keys[a] < keys[b];
+	});
+
+	// The keys are sorted, so each search can start where the
+	// previous one stopped, and neighbouring keys share the block
+	DiskBlock block;
+	qint64 pos = 0;
+	for (int i : order)
+		ret[i] = entriesFromDisk(keys[i], pos, block);
+
+	return ret;
 }
 
 Chess::GenericMove OpeningBook::move(quint64 key) const
@@ -23,9 +23,14 @@
 
 #include <QtGlobal>
 #include <QMultiMap>
+#include <QVector>
+
+#include <memory>
+#include <mutex>
 
 
 class QString;
+class QFile;
 class QDataStream;
 class PgnGame;
 class PgnStream;
@@ -52,7 +57,8 @@ class LIB_EXPORT OpeningBook
 		enum AccessMode
 		{
 			Ram,	//!< Load the entire book to RAM
-			Disk	//!< Read moves directly from disk
+			Disk,	//!< Read moves directly from disk
+			Mmap	//!< Map the book file to memory and search it in place
 		};
 
 		/*!
@@ -120,6 +126,15 @@ class LIB_EXPORT OpeningBook
 		/*! Returns all entries matching \a key. */
 		QList<Entry> entries(quint64 key) const;
 
+		/*!
+		 * Returns the entries matching each of \a keys, in the
+		 * same order as \a keys.
+		 *
+		 * In Disk mode the keys are resolved in ascending order
+		 * in a single forward pass over the book file.
+		 */
+		QVector<QList<Entry>> entries(const QVector<quint64>& keys) const;
+
 		/*!
 		 * Reads a book from \a filename.
 		 * Returns true if successful; otherwise returns false.
@@ -132,6 +147,9 @@ class LIB_EXPORT OpeningBook
 		 */
 		bool write(const QString& filename) const;
 
+		/*! Returns the access mode of the book. */
+		AccessMode accessMode() const;
+
 
 	protected:
 		friend LIB_EXPORT QDataStream& operator>>(QDataStream& in, OpeningBook* book);
@@ -153,17 +171,38 @@ class LIB_EXPORT OpeningBook
 		 * belongs to the entry.
 		 */
 		virtual Entry readEntry(QDataStream& in, quint64* key) const = 0;
+
+		/*!
+		 * Reads a book entry from the raw bytes at \a data and returns it.
+		 *
+		 * \a data points to entrySize() bytes in the book's file format.
+		 * The default implementation wraps the bytes into a data stream
+		 * and calls readEntry().
+		 */
+		virtual Entry readEntry(const uchar* data, quint64* key) const;
 		
 		/*! Writes the key and entry pointed to by \a it, to \a out. */
 		virtual void writeEntry(const Map::const_iterator& it,
 					QDataStream& out) const = 0;
 
 	private:
-		QList<Entry> entriesFromDisk(quint64 key) const;
+		struct DiskBlock;
+
+		void buildIndex();
+		const uchar* rowFromDisk(qint64 row, DiskBlock& block) const;
+		qint64 lowerBoundOnDisk(quint64 key, qint64 first, DiskBlock& block) const;
+		QList<Entry> entriesFromDisk(quint64 key, qint64& pos, DiskBlock& block) const;
+		QList<Entry> entriesFromMemory(quint64 key) const;
 
 		AccessMode m_mode;
 		QString m_filename;
 		Map m_map;
+		std::shared_ptr<QFile> m_file;
+		std::shared_ptr<std::mutex> m_fileMutex; // seek and read of m_file by concurrent lookups
+		const uchar* m_data;
+		qint64 m_size;
+		QVector<quint64> m_index;
+		qint64 m_indexStep;
 };
 
 /*!
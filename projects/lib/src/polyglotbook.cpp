@@ -18,6 +18,7 @@
 
 #include "polyglotbook.h"
 #include <QDataStream>
+#include <QtEndian>
 
 
 PolyglotBook::PolyglotBook(AccessMode mode)
@@ -43,6 +44,16 @@ OpeningBook::Entry PolyglotBook::readEntry(QDataStream& in, quint64* key) const
 	return { pgMove, weight, learn };
 }
 
+OpeningBook::Entry PolyglotBook::readEntry(const uchar* data, quint64* key) const
+{
+	*key = qFromBigEndian<quint64>(data);
+	quint16 pgMove = qFromBigEndian<quint16>(data + 8);
+	quint16 weight = qFromBigEndian<quint16>(data + 10);
+	quint32 learn = qFromBigEndian<quint32>(data + 12);
+
+	return { pgMove, weight, learn };
+}
+
 void PolyglotBook::writeEntry(const Map::const_iterator& it,
 			      QDataStream& out) const
 {
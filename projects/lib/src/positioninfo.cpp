@@ -5,14 +5,20 @@
 #include "tb/egtb/tb_reader.h"
 #include "tb/egtb/elements.h"
 #include "tb/thread.h"
+#include "tb/movegen.h"
+#include "tb/uci.h"
 
 #include <QFileInfo>
 #include <QDir>
+#include <QSettings>
+#include <QCryptographicHash>
+#include <QDateTime>
 
 #include <set>
 #include <stdexcept>
 #include <fstream>
 #include <filesystem>
+#include <chrono>
 
 
 #ifdef WIN32
@@ -485,6 +491,14 @@ std::tuple<Line, std::shared_ptr<Chess::Board>> parse_moves(QString text, const
 	return parse_line(text, true);
 }
 
+bool update_only_move(bool is_only_move, int pv, int score)
+{
+	// The best move is the only one if every other line of the MultiPV search loses
+	if (pv == 2)
+		is_only_move = true;
+	return is_only_move && score < BAD_MOVE_SCORE;
+}
+
 int get_max_depth(int score, size_t numPieces)
 {
 	int num_pieces = static_cast<int>(numPieces);
@@ -529,6 +543,217 @@ std::tuple<std::shared_ptr<Position>, std::shared_ptr<StateInfo>> boardToPositio
 	return { pos, st };
 }
 
+namespace
+{
+	/*
+	 * Keys of the pieces, en passant squares and side to move by the squares of the Position.
+	 * They are taken from the keys of the antichess Chess::Board, so that position_key() is
+	 * the same Polyglot key as Chess::Board::key() and the keys in the books.
+	 */
+	struct PositionKeys
+	{
+		PositionKeys();
+
+		quint64 base = 0;
+		quint64 white = 0;
+		quint64 pieces[PIECE_NB][SQUARE_NB] = {};
+		quint64 enpassant[SQUARE_NB] = {};
+	};
+
+	PositionKeys::PositionKeys()
+	{
+		using Squares = map<Square, char>;
+		shared_ptr<Chess::Board> board(Chess::BoardFactory::create("antichess"));
+		auto key = [&board](const Squares& squares, char side = 'b', const string& ep = "-")
+		{
+			string fen;
+			for (int r = RANK_8; r >= RANK_1; r--)
+			{
+				int num_empty = 0;
+				for (int f = FILE_A; f <= FILE_H; f++)
+				{
+					auto it = squares.find(make_square(File(f), Rank(r)));
+					if (it == squares.end()) {
+						num_empty++;
+						continue;
+					}
+					if (num_empty)
+						fen += char('0' + num_empty);
+					fen += it->second;
+					num_empty = 0;
+				}
+				if (num_empty)
+					fen += char('0' + num_empty);
+				if (r != RANK_1)
+					fen += '/';
+			}
+			fen += string(" ") + side + " - " + ep + " 0 1";
+			bool is_ok = board->setFenString(QString::fromStdString(fen));
+			if (!is_ok)
+				throw runtime_error("Error: failed to set up " + fen);
+			return board->key();
+		};
+
+		// The reference positions are the full 2nd and 7th ranks of pawns, as an empty board isn't a valid FEN
+		Squares rank_2, rank_7;
+		for (int f = FILE_A; f <= FILE_H; f++) {
+			rank_2[make_square(File(f), RANK_2)] = 'P';
+			rank_7[make_square(File(f), RANK_7)] = 'p';
+		}
+		quint64 key_2 = key(rank_2);
+		quint64 key_7 = key(rank_7);
+		const string piece_chars = " PNBRQK  pnbrqk";
+		for (Piece pc : { W_PAWN, W_KNIGHT, W_BISHOP, W_ROOK, W_QUEEN, W_KING, B_PAWN, B_KNIGHT, B_BISHOP, B_ROOK, B_QUEEN, B_KING })
+		{
+			for (int s = SQ_A1; s <= SQ_H8; s++)
+			{
+				Rank r = rank_of(Square(s));
+				if (type_of(pc) == PAWN && (r == RANK_1 || r == RANK_8))
+					continue;
+				bool is_rank_2 = (r == RANK_2);
+				Squares squares = is_rank_2 ? rank_7 : rank_2;
+				squares[Square(s)] = piece_chars[pc];
+				pieces[pc][s] = key(squares) ^ (is_rank_2 ? key_7 : key_2);
+			}
+		}
+		base = key_2;
+		for (int f = FILE_A; f <= FILE_H; f++)
+			base ^= pieces[W_PAWN][make_square(File(f), RANK_2)];
+		white = key(rank_2, 'w') ^ key_2;
+
+		// A pawn that has just been pushed two squares and an enemy pawn next to it
+		for (int f = FILE_A; f <= FILE_H; f++)
+		{
+			File adjacent = (f == FILE_A) ? FILE_B : File(f - 1);
+			Squares squares = rank_2;
+			squares[make_square(File(f), RANK_5)] = 'p';
+			squares[make_square(adjacent, RANK_5)] = 'P';
+			Square ep = make_square(File(f), RANK_6);
+			enpassant[ep] = key(squares, 'w', UCI::square(ep)) ^ key(squares, 'w');
+			squares = rank_7;
+			squares[make_square(File(f), RANK_4)] = 'P';
+			squares[make_square(adjacent, RANK_4)] = 'p';
+			ep = make_square(File(f), RANK_3);
+			enpassant[ep] = key(squares, 'b', UCI::square(ep)) ^ key(squares, 'b');
+		}
+	}
+}
+
+quint64 position_key(const Position& pos)
+{
+	static const PositionKeys keys;
+	quint64 key = keys.base;
+	Bitboard b = pos.pieces();
+	while (b) {
+		Square s = pop_lsb(&b);
+		key ^= keys.pieces[pos.piece_on(s)][s];
+	}
+	if (pos.ep_square() != SQ_NONE)
+		key ^= keys.enpassant[pos.ep_square()];
+	if (pos.side_to_move() == WHITE)
+		key ^= keys.white;
+	return key;
+}
+
+struct PositionTracker::Ply
+{
+	Chess::Move move;
+	::Move pos_move;
+	StateInfo st;
+};
+
+PositionTracker::PositionTracker()
+	: board(nullptr)
+	, num_root_plies(0)
+	, num_plies(0)
+{}
+
+PositionTracker::~PositionTracker() = default;
+
+static ::Move to_position_move(const Position& pos, const Chess::GenericMove& move)
+{
+	Square from = make_square(File(move.sourceSquare().file()), Rank(move.sourceSquare().rank()));
+	Square to = make_square(File(move.targetSquare().file()), Rank(move.targetSquare().rank()));
+	if (move.promotion())
+		return make<PROMOTION>(from, to, PieceType(move.promotion()));
+	if (type_of(pos.piece_on(from)) == PAWN && file_of(from) != file_of(to) && pos.empty(to))
+		return make<ENPASSANT>(from, to);
+	return make_move(from, to);
+}
+
+Position& PositionTracker::sync(std::shared_ptr<Chess::Board> board)
+{
+	const auto& history = board->MoveHistory();
+	if (board.get() != this->board || !pos || history.size() < num_root_plies) {
+		reset(board);
+		return *pos;
+	}
+
+	/// Undo the moves that are no longer on the board, then make the new ones
+	size_t num_board_plies = static_cast<size_t>(history.size() - num_root_plies);
+	size_t num_common = 0;
+	while (num_common < num_plies && num_common < num_board_plies && plies[num_common]->move == history[num_root_plies + num_common].move)
+		num_common++;
+	for (; num_plies > num_common; num_plies--)
+		pos->undo_move(plies[num_plies - 1]->pos_move);
+	for (; num_plies < num_board_plies; num_plies++)
+	{
+		if (num_plies == plies.size())
+			plies.push_back(make_unique<Ply>());
+		auto& ply = *plies[num_plies];
+		ply.move = history[num_root_plies + num_plies].move;
+		ply.pos_move = to_position_move(*pos, board->genericMove(ply.move));
+		if (!pos->pseudo_legal(ply.pos_move) || !pos->legal(ply.pos_move)) {
+			reset(board);
+			return *pos;
+		}
+		pos->do_move(ply.pos_move, ply.st);
+	}
+	// The moves before the root aren't compared, so the key tells whether it's still the same game
+	if (position_key(*pos) != board->key())
+		reset(board);
+	return *pos;
+}
+
+void PositionTracker::reset(std::shared_ptr<Chess::Board> board)
+{
+	this->board = board.get();
+	num_root_plies = board->MoveHistory().size();
+	num_plies = 0;
+	if (!root_state)
+		root_state = make_unique<StateInfo>();
+	if (!pos)
+		pos = make_unique<Position>();
+	pos->set(board->fenString().toStdString(), false, ANTI_VARIANT, root_state.get(), Threads.main());
+}
+
+static bool is_dtz_in_time(uint32_t move_dtz, int reversible_move_count)
+{
+	return int(move_dtz) < 100 - reversible_move_count || move_dtz == 100;
+}
+
+SolverMove to_saved_endgame_move(const SolverMove& move, uint8_t tb_dtz, std::shared_ptr<Chess::Board> board)
+{
+	// The depth byte keeps the EGTB version, the version byte the halfmove clock, then the DTZ of the move and of the position
+	SolverMove saved(move);
+	quint32 clock = static_cast<quint32>(min(board->reversibleMoveCount(), 0xFF));
+	saved.set_depth_time((move.depth_time() & 0x00FF00FF) | (clock << 8) | (quint32(tb_dtz) << 24));
+	return saved;
+}
+
+std::tuple<SolverMove, uint8_t> from_saved_endgame_move(const SolverMove& saved, std::shared_ptr<Chess::Board> board)
+{
+	// With a lower halfmove clock than the saved one, a faster win may fit in time, so the position is probed again
+	int clock = static_cast<int>(saved.version());
+	int reversible_move_count = board->reversibleMoveCount();
+	quint32 move_dtz = saved.time() & 0xFF;
+	if (clock > reversible_move_count || !is_dtz_in_time(move_dtz, reversible_move_count))
+		return { SolverMove(), egtb::DTZ_NONE };
+	SolverMove move(saved);
+	move.set_depth_time((move_dtz << 16) | saved.depth());
+	return { move, static_cast<uint8_t>(saved.time() >> 8) };
+}
+
 std::tuple<std::list<SolverMove>, uint8_t> get_endgame_moves(std::shared_ptr<Chess::Board> board, std::shared_ptr<Position> pos, bool apply_50move_rule)
 {
 	using namespace egtb;
@@ -548,15 +773,18 @@ std::tuple<std::list<SolverMove>, uint8_t> get_endgame_moves(std::shared_ptr<Che
 		return { moves, tb_dtz };
 	auto depth_time = [](uint32_t dtz_value) { return (dtz_value << 16) | EGTB_VERSION; };
 	auto our_color = board->sideToMove();
-	int dtz = 100 - board->reversibleMoveCount();
+	int reversible_move_count = board->reversibleMoveCount();
+	// All the replies are probed at once, so that the reads of each table are done in one pass
+	vector<TB_Child> children;
+	TB_Reader::probe_children(*pos, children);
+	map<string, const TB_Child*> pos_moves;
+	for (const auto& child : children)
+		pos_moves[UCI::move(child.move, pos->is_chess960())] = &child;
 	auto legal_moves = board->legalMoves();
 	for (auto& move : legal_moves)
 	{
+		auto it_pos_move = pos_moves.find(board->moveString(move, Chess::Board::LongAlgebraic).toStdString());
 		board->makeMove(move);
-		//Move posMove = make_move(Square(move.sourceSquare()), Square(move.targetSquare()));
-		//... promotion + special move flag
-		//StateInfo st_i;
-		//pos.do_move(posMove, st_i);
 		if (tb_val == 1 && board->result().winner() == our_color)
 		{
 			board->undoMove();
@@ -564,17 +792,28 @@ std::tuple<std::list<SolverMove>, uint8_t> get_endgame_moves(std::shared_ptr<Che
 		}
 		else
 		{
-			auto [pos, st] = boardToPosition(board); //!! TODO: convert move or use pos directly
 			int16_t value_i;
 			uint8_t dtz_i;
-			bool is_error = TB_Reader::probe_EGTB(*pos, value_i, dtz_i);
-			if (is_error)
-				throw runtime_error("Error: EGTB in " + pos->fen());
+			if (it_pos_move != pos_moves.end())
+			{
+				const auto& child = *it_pos_move->second;
+				if (child.is_error)
+					throw runtime_error("Error: EGTB in " + pos->fen() + " after " + it_pos_move->first);
+				value_i = child.val;
+				dtz_i = child.dtz;
+			}
+			else
+			{
+				auto [pos_i, st_i] = boardToPosition(board);
+				bool is_error = TB_Reader::probe_EGTB(*pos_i, value_i, dtz_i);
+				if (is_error)
+					throw runtime_error("Error: EGTB in " + pos_i->fen());
+			}
 			//is_zeroing = board_i.is_zeroing(move_i)
 			//if to_apply_50move_rule:
 			//...
 			board->undoMove();
-			if ((abs(value_i) == abs(tb_val) - 1) && ((value_i > 0) != (tb_val > 0)) && (!apply_50move_rule || dtz_i < dtz || dtz_i == 100))
+			if ((abs(value_i) == abs(tb_val) - 1) && ((value_i > 0) != (tb_val > 0)) && (!apply_50move_rule || is_dtz_in_time(dtz_i, reversible_move_count)))
 			{
 				constexpr static int16_t add_ply = 1;
 				int16_t score = (value_i > 0) ? (MATE_VALUE - (value_i + add_ply) / 2) : (-MATE_VALUE - (value_i - add_ply) / 2);
@@ -606,6 +845,7 @@ bool init_EGTB()
 	string egtb_path = path_egtb.toStdString();
 	using namespace egtb;
 	TB_Reader::init(egtb_path);
+	set_EGTB_cache_size(QSettings().value("solver/egtb_cache", 0.25).toDouble());
 	
 	for (const auto& entry : fs::directory_iterator(egtb_path))
 	{
@@ -613,7 +853,7 @@ bool init_EGTB()
 		{
 			const auto& path = entry.path();
 			string extension = path.extension().generic_string();
-			if (extension == TB_Reader::file_extension_compressed)
+			if (extension == TB_Reader::file_extension_compressed || extension == TB_Reader::file_extension_blocks)
 			{
 				string tb_name = path.stem().generic_string();
 				if (tb_name.length() > 5)
@@ -625,11 +865,128 @@ bool init_EGTB()
 	return true;
 }
 
+void set_EGTB_cache_size(double size_GB)
+{
+	// Inflated chunks of all the tables share this budget
+	egtb::TB_Reader::set_cache_size(static_cast<size_t>(max(0.01, size_GB) * 1024 * 1024 * 1024));
+}
+
+QByteArray EGTB_fingerprint()
+{
+	// The names, sizes and times of the table files, so that added or regenerated tables change it
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(QByteArray::number(EGTB_VERSION));
+	if (init_EGTB())
+	{
+		QDir dir(QString::fromStdString(egtb::TB_Reader::egtb_path.string()));
+		for (const auto& fi : dir.entryInfoList(QDir::Files, QDir::Name))
+			hash.addData(QString("%1 %2 %3\n").arg(fi.fileName()).arg(fi.size()).arg(fi.lastModified().toMSecsSinceEpoch()).toUtf8());
+	}
+	return hash.result();
+}
+
+QStringList preload_EGTB(size_t max_pieces)
+{
+	QStringList log;
+	if (!init_EGTB())
+		return log;
+	auto t0 = chrono::steady_clock::now();
+	auto infos = egtb::TB_Reader::preload(max_pieces);
+	chrono::duration<double> t = chrono::steady_clock::now() - t0;
+	size_t total_bytes = 0;
+	int num_failed = 0;
+	for (const auto& info : infos)
+	{
+		if (info.is_ok)
+			log << QString("EGTB %1 loaded into RAM: %2 MB in %3 s")
+			           .arg(QString::fromStdString(info.tb_name))
+			           .arg(info.bytes / (1024.0 * 1024.0), 0, 'f', 2)
+			           .arg(info.seconds, 0, 'f', 3);
+		else
+			log << QString("Failed to load EGTB %1 into RAM").arg(QString::fromStdString(info.tb_name));
+		total_bytes += info.bytes;
+		num_failed += !info.is_ok;
+	}
+	log << QString("%1 EGTBs of up to %2 pieces loaded into RAM: %3 MB in %4 s%5")
+	           .arg(infos.size() - num_failed)
+	           .arg(max_pieces)
+	           .arg(total_bytes / (1024.0 * 1024.0), 0, 'f', 1)
+	           .arg(t.count(), 0, 'f', 1)
+	           .arg(num_failed ? QString(", %1 failed").arg(num_failed) : "");
+	return log;
+}
+
+QStringList EGTB_stats_report(size_t max_tables)
+{
+	QStringList report;
+	auto stats = egtb::TB_Reader::probe_stats();
+	if (stats.empty())
+		return report;
+	report << QString("%1 %2 %3 %4 %5 %6 %7")
+	              .arg("EGTB", -8).arg("Probes", 11).arg("Missing", 9).arg("p50 us", 8).arg("p99 us", 8)
+	              .arg("Inflated MB", 12).arg("Engine s", 9);
+	for (size_t i = 0; i < min(max_tables, stats.size()); i++)
+	{
+		const auto& s = stats[i];
+		report << QString("%1 %2 %3 %4 %5 %6 %7")
+		              .arg(QString::fromStdString(s.tb_name), -8)
+		              .arg(s.probes, 11)
+		              .arg(s.errors, 9)
+		              .arg(s.p50_us, 8, 'f', 1)
+		              .arg(s.p99_us, 8, 'f', 1)
+		              .arg(s.inflated_bytes / (1024.0 * 1024.0), 12, 'f', 1)
+		              .arg(s.engine_seconds, 9, 'f', 1);
+	}
+	if (stats.size() > max_tables)
+		report << QString("... %1 more").arg(stats.size() - max_tables);
+	return report;
+}
+
+bool save_EGTB_stats(const QString& filepath, QString& error_text)
+{
+	string error;
+	bool is_ok = egtb::TB_Reader::save_probe_stats(filepath.toStdString(), error);
+	if (!is_ok)
+		error_text = QString::fromStdString(error);
+	return is_ok;
+}
+
+void reset_EGTB_stats()
+{
+	egtb::TB_Reader::reset_probe_stats();
+}
+
 quint32 egtb_version()
 {
 	return EGTB_VERSION;
 }
 
+uint8_t detect_engine_version(QString& engine_name)
+{
+	int i = engine_name.lastIndexOf(' ');
+	if (i <= 0)
+		return UNKNOWN_ENGINE_VERSION;
+	QString version = engine_name.mid(i + 1);
+	if (version.length() != 6)
+		return UNKNOWN_ENGINE_VERSION;
+	QString str_num = version.right(2) + version.mid(2, 2) + version.left(2);
+	bool ok;
+	int num = str_num.toInt(&ok);
+	if (!ok)
+		return UNKNOWN_ENGINE_VERSION;
+	uint8_t engine_version =
+	      (240903 <= num && num <= 240910) ? LATEST_ENGINE_VERSION // 5 // fix static eval overflow
+	    : (240701 <= num && num <= 240831) ? 4 // fix en passant in endgames
+	    : (240226 <= num && num <= 240630) ? 3 // use F-SF depths, use new EGTB
+	    : (num == 230811)                  ? 2 // increase depth when fast mate and lots of pieces
+	    : (num == 230803)                  ? 1 // add go ... mate xx
+	    : (230409 <= num && num <= 230415) ? 1
+	    : (230301 <= num && num <= 230401) ? 0
+	                                       : UNKNOWN_ENGINE_VERSION;
+	engine_name = engine_name.left(i + 1) + str_num;
+	return engine_version;
+}
+
 bool is_endgame_available(std::shared_ptr<const Position> pos)
 {
 	if (!pos)
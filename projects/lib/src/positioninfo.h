@@ -22,6 +22,7 @@ constexpr static qint16 FAKE_DRAW_SCORE = 31500;
 constexpr static qint16 MATE_THRESHOLD = 31500;
 constexpr static qint16 WIN_THRESHOLD = MATE_VALUE - 190; // #190
 constexpr static qint16 ABOVE_EG = 20000;
+constexpr static qint16 BAD_MOVE_SCORE = -10000;
 constexpr static qint16 MANUAL_VALUE = 0xFF;
 constexpr static qint16 FORCED_MOVE = MATE_VALUE - MANUAL_VALUE;
 constexpr static qint16 ESOLUTION_VALUE = 0xDD;
@@ -29,6 +30,8 @@ constexpr static quint32 OVERRIDE_MASK = 0xFF00;
 constexpr static quint32 REAL_DEPTH_LIMIT = 200;
 
 constexpr static uint8_t LATEST_ENGINE_VERSION = 5; // +1 for NNUE
+constexpr static uint8_t UNKNOWN_ENGINE_VERSION = 0xFE;
+constexpr static quint64 NODES_PER_S = 1'500'000;
 
 constexpr static QChar SEP_MOVES = '_';
 
@@ -177,6 +180,32 @@ struct SolverMove : public SolutionEntry
 using Line = std::list<Chess::Move>;
 using EntryRow = std::array<char, 16>;
 
+/*
+ * A Stockfish Position that follows a board, for the walks that look at the positions around the current one.
+ * Each call makes and undoes only the moves that differ from the previous call. The Position is set up
+ * from the FEN again only when the board is another one or has gone back beyond that point.
+ */
+class PositionTracker
+{
+	public:
+		PositionTracker();
+		~PositionTracker();
+
+		Position& sync(std::shared_ptr<Chess::Board> board); // in the position of the board, with the same key
+
+	private:
+		struct Ply;
+
+		void reset(std::shared_ptr<Chess::Board> board);
+
+		const Chess::Board* board;
+		int num_root_plies;                      // in the history of the board when the Position was set up
+		std::unique_ptr<StateInfo> root_state;
+		std::unique_ptr<Position> pos;
+		std::vector<std::unique_ptr<Ply>> plies; // the first num_plies are made on the Position, the rest are kept for reuse
+		size_t num_plies;
+};
+
 QString get_move_stack(std::shared_ptr<Chess::Board> game_board, bool add_fen = false, int move_limit = 999);
 QString get_move_stack(Chess::Board* game_board, bool add_fen = false, int move_limit = 999);
 QString get_san_sequence(int ply, const QStringList& moves);
@@ -189,10 +218,21 @@ std::tuple<Line, std::shared_ptr<Chess::Board>> parse_line(const QString& line,
 std::tuple<Line, std::shared_ptr<Chess::Board>> parse_moves(QString text, const QString* ptr_opening = nullptr);
 
 int get_max_depth(int score, size_t num_pieces);
+bool update_only_move(bool is_only_move, int pv, int score);
 std::tuple<std::shared_ptr<Position>, std::shared_ptr<StateInfo>> boardToPosition(std::shared_ptr<Chess::Board> board);
+quint64 position_key(const Position& pos); // the same Polyglot key as Chess::Board::key() of the position
 std::tuple<std::list<SolverMove>, uint8_t> get_endgame_moves(std::shared_ptr<Chess::Board> board, std::shared_ptr<Position> position = nullptr, bool apply_50move_rule = true);
+SolverMove to_saved_endgame_move(const SolverMove& move, uint8_t tb_dtz, std::shared_ptr<Chess::Board> board); // with the DTZ of the position and the halfmove clock of the board
+std::tuple<SolverMove, uint8_t> from_saved_endgame_move(const SolverMove& saved, std::shared_ptr<Chess::Board> board); // the move and the DTZ of the position, a null move if it has to be probed again
 bool init_EGTB();
+void set_EGTB_cache_size(double size_GB);
+QStringList preload_EGTB(size_t max_pieces = 4);
+QByteArray EGTB_fingerprint(); // changes when the set of tables changes
+QStringList EGTB_stats_report(size_t max_tables = 20);
+bool save_EGTB_stats(const QString& filepath, QString& error_text);
+void reset_EGTB_stats();
 quint32 egtb_version();
+uint8_t detect_engine_version(QString& engine_name); // the ddmmyy suffix of the name becomes yymmdd
 bool is_endgame_available(std::shared_ptr<const Position> pos);
 bool is_branch(std::shared_ptr<Chess::Board> main_pos, std::shared_ptr<Chess::Board> branch);
 bool is_branch(Chess::Board* main_pos, Chess::Board* branch);
@@ -3,6 +3,7 @@
 #include "board/boardfactory.h"
 #include "watkins/watkinssolution.h"
 #include "watkins/losingloeser.h"
+#include "bookmerge.h"
 
 #include <QFileInfo>
 #include <QDir>
@@ -14,6 +15,7 @@
 #include <vector>
 #include <map>
 #include <fstream>
+#include <chrono>
 
 
 using namespace std;
@@ -118,6 +120,10 @@ void Solution::loadBook(bool ignore_lower_level)
 	s.endGroup();
 	bool all_branches_upper = state_upper_level & static_cast<int>(SolutionInfoState::all_branches);
 	bool all_branches_lower = state_lower_level & static_cast<int>(SolutionInfoState::all_branches);
+	// A book patched in place when the app stopped is finished from the log in its temporary file
+	for (auto type : { FileType_book_upper, FileType_book })
+		if (fileExists(type) && !replay_entry_rows(path(type).toStdString(), ext_to_bak(path(type)).toStdString()))
+			emit Message(QString("Failed to finish patching %1").arg(path(type)), MessageType::error);
 	bool exists_lower = !ignore_lower_level && fileExists(FileType_book);
 	bool exists_upper = fileExists(FileType_book_upper);
 	QString path_book = (exists_lower && all_branches_lower) ? path(FileType_book)
@@ -125,13 +131,15 @@ void Solution::loadBook(bool ignore_lower_level)
 	                  : exists_lower                         ? path(FileType_book)
 	                  : exists_upper                         ? path(FileType_book_upper)
 	                                                         : "";
+	closeMainBook();
 	if (path_book.isEmpty())
 		return;
 
 	QFileInfo fi(path_book);
 	if (fi.size() <= ram_budget) {
-		book_main = make_shared<SolutionBook>(OpeningBook::Ram);
-		ram_budget -= fi.size();
+		book_main = make_shared<SolutionBook>(OpeningBook::Mmap);
+		ram_charged_main = fi.size();
+		ram_budget -= ram_charged_main;
 	}
 	else {
 		book_main = make_shared<SolutionBook>(OpeningBook::Disk);
@@ -139,12 +147,18 @@ void Solution::loadBook(bool ignore_lower_level)
 	bool is_ok = book_main->read(path_book);
 	if (!is_ok)
 	{
-		book_main.reset();
-		ram_budget += fi.size();
+		closeMainBook();
 		return;
 	}
 }
 
+void Solution::closeMainBook()
+{
+	book_main.reset();
+	ram_budget += ram_charged_main;
+	ram_charged_main = 0;
+}
+
 void Solution::updateInfo()
 {
 	QSettings s(path(FileType_spec), QSettings::IniFormat);
@@ -237,31 +251,48 @@ void Solution::activate(bool send_msg)
 	// Update info
 	updateInfo();
 
+	// Sync the journals also when nothing is added for a while
+	int sync_time = max(1, QSettings().value("solver/journal_sync_time", 10).toInt());
+	connect(&timer_journal_sync, &QTimer::timeout, this, &Solution::syncJournals, Qt::UniqueConnection);
+	timer_journal_sync.start(sync_time * 1000);
+
 	// Read the book
 	ram_budget = static_cast<quint64>(QSettings().value("solver/book_cache", 1.0).toDouble() * 1024 * 1024 * 1024);
 	loadBook();
 
-	// Read alts, positions, and solution books
-	for (FileType type : { FileType_alts_upper, FileType_alts_lower, FileType_positions_upper, FileType_positions_lower, FileType_solution_upper, FileType_solution_lower })
-	{
-		QString path_pos = path(type);
-		QFileInfo fi_pos(path_pos);
-		if (fi_pos.exists())
-		{
-			if (fi_pos.size() <= ram_budget) {
-				books[type] = make_shared<SolutionBook>(OpeningBook::Ram);
-				ram_budget -= fi_pos.size();
-			}
-			else {
-				books[type] = make_shared<SolutionBook>(OpeningBook::Disk);
-			}
-			bool is_ok = books[type]->read(path_pos);
-			if (!is_ok) {
-				books[type].reset();
-				ram_budget += fi_pos.size();
-			}
-		}
+	// Read alts, positions, solution, and endgame books
+	for (FileType type : { FileType_alts_upper, FileType_alts_lower, FileType_positions_upper, FileType_positions_lower, FileType_solution_upper, FileType_solution_lower,
+	                       FileType_endgames_upper, FileType_endgames_lower })
+		openDataBook(type);
+}
+
+void Solution::openDataBook(FileType type)
+{
+	QString path_pos = path(type);
+	QFileInfo fi_pos(path_pos);
+	if (!fi_pos.exists())
+		return;
+	if (fi_pos.size() <= ram_budget) {
+		books[type] = make_shared<SolutionBook>(OpeningBook::Mmap);
+		ram_charged[type] = fi_pos.size();
+		ram_budget -= ram_charged[type];
 	}
+	else {
+		books[type] = make_shared<SolutionBook>(OpeningBook::Disk);
+	}
+	bool is_ok = books[type]->read(path_pos);
+	if (!is_ok)
+		closeDataBook(type);
+}
+
+void Solution::closeDataBook(FileType type)
+{
+	if (!books[type])
+		return;
+	// The file may have been replaced since it was opened, so the budget gets back what was charged then
+	ram_budget += ram_charged[type];
+	ram_charged[type] = 0;
+	books[type].reset();
 }
 
 void Solution::deactivate(bool send_msg)
@@ -269,9 +300,12 @@ void Solution::deactivate(bool send_msg)
 	if (send_msg)
 		emit Message(QString("Closing solution: %1...").arg(nameToShow(true)));
 
-	book_main.reset();
-	for (auto& book : books)
-		book.reset();
+	timer_journal_sync.stop();
+	closeMainBook();
+	for (int type = 0; type < FileType_DATA_END; type++)
+		closeDataBook(static_cast<FileType>(type));
+	for (auto& journal : journals)
+		journal.reset();
 }
 
 std::shared_ptr<Solution> Solution::load(const QString& filepath)
@@ -683,8 +717,13 @@ std::shared_ptr<SolutionEntry> Solution::bookEntry(Chess::Board* board, FileType
 	list<SolutionEntry> book_entries;
 	if (books[type])
 		book_entries = books[type]->bookEntries(board->key());
+	return bookEntry(book_entries, board->key(), type, check_cache);
+}
+
+std::shared_ptr<SolutionEntry> Solution::bookEntry(std::list<SolutionEntry>& book_entries, quint64 key, FileType type, bool check_cache) const
+{
 	if (check_cache && type < data_new.size()) {
-		auto it_new = data_new[type].find(board->key());
+		auto it_new = data_new[type].find(key);
 		if (it_new != data_new[type].end()) {
 			for (auto it = book_entries.begin(); it != book_entries.end(); ++it) {
 				if (it->pgMove == it_new->second.pgMove) {
@@ -702,6 +741,16 @@ std::shared_ptr<SolutionEntry> Solution::bookEntry(Chess::Board* board, FileType
 	return entry;
 }
 
+std::vector<std::shared_ptr<SolutionEntry>> Solution::bookEntries(const QVector<quint64>& keys, FileType type, bool check_cache) const
+{
+	vector<shared_ptr<SolutionEntry>> entries(keys.size());
+	vector<list<SolutionEntry>> book_entries = books[type] ? books[type]->bookEntries(keys)
+	                                                       : vector<list<SolutionEntry>>(keys.size());
+	for (int i = 0; i < keys.size(); i++)
+		entries[i] = bookEntry(book_entries[i], keys[i], type, check_cache);
+	return entries;
+}
+
 QString Solution::positionInfo(std::shared_ptr<Chess::Board> board)
 {
 	auto entry = bookEntry(board, FileType_positions_upper);
@@ -1034,19 +1083,20 @@ void Solution::saveBranchSettings(QSettings& s, std::shared_ptr<Chess::Board> bo
 	s.endArray();
 }
 
-bool Solution::mergeFiles(FileType type) const
+bool Solution::mergeFiles(FileType type)
 {
+	journals[type].reset(); // syncs and closes the file
 	auto path_new = path(type, FileSubtype::New);
 	QFileInfo fi_new(path_new);
 	if (!fi_new.exists())
 		return true;
 	auto size_new = fi_new.size();
+	size_new -= size_new % 16; // ignore an incomplete last row
 	if (size_new == 0)
 		return true;
 
 	auto path_std = path(type, FileSubtype::Std);
 	QFileInfo fi_std(path_std);
-	auto size_std = fi_std.size();
 	//if (!fi_std.exists())
 	//	return QFile::rename(path_new, path_std);
 	//if (fi_std.size() == 0) {
@@ -1057,52 +1107,48 @@ bool Solution::mergeFiles(FileType type) const
 	//}
 
 	bool to_clean = (version == -1 && (type == FileType_positions_upper || type == FileType_positions_lower));
+	auto is_to_keep = [to_clean](uint64_t val)
+	{
+		if (!to_clean)
+			return true;
+		return !(   (val & 0xFFFF) == 1                     // endgame
+		         || (val & 0xFFFF000000000000) == 0         // null-move
+		     //  || (val & 0xFFFFFFFFFFFF) == 0x00DD000000DD // esolution
+		         || (val & 0xFFFF) == ESOLUTION_VALUE       // esolution
+		         || (val & 0xFFFF) == MANUAL_VALUE);        // override
+	};
 
 	/// Merge.
+	// Only the new rows are sorted in memory; the std file is sorted already and is streamed.
 	uintmax_t filesize;
-	fs::path path_bak;
+	fs::path path_bak = ext_to_bak(path_std).toStdString();
+	BookRowReader rows_new(read_rows(path_new.toStdString(), size_new), true);
+	BookRowReader rows_std(path_std.toStdString());
+	for (;;)
 	{
-		vector<char> data_to_save;
+		BookRowWriter file_bak(path_bak.string());
+		while (!rows_new.at_end() || !rows_std.at_end())
 		{
-			map<uint64_t, uint64_t> entries = read_book(path_std.toStdString(), size_std);
-			// Update entries:
-			{
-				vector<char> buf(size_new);
-				ifstream file_new(path_new.toStdString(), ios::binary | ios::in);
-				file_new.read(buf.data(), size_new);
-				for (int i = 0; i < size_new; i += 16)
-					entries[load_bigendian(&buf[i])] = load_bigendian(&buf[i + 8]);
-			} // destructing the buffer
-			if (to_clean) {
-				for (auto it = entries.cbegin(); it != entries.cend(); )
-				{
-					const uint64_t& val = it->second;
-					if (   (val & 0xFFFF) == 1                      // endgame
-						|| (val & 0xFFFF000000000000) == 0          // null-move
-					//	|| (val & 0xFFFFFFFFFFFF) == 0x00DD000000DD // esolution
-					    || (val & 0xFFFF) == ESOLUTION_VALUE        // esolution
-						|| (val & 0xFFFF) == MANUAL_VALUE)          // override
-						it = entries.erase(it);
-					else
-						++it;
-				}
-			}
-			filesize = entries.size() * 16;
-			data_to_save.resize(filesize);
-			size_t n = 0;
-			for (auto& [key, val] : entries)
-			{
-				save_bigendian(key, data_to_save.data() + n);
-				save_bigendian(val, data_to_save.data() + n + 8);
-				n += 16;
-			}
-		} // destructing entries
-
-		/// Create bak file.
-		path_bak = ext_to_bak(path_std).toStdString();
-		ofstream file_bak(path_bak, ios::binary | ios::out | ios::trunc);
-		file_bak.write((const char*)data_to_save.data(), filesize);
-	} // destructing data_to_save
+			bool is_new = !rows_new.at_end() && (rows_std.at_end() || rows_new.key() <= rows_std.key());
+			uint64_t key = is_new ? rows_new.key() : rows_std.key();
+			uint64_t val = is_new ? rows_new.value() : rows_std.value();
+			if (!rows_std.at_end() && rows_std.key() == key)
+				rows_std.next_key();
+			if (is_new)
+				rows_new.next_key();
+			if (is_to_keep(val))
+				file_bak.write(key, val);
+		}
+		if (!file_bak.close() || !rows_std.is_ok())
+			return false;
+		filesize = file_bak.size();
+		if (rows_std.is_sorted())
+			break;
+		// The std file is not sorted: sort it in memory and start over
+		if (!rows_std.load_sorted())
+			return false;
+		rows_new.rewind();
+	}
 
 	/// Replace files
 	if (fs::file_size(path_bak) != filesize)
@@ -1110,12 +1156,15 @@ bool Solution::mergeFiles(FileType type) const
 	bool is_ok = QFile::remove(path_new);
 	if (!is_ok)
 		return false;
-	if (fi_std.exists()) {
+	// The book maps the std file or keeps it open, so it's closed while the file is replaced
+	bool is_open = (books[type] != nullptr);
+	closeDataBook(type);
+	if (fi_std.exists())
 		is_ok = QFile::remove(path_std);
-		if (!is_ok)
-			return false;
-	}
-	is_ok = QFile::rename(QString::fromStdString(path_bak.generic_string()), path_std);
+	if (is_ok)
+		is_ok = QFile::rename(QString::fromStdString(path_bak.generic_string()), path_std);
+	if (is_open)
+		openDataBook(type);
 	return is_ok;
 }
 
@@ -1137,6 +1186,13 @@ bool Solution::mergeAllFiles()
 	return true;
 }
 
+void Solution::syncJournals()
+{
+	for (size_t i = 0; i < journals.size(); i++)
+		if (journals[i] && !journals[i]->sync())
+			emit Message(QString("Failed to sync %1").arg(path(FileType(i), FileSubtype::New)), MessageType::error);
+}
+
 bool Solution::hasMergeErrors() const
 {
 	for (int i = FileType_DATA_START; i < FileType_DATA_END; i++)
@@ -1160,6 +1216,9 @@ void Solution::addToBook(quint64 key, const SolutionEntry& entry, FileType type)
 	addToBook(row, type);
 	if (type < data_new.size())
 		data_new[type][key] = entry;
+	for (auto& base : book_bases)
+		if (base.timestamp)
+			base.changed_keys.insert(key);
 }
 
 void Solution::addToBook(std::shared_ptr<Chess::Board> board, uint64_t data, FileType type)
@@ -1173,13 +1232,24 @@ void Solution::addToBook(std::shared_ptr<Chess::Board> board, uint64_t data, Fil
 	addToBook(row, type);
 	if (type < data_new.size())
 		data_new[type][board->key()] = data;
+	for (auto& base : book_bases)
+		if (base.timestamp)
+			base.changed_keys.insert(board->key());
 }
 
-void Solution::addToBook(const EntryRow& row, FileType type) const
+void Solution::addToBook(const EntryRow& row, FileType type)
 {
-	auto book_path = path(type, FileSubtype::New).toStdString();
-	ofstream file(book_path, ios::binary | ios::out | ios::app);
-	file.write(row.data(), row.size());
+	auto& journal = journals[type];
+	if (!journal) {
+		QSettings s;
+		auto sync_rows = s.value("solver/journal_sync_rows", 4096).toUInt();
+		auto sync_time = chrono::seconds(s.value("solver/journal_sync_time", 10).toInt());
+		journal = make_unique<BookJournal>(path(type, FileSubtype::New), sync_rows, sync_time);
+	}
+	bool is_ok = journal->append(row);
+	if (!is_ok && !journal_errors[type]) // reported once until a row is written again
+		emit Message(QString("Failed to write %1").arg(path(type, FileSubtype::New)), MessageType::error);
+	journal_errors[type] = !is_ok;
 }
 
 std::vector<SolutionEntry> Solution::eSolutionEntries(std::shared_ptr<Chess::Board> board, bool use_cache)
@@ -1218,13 +1288,27 @@ std::vector<SolutionEntry> Solution::eSolutionEntries(Chess::Board* board, bool
 		}
 		shared_ptr<Board> temp_board(board->copy());
 		auto legal_moves = temp_board->legalMoves();
+		QVector<quint64> keys;
+		keys.reserve(legal_moves.size());
 		for (auto& m : legal_moves)
 		{
 			temp_board->makeMove(m);
-			auto entry = bookEntry(temp_board, FileType_solution_upper, use_cache);
-			if (!entry)
-				entry = bookEntry(temp_board, FileType_solution_lower, use_cache);
+			keys << temp_board->key();
 			temp_board->undoMove();
+		}
+		auto entries_upper = bookEntries(keys, FileType_solution_upper, use_cache);
+		// The lower level is looked up only for the replies missing from the upper one
+		QVector<quint64> keys_lower;
+		for (int i = 0; i < keys.size(); i++)
+			if (!entries_upper[i])
+				keys_lower << keys[i];
+		vector<shared_ptr<SolutionEntry>> entries_lower;
+		if (!keys_lower.isEmpty())
+			entries_lower = bookEntries(keys_lower, FileType_solution_lower, use_cache);
+		for (int i = 0, i_lower = 0; i < legal_moves.size(); i++)
+		{
+			auto& m = legal_moves[i];
+			auto entry = entries_upper[i] ? entries_upper[i] : entries_lower[i_lower++];
 			if (!entry || !entry->pgMove)
 				break;
 			auto pgMove = OpeningBook::moveToBits(temp_board->genericMove(m));
@@ -2,15 +2,18 @@
 #define SOLUTION_H
 
 #include "solutionbook.h"
+#include "bookjournal.h"
 #include "positioninfo.h"
 #include "side.h"
 #include "board/move.h"
 #include "board/board.h"
 #include "watkins/watkinssolution.h"
+#include "flathash.h"
 
 #include <QStringList>
 #include <QChar>
 #include <QSettings>
+#include <QTimer>
 
 #include <array>
 #include <list>
@@ -50,6 +53,20 @@ struct LIB_EXPORT SolutionData
 };
 
 
+/*
+ * The book of a level as the solver saved it in this session, and the positions whose data has been changed since then.
+ * While the book file is still the same, the solver patches the rows of these positions instead of rewriting the book.
+ */
+struct BookPatchBase
+{
+	qint64 timestamp = 0; // ms, 0 if there's no base
+	qint64 size = 0;
+	quint64 root_key = 0;
+	QByteArray fingerprint; // of the solver settings and the EGTBs that the tree depends on
+	FlatHashSet changed_keys;
+};
+
+
 class Solution;
 using SolutionCollection = std::map<QString, std::list<std::shared_ptr<Solution>>>;
 
@@ -105,6 +122,7 @@ public:
 	bool remove(std::function<bool(const QString&)> are_you_sure, std::function<void(const QString&)> message);
 	void edit(std::shared_ptr<SolutionData> data);
 	bool mergeAllFiles();
+	void syncJournals();
 	void addToBook(std::shared_ptr<Chess::Board> board, const SolutionEntry& entry, FileType type);
 	void addToBook(quint64 key, const SolutionEntry& entry, FileType type);
 	void addToBook(std::shared_ptr<Chess::Board> board, uint64_t data, FileType type);
@@ -121,8 +139,13 @@ private:
 	int winInValue(std::shared_ptr<Chess::Board> board, FileType type) const;
 	bool hasMergeErrors() const;
 	void saveBranchSettings(QSettings& s, std::shared_ptr<Chess::Board> board);
-	bool mergeFiles(FileType type) const;
-	void addToBook(const EntryRow& row, FileType type) const;
+	bool mergeFiles(FileType type);
+	void openDataBook(FileType type);
+	void closeDataBook(FileType type);
+	void closeMainBook();
+	std::shared_ptr<SolutionEntry> bookEntry(std::list<SolutionEntry>& book_entries, quint64 key, FileType type, bool check_cache) const;
+	std::vector<std::shared_ptr<SolutionEntry>> bookEntries(const QVector<quint64>& keys, FileType type, bool check_cache = true) const;
+	void addToBook(const EntryRow& row, FileType type);
 
 private:
 	Line opening;
@@ -146,7 +169,13 @@ private:
 	std::array<QString, FileType_DATA_END> filenames_new;
 	std::array<std::shared_ptr<SolutionBook>, FileType_DATA_END> books;
 	std::array<std::map<uint64_t, SolutionEntry>, FileType_DATA_END> data_new;
+	std::array<std::unique_ptr<BookJournal>, FileType_DATA_END> journals;
+	std::array<bool, FileType_DATA_END> journal_errors = {};
+	QTimer timer_journal_sync;
 	int64_t ram_budget;
+	int64_t ram_charged_main = 0; // taken from the budget by book_main
+	std::array<int64_t, FileType_DATA_END> ram_charged = {}; // taken from the budget by each book in books
+	std::array<BookPatchBase, 2> book_bases; // upper level, lower level
 
 	friend class Solver;
 	friend class SolverResults;
@@ -190,3 +190,15 @@ std::list<SolutionEntry> SolutionBook::bookEntries(quint64 key) const
 	}
 	return book_entries;
 }
+
+std::vector<std::list<SolutionEntry>> SolutionBook::bookEntries(const QVector<quint64>& keys) const
+{
+	std::vector<std::list<SolutionEntry>> book_entries(keys.size());
+	auto entries = OpeningBook::entries(keys);
+	for (int i = 0; i < entries.size(); i++)
+	{
+		for (auto& entry : entries[i])
+			book_entries[i].push_back(SolutionEntry(entry));
+	}
+	return book_entries;
+}
@@ -7,6 +7,7 @@
 #include <QString>
 #include <memory>
 #include <list>
+#include <vector>
 
 
 namespace Chess
@@ -50,6 +51,7 @@ public:
 	SolutionBook(AccessMode mode = Ram);
 
 	std::list<SolutionEntry> bookEntries(quint64 key) const;
+	std::vector<std::list<SolutionEntry>> bookEntries(const QVector<quint64>& keys) const;
 
 protected:
 	//SolutionEntry getEntry(QDataStream& in, quint64* key) const;
@@ -4,17 +4,24 @@
 #include "board/boardfactory.h"
 #include "board/move.h"
 #include "tb/egtb/tb_reader.h"
+#include "tb/egtb/elements.h"
+#include "tb/movegen.h"
+#include "tb/uci.h"
 #include "moveevaluation.h"
+#include "enginepool.h"
+#include "bookmerge.h"
 
 #include <QTimer>
+#include <QEventLoop>
 #include <QFile>
 #include <QFileInfo>
 #include <QDateTime>
+#include <QCryptographicHash>
 
 #include <stdexcept>
-#include <thread>
 #include <algorithm>
 #include <fstream>
+#include <filesystem>
 #include <set>
 #include <map>
 
@@ -24,7 +31,6 @@ using namespace std::chrono;
 constexpr static qint16 DRAW_EG = 0; // = FAKE_DRAW_SCORE
 
 constexpr static auto UPDATE_PERIOD = 70ms;
-constexpr static auto MAX_SLEEP_TIME = 50ms;
 
 
 SolverState::SolverState(bool to_force_solver, int8_t alt_steps, int16_t score_to_beat)
@@ -52,24 +58,18 @@ bool SolverEvalResult::empty() const
 }
 
 
-Transposition::Transposition(quint32 num_nodes, MapT& sub_saved_positions, MapT& sub_trans_positions, qint16 score)
-    : num_nodes(num_nodes)
-	, sub_saved_positions(sub_saved_positions)
-	, sub_trans_positions(sub_trans_positions)
-	, score(score)
-{}
-
-
 Solver::Solver(std::shared_ptr<Solution> solution)
 {
 	sol = solution;
+	changed_keys = nullptr;
+	std_engine_time = 190;
+	add_engine_time = 150;
 	is_final_assembly = false; // !only_upper_level && !branch
 	limit_win = 30;
 	set_mode(SolverMode::Standard);
 	min_winning_sequence = 1;
 	to_fix_engine_v0 = !true;
 	force_cached_transpositions = true;
-	s.add_engine_time_to_ensure_winning_sequence = 5 * s.add_engine_time;
 	s.min_score = -500;
 	s.score_to_add_time = 1100;
 	solver_score = 1400;
@@ -81,8 +81,6 @@ Solver::Solver(std::shared_ptr<Solution> solution)
 	s.max_depth = 99; // 90
 	s.multiPV_boost_depth = 20;
 	s.multiPV_2_num = 18;
-	s.multiPV_2_stop_time = int(s.std_engine_time * 0.10f);
-	s.multiPV_stop_time = int(s.std_engine_time * 0.50f); // 20
 	s.multiPV_stop_score = MATE_VALUE - 8;
 	s.multiPV_threshold_time = 15;
 	endgame5_score_limit = MATE_VALUE - limit_win; // -20  // MATE_VALUE - 0 --> to evaluate all known 5-men endgames
@@ -103,13 +101,11 @@ Solver::Solver(std::shared_ptr<Solution> solution)
 	num_warnings = 0;
 	is_solver_path = true;  // if false  --> see start()
 	last_engine_key = 0;
+	eval_loop = nullptr;
 
 	//tree = None
 	num_new_moves = 0;
 
-	/// Engine
-	s.max_search_time = (s.std_engine_time + s.add_engine_time + s.add_engine_time_to_ensure_winning_sequence);
-
 	/// State
 	status = Status::idle;
 	solver_session = make_shared<SolverSession>();
@@ -138,6 +134,7 @@ void Solver::init()
 	for (const auto& move : sol->opening)
 		board->makeMove(move);
 	skip_branches.clear();
+	skip_branches.reserve(sol->branchesToSkip.size());
 	for (const auto& branch_to_skip : sol->branchesToSkip)
 	{
 		size_t num_moves = 0;
@@ -156,6 +153,7 @@ void Solver::init()
 
 void Solver::set_mode(SolverMode mode)
 {
+	solver_mode = mode;
 	to_copy_solution = (mode == SolverMode::Copy_Watkins || mode == SolverMode::Copy_Watkins_Override || mode == SolverMode::Copy_Watkins_EG);
 	to_allow_override_when_copying = (mode == SolverMode::Copy_Watkins_Override || mode == SolverMode::Copy_Watkins_EG);
 
@@ -164,7 +162,7 @@ void Solver::set_mode(SolverMode mode)
 	s.to_reensure_winning_sequence = !to_copy_solution && !is_final_assembly;
 	max_num_iterations = to_copy_solution ? 10'000'000 : 100'000'000;
 	to_save_null_in_extended_solution = to_copy_solution;
-	to_save_endgames = false; // !only_upper_level // to_copy_solution
+	to_save_endgames = !to_copy_solution; // the copy modes ignore the 50-move rule
 	to_update_max_only_when_finish = to_copy_solution;
 
 	bool upper_level = !to_copy_solution;
@@ -179,8 +177,12 @@ void Solver::set_level(bool upper_level)
 	sol->is_solver_upper_level = only_upper_level;
 	s.score_limit = only_upper_level ? (MATE_VALUE - limit_win) : (MATE_VALUE - 0);
 	score_hard_limit = only_upper_level ? (MATE_VALUE - 7) : (MATE_VALUE - 0);
-	s.std_engine_time = 190;
-	s.add_engine_time = 150;
+	s.std_engine_time = std_engine_time;
+	s.add_engine_time = add_engine_time;
+	s.add_engine_time_to_ensure_winning_sequence = 5 * s.add_engine_time;
+	s.max_search_time = (s.std_engine_time + s.add_engine_time + s.add_engine_time_to_ensure_winning_sequence);
+	s.multiPV_2_stop_time = int(s.std_engine_time * 0.10f);
+	s.multiPV_stop_time = int(s.std_engine_time * 0.50f); // 20
 	if (!to_copy_solution)
 		evaluate_endgames = !upper_level;
 }
@@ -261,6 +263,8 @@ void Solver::start(pBoard start_pos, std::function<void(QString)> message, Solve
 	positions.clear();
 	trans.clear();
 	new_positions.clear();
+	if (engine_pool)
+		engine_pool->clear();
 	max_num_moves = 0;
 	num_processed = 0;
 	num_moves_from_solver = 0;
@@ -411,6 +415,7 @@ void Solver::start(pBoard start_pos, std::function<void(QString)> message, Solve
 		status = Status::idle;
 	}
 	timer_log_update.stop();
+	sol->syncJournals();
 	line_to_log.clear();
 	emit Message(QString("Finishing solving %1 at the %2 level").arg(sol_name).arg(only_upper_level ? "UPPER" : "LOWER"), MessageType::info);
 	if (status != Status::solving) {
@@ -428,6 +433,8 @@ void Solver::start(pBoard start_pos, std::function<void(QString)> message, Solve
 	emit Message(QString("Number of solution moves: %L1").arg(num_moves_from_solver));
 	emit Message(QString("Number of evaluated endgames: %L1").arg(num_evaluated_endgames));
 	emit Message(QString("Number of warnings: %L1").arg(num_warnings));
+	save_TB_stats();
+	log_memory_usage();
 
 	bool is_created = create_book(t, num_opening_moves);
 	bool is_merged = sol->mergeAllFiles();
@@ -462,6 +469,7 @@ void Solver::stop()
 {
 	if (status != Status::postprocessing)
 		status = Status::idle;
+	wake_up();
 }
 
 bool Solver::save(pBoard pos, Chess::Move move, std::shared_ptr<SolutionEntry> data, bool is_only_move, bool is_multi_pos)
@@ -523,13 +531,31 @@ void Solver::saveOverride(Chess::Board* pos, std::shared_ptr<SolutionEntry> data
 
 	auto prev_key = moves.back().key;
 	bool is_waiting = (status == Status::waitingEval) && (prev_key == board->key());
-	if (is_waiting)
+	if (is_waiting) {
 		eval_result = { data, move, false };
+		wake_up();
+	}
 
 	auto type = only_upper_level ? FileType_alts_upper : FileType_alts_lower;
 	sol->addToBook(prev_key, *data, type);
 }
 
+void Solver::setEngineTime(int std_engine_time, int add_engine_time)
+{
+	this->std_engine_time = max(1, std_engine_time);
+	this->add_engine_time = max(0, add_engine_time);
+	set_level(only_upper_level);
+}
+
+void Solver::setEnginePool(std::shared_ptr<EnginePool> pool)
+{
+	if (engine_pool)
+		disconnect(engine_pool.get(), nullptr, this, nullptr);
+	engine_pool = pool;
+	if (engine_pool)
+		connect(engine_pool.get(), &EnginePool::resultReady, this, &Solver::onEnginePoolResult);
+}
+
 void Solver::process(pBoard pos, Chess::Move move, std::shared_ptr<SolutionEntry> data, bool is_only_move)
 {
 	if (status != Status::waitingEval
@@ -541,6 +567,19 @@ void Solver::process(pBoard pos, Chess::Move move, std::shared_ptr<SolutionEntry
 		return;
 
 	eval_result = { data, move, is_only_move };
+	wake_up();
+}
+
+void Solver::onEnginePoolResult(quint64 key)
+{
+	if (status == Status::waitingEval && board && board->key() == key)
+		wake_up();
+}
+
+void Solver::wake_up()
+{
+	if (eval_loop)
+		eval_loop->quit();
 }
 
 void Solver::process_move(std::vector<pMove>& tree, SolverState& info)
@@ -616,6 +655,8 @@ void Solver::process_move(std::vector<pMove>& tree, SolverState& info)
 		move->size = 0;
 		quint64 signal_key = 0;
 		uint8_t num_winning_moves = info.num_winning_moves;
+		if (!info.is_alt())
+			prefetch_engine_moves(move->moves);
 		for (auto& m : move->moves) {
 			if (!m->is_solved()) {
 				tree.push_back(m);
@@ -835,7 +876,11 @@ void Solver::find_solution(SolverMove& move, SolverState& info, pMove& best_move
 	shared_ptr<Position> position;
 	shared_ptr<StateInfo> state;
 	size_t num_pieces = board->numPieces();
-	bool is_endgame = (num_pieces <= 4);
+	pMove egtb_move;
+	uint8_t egtb_dtz = egtb::DTZ_NONE;
+	if (to_save_endgames && num_pieces <= 5)
+		tie(egtb_move, egtb_dtz) = get_endgame_move();
+	bool is_endgame = (num_pieces <= 4) || egtb_move;
 	if (!is_endgame && !to_copy_solution && num_pieces == 5) {
 		tie(position, state) = boardToPosition(board);
 		is_endgame = is_endgame_available(position);
@@ -851,15 +896,13 @@ void Solver::find_solution(SolverMove& move, SolverState& info, pMove& best_move
 		// Endgame
 		if (is_endgame) {
 			list<SolverMove> endgame_moves;
-			uint8_t tb_dtz;
+			uint8_t tb_dtz = egtb::DTZ_NONE;
 			bool is_egtb_loaded = false;
-			//if (to_save_endgames) {
-			//	egtb_move = get_endgame_move();
-			//	if egtb_move:
-			//		val_dtz = egtb_move.time()
-			//		endgame_moves = [egtb_move]
-			//		is_egtb_loaded = True
-			//}
+			if (egtb_move) {
+				endgame_moves.push_back(*egtb_move);
+				tb_dtz = egtb_dtz;
+				is_egtb_loaded = true;
+			}
 			if (!is_egtb_loaded)
 				tie(endgame_moves, tb_dtz) = get_endgame_moves(board, position, !to_copy_solution);
 			if (tb_dtz != egtb::DTZ_NONE && tb_dtz >= egtb::DTZ_MAX) {
@@ -905,9 +948,8 @@ void Solver::find_solution(SolverMove& move, SolverState& info, pMove& best_move
 				}
 				best_move = make_shared<SolverMove>(*m_best);
 			}
-			//if self.to_save_endgames and not is_egtb_loaded:
-			//	best_move.set_data(best_move.score, best_move.depth(), val_dtz)
-			//	self.positions.save_endgame(board, best_move, zbytes)
+			if (to_save_endgames && !is_egtb_loaded)
+				save_endgame(best_move, tb_dtz);
 			update_max_move(best_move->score());
 			num_evaluated_endgames++;
 			if (!to_copy_solution && best_move->score() < MATE_VALUE - 267)
@@ -915,7 +957,10 @@ void Solver::find_solution(SolverMove& move, SolverState& info, pMove& best_move
 		}
 		else
 		{
+			auto t0 = steady_clock::now();
 			evaluate_position(move, info, best_move, solver_move);
+			if (position) // 5 pieces without the EGTB
+				egtb::TB_Reader::add_engine_time(egtb::board_to_name(*position), duration<double>(steady_clock::now() - t0).count());
 		}
 		is_solver_path = (solver_move && solver_move->pgMove == best_move->pgMove) || (is_solver_Watkins && (board->plyCount() < sol->WatkinsStartingPly));
 		if (!info.is_alt())
@@ -1166,20 +1211,37 @@ Solver::pMove Solver::get_engine_move(SolverMove& move, SolverState& info, bool
 
 	/// Ealuate.
 	eval_result.clear();
-	auto sleep_time = 0ms;
 	status = Status::waitingEval;
-	emit evaluatePosition();
+	// The pool searches with a fixed budget and MultiPV 2, so it only replaces the main engine in plain sessions
+	bool use_pool = engine_pool && engine_pool->isReady() && !re_ensure && !is_super_boost;
+	if (use_pool)
+		engine_pool->evaluate(board, static_cast<quint64>(s.std_engine_time) * NODES_PER_S, true);
+	else
+		emit evaluatePosition();
+	// Wait in a local event loop: it's woken up as soon as the result arrives, see wake_up()
+	QEventLoop loop;
+	eval_loop = &loop;
 	while (true) {
-		t_gui_update = steady_clock::now();
-		qApp->processEvents();
-		if (!eval_result.empty())
+		if (use_pool) {
+			EngineResult pool_result;
+			bool is_done = engine_pool->takeResult(board->key(), pool_result);
+			if (pool_result.data) {
+				eval_result = { pool_result.data, pool_result.move, pool_result.is_only_move };
+			}
+			else if (is_done || !engine_pool->contains(board->key())) {
+				// The pool engine failed => use the main engine
+				use_pool = false;
+				emit evaluatePosition();
+			}
+		}
+		if (!eval_result.empty() || status != Status::waitingEval)
 			break;
-		if (status != Status::waitingEval)
-			throw stopProcessing();
-		if (sleep_time < MAX_SLEEP_TIME)
-			sleep_time += 5ms;
-		this_thread::sleep_for(sleep_time);
+		loop.exec();
+		t_gui_update = steady_clock::now();
 	}
+	eval_loop = nullptr;
+	if (eval_result.empty())
+		throw stopProcessing();
 	status = Status::solving;
 
 	/// Process results.
@@ -1241,6 +1303,31 @@ Solver::pMove Solver::get_engine_move(SolverMove& move, SolverState& info, bool
 	return best_move;
 }
 
+void Solver::prefetch_engine_moves(const std::vector<pMove>& moves)
+{
+	if (!engine_pool || !engine_pool->isReady() || to_copy_solution)
+		return;
+
+	// Queue the replies that are likely to need the engine, so that the pool evaluates them
+	// while the solver is still busy with the preceding ones
+	quint64 num_nodes = static_cast<quint64>(s.std_engine_time) * NODES_PER_S;
+	for (auto& m : moves)
+	{
+		if (m->is_solved())
+			continue;
+		board->makeMove(m->move(board));
+		if (board->result().isNone()
+		    && board->numPieces() > 5
+		    && board->legalMoves().size() > 1
+		    && !skip_branches.count(board->key())
+		    && !get_existing(board)
+		    && !get_saved()
+		    && !(is_solver_path && get_solution_move()))
+			engine_pool->evaluate(board, num_nodes);
+		board->undoMove();
+	}
+}
+
 void Solver::update_max_move(int16_t score, QString move_sequence)
 {
 	int16_t mate_in = MATE_VALUE - score;
@@ -1358,39 +1445,42 @@ Solver::pMove Solver::get_saved() const
 	return make_shared<SolverMove>(pos_entry);
 }
 
-Solver::pMove Solver::find_cached_move() const
+Solver::pMove Solver::find_cached_move()
 {
-	Chess::Move best_move;
+	// Both plies are made on the Position, whose keys are the same as the keys of the board
+	::Move best_move = MOVE_NONE;
 	qint16 best_score = UNKNOWN_SCORE;
 	quint32 best_depthtime = 0;
-	shared_ptr<Chess::Board> temp_board(board->copy());
-	auto legal_moves = temp_board->legalMoves();
-	for (auto& move : legal_moves)
+	Position& pos = walk_position.sync(board);
+	for (const auto& move : MoveList<LEGAL>(pos))
 	{
-		Chess::Move move_i;
+		::Move move_i = MOVE_NONE;
 		qint16 score_i = UNKNOWN_SCORE;
 		quint32 depthtime_i = 0;
-		temp_board->makeMove(move);
-		for (auto& opp_move : temp_board->legalMoves())
+		StateInfo st_move;
+		pos.do_move(move, st_move);
+		for (const auto& opp_move : MoveList<LEGAL>(pos))
 		{
-			temp_board->makeMove(opp_move);
-			auto cached_move = get_existing(temp_board);
-			temp_board->undoMove();
-			if (!cached_move)
+			StateInfo st_opp_move;
+			pos.do_move(opp_move, st_opp_move);
+			auto it = positions.find(position_key(pos));
+			pos.undo_move(opp_move);
+			if (it == positions.end())
 			{
 				score_i = UNKNOWN_SCORE;
-				move_i = Chess::Move();
+				move_i = MOVE_NONE;
 				depthtime_i = 0;
 				break;
 			}
-			if (score_i == UNKNOWN_SCORE || cached_move->score() < score_i)
+			SolverMove cached_move(it->second);
+			if (score_i == UNKNOWN_SCORE || cached_move.score() < score_i)
 			{
-				score_i = cached_move->score();
+				score_i = cached_move.score();
 				move_i = move;
-				depthtime_i = cached_move->depth_time();
+				depthtime_i = cached_move.depth_time();
 			}
 		}
-		temp_board->undoMove();
+		pos.undo_move(move);
 		if (score_i != UNKNOWN_SCORE)
 		{
 			qint16 score_i_1 = score_i >= MATE_THRESHOLD ? (score_i - 1) : score_i;
@@ -1403,9 +1493,12 @@ Solver::pMove Solver::find_cached_move() const
 		}
 	}
 	// best_depthtime is for the best opp move only, it shouldn't be used
-	if (best_move.isNull())
+	if (best_move == MOVE_NONE)
+		return nullptr;
+	auto move = board->moveFromString(QString::fromStdString(UCI::move(best_move, pos.is_chess960())));
+	if (move.isNull())
 		return nullptr;
-	return make_shared<SolverMove>(best_move, board, best_score, best_depthtime);
+	return make_shared<SolverMove>(move, board, best_score, best_depthtime);
 }
 
 void Solver::add_existing(const SolverMove& move, bool is_stop_move)
@@ -1451,6 +1544,30 @@ void Solver::save_data(pcMove move, bool to_save)
 		sol->addToBook(board, move->toBytes(), only_upper_level ? FileType_positions_upper : FileType_positions_lower);
 }
 
+std::tuple<Solver::pMove, uint8_t> Solver::get_endgame_move() const
+{
+	if (!init_EGTB())
+		return { nullptr, egtb::DTZ_NONE };
+	auto eg1 = only_upper_level ? FileType_endgames_upper : FileType_endgames_lower;
+	auto eg2 = only_upper_level ? FileType_endgames_lower : FileType_endgames_upper;
+	auto entry = sol->bookEntry(board, eg1);
+	if (!entry)
+		entry = sol->bookEntry(board, eg2);
+	// The moves saved with other tablebases have to be probed again
+	if (!entry || entry->isNull() || entry->depth() != egtb_version())
+		return { nullptr, egtb::DTZ_NONE };
+	auto [move, tb_dtz] = from_saved_endgame_move(SolverMove(entry), board);
+	if (move.isNull())
+		return { nullptr, egtb::DTZ_NONE };
+	return { make_shared<SolverMove>(move), tb_dtz };
+}
+
+void Solver::save_endgame(pcMove move, uint8_t tb_dtz)
+{
+	auto saved = to_saved_endgame_move(*move, tb_dtz, board);
+	sol->addToBook(board, saved.toBytes(), only_upper_level ? FileType_endgames_upper : FileType_endgames_lower);
+}
+
 void Solver::save_alt(pcMove move)
 {
 	sol->addToBook(board, move->toBytes(), only_upper_level ? FileType_alts_upper : FileType_positions_lower);
@@ -1487,10 +1604,31 @@ bool Solver::create_book(pMove tree_front, int num_opening_moves)
 {
 	bool is_ok = true;
 	positions.clear();
+	book_nodes.clear();
+	book_events.clear();
 	prepared_transpositions.clear();
 	all_entries.clear();
 	num_processed = 0;
-	auto [num_nodes, score, saved_positions, transpositions] = prepare_moves(tree_front);
+	num_unused = 0;
+
+	// If the book saved in this session is still there, only the rows that have changed since then are patched
+	auto path_book = sol->path(only_upper_level ? FileType_book_upper : FileType_book);
+	auto& base = sol->book_bases[only_upper_level ? 0 : 1];
+	quint64 root_key = board->key();
+	QByteArray fingerprint = book_fingerprint();
+	bool is_patching = can_patch_book(path_book, root_key, fingerprint);
+	if (is_patching) {
+		old_book = make_unique<BookRowFinder>(path_book.toStdString());
+		changed_keys = &base.changed_keys;
+		is_patching = old_book->is_ok();
+		if (!is_patching)
+			old_book.reset();
+	}
+	qint16 score = prepare_moves(tree_front, BookNode::NONE);
+	if (is_patching)
+		prepare_patch();
+	add_book_entries();
+	size_t num_nodes = book_nodes.size();
 	bool is_their_turn = (board->sideToMove() != our_color);
 	qint16 tree_score = UNKNOWN_SCORE;
 	correct_score(tree_score, score, is_their_turn, tree_front);
@@ -1505,45 +1643,55 @@ bool Solver::create_book(pMove tree_front, int num_opening_moves)
 	                 .arg(num_opening_moves)
 	                 .arg(mate_score));
 	
-	auto path_book = sol->path(only_upper_level ? FileType_book_upper : FileType_book);
-	auto path_bak = Solution::ext_to_bak(path_book);
-	save_book(path_bak);
 	QFileInfo fi(path_book);
-	if (fi.exists())
-	{
-		if (sol->book_main) {
-			sol->book_main.reset();
-			sol->ram_budget += fi.size();
-		}
-		bool is_removed = QFile::remove(path_book);
-		if (!is_removed) {
-			emit Message(QString("Failed to delete the existing book:\n\n%1").arg(path_book), MessageType::error);
-			is_ok = false;
-		}
-	}
-	bool is_renamed = QFile::rename(path_bak, path_book);
+	if (fi.exists() && sol->book_main)
+		sol->closeMainBook();
+	bool is_renamed = is_patching ? patch_book(path_book) : save_book(path_book);
+	if (is_patching && is_renamed)
+		emit Message(QString("Book patched: %L1 rows written, %L2 rows removed").arg(all_entries.size()).arg(removed_keys.size()));
 	if (!is_renamed) {
-		emit Message(QString("Failed to save the book:\n\nTemporary file path: %1\nBook file path: %2").arg(path_bak).arg(path_book), MessageType::error);
+		emit Message(QString("Failed to save the book:\n\nTemporary file path: %1\nBook file path: %2").arg(Solution::ext_to_bak(path_book)).arg(path_book), MessageType::error);
 		is_ok = false;
 	}
-	if (transpositions.size()) {
-		emit Message(QString("Number of unused transpositions: %1").arg(transpositions.size()), MessageType::warning);
+	if (num_unused) {
+		emit Message(QString("Number of unused transpositions: %1").arg(num_unused), MessageType::warning);
 		is_ok = false;
 	}
-	if (saved_positions.size() != prepared_transpositions.size()) {
+	size_t num_saved = count_if(book_nodes.begin(), book_nodes.end(), [](const BookNode& node) { return node.is_transposition; });
+	if (num_saved != prepared_transpositions.size()) {
 		emit Message(QString("Number of saved transpositions %1 is different from the number of prepared transpositions %2")
-		                 .arg(saved_positions.size())
+		                 .arg(num_saved)
 		                 .arg(prepared_transpositions.size()),
 		             MessageType::warning);
 		is_ok = false;
 	}
-	//assert(saved_positions.size() == trans.size());
+	//assert(num_saved == trans.size());
+	book_nodes.clear();
+	book_nodes.shrink_to_fit();
+	book_events.clear();
+	book_events.shrink_to_fit();
 	prepared_transpositions.clear();
 	all_entries.clear();
+	removed_keys.clear();
+	num_patched_before.clear();
+	num_patched_before.shrink_to_fit();
+	changed_keys = nullptr;
+
+	/// The base to patch the book next time
+	fi.refresh();
+	if (is_renamed && skip_branches.empty() && fi.exists()) {
+		base.timestamp = fi.lastModified().toMSecsSinceEpoch();
+		base.size = fi.size();
+		base.root_key = root_key;
+		base.fingerprint = fingerprint;
+		base.changed_keys.clear();
+	}
+	else {
+		base = BookPatchBase();
+	}
 
 	if (is_ok)
 	{
-		fi.refresh();
 		QSettings s(sol->path(FileType_spec), QSettings::IniFormat);
 		s.beginGroup("info");
 		QString state_param = only_upper_level ? "state_upper_level" : "state_lower_level";
@@ -1564,108 +1712,297 @@ bool Solver::create_book(pMove tree_front, int num_opening_moves)
 	return is_ok;
 }
 
-void Solver::save_book(const QString& book_path)
+bool Solver::save_book(const QString& book_path)
 {
-	sort(all_entries.begin(), all_entries.end(),
-		[](EntryRow& a, EntryRow& b)
-		{
-			for (size_t i = 0; i < 8; i++) {
-			    if (reinterpret_cast<uint8_t&>(a[i]) < reinterpret_cast<uint8_t&>(b[i]))
-				    return true;
-			    if (reinterpret_cast<uint8_t&>(a[i]) > reinterpret_cast<uint8_t&>(b[i]))
-				    return false;
-			}
-			for (size_t i = 10; i < 12; i++) {
-			    if (reinterpret_cast<uint8_t&>(a[i]) < reinterpret_cast<uint8_t&>(b[i]))
-					return false;
-			    if (reinterpret_cast<uint8_t&>(a[i]) > reinterpret_cast<uint8_t&>(b[i]))
-					return true;
-			}
-			return true;
-		}
-	);
+	sort_entry_rows(all_entries);
+
+	// The book is written to a temporary file that replaces the old book at once
+	string path_book = book_path.toStdString();
+	string path_bak = Solution::ext_to_bak(book_path).toStdString();
+	BookRowWriter book(path_bak);
+	if (!all_entries.empty())
+		book.write_rows(all_entries.front().data(), all_entries.size());
+	error_code ec;
+	if (!book.close()) {
+		filesystem::remove(path_bak, ec);
+		return false;
+	}
+	filesystem::rename(path_bak, path_book, ec);
+	return !ec;
+}
 
-	ofstream book(book_path.toStdString(), ios::binary | ios::out | ios::trunc);
-	for (auto& entry : all_entries)
-		book.write(entry.data(), entry.size());
-	book.close();
+QByteArray Solver::book_fingerprint() const
+{
+	// Everything besides the saved data that the tree depends on: if any of it changes, the book is rebuilt in full
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	QString settings = QString("%1 %2 %3 %4 %5 %6 %7 %8 %9")
+	                       .arg(static_cast<int>(solver_mode))
+	                       .arg(static_cast<int>(move_order))
+	                       .arg(only_upper_level)
+	                       .arg(evaluate_endgames)
+	                       .arg(to_save_endgames)
+	                       .arg(s.score_limit)
+	                       .arg(score_hard_limit)
+	                       .arg(endgame5_score_limit)
+	                       .arg(limit_win);
+	settings += QString(" %1 %2 %3 %4")
+	                .arg(min_winning_sequence)
+	                .arg(max_alt_steps)
+	                .arg(solver_stop_score)
+	                .arg(QSettings().value("solver/egtb_preload", false).toBool());
+	hash.addData(settings.toUtf8());
+	hash.addData(EGTB_fingerprint());
+	return hash.result();
 }
 
-void update(MapT& elements, const MapT& new_elements)
+bool Solver::can_patch_book(const QString& book_path, quint64 root_key, const QByteArray& fingerprint) const
 {
-	for (const auto& elem : new_elements)
-		elements[elem.first] = elem.second;
+	if (!QSettings().value("solutions/patch_book", true).toBool())
+		return false;
+	auto& base = sol->book_bases[only_upper_level ? 0 : 1];
+	if (!base.timestamp
+	    || base.root_key != root_key
+	    || base.fingerprint != fingerprint
+	    || !skip_branches.empty())
+		return false;
+	// Nothing else has written the book since then
+	QFileInfo fi(book_path);
+	return fi.exists() && fi.size() == base.size && fi.lastModified().toMSecsSinceEpoch() == base.timestamp;
+}
+
+bool Solver::patch_book(const QString& book_path)
+{
+	sort_entry_rows(all_entries);
+
+	// If the same positions stay in the book, their rows are overwritten in place, through a log in the temporary file.
+	// Otherwise the book is merged with the patch into the temporary file, which then replaces the old book at once.
+	string path_book = book_path.toStdString();
+	string path_bak = Solution::ext_to_bak(book_path).toStdString();
+	if (removed_keys.empty() && overwrite_entry_rows(path_book, path_bak, all_entries))
+		return true;
+	if (!replay_entry_rows(path_book, path_bak))
+		return false;
+	error_code ec;
+	if (!merge_entry_rows(path_book, path_bak, all_entries, removed_keys)) {
+		filesystem::remove(path_bak, ec);
+		return false;
+	}
+	filesystem::rename(path_bak, path_book, ec);
+	return !ec;
 }
 
-std::tuple<quint32, qint16, MapT, MapT> Solver::prepare_moves(pMove& move)
+qint16 Solver::prepare_moves(pMove& move, uint32_t parent)
 {
-	// trans           - transpositions from the processing procedure
-	// positions       - all positions from the processing procedure
-	// prepared_transpositions - to accumulate all the transpositions in this function
-	// saved_positions - positions saved in this branch because they will be used as transpositions in the next branches
-	// transpositions  - transpositions used in this branch
+	// Pass 1 of the book assembly: the DFS of the tree that collects the positions with our turn (book_nodes)
+	// and the transpositions (book_events), and corrects the scores.
+	// trans                   - transpositions from the processing procedure
+	// prepared_transpositions - the nodes with the keys from trans, once their subtrees are finished
+	// parent                  - the last node with our turn above
+	// num_unused              - transpositions whose subtree hasn't been finished before them, or isn't in the tree
 
-	MapT saved_positions;
-	MapT transpositions;
 	bool is_their_turn = (board->sideToMove() != our_color);
 	assert(is_their_turn || move->moves.size() <= 1);
-	quint32 num_new_nodes = 0;
 	qint16 score = UNKNOWN_SCORE;
 	uint64_t key = board->key();
+	bool is_changed = old_book && changed_keys->count(key);
+	if (is_changed && parent != BookNode::NONE)
+		book_nodes[parent].is_patched = true; // the positions right after the parent may be different
 	if (move->moves.empty())
 	{
 		if (!is_their_turn)
 		{
 			auto it = prepared_transpositions.find(key);
 			if (it != prepared_transpositions.end()) {
-				auto& t = it->second;
-				if (transpositions.find(key) == transpositions.end())
-					transpositions[key] = t;
-				score = t->score;
+				book_events.push_back({ parent, it->second });
+				score = book_nodes[it->second].score;
 			}
 			auto it_skip = skip_branches.find(board->key());
 			if (it_skip != skip_branches.end()) {
 				auto row = entry_to_bytes(board->key(), 0, it_skip->second, 0);
 				all_entries.push_back(row);
 			}
+			else if (it == prepared_transpositions.end() && trans.count(key))
+				num_unused++;
 		}
 	}
 	else
 	{
 		for (auto& m : move->moves)
 		{
+			uint32_t node = parent;
+			if (!is_their_turn) {
+				node = static_cast<uint32_t>(book_nodes.size());
+				book_nodes.push_back({ key, 0, parent, 0, m->pgMove, 0, false, is_changed, false });
+			}
 			board->makeMove(m->move(board));
-			auto [sub_num_nodes, sub_score, new_saved_positions, new_transpositions] = prepare_moves(m);
-			num_new_nodes += sub_num_nodes;
+			qint16 sub_score = prepare_moves(m, node);
 			correct_score(score, sub_score, is_their_turn, m);
-			if (!is_their_turn)
-				expand_positions(new_saved_positions, new_transpositions);
 			board->undoMove();
-			update(saved_positions, new_saved_positions);
-			update(transpositions, new_transpositions);
 			if (is_their_turn)
 				continue;
 			// ONLY if not is_their_turn:
 			assert(move->moves.size() == 1);
-			num_new_nodes++;
-			quint32 num_nodes = num_new_nodes;
-			for (auto& d : transpositions)
-				num_nodes += d.second->num_nodes;
-			if (trans.find(key) != trans.end())
+			auto& book_node = book_nodes[node];
+			book_node.end = static_cast<uint32_t>(book_nodes.size());
+			book_node.score = m->score();
+			book_events.push_back({ node, BookNode::NONE });
+			if (old_book && book_node.is_patched)
+				check_patch(node, m);
+			if (trans.count(key))
 			{
-				assert(saved_positions.find(key) == saved_positions.end() && prepared_transpositions.find(key) == prepared_transpositions.end());
-				auto new_t = make_shared<Transposition>(num_new_nodes, new_saved_positions, new_transpositions, m->score());
-				prepared_transpositions[key] = new_t;
-				saved_positions[key] = new_t;
+				book_node.is_transposition = true;
+				prepared_transpositions[key] = node;
 			}
-			auto row = entry_to_bytes(board->key(), m->pgMove, m->score(), num_nodes);
-			all_entries.push_back(row);
 			num_processed++;
 			if (num_processed % 5000 == 0)
 				emit_message(QString("Prepared %1").arg(num_processed));
 		}
 	}
-	return { num_new_nodes, score, saved_positions, transpositions };
+	return score;
+}
+
+void Solver::check_patch(uint32_t node, pMove& m)
+{
+	// The data of the position or of a position right after it has changed since the book was saved.
+	// If the move is the same and so are the positions with our turn after the replies that have a row, only its row
+	// is patched. Otherwise the whole subtree is, and the old subtree is collected to remove the positions no longer in the book.
+	auto rows = old_book->rows(book_nodes[node].key);
+	bool is_same = (rows.size() == 1 && (rows.front().second >> 48) == book_nodes[node].pgMove);
+	if (is_same)
+	{
+		board->makeMove(m->move(board));
+		for (auto& reply : board->legalMoves())
+		{
+			auto pgMove = OpeningBook::moveToBits(board->genericMove(reply));
+			auto it = find_if(m->moves.begin(), m->moves.end(), [pgMove](const pMove& r) { return r->pgMove == pgMove; });
+			board->makeMove(reply);
+			quint64 key = board->key();
+			bool is_node = (it != m->moves.end()) && (!(*it)->moves.empty() || prepared_transpositions.count(key));
+			auto old_rows = old_book->rows(key);
+			bool was_node = !old_rows.empty() && (old_rows.front().second >> 48);
+			board->undoMove();
+			if (is_node != was_node) {
+				is_same = false;
+				break;
+			}
+		}
+		board->undoMove();
+	}
+	if (is_same)
+		return;
+	book_nodes[node].is_replaced = true;
+	collect_old_subtree();
+}
+
+void Solver::collect_old_subtree()
+{
+	// The DFS of the old book from the current position with our turn
+	quint64 key = board->key();
+	auto rows = old_book->rows(key);
+	if (rows.empty())
+		return;
+	auto pgMove = static_cast<quint16>(rows.front().second >> 48);
+	if (!pgMove || !old_subtree_visited.insert(key))
+		return;
+	old_subtree_keys.push_back(key);
+	for (auto& move : board->legalMoves())
+	{
+		if (OpeningBook::moveToBits(board->genericMove(move)) != pgMove)
+			continue;
+		board->makeMove(move);
+		for (auto& reply : board->legalMoves()) {
+			board->makeMove(reply);
+			collect_old_subtree();
+			board->undoMove();
+		}
+		board->undoMove();
+		break;
+	}
+}
+
+void Solver::prepare_patch()
+{
+	/// The positions of the old subtrees that are still in the book are patched, the rest are removed
+	if (!old_subtree_keys.empty())
+	{
+		FlatHashSet kept;
+		for (auto& node : book_nodes) {
+			if (old_subtree_visited.count(node.key)) {
+				node.is_patched = true;
+				kept.insert(node.key);
+			}
+		}
+		for (auto key : old_subtree_keys)
+			if (!kept.count(key))
+				removed_keys.push_back(key);
+		sort(removed_keys.begin(), removed_keys.end());
+	}
+	old_book.reset();
+	old_subtree_visited.clear();
+	old_subtree_keys.clear();
+
+	/// The subtrees of the nodes whose move has changed are patched as a whole
+	num_patched_before.assign(book_nodes.size() + 1, 0);
+	uint32_t replaced_end = 0;
+	for (uint32_t i = 0; i < book_nodes.size(); i++)
+	{
+		auto& node = book_nodes[i];
+		if (node.is_replaced)
+			replaced_end = max(replaced_end, node.end);
+		if (i < replaced_end)
+			node.is_patched = true;
+		num_patched_before[i + 1] = num_patched_before[i] + (node.is_patched ? 1 : 0);
+	}
+}
+
+void Solver::add_book_entries()
+{
+	// Pass 2 of the book assembly: the number of nodes of a position is the size of its subtree plus the sizes
+	// of the subtrees that the transpositions lead to, each counted once. A transposition always leads
+	// to a subtree finished before, which is outside the subtree with the transposition or inside it.
+	// So the nodes are processed in the order their subtrees are finished, keeping the maximal subtrees
+	// before each node that it leads to.
+	// When the book is patched, only the rows of the nodes that lead to a patched node are added.
+	vector<vector<uint32_t>> reached(book_nodes.size());
+	auto subtree_size = [this](uint32_t i) { return book_nodes[i].end - i; };
+	auto leads_to_patched = [this](uint32_t i) { return num_patched_before[book_nodes[i].end] != num_patched_before[i]; };
+	for (auto& [node, target] : book_events)
+	{
+		if (target != BookNode::NONE)
+		{
+			assert(book_nodes[target].num_nodes); // pass 1 only adds the transpositions to finished subtrees
+			if (node == BookNode::NONE || target >= node)
+				continue; // inside the subtree
+			auto& nodes = reached[node];
+			nodes.push_back(target);
+			nodes.insert(nodes.end(), reached[target].begin(), reached[target].end());
+			continue;
+		}
+
+		/// The subtree is finished
+		auto& nodes = reached[node];
+		sort(nodes.begin(), nodes.end());
+		size_t num_maximal = 0;
+		for (auto i : nodes)
+			if (num_maximal == 0 || i >= book_nodes[nodes[num_maximal - 1]].end)
+				nodes[num_maximal++] = i;
+		nodes.resize(num_maximal);
+		auto& book_node = book_nodes[node];
+		book_node.num_nodes = subtree_size(node);
+		for (auto i : nodes)
+			book_node.num_nodes += subtree_size(i);
+		if (num_patched_before.empty() || leads_to_patched(node) || any_of(nodes.begin(), nodes.end(), leads_to_patched)) {
+			auto row = entry_to_bytes(book_node.key, book_node.pgMove, book_node.score, book_node.num_nodes);
+			all_entries.push_back(row);
+		}
+		uint32_t parent = book_node.parent;
+		if (parent != BookNode::NONE)
+			for (auto i : nodes)
+				if (i < parent)
+					reached[parent].push_back(i);
+		if (!book_node.is_transposition)
+			vector<uint32_t>().swap(nodes);
+	}
 }
 
 void Solver::correct_score(qint16& score, qint16 sub_score, bool is_their_turn, pMove& m)
@@ -1697,34 +2034,6 @@ void Solver::correct_score(qint16& score, qint16 sub_score, bool is_their_turn,
 		score = new_score;
 }
 
-void Solver::expand_positions(MapT& saved_positions, MapT& transpositions)
-{
-	/// Merge all saved positions (depth=1)
-	MapT to_add;
-	for (auto& d : saved_positions)
-		update(to_add, d.second->sub_saved_positions);
-	update(saved_positions, to_add);
-	for (auto& d : transpositions)
-		update(saved_positions, d.second->sub_saved_positions);
-
-	/// Merge all transpositions (depth=1)
-	to_add.clear();
-	for (auto& d : transpositions)
-		for (auto& [sub_key, sub_t] : d.second->sub_trans_positions)
-			if (saved_positions.find(sub_key) == saved_positions.end())
-				to_add[sub_key] = sub_t;
-	update(transpositions, to_add);
-
-	/// Clear transpositions (after all sub-items have been expanded)
-	for (auto it = transpositions.begin(); it != transpositions.end();)
-	{
-		if (saved_positions.find(it->first) == saved_positions.end())
-			++it;
-		else
-			it = transpositions.erase(it);
-	}
-}
-
 void Solver::onLogUpdate()
 {
 	timer_log_update.stop();
@@ -1935,6 +2244,30 @@ std::vector<MoveInfo> Solver::moveList(Chess::Board* pos) const
 	return moves;
 }
 
+void Solver::log_memory_usage()
+{
+	auto to_MB = [](size_t bytes) { return QString::number(bytes / (1024.0 * 1024.0), 'f', 1); };
+	emit Message(QString("Hash tables: %L1 positions (%2 MB), %L3 new positions (%4 MB), %L5 transpositions (%6 MB)")
+	                 .arg(positions.size())
+	                 .arg(to_MB(positions.memory_usage()))
+	                 .arg(new_positions.size())
+	                 .arg(to_MB(new_positions.memory_usage()))
+	                 .arg(trans.size())
+	                 .arg(to_MB(trans.memory_usage())));
+}
+
+void Solver::save_TB_stats()
+{
+	// Next to the solution spec, accumulated over all the runs since the start or the last reset
+	QFileInfo fi(sol->path(FileType_spec));
+	QString path = QString("%1/%2_tb.csv").arg(fi.absolutePath()).arg(fi.completeBaseName());
+	QString error_text;
+	if (save_EGTB_stats(path, error_text))
+		emit Message(QString("EGTB probe statistics saved to %1").arg(path));
+	else
+		emit Message(QString("Failed to save EGTB probe statistics: %1").arg(error_text), MessageType::warning);
+}
+
 std::chrono::seconds Solver::log_update_time() const
 {
 	return (frequency_log_update == UpdateFrequency::always)      ? 0s
@@ -5,6 +5,7 @@
 #include "board/move.h"
 #include "board/board.h"
 #include "positioninfo.h"
+#include "flathash.h"
 
 #include <QString>
 #include <QPointer>
@@ -23,6 +24,9 @@
 
 
 struct SolutionEntry;
+class EnginePool;
+class QEventLoop;
+class BookRowFinder;
 
 
 constexpr static int8_t NO_ALT_STEPS = std::numeric_limits<int8_t>::lowest();
@@ -96,17 +100,33 @@ enum class SolverMode
 };
 
 
-struct Transposition;
-using MapT = std::map<uint64_t, std::shared_ptr<Transposition>>;
-
-struct LIB_EXPORT Transposition
+/*
+ * A position with our turn in the book being created. The nodes are numbered in the DFS order,
+ * so the subtree of node i is [i, end).
+ */
+struct LIB_EXPORT BookNode
 {
-	Transposition(quint32 num_nodes, MapT& sub_saved_positions, MapT& sub_trans_positions, qint16 score);
-	
-	quint32 num_nodes;
-	MapT sub_saved_positions;
-	MapT sub_trans_positions;
+	constexpr static uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+	uint64_t key;
+	uint32_t end;
+	uint32_t parent;
+	quint32 num_nodes; // 0 until counted
+	quint16 pgMove;
 	qint16 score;
+	bool is_transposition; // some transposition leads here
+	bool is_patched;       // the row is patched when the book is patched, and so are the rows of the nodes leading here
+	bool is_replaced;      // the move or the nodes right below have changed, so the whole subtree is patched
+};
+
+/*
+ * The DFS of the book, in order: a node whose subtree is finished (target is NONE),
+ * or a transposition in the subtree of the node that leads to the target node.
+ */
+struct BookEvent
+{
+	uint32_t node;
+	uint32_t target;
 };
 
 struct LIB_EXPORT MoveInfo
@@ -158,6 +178,8 @@ public:
 	void stop();
 	bool save(pBoard pos, Chess::Move move, std::shared_ptr<SolutionEntry> data, bool is_only_move, bool is_multi_pos);
 	void saveOverride(Chess::Board* pos, std::shared_ptr<SolutionEntry> data);
+	void setEngineTime(int std_engine_time, int add_engine_time); // [s], the other engine times are derived from them
+	void setEnginePool(std::shared_ptr<EnginePool> pool);
 	void process(pBoard pos, Chess::Move move, std::shared_ptr<SolutionEntry> data, bool is_only_move);
 
 signals:
@@ -172,6 +194,7 @@ public slots:
 	void onLogUpdate();
 	void onLogUpdateFrequencyChanged(UpdateFrequency frequency);
 	void onSolverMoveOrderChanged(SolverMoveOrder move_order);
+	void onEnginePoolResult(quint64 key);
 
 protected:
 	void init();
@@ -185,6 +208,7 @@ protected:
 	void evaluate_position(SolverMove& move, SolverState& info, pMove& best_move, pMove& solver_move);
 	pMove get_only_move(SolverMove& move, SolverState& info);
 	pMove get_engine_move(SolverMove& move, SolverState& info, bool is_super_boost);
+	void prefetch_engine_moves(const std::vector<pMove>& moves);
 	void update_max_move(int16_t score, QString move_sequence = "");
 	bool is_stop_move(const SolverMove& m, const SolverState& info) const;
 	pMove get_existing(pBoard board) const;
@@ -192,35 +216,57 @@ protected:
 	pMove get_esolution_move() const;
 	pMove get_alt_move() const;
 	pMove get_saved() const;
-	pMove find_cached_move() const;
+	std::tuple<pMove, uint8_t> get_endgame_move() const; // and the DTZ of the position
+	pMove find_cached_move();
 	void add_existing(const SolverMove& move, bool is_stop_move);
 	void save_data(pcMove move, bool to_save = true);
 	void save_alt(pcMove move);
+	void save_endgame(pcMove move, uint8_t tb_dtz);
 	bool create_book(pMove tree_front, int num_opening_moves);
-	void save_book(const QString& book_path);
-	std::tuple<quint32, qint16, MapT, MapT> prepare_moves(pMove& move);
+	bool save_book(const QString& book_path); // false if failed
+	QByteArray book_fingerprint() const;
+	bool can_patch_book(const QString& book_path, quint64 root_key, const QByteArray& fingerprint) const;
+	bool patch_book(const QString& book_path); // false if failed
+	qint16 prepare_moves(pMove& move, uint32_t parent);
+	void check_patch(uint32_t node, pMove& m);
+	void collect_old_subtree();
+	void prepare_patch();
+	void add_book_entries();
 	void correct_score(qint16& score, qint16 sub_score, bool is_their_turn, pMove& m);
-	void expand_positions(MapT& saved_positions, MapT& transpositions);
+	void log_memory_usage();
+	void save_TB_stats();
 	void emit_message(const QString& message, MessageType type = MessageType::std, bool force_no_warning = false, bool force_gui_update = false);
 	std::chrono::seconds log_update_time() const;
 	void update_gui(bool force = false);
+	void wake_up();
 
 protected:
 	std::shared_ptr<Solution> sol;
 	pBoard board;
-	std::map<uint64_t, int16_t> skip_branches;
+	FlatHashMap<int16_t> skip_branches;
 	Chess::Side our_color;
 	std::vector<pMove> tree;
 	SolverState tree_state;
 	Status status;
 	int16_t max_num_moves;
-	std::map<uint64_t, quint64> positions;
-	std::set<uint64_t> trans;
-	std::map<uint64_t, quint64> new_positions;
+	FlatHashMap<quint64> positions;
+	FlatHashSet trans;
+	FlatHashMap<quint64> new_positions;
 	std::shared_ptr<SolverSession> solver_session;
 	SolverEvalResult eval_result;
-	MapT prepared_transpositions;
+	std::shared_ptr<EnginePool> engine_pool;
+	QEventLoop* eval_loop;
+	std::vector<BookNode> book_nodes;
+	std::vector<BookEvent> book_events;
+	FlatHashMap<uint32_t> prepared_transpositions;
 	std::vector<EntryRow> all_entries;
+	std::unique_ptr<BookRowFinder> old_book; // the book being patched
+	const FlatHashSet* changed_keys;
+	FlatHashSet old_subtree_visited;
+	std::vector<uint64_t> old_subtree_keys;
+	std::vector<uint64_t> removed_keys;
+	std::vector<uint32_t> num_patched_before; // number of the patched nodes before each node
+	size_t num_unused;                        // number of the transpositions to a subtree not in the book before them
 
 	QTimer timer_log_update;
 	UpdateFrequency frequency_log_update;
@@ -229,13 +275,17 @@ protected:
 	std::chrono::steady_clock::time_point t_gui_update;
 	LineToLog line_to_log;
 	quint64 last_engine_key;
+	PositionTracker walk_position; // follows the board through the tree
 
 private:
+	SolverMode solver_mode;
 	bool to_copy_solution;
 	bool to_allow_override_when_copying;
 	bool only_upper_level;
 	bool is_final_assembly;
 	qint16 limit_win;
+	int std_engine_time; // [s]
+	int add_engine_time; // [s]
 	int min_winning_sequence;
 	bool check_depth_limit;
 	bool to_fix_engine_v0;
@@ -251,7 +301,6 @@ private:
 	bool to_recheck_endgames;
 	int rechecked_good_endgames;
 	std::list<QString> rechecked_bad_endgames;
-	std::map<std::string, int> TBs_needed;
 	int update_step;
 	size_t max_num_iterations;
 	bool is_solver_Watkins;
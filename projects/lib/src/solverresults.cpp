@@ -1,4 +1,5 @@
 #include "solverresults.h"
+#include "bookmerge.h"
 #include "solutionbook.h"
 #include "tb/egtb/tb_reader.h"
 #include "tb/egtb/elements.h"
@@ -7,8 +8,12 @@
 
 #include <fstream>
 #include <utility>
+#include <algorithm>
 #include <vector>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <exception>
 
 using namespace std;
 using namespace std::chrono;
@@ -35,42 +40,75 @@ void SolverResults::merge_books(std::list<QString> books, const std::string& fil
 	// Assuming each book has one entry/move for each key.
 	// Duplicates are saved, except for null-move duplicates.
 	
-	size_t num_duplicates = 0;
-	size_t num_null_duplicates = 0;
-	size_t num_elements = 0;
+	size_t num_duplicates;
+	size_t num_null_duplicates;
 
-	/// Load
-	map<uint64_t, list<uint64_t>> all_entries;
+	/// Merge
+	// The books are sorted by key, so they are merged in one pass with bounded memory.
+	list<BookRowReader> readers;
 	for (auto& path_i : books)
+		readers.emplace_back(path_i.toStdString());
+	for (;;)
 	{
-		//auto path_i = path(type, FileSubtype::Std);
-		map<uint64_t, uint64_t> entries = read_book(path_i.toStdString());
-		for (auto& [key, val] : entries)
+		num_duplicates = 0;
+		num_null_duplicates = 0;
+		BookRowWriter file(file_to_save);
+		vector<uint64_t> values;
+		for (;;)
 		{
-			auto it = all_entries.find(key);
-			if (it == all_entries.end())
-			{
-				all_entries[key] = {val};
-			}
-			else
+			auto it_min = readers.end();
+			for (auto it = readers.begin(); it != readers.end(); ++it)
+				if (!it->at_end() && (it_min == readers.end() || it->key() < it_min->key()))
+					it_min = it;
+			if (it_min == readers.end())
+				break;
+			uint64_t key = it_min->key();
+			values.clear();
+			for (auto& reader : readers)
 			{
+				if (reader.at_end() || reader.key() != key)
+					continue;
+				uint64_t val = reader.value();
+				reader.next_key();
+				if (values.empty()) {
+					values.push_back(val);
+					continue;
+				}
 				uint64_t move = val >> 48;
 				if (move)
 				{
-					uint64_t prev_move = it->second.back() >> 48;
+					uint64_t prev_move = values.back() >> 48;
 					if (!prev_move) {
-						it->second.pop_back();
+						values.pop_back();
 						num_null_duplicates++;
 					}
-					it->second.push_back(val);
+					values.push_back(val);
 				}
 				else {
 					num_null_duplicates++;
 				}
 				num_duplicates++;
 			}
-			num_elements++;
+			for (auto& val : values)
+				file.write(key, val);
 		}
+		bool is_ok = file.close();
+		for (auto& reader : readers)
+			is_ok = is_ok && reader.is_ok();
+		if (!is_ok) {
+			emit_message(QString("Merge books: Failed to write %1").arg(QString::fromStdString(file_to_save)), MessageType::error);
+			return;
+		}
+		auto it_unsorted = find_if(readers.begin(), readers.end(), [](const BookRowReader& reader) { return !reader.is_sorted(); });
+		if (it_unsorted == readers.end())
+			break;
+		// An unsorted book: sort it in memory and start over
+		if (!it_unsorted->load_sorted()) {
+			emit_message("Merge books: Failed to read the books", MessageType::error);
+			return;
+		}
+		for (auto& reader : readers)
+			reader.rewind();
 	}
 
 	/// Check duplicates
@@ -83,23 +121,10 @@ void SolverResults::merge_books(std::list<QString> books, const std::string& fil
 	else
 		emit_message("Merge books: No duplicates");
 	
-	/// Save
-	uintmax_t filesize = num_elements * 16;
-	vector<char> data_to_save(filesize);
-	size_t n = 0;
-	for (auto& [key, values] : all_entries) {
-		for (auto& val : values) {
-			save_bigendian(key, data_to_save.data() + n);
-			save_bigendian(val, data_to_save.data() + n + 8);
-			n += 16;
-		}
-	}
-	ofstream file(file_to_save, ios::binary | ios::out | ios::trunc);
-	file.write((const char*)data_to_save.data(), filesize);
 	emit_message(QString("Merge books: %1 merged").arg(sol->nameToShow(true)));
 }
 
-void SolverResults::verify(FileType book_type)
+void SolverResults::verify(FileType book_type, int num_threads)
 {
 	if (status != Status::idle) {
 		emit Message(QString("It's already been started."));
@@ -128,9 +153,11 @@ void SolverResults::verify(FileType book_type)
 		v_num_analysed = 0;
 		v_min_stop_score = MATE_VALUE;
 		v_min_stop_TB_score = MATE_VALUE;
-		v_already_analysed.clear();
+		v_num_saved = 0;
+		v_memo.clear();
+		v_stop = false;
+		v_num_processed = 0;
 		v_tb_needed.clear();
-		v_deepness = 0;
 
 		if (sol->fileExists(book_type))
 		{
@@ -138,7 +165,60 @@ void SolverResults::verify(FileType book_type)
 			bool is_ok = v_book->read(path_book);
 			if (is_ok)
 			{
-				auto [is_ok, score, num_nodes] = verify_move(true);
+				/// Verify
+				// Each worker walks the whole book from the root on its own board, skipping the positions
+				// that the others are verifying. The first worker to finish the root stops the others.
+				init_EGTB(); // before the workers probe it
+				if (num_threads <= 0)
+					num_threads = QSettings().value("engine/threads", 2).toInt();
+				num_threads = max(1, num_threads);
+				vector<VerifyWorker> workers(num_threads);
+				for (auto& worker : workers)
+					worker.board.reset(board->copy());
+				VerifyLog root_log;
+				exception_ptr worker_error;
+				mutex mtx_error;
+				auto run = [&](VerifyWorker& worker)
+				{
+					try
+					{
+						VerifyLog log;
+						auto [flag, _score, _num_nodes] = verify_move(worker, true, log);
+						if (!v_stop.exchange(true)) {
+							is_ok = flag;
+							root_log = std::move(log);
+						}
+					}
+					catch (...)
+					{
+						lock_guard<mutex> lock(mtx_error);
+						if (!worker_error)
+							worker_error = current_exception();
+						v_stop = true;
+					}
+				};
+				vector<std::thread> threads;
+				for (auto& worker : workers)
+					threads.emplace_back(run, std::ref(worker));
+				size_t num_reported = 0;
+				while (!v_stop)
+				{
+					this_thread::sleep_for(50ms);
+					size_t num_processed = v_num_processed / 10'000 * 10'000;
+					if (num_processed > num_reported) {
+						num_reported = num_processed;
+						emit_message(QString(" %L1 nodes processed").arg(num_processed));
+					}
+					else {
+						update_gui();
+					}
+				}
+				for (auto& t : threads)
+					t.join();
+				if (worker_error)
+					rethrow_exception(worker_error);
+				replay_verification(root_log);
+
 				QSettings s(sol->path(FileType_spec), QSettings::IniFormat);
 				s.beginGroup("info");
 				QString state_param = (book_type == FileType_book_upper) ? "state_upper_level" : "state_lower_level";
@@ -160,7 +240,7 @@ void SolverResults::verify(FileType book_type)
 						emit Message(QString("Maximum not solved win: #%1").arg(MATE_VALUE - v_min_stop_score));
 					if (v_min_stop_TB_score < MATE_VALUE)
 						emit Message(QString("Maximum not solved EG win: #%1").arg(MATE_VALUE - v_min_stop_TB_score));
-					if (v_already_analysed.size() != v_num_analysed + v_num_TBs && v_already_analysed.size() != v_num_analysed)
+					if (v_num_saved != v_num_analysed + v_num_TBs && v_num_saved != v_num_analysed)
 						emit Message("Incorrect values", MessageType::warning);
 				}
 				else
@@ -205,51 +285,51 @@ void SolverResults::verify(FileType book_type)
 		emit Message("Error while verifying. Please restart the app.");
 	}
 
-	v_already_analysed.clear();
+	v_memo.clear();
 	v_tb_needed.clear();
 	v_book.reset();
 	status = Status::idle;
 	emit solvingStatusChanged();
 }
 
-std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
+std::tuple<bool, qint16, quint32> SolverResults::verify_move(VerifyWorker& worker, bool is_our_turn, VerifyLog& log)
 {
-	if (v_deepness > 150)
+	// Runs in the worker threads: the messages and counters go to the log (see replay_verification())
+	auto& board = worker.board;
+	if (v_stop.load(memory_order_relaxed))
+		return { false, 0, 0 }; // the root is verified by another worker
+	if (worker.deepness > 150)
 	{
-		emit Message(QString("Bad deepness: %1").arg(get_move_stack(board)), MessageType::error);
+		log.add_message(QString("Bad deepness: %1").arg(get_move_stack(board)), MessageType::error);
 		return { false, 0, 0 };
 	}
 	qint16 score = MATE_VALUE;
 	quint32 num_nodes = 0;
 
-	auto get_book_moves = [this]()
+	auto get_book_moves = [this, &board]()
 	{
 		auto moves = v_book->bookEntries(board->key());
 		moves.sort(std::not_fn(SolutionEntry::compare));
 		auto move_score = moves.empty() ? UNKNOWN_SCORE : moves.front().score();
 		return make_tuple(moves, move_score);
 	};
-	auto add_tb_needed = [this](const string& tb_name, qint16 new_tb_val)
+	auto add_tb_needed = [&log](const string& tb_name, qint16 new_tb_val)
 	{
-		auto it_tb = v_tb_needed.find(tb_name);
-		if (it_tb == v_tb_needed.end()) {
-			emit_message(QString("Skipped TB: %1").arg(tb_name.c_str()));
-			v_tb_needed[tb_name] = new_tb_val;
-		}
-		else if (new_tb_val > it_tb->second) {
-			it_tb->second = new_tb_val;
-		}
+		log.add(VerifyEvent::Type::tb_needed, new_tb_val, QString::fromStdString(tb_name));
 	};
 
 	if (is_our_turn)
 	{
 		auto [moves, move_score] = get_book_moves();
 		/// Skip transpositions
-		auto it = v_already_analysed.find(board->key());
-		if (it != v_already_analysed.end()) {
-			auto [already_score, already_num_nodes] = it->second;
+		quint64 key = board->key();
+		qint16 already_score;
+		quint32 already_num_nodes;
+		if (v_memo.find(key, already_score, already_num_nodes)) {
+			log.add_position(key);
 			return { true, already_score, already_num_nodes };
 		}
+		auto log_mark = log.mark();
 		bool to_save = true;
 		if (!moves.empty())
 		{
@@ -257,39 +337,41 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 			if (num_pieces <= 4)
 			{
 				using namespace egtb;
-				v_num_overridden_TBs++;
+				log.num_overridden_TBs++;
 				auto [pos, st] = boardToPosition(board);
 				string tb_name = board_to_name(*pos);
 				if (tb_name.empty()) {
-					emit Message(QString("Failed to read EGTB: %1").arg(get_move_stack(board)), MessageType::error);
+					log.add_message(QString("Failed to read EGTB: %1").arg(get_move_stack(board)), MessageType::error);
 					return { false, 0, 0 };
 				}
 				qint16 new_tb_val = MATE_VALUE - abs(move_score);
 				add_tb_needed(tb_name, new_tb_val);
 			}
 			if (moves.size() != 1) {
-				emit_message(QString("Number of moves is %1! Checking only the first one: %2").arg(moves.size()).arg(get_move_stack(board)), MessageType::warning);
+				log.add_message(QString("Number of moves is %1! Checking only the first one: %2").arg(moves.size()).arg(get_move_stack(board)), MessageType::warning, true);
 				//return { false, 0, 0 };
 			}
 			if (move_score <= ABOVE_EG) {
-				emit Message(QString("Incorrect mate information: %1! %2").arg(move_score).arg(get_move_stack(board)), MessageType::error);
+				log.add_message(QString("Incorrect mate information: %1! %2").arg(move_score).arg(get_move_stack(board)), MessageType::error);
 				return { false, 0, 0 };
 			}
 			auto move = moves.front().move(board);
 			if (!board->isLegalMove(move))
 			{
 				if (move.isNull()) {
-					emit_message(QString("STOP move #%1: %2").arg(FAKE_MATE_VALUE - move_score).arg(get_move_stack(board)), MessageType::info);
+					log.add_message(QString("STOP move #%1: %2").arg(FAKE_MATE_VALUE - move_score).arg(get_move_stack(board)), MessageType::info, true);
 					return { true, move_score, 0 };
 				}
-				emit Message(QString("Illegal move: %1! %2").arg(moves.front().san(board)).arg(get_move_stack(board)), MessageType::error);
+				log.add_message(QString("Illegal move: %1! %2").arg(moves.front().san(board)).arg(get_move_stack(board)), MessageType::error);
 				return { false, 0, 0 };
 			}
+			v_memo.set_busy(key, true);
 			board->makeMove(move);
-			v_deepness++;
-			auto [flag, next_score, next_num_nodes] = verify_move(!is_our_turn);
-			v_deepness--;
+			worker.deepness++;
+			auto [flag, next_score, next_num_nodes] = verify_move(worker, !is_our_turn, log);
+			worker.deepness--;
 			board->undoMove();
+			v_memo.set_busy(key, false);
 			score = move_score;
 			num_nodes = moves.front().learn;
 			if (flag)
@@ -318,13 +400,10 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 						if (is_4_pieces)
 						{
 							if (move_score >= MATE_VALUE) {
-								emit Message(QString("Incorrect EG score: %1! %2").arg(move_score).arg(get_move_stack(board)), MessageType::error);
+								log.add_message(QString("Incorrect EG score: %1! %2").arg(move_score).arg(get_move_stack(board)), MessageType::error);
 								return { false, 0, 0 };
 							}
-							if (move_score < v_min_stop_TB_score) {
-								v_min_stop_TB_score = move_score;
-								emit_message(QString("Not solved EG win #%1").arg(MATE_VALUE - v_min_stop_TB_score).arg(get_move_stack(board)));
-							}
+							log.add(VerifyEvent::Type::stop_TB_score, move_score, get_move_stack(board));
 						}
 						else
 						{
@@ -333,22 +412,22 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 								if (PRINT_STOP_SCORE) {
 									qint16 diff = move_score - (next_score - 1);
 									QString str_diff = (diff >= 0) ? QString("+%1").arg(diff) : QString::number(diff);
-									emit_message(QString("Stop score #%1 != Next score %2 %3").arg(MATE_VALUE - move_score).arg(str_diff).arg(get_move_stack(board)));
+									log.add_message(QString("Stop score #%1 != Next score %2 %3").arg(MATE_VALUE - move_score).arg(str_diff).arg(get_move_stack(board)), MessageType::std, true);
 								}
 							}
 							else
 							{
-								emit Message(QString("Incorrect score: %1 %2").arg(move_score).arg(get_move_stack(board)));
+								log.add_message(QString("Incorrect score: %1 %2").arg(move_score).arg(get_move_stack(board)));
 								return { false, 0, 0 };
 							}
 						}
-						v_num_analysed--; //??
+						log.num_analysed--; //??
 						to_save = false;
 					}
 					board->undoMove();
 				}
 				if (num_nodes < next_num_nodes && num_nodes > 1) {
-					emit Message(QString("Incorrect num nodes: %L1 < %L2 %3").arg(num_nodes).arg(next_num_nodes).arg(get_move_stack(board)));
+					log.add_message(QString("Incorrect num nodes: %L1 < %L2 %3").arg(num_nodes).arg(next_num_nodes).arg(get_move_stack(board)));
 					return { false, 0, 0 };
 				}
 			}
@@ -359,17 +438,14 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 					if (move_score > ABOVE_EG)
 					{
 						if (move_score >= MATE_VALUE) {
-							emit Message(QString("Incorrect next score: %1! %2").arg(move_score).arg(get_move_stack(board)), MessageType::error);
+							log.add_message(QString("Incorrect next score: %1! %2").arg(move_score).arg(get_move_stack(board)), MessageType::error);
 							return { false, 0, 0 };
 						}
-						if (move_score < v_min_stop_score) {
-							v_min_stop_score = move_score;
-							emit_message(QString("Not solved win #%1: %2").arg(MATE_VALUE - v_min_stop_score).arg(get_move_stack(board)));
-						}
+						log.add(VerifyEvent::Type::stop_score, move_score, get_move_stack(board));
 					}
 					else
 					{
-						emit_message(QString("No solution with score %1! %2").arg(move_score).arg(get_move_stack(board)));
+						log.add_message(QString("No solution with score %1! %2").arg(move_score).arg(get_move_stack(board)), MessageType::std, true);
 					}
 				}
 				else
@@ -377,9 +453,8 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 					return { false, 0, 0 };
 				}
 			}
-			v_num_analysed++;
-			if (v_num_analysed % 10'000 == 0)
-				emit_message(QString(" %L1 nodes processed").arg(v_num_analysed));
+			log.num_analysed++;
+			v_num_processed.fetch_add(1, memory_order_relaxed);
 		}
 		else if (board->result().winner() == our_color)
 		{ // It's a win
@@ -397,22 +472,22 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 				auto [pos, st] = boardToPosition(board);
 				string tb_name = board_to_name(*pos);
 				if (tb_name.empty()) {
-					emit Message(QString("Failed to read EGTB: %1").arg(get_move_stack(board)), MessageType::error);
+					log.add_message(QString("Failed to read EGTB: %1").arg(get_move_stack(board)), MessageType::error);
 					return { false, 0, 0 };
 				}
 				int16_t tb_val;
 				uint8_t tb_dtz;
 				bool is_error = TB_Reader::probe_EGTB(*pos, tb_val, tb_dtz);
 				if (is_error) {
-					emit Message(QString("Failed to probe EGTB: %1").arg(get_move_stack(board)), MessageType::error);
+					log.add_message(QString("Failed to probe EGTB: %1").arg(get_move_stack(board)), MessageType::error);
 					return { false, 0, 0 };
 				}
 				if ((is_our_turn && tb_val < 1) || (!is_our_turn && tb_val > -1)) {
-					emit Message(QString("Not winning EG: %1").arg(get_move_stack(board)), MessageType::error);
+					log.add_message(QString("Not winning EG: %1").arg(get_move_stack(board)), MessageType::error);
 					return { false, 0, 0 };
 				}
 				if (tb_dtz >= 100) { // tb_dtz can be 0 if EGTB is compressed
-					emit Message(QString("DTZ = %1! %2").arg(tb_dtz).arg(get_move_stack(board)));
+					log.add_message(QString("DTZ = %1! %2").arg(tb_dtz).arg(get_move_stack(board)));
 					return { false, 0, 0 };
 				}
 				auto m1 = board->MoveHistory().back().move;
@@ -423,18 +498,17 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 				board->makeMove(m2);
 				board->makeMove(m1);
 				if (prev_move_score == UNKNOWN_SCORE)  {
-					emit Message(QString("Unknown move history: %1").arg(get_move_stack(board)));
+					log.add_message(QString("Unknown move history: %1").arg(get_move_stack(board)));
 					return { false, 0, 0 };
 				}
 				qint16 new_tb_val = MATE_VALUE - (prev_move_score + 1);
-				auto it = v_already_analysed.find(board->key());
-				if (it == v_already_analysed.end())
+				if (!v_memo.find(board->key(), already_score, already_num_nodes))
 				{
 					bool to_add_tb = !TO_CHECK_TB;
 					if (TO_CHECK_TB)
 					{
 						if (prev_move_score + 1 != MATE_VALUE - tb_val / 2) {
-							emit_message(QString("%1 != %2 for 2 plies back: %3").arg(prev_move_score + 1).arg(MATE_VALUE - tb_val / 2).arg(get_move_stack(board)));
+							log.add_message(QString("%1 != %2 for 2 plies back: %3").arg(prev_move_score + 1).arg(MATE_VALUE - tb_val / 2).arg(get_move_stack(board)), MessageType::std, true);
 							//return { false, 0, 0 };
 						}
 					}
@@ -447,32 +521,71 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 				{
 					add_tb_needed(tb_name, new_tb_val);
 				}
-				v_num_TBs++;
+				log.num_TBs++;
 			}
 			else
 			{
-				//emit Message(QString("No solution %1: %2").arg(moves.size()).arg(get_move_stack(board)), MessageType::error);
+				//log.add_message(QString("No solution %1: %2").arg(moves.size()).arg(get_move_stack(board)), MessageType::error);
 				return { false, UNKNOWN_SCORE, 0 };
 			}
 		}
 		if (to_save)
-			v_already_analysed[board->key()] = { move_score, moves.front().learn };
+		{
+			// The events of the position are kept with it and replayed the first time it's reached
+			VerifyMemo::Node node{ move_score, moves.front().learn, log.split(log_mark) };
+			v_memo.insert(key, std::move(node));
+			log.add_position(key);
+		}
 	}
 	else
 	{
+		// The replies that another worker is verifying are left for later. The results are combined
+		// in the order of the moves, so the first failed reply is the same as in a sequential walk.
 		auto legal_moves = board->legalMoves();
+		int num_moves = legal_moves.size();
+		vector<tuple<bool, qint16, quint32>> results(num_moves);
+		vector<VerifyLog> logs(num_moves);
+		vector<int> deferred;
+		int i_failed = num_moves;
+		auto verify_reply = [&](int i, bool to_defer)
+		{
+			board->makeMove(legal_moves[i]);
+			if (to_defer && v_memo.is_busy(board->key())) {
+				board->undoMove();
+				deferred.push_back(i);
+				return true;
+			}
+			worker.deepness++;
+			results[i] = verify_move(worker, !is_our_turn, logs[i]);
+			worker.deepness--;
+			board->undoMove();
+			return get<0>(results[i]);
+		};
+		for (int i = 0; i < num_moves; i++)
+		{
+			if (!verify_reply(i, true)) {
+				i_failed = i;
+				break;
+			}
+		}
+		for (int i : deferred)
+		{
+			if (i > i_failed)
+				break;
+			if (!verify_reply(i, false)) {
+				i_failed = i;
+				break;
+			}
+		}
 		num_nodes = 0;
-		for (auto& m : legal_moves)
+		for (int i = 0; i < num_moves && i <= i_failed; i++)
 		{
-			board->makeMove(m);
-			v_deepness++;
-			auto [flag, next_score, next_num_nodes] = verify_move(!is_our_turn);
-			v_deepness--;
+			auto [flag, next_score, next_num_nodes] = results[i];
+			log.append(std::move(logs[i]));
 			if (next_score < score)
 				score = next_score;
 			if (next_num_nodes > num_nodes)
 				num_nodes = next_num_nodes;
-			board->undoMove();
 			if (!flag)
 				return { false, next_score, next_num_nodes };
 		}
@@ -480,6 +593,68 @@ std::tuple<bool, qint16, quint32> SolverResults::verify_move(bool is_our_turn)
 	return { true, score, num_nodes };
 }
 
+void SolverResults::replay_verification(const VerifyLog& log)
+{
+	// Reports what the workers found in the order of a sequential walk: a saved position is reported
+	// the first time it's reached, the other times it's a transposition
+	v_num_analysed += log.num_analysed;
+	v_num_TBs += log.num_TBs;
+	v_num_overridden_TBs += log.num_overridden_TBs;
+	size_t i_position = 0;
+	auto replay_positions = [this, &log, &i_position](size_t num_positions)
+	{
+		for (; i_position < num_positions; i_position++)
+		{
+			auto node = v_memo.node(log.positions[i_position]);
+			if (node && !node->is_replayed)
+			{
+				node->is_replayed = true;
+				v_num_saved++;
+				replay_verification(node->log);
+			}
+		}
+	};
+	for (auto& event : log.events)
+	{
+		replay_positions(event.num_positions);
+		switch (event.type)
+		{
+		case VerifyEvent::Type::tb_needed:
+		{
+			string tb_name = event.text.toStdString();
+			auto it_tb = v_tb_needed.find(tb_name);
+			if (it_tb == v_tb_needed.end()) {
+				emit_message(QString("Skipped TB: %1").arg(event.text));
+				v_tb_needed[tb_name] = event.value;
+			}
+			else if (event.value > it_tb->second) {
+				it_tb->second = event.value;
+			}
+			break;
+		}
+		case VerifyEvent::Type::stop_score:
+			if (event.value < v_min_stop_score) {
+				v_min_stop_score = event.value;
+				emit_message(QString("Not solved win #%1: %2").arg(MATE_VALUE - v_min_stop_score).arg(event.text));
+			}
+			break;
+		case VerifyEvent::Type::stop_TB_score:
+			if (event.value < v_min_stop_TB_score) {
+				v_min_stop_TB_score = event.value;
+				emit_message(QString("Not solved EG win #%1").arg(MATE_VALUE - v_min_stop_TB_score).arg(event.text));
+			}
+			break;
+		case VerifyEvent::Type::message:
+			emit Message(event.text, event.message_type);
+			break;
+		case VerifyEvent::Type::counted_message:
+			emit_message(event.text, event.message_type);
+			break;
+		}
+	}
+	replay_positions(log.positions.size());
+}
+
 void SolverResults::shorten()
 {
 	if (status != Status::idle)
@@ -550,9 +725,7 @@ void SolverResults::shorten()
 				emit Message(QString("Max not best delta: %1").arg(s_max_not_best));
 				emit Message("Creating a book...");
 				QString path_book_short = sol->path(FileType_book_short);
-				save_book(path_book_short);
-				QFileInfo fi(path_book_short);
-				if (fi.exists())
+				if (save_book(path_book_short))
 					emit Message("Done");
 				else
 					emit Message(QString("Failed to save the \"%1\" book").arg(path_book_short), MessageType::error);
@@ -5,12 +5,14 @@
 #include "board/move.h"
 #include "board/board.h"
 #include "positioninfo.h"
+#include "verifymemo.h"
 
 #include <memory>
 #include <list>
 #include <set>
 #include <map>
 #include <tuple>
+#include <atomic>
 
 
 class LIB_EXPORT SolverResults : public Solver
@@ -21,11 +23,17 @@ public:
 	SolverResults(std::shared_ptr<Solution> solution);
 
 	void merge_books(std::list<QString> books, const std::string& file_to_save);
-	void verify(FileType book_type);
+	void verify(FileType book_type, int num_threads = 0); // 0 for the "engine/threads" setting
 	void shorten();
 
 private:
-	std::tuple<bool, qint16, quint32> verify_move(bool is_our_turn);
+	struct VerifyWorker
+	{
+		std::shared_ptr<Chess::Board> board;
+		int deepness = 0;
+	};
+	std::tuple<bool, qint16, quint32> verify_move(VerifyWorker& worker, bool is_our_turn, VerifyLog& log);
+	void replay_verification(const VerifyLog& log);
 	void shorten_move();
 	std::shared_ptr<SolutionEntry> get_engine_data();
 	std::shared_ptr<SolutionEntry> get_alt_data();
@@ -37,9 +45,11 @@ private:
 	int v_num_analysed;
 	qint16 v_min_stop_score;
 	qint16 v_min_stop_TB_score;
-	std::map<quint64, std::tuple<qint16, quint32>> v_already_analysed;
+	size_t v_num_saved;
+	VerifyMemo v_memo;
+	std::atomic<bool> v_stop;
+	std::atomic<size_t> v_num_processed;
 	std::map<std::string, qint16> v_tb_needed;
-	int v_deepness;
 	std::shared_ptr<SolutionBook> v_book;
 
 private:
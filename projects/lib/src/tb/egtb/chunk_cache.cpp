@@ -0,0 +1,162 @@
+#include "chunk_cache.h"
+
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+
+namespace egtb
+{
+ChunkStats::ChunkStats()
+	: hits(0)
+	, misses(0)
+	, inflate_ns(0)
+	, inflated_bytes(0)
+{}
+
+
+ChunkCache& ChunkCache::instance()
+{
+	// Never destroyed: the tables discard their chunks when the static table cache is destroyed at exit
+	static ChunkCache* cache = new ChunkCache;
+	return *cache;
+}
+
+ChunkCache::ChunkCache()
+	: max_shard_size(DEFAULT_BUDGET / NUM_SHARDS)
+	, generation(1)
+{}
+
+void ChunkCache::set_budget(size_t bytes)
+{
+	max_shard_size = bytes / NUM_SHARDS;
+	generation++;
+	for (auto& shard : shards)
+	{
+		lock_guard<mutex> lock(shard.mtx);
+		evict(shard, max_shard_size);
+	}
+}
+
+size_t ChunkCache::budget() const
+{
+	return max_shard_size * NUM_SHARDS;
+}
+
+size_t ChunkCache::memory_usage() const
+{
+	size_t total = 0;
+	for (auto& shard : shards)
+	{
+		lock_guard<mutex> lock(shard.mtx);
+		total += shard.size;
+	}
+	return total;
+}
+
+void ChunkCache::clear()
+{
+	generation++;
+	for (auto& shard : shards)
+	{
+		lock_guard<mutex> lock(shard.mtx);
+		shard.lru.clear();
+		shard.chunks.clear();
+		shard.size = 0;
+	}
+}
+
+void ChunkCache::discard(uint32_t table_id)
+{
+	generation++;
+	for (auto& shard : shards)
+	{
+		lock_guard<mutex> lock(shard.mtx);
+		for (auto it = shard.lru.begin(); it != shard.lru.end(); )
+		{
+			if ((it->first >> 32) == table_id) {
+				shard.size -= it->second->size();
+				shard.chunks.erase(it->first);
+				it = shard.lru.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+}
+
+Chunk ChunkCache::get(uint32_t table_id, uint32_t chunk_id, const Loader& loader, ChunkStats& stats)
+{
+	struct Recent
+	{
+		uint64_t generation = 0;
+		array<pair<Key, Chunk>, NUM_RECENT> chunks;
+	};
+	thread_local Recent recent;
+
+	Key key = (static_cast<Key>(table_id) << 32) | chunk_id;
+	uint64_t hash = key * 0x9E3779B97F4A7C15ULL;
+	uint64_t curr_generation = generation.load(memory_order_acquire);
+	if (recent.generation != curr_generation) {
+		recent.chunks.fill({ 0, nullptr });
+		recent.generation = curr_generation;
+	}
+	auto& recent_chunk = recent.chunks[hash % NUM_RECENT];
+	if (recent_chunk.first == key) {
+		stats.hits.fetch_add(1, memory_order_relaxed);
+		return recent_chunk.second;
+	}
+
+	Shard& shard = shards[hash >> 60];
+	{
+		lock_guard<mutex> lock(shard.mtx);
+		auto it = shard.chunks.find(key);
+		if (it != shard.chunks.end())
+		{
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			stats.hits.fetch_add(1, memory_order_relaxed);
+			recent_chunk = { key, it->second->second };
+			return recent_chunk.second;
+		}
+	}
+
+	// Inflate outside the lock so that the other tables in the shard aren't blocked.
+	// If two threads miss the same chunk, both inflate it and the second one is dropped.
+	stats.misses.fetch_add(1, memory_order_relaxed);
+	auto t0 = steady_clock::now();
+	auto data = make_shared<vector<char>>();
+	if (!loader(*data))
+		return nullptr;
+	stats.inflate_ns.fetch_add(duration_cast<nanoseconds>(steady_clock::now() - t0).count(), memory_order_relaxed);
+	stats.inflated_bytes.fetch_add(data->size(), memory_order_relaxed);
+
+	lock_guard<mutex> lock(shard.mtx);
+	auto it = shard.chunks.find(key);
+	if (it != shard.chunks.end()) {
+		recent_chunk = { key, it->second->second };
+		return recent_chunk.second;
+	}
+	shard.lru.emplace_front(key, data);
+	shard.chunks[key] = shard.lru.begin();
+	shard.size += data->size();
+	evict(shard, max_shard_size);
+	if (curr_generation == generation.load(memory_order_acquire))
+		recent_chunk = { key, data };
+	return data;
+}
+
+void ChunkCache::evict(Shard& shard, size_t max_size)
+{
+	// The chunks that are still being read are kept alive by their readers
+	while (shard.size > max_size && !shard.lru.empty())
+	{
+		auto& [key, chunk] = shard.lru.back();
+		shard.size -= chunk->size();
+		shard.chunks.erase(key);
+		shard.lru.pop_back();
+	}
+}
+
+} // namespace egtb
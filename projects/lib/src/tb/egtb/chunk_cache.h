@@ -0,0 +1,75 @@
+#ifndef _CHUNK_CACHE_H_
+#define _CHUNK_CACHE_H_
+
+#include <memory>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+
+namespace egtb
+{
+	using Chunk = std::shared_ptr<const std::vector<char>>;
+
+	struct ChunkStats
+	{
+		ChunkStats();
+
+		std::atomic<uint64_t> hits;
+		std::atomic<uint64_t> misses;
+		std::atomic<uint64_t> inflate_ns;
+		std::atomic<uint64_t> inflated_bytes;
+	};
+
+	/// LRU cache of decompressed chunks shared by all the tables.
+	/// It's split into shards with their own locks, and the byte budget is divided equally between them.
+	/// Each thread also keeps its recently used chunks, so that repeated hits don't take any lock.
+	class ChunkCache
+	{
+	public:
+		using Loader = std::function<bool(std::vector<char>& chunk)>;
+
+		static ChunkCache& instance();
+
+		void set_budget(size_t bytes);
+		size_t budget() const;
+		size_t memory_usage() const;
+		void clear();
+		void discard(uint32_t table_id);
+
+		/// Returns the chunk from the cache or loads it with the loader; nullptr if the loader fails.
+		Chunk get(uint32_t table_id, uint32_t chunk_id, const Loader& loader, ChunkStats& stats);
+
+	private:
+		ChunkCache();
+
+		constexpr static size_t NUM_SHARDS = 16;
+		constexpr static size_t NUM_RECENT = 32; // per thread
+		constexpr static size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+
+		using Key = uint64_t;
+		using LRU = std::list<std::pair<Key, Chunk>>;
+
+		struct Shard
+		{
+			mutable std::mutex mtx;
+			LRU lru; // the most recently used chunks are in front
+			std::unordered_map<Key, LRU::iterator> chunks;
+			size_t size = 0;
+		};
+
+		void evict(Shard& shard, size_t max_size);
+
+	private:
+		std::array<Shard, NUM_SHARDS> shards;
+		std::atomic<size_t> max_shard_size;
+		std::atomic<uint64_t> generation; // incremented to invalidate the chunks kept by the threads
+	};
+
+} // namespace egtb
+#endif
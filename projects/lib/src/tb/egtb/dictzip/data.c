@@ -82,7 +82,8 @@ static int dict_read_header(const char *filename,
 		header->type = DICT_TEXT;
 		fstat(fileno(str), &sb);
 		header->compressedLength = header->length = sb.st_size;
-		header->origFilename = filename; // str_find( filename );
+		header->origFilename = xmalloc(strlen(filename) + 1); // freed in dict_data_close
+		strcpy((char *)header->origFilename, filename);
 		header->mtime = sb.st_mtime;
 		if (computeCRC) {
 			rewind(str);
@@ -359,6 +360,24 @@ void dict_data_close(dictData *header)
 	xfree(header);
 }
 
+static void dict_data_init_inflate(dictData *h)
+{
+	if (h->initialized)
+		return;
+	++h->initialized;
+	h->zStream.zalloc = NULL;
+	h->zStream.zfree = NULL;
+	h->zStream.opaque = NULL;
+	h->zStream.next_in = 0;
+	h->zStream.avail_in = 0;
+	h->zStream.next_out = NULL;
+	h->zStream.avail_out = 0;
+	if (inflateInit2(&h->zStream, -15) != Z_OK)
+		err_internal(__func__,
+			"Cannot initialize inflation engine: %s\n",
+			h->zStream.msg);
+}
+
 int dict_data_read(
 	dictData *h, unsigned long start, unsigned long size,
 	const char *preFilter, const char *postFilter, char* buffer)
@@ -372,7 +391,6 @@ int dict_data_read(
 	int           firstOffset, lastOffset;
 	int           i, j;
 	int           found, target, lastStamp;
-	static int    stamp = 0;
 
 	end = start + size;
 
@@ -394,20 +412,7 @@ int dict_data_read(
 		//buffer[size] = '\0';
 		break;
 	case DICT_DZIP:
-		if (!h->initialized) {
-			++h->initialized;
-			h->zStream.zalloc = NULL;
-			h->zStream.zfree = NULL;
-			h->zStream.opaque = NULL;
-			h->zStream.next_in = 0;
-			h->zStream.avail_in = 0;
-			h->zStream.next_out = NULL;
-			h->zStream.avail_out = 0;
-			if (inflateInit2(&h->zStream, -15) != Z_OK)
-				err_internal(__func__,
-					"Cannot initialize inflation engine: %s\n",
-					h->zStream.msg);
-		}
+		dict_data_init_inflate(h);
 		firstChunk = start / h->chunkLength;
 		firstOffset = start % h->chunkLength;
 		lastChunk = (end - 1) / h->chunkLength;
@@ -440,7 +445,7 @@ int dict_data_read(
 				}
 			}
 
-			h->cache[target].stamp = ++stamp;
+			h->cache[target].stamp = ++h->stamp;
 			if (found) {
 				count = h->cache[target].count;
 				inBuffer = h->cache[target].inBuffer;
@@ -523,3 +528,55 @@ char *dict_data_read_(
 	dict_data_read(h, start, size, preFilter, postFilter, buffer);
 	return buffer;
 }
+
+int dict_data_read_chunk(
+	dictData *h, z_stream *zStream, int chunk, char *buffer, int *count)
+{
+	/* Inflates a whole chunk into buffer (at least chunkLength bytes), bypassing the cache.
+	   Each reading thread may pass its own zStream (see dict_data_new_stream);
+	   with NULL, the stream of the header is used and the calls must be serialized. */
+	assert(h != NULL);
+	if (h->type != DICT_DZIP || chunk < 0 || chunk >= h->chunkCount)
+		return 1;
+	if (zStream == NULL) {
+		dict_data_init_inflate(h);
+		zStream = &h->zStream;
+	}
+	else if (inflateReset(zStream) != Z_OK) {
+		err_no_fatal(__func__, "%s :: inflateReset: %s\n", h->origFilename, zStream->msg);
+		return 2;
+	}
+	zStream->next_in = (Bytef *)(h->start + h->offsets[chunk]);
+	zStream->avail_in = h->chunks[chunk];
+	zStream->next_out = (Bytef *)buffer;
+	zStream->avail_out = h->chunkLength;
+	if (inflate(zStream, Z_PARTIAL_FLUSH) != Z_OK) {
+		err_no_fatal(__func__, "%s :: inflate: %s\n", h->origFilename, zStream->msg);
+		return 2;
+	}
+	if (zStream->avail_in)
+		err_internal(__func__,
+			"inflate did not flush (%d pending, %d avail)\n",
+			zStream->avail_in, zStream->avail_out);
+	*count = h->chunkLength - zStream->avail_out;
+	return 0;
+}
+
+z_stream *dict_data_new_stream(void)
+{
+	z_stream *zStream = xmalloc(sizeof(z_stream));
+	memset(zStream, 0, sizeof(z_stream));
+	if (inflateInit2(zStream, -15) != Z_OK)
+		err_internal(__func__,
+			"Cannot initialize inflation engine: %s\n",
+			zStream->msg);
+	return zStream;
+}
+
+void dict_data_free_stream(z_stream *zStream)
+{
+	if (!zStream)
+		return;
+	inflateEnd(zStream);
+	xfree(zStream);
+}
@@ -42,6 +42,12 @@ extern char *dict_data_read_ (
    const char *preFilter,
    const char *postFilter );
 
+extern int dict_data_read_chunk (
+   dictData *data, z_stream *zStream, int chunk, char *buffer, int *count);
+
+extern z_stream *dict_data_new_stream (void);
+extern void dict_data_free_stream (z_stream *zStream);
+
 extern int        mmap_mode;
 
 #endif /* _DATA_H_ */
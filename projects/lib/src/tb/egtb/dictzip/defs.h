@@ -338,6 +338,7 @@ typedef struct dictData {
    unsigned long length;
    unsigned long compressedLength;
    dictCache     cache[DICT_CACHE_SIZE];
+   int           stamp;	/* last stamp of the cache */
 } dictData;
 
 #endif /* _DEFS_H_ */
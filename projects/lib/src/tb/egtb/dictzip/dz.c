@@ -2,6 +2,8 @@
 #include "dictzip.h"
 #include "data.h"
 
+#include <string.h>
+
 
 extern int dict_data_read(
 	dictData *h, unsigned long start, unsigned long size,
@@ -108,6 +110,63 @@ int dz_read(void* header, unsigned long start, unsigned long size, char* buffer)
 	return errcode;
 }
 
+int dz_read_chunk(void* header, void* stream, unsigned long chunk, char* buffer, unsigned long* count)
+{
+	int len = 0;
+	int errcode = dict_data_read_chunk(header, stream, (int)chunk, buffer, &len);
+	*count = len;
+	return errcode;
+}
+
+void* dz_new_stream()
+{
+	return dict_data_new_stream();
+}
+
+void dz_free_stream(void* stream)
+{
+	dict_data_free_stream(stream);
+}
+
+int dz_deflate_block(const char* src, unsigned long len, char* dst, unsigned long* dst_len, int level)
+{
+	z_stream zStream;
+	int ret;
+
+	memset(&zStream, 0, sizeof(zStream));
+	if (deflateInit2(&zStream, level, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 1;
+	zStream.next_in = (Bytef*)src;
+	zStream.avail_in = len;
+	zStream.next_out = (Bytef*)dst;
+	zStream.avail_out = *dst_len;
+	ret = deflate(&zStream, Z_FINISH);
+	*dst_len -= zStream.avail_out;
+	deflateEnd(&zStream);
+	return (ret == Z_STREAM_END) ? 0 : 2;
+}
+
+unsigned long dz_deflate_bound(unsigned long len)
+{
+	return compressBound(len);
+}
+
+int dz_inflate_block(void* stream, const char* src, unsigned long len, char* dst, unsigned long* dst_len)
+{
+	z_stream* zStream = stream;
+	int ret;
+
+	if (inflateReset(zStream) != Z_OK)
+		return 1;
+	zStream->next_in = (Bytef*)src;
+	zStream->avail_in = len;
+	zStream->next_out = (Bytef*)dst;
+	zStream->avail_out = *dst_len;
+	ret = inflate(zStream, Z_FINISH);
+	*dst_len -= zStream->avail_out;
+	return (ret == Z_STREAM_END) ? 0 : 2;
+}
+
 void dz_read_all(const char* inFilename, char* buffer)
 {
 	void* header = dz_open(inFilename);
@@ -130,6 +189,13 @@ unsigned long dz_get_orig_length(void* header)
 	return ((dictData*)header)->length;
 }
 
+const char* dz_get_data(void* header)
+{
+	if (header == NULL)
+		return NULL;
+	return ((dictData*)header)->start;
+}
+
 unsigned long dz_get_compr_length(void* header)
 {
 	if (header == NULL)
@@ -137,6 +203,13 @@ unsigned long dz_get_compr_length(void* header)
 	return ((dictData*)header)->compressedLength;
 }
 
+unsigned long dz_get_chunk_length(void* header)
+{
+	if (header == NULL || ((dictData*)header)->type != DICT_DZIP)
+		return 0;
+	return ((dictData*)header)->chunkLength;
+}
+
 const char* dz_get_orig_filename(void* header)
 {
 	if (header == NULL)
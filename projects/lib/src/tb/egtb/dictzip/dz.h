@@ -11,10 +11,18 @@ int dz_unpack(const char* inFilename, const char* outFilename, unsigned long siz
 void* dz_open(const char* inFilename);
 void dz_close(void* header);
 int dz_read(void* header, unsigned long start, unsigned long size, char* buffer);
+int dz_read_chunk(void* header, void* stream, unsigned long chunk, char* buffer, unsigned long* count); // buffer must hold dz_get_chunk_length() bytes; stream is from dz_new_stream() or NULL to use the one of the header
+void* dz_new_stream(); // inflate state that can be used by one thread at a time for any header
+void dz_free_stream(void* stream);
+int dz_deflate_block(const char* src, unsigned long len, char* dst, unsigned long* dst_len, int level); // raw deflate; dst_len: capacity in, size out
+unsigned long dz_deflate_bound(unsigned long len);
+int dz_inflate_block(void* stream, const char* src, unsigned long len, char* dst, unsigned long* dst_len); // stream is from dz_new_stream()
 void dz_read_all(const char* inFilename, char* buffer);
 int dz_is_open(void* header);
 unsigned long dz_get_orig_length(void* header);
+const char* dz_get_data(void* header); // mapped file contents, i.e. the raw bytes of a file that isn't in gzip format
 unsigned long dz_get_compr_length(void* header);
+unsigned long dz_get_chunk_length(void* header); // 0 if the file isn't in dzip format
 const char* dz_get_orig_filename(void* header);
 const char* dz_get_compr_filename(void* header);
 time_t dz_get_orig_time(void* header);
@@ -0,0 +1,73 @@
+#include "probe_stats.h"
+#include "../bitboard.h"
+
+using namespace std;
+
+
+namespace egtb
+{
+static size_t bucket_of(uint64_t ns)
+{
+	if (ns < ProbeStats::SUB_BUCKETS)
+		return static_cast<size_t>(ns);
+	// 2 bits below the most significant one select the sub-bucket
+	int shift = int(msb(ns)) - 2;
+	return (shift + 1) * ProbeStats::SUB_BUCKETS + ((ns >> shift) & (ProbeStats::SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_upper_bound(size_t bucket)
+{
+	if (bucket < ProbeStats::SUB_BUCKETS)
+		return bucket;
+	int shift = static_cast<int>(bucket / ProbeStats::SUB_BUCKETS) - 1;
+	uint64_t sub = bucket % ProbeStats::SUB_BUCKETS;
+	return ((ProbeStats::SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+
+ProbeStats::ProbeStats()
+	: probes(0)
+	, errors(0)
+	, total_ns(0)
+	, engine_ms(0)
+{
+	for (auto& bucket : buckets)
+		bucket = 0;
+}
+
+void ProbeStats::add(uint64_t ns, uint64_t count)
+{
+	probes.fetch_add(count, memory_order_relaxed);
+	total_ns.fetch_add(ns * count, memory_order_relaxed);
+	buckets[bucket_of(ns)].fetch_add(count, memory_order_relaxed);
+}
+
+uint64_t ProbeStats::percentile(double fraction) const
+{
+	uint64_t total = 0;
+	for (const auto& bucket : buckets)
+		total += bucket.load(memory_order_relaxed);
+	if (total == 0)
+		return 0;
+	uint64_t rank = static_cast<uint64_t>(fraction * (total - 1));
+	uint64_t num = 0;
+	for (size_t i = 0; i < NUM_BUCKETS; i++)
+	{
+		num += buckets[i].load(memory_order_relaxed);
+		if (num > rank)
+			return bucket_upper_bound(i);
+	}
+	return bucket_upper_bound(NUM_BUCKETS - 1);
+}
+
+void ProbeStats::reset()
+{
+	probes = 0;
+	errors = 0;
+	total_ns = 0;
+	engine_ms = 0;
+	for (auto& bucket : buckets)
+		bucket = 0;
+}
+
+} // namespace egtb
@@ -0,0 +1,34 @@
+#ifndef _PROBE_STATS_H_
+#define _PROBE_STATS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace egtb
+{
+	/// Probe counters and latency histogram of one table, updated by the probing threads without locks.
+	/// The buckets grow geometrically (4 per power of two), so a percentile is within 25% of the exact latency.
+	struct ProbeStats
+	{
+		ProbeStats();
+
+		void add(uint64_t ns, uint64_t count = 1);
+		/// Latency in ns below which the given fraction of the probes is
+		uint64_t percentile(double fraction) const;
+		void reset();
+
+		constexpr static size_t SUB_BUCKETS = 4;
+		constexpr static size_t NUM_BUCKETS = 64 * SUB_BUCKETS;
+
+		std::atomic<uint64_t> probes;
+		std::atomic<uint64_t> errors; // the table is missing or broken
+		std::atomic<uint64_t> total_ns;
+		std::atomic<uint64_t> engine_ms; // spent by the engine on the positions of the missing table
+		std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets;
+	};
+
+} // namespace egtb
+#endif
@@ -2,6 +2,7 @@
 
 #include "../types.h"
 #include "../egtb/tb_reader.h"
+#include "../egtb/tb_gen.h"
 #include "../endgame.h"
 #include "../thread.h"
 #include "../uci.h"
@@ -46,7 +47,7 @@ int antichess_tb_init()
 
 int antichess_tb_num_tbs()
 {
-	return static_cast<int>(TB_Reader::tb_cache.size());
+	return static_cast<int>(TB_Reader::num_tbs());
 }
 
 int antichess_tb_add_path(const char* path, size_t path_len)
@@ -56,7 +57,7 @@ int antichess_tb_add_path(const char* path, size_t path_len)
 		string egtb_path(path, path_len);
 		Tablebases::init(ANTI_VARIANT, egtb_path);
 		TB_Reader::init(egtb_path, true);
-		size_t num_files = TB_Reader::tb_cache.size();
+		size_t num_files = TB_Reader::num_tbs();
 		if (num_files >= 714)
 			return 0;
 		return static_cast<int>(num_files) - 714;
@@ -131,3 +132,23 @@ int antichess_tb_probe_dtw(const int* white_squares, const int* white_pieces, si
 		return -11;
 	}
 }
+
+int antichess_tb_generate(const char* tb_name, size_t tb_name_len, size_t num_threads)
+{
+	try
+	{
+		TB_GenOptions options;
+		options.num_threads = num_threads;
+		TB_Generator generator(string(tb_name, tb_name_len), options);
+		string error_text;
+		return generator.generate(error_text) ? 0 : -1;
+	}
+	catch (const std::exception&)
+	{
+		return -10;
+	}
+	catch (...)
+	{
+		return -11;
+	}
+}
@@ -13,6 +13,7 @@ extern "C" {
 	int antichess_tb_probe_dtw(const int* white_squares, const int* white_pieces, size_t num_white_pieces,
 	                           const int* black_squares, const int* black_pieces, size_t num_black_pieces,
 	                           int side_to_move, int ep_square, int* dtw);
+	int antichess_tb_generate(const char* tb_name, size_t tb_name_len, size_t num_threads);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,170 @@
+#include "tb_blocks.h"
+extern "C" {
+#include "dictzip/dz.h"
+}
+
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+
+namespace egtb
+{
+static const char BLOCKS_MAGIC[4] = { 'A', 'N', 'B', 'K' };
+
+
+void* thread_inflate_stream()
+{
+	struct InflateStream
+	{
+		InflateStream() : stream(dz_new_stream()) {}
+		~InflateStream() { dz_free_stream(stream); }
+		void* stream;
+	};
+	thread_local InflateStream inflate_stream;
+	return inflate_stream.stream;
+}
+
+BlockFile::BlockFile(const string& path)
+	: dz_header(nullptr)
+	, offsets(nullptr)
+	, file_data(nullptr)
+{
+	memset(&header, 0, sizeof(header));
+	ifstream file(path, ios::binary);
+	if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return;
+	file.close();
+	if (memcmp(header.magic, BLOCKS_MAGIC, sizeof(BLOCKS_MAGIC)) != 0
+	    || header.version != BLOCKS_VERSION || header.codec != BLOCKS_CODEC_DEFLATE || header.block_size == 0)
+	{
+		header.num_blocks = 0;
+		return;
+	}
+	dz_header = dz_open(path.c_str());
+	if (!dz_is_open(dz_header))
+		return;
+	file_data = dz_get_data(dz_header);
+	size_t file_size = dz_get_compr_length(dz_header);
+	size_t table_size = sizeof(header) + (header.num_blocks + 1ULL) * sizeof(uint64_t);
+	if (!file_data || file_size < table_size) {
+		file_data = nullptr;
+		return;
+	}
+	offsets = reinterpret_cast<const uint64_t*>(file_data + sizeof(header));
+	if (offsets[header.num_blocks] != file_size)
+		file_data = nullptr;
+}
+
+BlockFile::~BlockFile()
+{
+	if (dz_header)
+		dz_close(dz_header);
+}
+
+bool BlockFile::write(const string& path, const vector<char>& data, uint16_t flags, uint32_t block_size, string& error_text)
+{
+	BlocksHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, BLOCKS_MAGIC, sizeof(BLOCKS_MAGIC));
+	h.version = BLOCKS_VERSION;
+	h.flags = flags;
+	h.block_size = block_size;
+	h.num_blocks = static_cast<uint32_t>((data.size() + block_size - 1) / block_size);
+	h.orig_length = data.size();
+	h.codec = BLOCKS_CODEC_DEFLATE;
+
+	vector<uint64_t> block_offsets(h.num_blocks + 1ULL);
+	vector<char> blocks;
+	blocks.reserve(data.size() / 2);
+	vector<char> block(dz_deflate_bound(block_size));
+	uint64_t offset = sizeof(h) + block_offsets.size() * sizeof(uint64_t);
+	for (uint32_t i = 0; i < h.num_blocks; i++)
+	{
+		const char* src = data.data() + static_cast<size_t>(i) * block_size;
+		unsigned long len = static_cast<unsigned long>(min<size_t>(block_size, data.size() - static_cast<size_t>(i) * block_size));
+		unsigned long compr_len = static_cast<unsigned long>(block.size());
+		if (dz_deflate_block(src, len, block.data(), &compr_len, 9) != 0) {
+			error_text = "can't compress block " + to_string(i);
+			return false;
+		}
+		block_offsets[i] = offset;
+		if (compr_len < len)
+			blocks.insert(blocks.end(), block.data(), block.data() + compr_len);
+		else
+			blocks.insert(blocks.end(), src, src + len); // stored
+		offset += min(compr_len, len);
+	}
+	block_offsets[h.num_blocks] = offset;
+
+	string tmp_path = path + ".tmp";
+	{
+		ofstream file(tmp_path, ios::binary | ios::trunc);
+		file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		file.write(reinterpret_cast<const char*>(block_offsets.data()), block_offsets.size() * sizeof(uint64_t));
+		file.write(blocks.data(), blocks.size());
+		if (!file) {
+			error_text = "can't write " + tmp_path;
+			return false;
+		}
+	}
+	remove(path.c_str());
+	if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+		error_text = "can't rename " + tmp_path;
+		return false;
+	}
+	return true;
+}
+
+bool BlockFile::is_open() const
+{
+	return file_data != nullptr;
+}
+
+uint16_t BlockFile::flags() const
+{
+	return header.flags;
+}
+
+uint64_t BlockFile::orig_length() const
+{
+	return header.orig_length;
+}
+
+uint32_t BlockFile::block_size() const
+{
+	return header.block_size;
+}
+
+uint32_t BlockFile::num_blocks() const
+{
+	return header.num_blocks;
+}
+
+size_t BlockFile::compr_length(uint32_t block) const
+{
+	return static_cast<size_t>(offsets[block + 1] - offsets[block]);
+}
+
+bool BlockFile::read_block(uint32_t block, vector<char>& data) const
+{
+	if (!is_open() || block >= header.num_blocks)
+		return false;
+	size_t len = min<uint64_t>(header.block_size, header.orig_length - static_cast<uint64_t>(block) * header.block_size);
+	size_t compr_len = compr_length(block);
+	const char* src = file_data + offsets[block];
+	if (compr_len == len) {
+		data.assign(src, src + len);
+		return true;
+	}
+	data.resize(len);
+	unsigned long count = static_cast<unsigned long>(len);
+	if (dz_inflate_block(thread_inflate_stream(), src, static_cast<unsigned long>(compr_len), data.data(), &count) != 0)
+		return false;
+	return count == len;
+}
+
+} // namespace egtb
@@ -0,0 +1,64 @@
+#ifndef _TB_BLOCKS_H_
+#define _TB_BLOCKS_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+
+namespace egtb
+{
+	constexpr uint16_t BLOCKS_VERSION       = 1;
+	constexpr uint32_t DEFAULT_BLOCK_SIZE   = 4096;
+	constexpr uint8_t  BLOCKS_CODEC_DEFLATE = 1;
+
+	/// Header of the random-access container.
+	/// Layout: BlocksHeader | uint64 offsets[num_blocks + 1] from the start of the file | blocks.
+	/// Each block holds block_size bytes of the original data (the last one may be shorter)
+	/// and is compressed on its own; a block that doesn't shrink is stored as is.
+	struct BlocksHeader
+	{
+		char     magic[4];
+		uint16_t version;
+		uint16_t flags; // EGTB_* flags of the table
+		uint32_t block_size;
+		uint32_t num_blocks;
+		uint64_t orig_length;
+		uint8_t  codec;
+		uint8_t  reserved[7];
+	};
+	static_assert(sizeof(BlocksHeader) == 32, "BlocksHeader must be packed");
+
+	/// zlib inflate state of the calling thread; the mapped data is shared, the inflate state isn't
+	void* thread_inflate_stream();
+
+	class BlockFile
+	{
+	public:
+		explicit BlockFile(const std::string& path);
+		~BlockFile();
+		BlockFile(const BlockFile&) = delete;
+		BlockFile& operator=(const BlockFile&) = delete;
+
+		static bool write(const std::string& path, const std::vector<char>& data, uint16_t flags,
+		                  uint32_t block_size, std::string& error_text);
+
+		bool is_open() const;
+		uint16_t flags() const;
+		uint64_t orig_length() const;
+		uint32_t block_size() const;
+		uint32_t num_blocks() const;
+		size_t compr_length(uint32_t block) const;
+
+		/// Thread-safe: the file is mapped read-only and each thread inflates with its own stream.
+		bool read_block(uint32_t block, std::vector<char>& data) const;
+
+	private:
+		void* dz_header; // the file is mapped by dictzip as plain data
+		BlocksHeader header;
+		const uint64_t* offsets;
+		const char* file_data;
+	};
+
+} // namespace egtb
+#endif
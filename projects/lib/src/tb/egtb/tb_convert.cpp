@@ -0,0 +1,61 @@
+// Converts the dictzip tables (.an2) into the random-access format (.ab2).
+// Usage: egtb_convert <egtb_dir> [block_size] [tb_name ...]
+
+#include "tb_api.h"
+#include "tb_reader.h"
+
+#include <iostream>
+#include <set>
+
+using namespace std;
+using namespace egtb;
+
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <egtb_dir> [block_size] [tb_name ...]" << endl;
+		return 1;
+	}
+	if (antichess_tb_init() != 0) {
+		cerr << "Failed to initialize" << endl;
+		return 1;
+	}
+	string egtb_path = argv[1];
+	TB_Reader::init(egtb_path);
+	uint32_t block_size = (argc > 2) ? static_cast<uint32_t>(stoul(argv[2])) : DEFAULT_BLOCK_SIZE;
+	if (block_size < 256 || block_size > (1 << 24)) {
+		cerr << "Wrong block size: " << block_size << endl;
+		return 1;
+	}
+
+	set<string> tb_names;
+	for (int i = 3; i < argc; i++)
+		tb_names.insert(argv[i]);
+	if (tb_names.empty()) {
+		for (const auto& entry : fs::directory_iterator(egtb_path))
+			if (entry.is_regular_file() && entry.path().extension().generic_string() == TB_Reader::file_extension_compressed)
+				tb_names.insert(entry.path().stem().generic_string());
+	}
+
+	int num_errors = 0;
+	uintmax_t total_old = 0;
+	uintmax_t total_new = 0;
+	for (const auto& tb_name : tb_names)
+	{
+		string error_text;
+		if (!TB_Reader::convert_to_blocks(tb_name, block_size, true, error_text)) {
+			cerr << tb_name << ": " << error_text << endl;
+			num_errors++;
+			continue;
+		}
+		auto size_old = fs::file_size(fs::path(egtb_path) / (tb_name + TB_Reader::file_extension_compressed));
+		auto size_new = fs::file_size(fs::path(egtb_path) / (tb_name + TB_Reader::file_extension_blocks));
+		total_old += size_old;
+		total_new += size_new;
+		cout << tb_name << ": " << size_old << " -> " << size_new << " bytes" << endl;
+	}
+	cout << "Converted " << (tb_names.size() - num_errors) << " of " << tb_names.size() << " tables: "
+	     << total_old << " -> " << total_new << " bytes" << endl;
+	return num_errors ? 2 : 0;
+}
@@ -0,0 +1,631 @@
+#include "tb_gen.h"
+#include "tb_reader.h"
+#include "elements.h"
+#include "../movegen.h"
+extern "C" {
+#include "dictzip/dz.h"
+}
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <set>
+#include <cstring>
+#include <cstdio>
+#include <limits>
+
+using namespace std;
+using namespace std::chrono;
+
+
+namespace egtb
+{
+static const char CHECKPOINT_MAGIC[4] = { 'A', 'N', 'G', 'N' };
+static const uint32_t CHECKPOINT_VERSION = 2;
+static const string CHECKPOINT_EXTENSION = ".gen";
+static const uint64_t BLOCK_SIZE = 4096; // indices taken by a thread at once
+
+struct CheckpointHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t num_entries;
+	int32_t pass;
+	int32_t max_external;
+	int32_t quiet_passes;
+	uint32_t reserved;
+};
+
+static inline uint32_t pack(int16_t val, uint8_t dtz)
+{
+	return static_cast<uint16_t>(val) | (static_cast<uint32_t>(dtz) << 16);
+}
+
+static inline int16_t unpack_val(uint32_t entry)
+{
+	return static_cast<int16_t>(entry & 0xFFFF);
+}
+
+static inline uint8_t unpack_dtz(uint32_t entry)
+{
+	return static_cast<uint8_t>(entry >> 16);
+}
+
+
+vector<string> TB_Generator::all_tables(size_t num_pieces)
+{
+	// Multisets of the pieces of each side, from the king down to the pawn
+	const string symbols = "KQRBNP";
+	function<void(size_t, size_t, string&, vector<string>&)> add_sides = [&](size_t n, size_t first, string& side, vector<string>& sides)
+	{
+		if (n == 0) {
+			sides.push_back(side);
+			return;
+		}
+		for (size_t i = first; i < symbols.size(); i++) {
+			side.push_back(symbols[i]);
+			add_sides(n - 1, i, side, sides);
+			side.pop_back();
+		}
+	};
+	set<string> names;
+	for (size_t num_white = 1; num_white < num_pieces; num_white++)
+	{
+		vector<string> whites, blacks;
+		string side;
+		add_sides(num_white, 0, side, whites);
+		add_sides(num_pieces - num_white, 0, side, blacks);
+		for (const auto& white : whites)
+			for (const auto& black : blacks)
+			{
+				StateInfo st;
+				Position pos;
+				pos.set(white + "v" + black, WHITE, TBTable::variant, &st);
+				names.insert(board_to_name(pos));
+			}
+	}
+	vector<string> tables(names.begin(), names.end());
+	stable_sort(tables.begin(), tables.end(), [](const string& a, const string& b)
+	{
+		return count(a.begin(), a.end(), 'P') < count(b.begin(), b.end(), 'P');
+	});
+	return tables;
+}
+
+vector<char> TB_Generator::make_idx_header(const string& tb_name)
+{
+	StateInfo st;
+	Position pos;
+	pos.set(tb_name, WHITE, TBTable::variant, &st);
+	auto count_of = [&pos](Piece piece) { return popcount(pos.pieces(color_of(piece), type_of(piece))); };
+	vector<Piece> pieces;
+	for (Color c : { WHITE, BLACK })
+		for (size_t i = PIECE_TYPES.size() - 1; i > 0; i--)
+			if (pos.pieces(c, PIECE_TYPES[i]))
+				pieces.push_back(make_piece(c, PIECE_TYPES[i]));
+
+	// The leading group goes first (see set_groups() in tb_idx.cpp), then the other groups
+	vector<Piece> order;
+	auto add_group = [&](Piece piece)
+	{
+		order.insert(order.end(), count_of(piece), piece);
+		pieces.erase(find(pieces.begin(), pieces.end(), piece));
+	};
+	bool has_pawns = pos.pieces(PAWN);
+	bool pp = false;
+	if (has_pawns)
+	{
+		// Lead pawns are of the side with fewer pawns, as in the TBTable constructor
+		int num_white = pos.count<PAWN>(WHITE);
+		int num_black = pos.count<PAWN>(BLACK);
+		Color lead = (!num_black || (num_white && num_black >= num_white)) ? WHITE : BLACK;
+		add_group(make_piece(lead, PAWN));
+		pp = num_white && num_black;
+		if (pp)
+			add_group(make_piece(~lead, PAWN));
+	}
+	else
+	{
+		vector<Piece> unique;
+		for (Piece piece : pieces)
+			if (count_of(piece) == 1)
+				unique.push_back(piece);
+		if (unique.size() >= 2)
+		{
+			for (size_t i = 0; i < min<size_t>(unique.size(), 3); i++)
+				add_group(unique[i]);
+		}
+		else
+		{
+			auto it = min_element(pieces.begin(), pieces.end(), [&count_of](Piece a, Piece b)
+			{
+				int count_a = count_of(a);
+				int count_b = count_of(b);
+				return (count_a >= 2 && (count_b < 2 || count_a < count_b));
+			});
+			add_group(*it);
+		}
+	}
+	while (!pieces.empty())
+		add_group(pieces.front());
+
+	// Same order for both sides to move, and for each file of the leading pawn
+	vector<char> header;
+	for (int f = 0; f < (has_pawns ? 4 : 1); f++)
+	{
+		header.push_back(0x00);       // leading group first
+		if (pp)
+			header.push_back(0x11);   // remaining pawns second
+		for (Piece piece : order)
+			header.push_back(static_cast<char>((piece << 4) | piece));
+	}
+	return header;
+}
+
+TB_Generator::TB_Generator(const string& tb_name, const TB_GenOptions& options)
+	: tb_name(tb_name)
+	, options(options)
+	, num_entries(0)
+	, next_idx(0)
+	, num_new(0)
+	, max_external(0)
+	, num_resolved(0)
+	, quiet_passes(0)
+{
+	this->idx_header = make_idx_header(tb_name);
+	this->tbtable = make_unique<TBTable>(tb_name, idx_header.data());
+	this->decoder = make_unique<TBDecoder>(*tbtable);
+	this->num_entries = (tbtable->key != tbtable->key2) ? 2 * tbtable->size() : tbtable->size();
+}
+
+size_t TB_Generator::memory_required() const
+{
+	// The values while generating + the file data when writing
+	return num_entries * (sizeof(atomic<uint32_t>) + 3) + idx_header.size();
+}
+
+uint64_t TB_Generator::data_size() const
+{
+	return idx_header.size() + 3 * num_entries;
+}
+
+bool TB_Generator::generate(string& error_text, const Progress& progress)
+{
+	if (options.max_memory && memory_required() > options.max_memory) {
+		error_text = "not enough memory: " + to_string(memory_required() / (1024 * 1024)) + " MB required";
+		return false;
+	}
+	// dz_pack() takes the length as unsigned long, which is 32-bit on Windows
+	if (data_size() > numeric_limits<unsigned long>::max()) {
+		error_text = "the table is too large to compress: " + to_string(data_size() / (1024 * 1024)) + " MB";
+		return false;
+	}
+	this->entries = make_unique<atomic<uint32_t>[]>(num_entries);
+	auto t0 = steady_clock::now();
+	auto t_checkpoint = t0;
+	auto report = [&](int pass)
+	{
+		if (!progress)
+			return;
+		duration<double> t = steady_clock::now() - t0;
+		progress({ tb_name, pass, num_entries, num_resolved, num_new, t.count() });
+	};
+	auto count_resolved = [this]()
+	{
+		num_resolved = 0;
+		for (uint64_t idx = 0; idx < num_entries; idx++)
+			num_resolved += unpack_val(entries[idx].load(memory_order_relaxed)) != NONE;
+	};
+
+	// The summaries of the fixed children aren't in the checkpoint, so they are collected again for the unresolved positions
+	int pass = load_checkpoint();
+	bool is_resumed = (pass >= 0);
+	run_pass(0, is_resumed);
+	if (!thread_error.empty()) {
+		error_text = thread_error;
+		return false;
+	}
+	if (!is_resumed)
+	{
+		pass = 0;
+		count_resolved();
+		report(pass);
+	}
+
+	// The values of the other tables appear by the pass after the longest one
+	while (quiet_passes == 0 || pass <= max_external + 1)
+	{
+		pass++;
+		if (pass >= DRAW) {
+			error_text = "too many passes";
+			return false;
+		}
+		num_new = 0;
+		run_pass(pass);
+		if (!thread_error.empty()) {
+			error_text = thread_error;
+			return false;
+		}
+		quiet_passes = num_new ? 0 : quiet_passes + 1;
+		count_resolved();
+		report(pass);
+		if (options.checkpoint_seconds && steady_clock::now() - t_checkpoint >= seconds(options.checkpoint_seconds))
+		{
+			if (!save_checkpoint(pass, error_text))
+				return false;
+			t_checkpoint = steady_clock::now();
+		}
+	}
+
+	if (!write_table(error_text))
+		return false;
+	entries.reset();
+	vector<pair<uint64_t, Children>>().swap(summaries);
+	remove((TB_Reader::egtb_path / (tb_name + CHECKPOINT_EXTENSION)).generic_string().c_str());
+	TB_Reader::reopen_tb(tb_name); // in case it was looked up before it existed
+	return true;
+}
+
+void TB_Generator::run_pass(int pass, bool is_resumed)
+{
+	next_idx = 0;
+	size_t num_threads = options.num_threads ? options.num_threads : max(1u, thread::hardware_concurrency());
+	const auto by_index = [](const pair<uint64_t, Children>& a, uint64_t idx) { return a.first < idx; };
+	Children only_internal;
+	only_internal.has_internal = true;
+	vector<thread> threads;
+	for (size_t t = 0; t < num_threads; t++)
+	{
+		threads.emplace_back([this, pass, is_resumed, &by_index, &only_internal]()
+		{
+			StateInfo st;
+			Position pos;
+			vector<pair<uint64_t, Children>> new_summaries;
+			try
+			{
+				for (;;)
+				{
+					uint64_t begin = next_idx.fetch_add(BLOCK_SIZE);
+					if (begin >= num_entries)
+						break;
+					uint64_t end = min(begin + BLOCK_SIZE, num_entries);
+					vector<pair<uint64_t, Children>>::const_iterator it_summary;
+					if (pass > 0)
+						it_summary = lower_bound(summaries.cbegin(), summaries.cend(), begin, by_index);
+					for (uint64_t idx = begin; idx < end; idx++)
+					{
+						if (pass == 0) {
+							init_entry(idx, pos, st, is_resumed, new_summaries);
+							continue;
+						}
+						if (unpack_val(entries[idx].load(memory_order_relaxed)) != NONE)
+							continue;
+						if (!set_position(idx, pos, st))
+							throw logic_error("can't decode index " + to_string(idx));
+						while (it_summary != summaries.cend() && it_summary->first < idx)
+							++it_summary;
+						bool has_summary = (it_summary != summaries.cend() && it_summary->first == idx);
+						auto value = evaluate(pos, has_summary ? it_summary->second : only_internal, pass);
+						if (!value.is_known)
+							continue;
+						// The values of this pass aren't used by the other threads in this pass, apart from the draws that are final
+						entries[idx].store(pack(value.val, value.dtz), memory_order_relaxed);
+						if (value.val != DRAW)
+							num_new.fetch_add(1, memory_order_relaxed);
+					}
+				}
+			}
+			catch (const exception& e)
+			{
+				lock_guard<mutex> lock(mtx_error);
+				if (thread_error.empty())
+					thread_error = e.what();
+				next_idx = num_entries; // stop the other threads
+			}
+			if (!new_summaries.empty()) {
+				lock_guard<mutex> lock(mtx_summaries);
+				summaries.insert(summaries.end(), new_summaries.begin(), new_summaries.end());
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	if (pass == 0)
+		sort(summaries.begin(), summaries.end(), [](const pair<uint64_t, Children>& a, const pair<uint64_t, Children>& b) { return a.first < b.first; });
+}
+
+void TB_Generator::init_entry(uint64_t idx, Position& pos, StateInfo& st, bool is_resumed, vector<pair<uint64_t, Children>>& summaries)
+{
+	// The broken indices and the stalemates are never probed. An index may not be the one
+	// get_idx() returns for the decoded position, since the same pieces can be encoded in another order,
+	// but it's still probed for the position
+	if (is_resumed)
+	{
+		if (unpack_val(entries[idx].load(memory_order_relaxed)) != NONE)
+			return;
+		if (!set_position(idx, pos, st))
+			throw logic_error("can't decode index " + to_string(idx));
+	}
+	else
+	{
+		bool is_probed = set_position(idx, pos, st) && !is_anti_win(pos);
+		entries[idx].store(pack(is_probed ? NONE : EMPTY, 0), memory_order_relaxed);
+		if (!is_probed)
+			return;
+	}
+
+	/// The children that don't depend on the table are probed only here
+	auto children = fixed_children(pos);
+	if (!children.has_internal) {
+		// Its value is stored now, and the other positions see it in the pass after its length like the values of that pass
+		auto value = choose(children, DRAW);
+		entries[idx].store(pack(value.val, value.dtz), memory_order_relaxed);
+	}
+	else if (children.max_val || children.has_draw) {
+		summaries.emplace_back(idx, children);
+	}
+}
+
+bool TB_Generator::set_position(uint64_t idx, Position& pos, StateInfo& st) const
+{
+	Piece pieces[PairsData::TBPIECES];
+	Square squares[PairsData::TBPIECES];
+	Color stm;
+	if (!decoder->decode(idx, pieces, squares, stm))
+		return false;
+	pos.reset();
+	st.reset();
+	pos.replace_state(&st);
+	for (int i = 0; i < tbtable->pieceCount; i++)
+	{
+		if (!pos.empty(squares[i]))
+			return false;
+		pos.put_piece(pieces[i], squares[i]);
+	}
+	pos.set_side_to_move(stm);
+	pos.set_state(&st);
+	return true;
+}
+
+void TB_Generator::add_child(Children& children, int16_t val, uint8_t dtz)
+{
+	// The same choice as in TB_Reader::probe_ep
+	if (val == DRAW) {
+		children.has_draw = true;
+		return;
+	}
+	children.max_val = max<int16_t>(children.max_val, static_cast<int16_t>(abs(val)));
+	if (val > 0) {
+		if (dtz > 100)
+			children.has_draw = true; // a cursed win
+		else if (children.win_val == 0 || val < children.win_val || (val == children.win_val && dtz < children.win_dtz)) {
+			children.win_val = val;
+			children.win_dtz = dtz;
+		}
+	}
+	else if (val < children.loss_val || (val == children.loss_val && dtz < children.loss_dtz)) {
+		children.loss_val = val;
+		children.loss_dtz = dtz;
+	}
+}
+
+TB_Generator::Value TB_Generator::choose(const Children& children, int limit)
+{
+	// The values longer than the limit aren't known yet, and they would be longer wins
+	const Value unknown = { false, 0, 0 };
+	if (children.win_val > 0)
+		return (children.win_val <= limit) ? Value{ true, children.win_val, children.win_dtz } : unknown;
+	if (children.has_unknown || children.max_val > limit)
+		return unknown;
+	if (children.has_draw || children.loss_dtz > 100)
+		return { true, DRAW, 0 };
+	return { true, children.loss_val, children.loss_dtz };
+}
+
+TB_Generator::Children TB_Generator::fixed_children(Position& pos)
+{
+	Children children;
+	for (const auto& move_i : MoveList<LEGAL>(pos))
+	{
+		int16_t val;
+		uint8_t dtz;
+		if (fixed_child(pos, move_i.move, val, dtz))
+			add_child(children, val, dtz);
+		else
+			children.has_internal = true;
+	}
+	return children;
+}
+
+bool TB_Generator::fixed_child(Position& pos, Move move, int16_t& val, uint8_t& dtz)
+{
+	// The value of a child from the point of view of the position, unless the child is in the table being generated.
+	// A capture, a promotion and a double push to an ep position are zeroing moves.
+	bool is_capture_or_promotion = pos.capture_or_promotion(move);
+	bool is_fixed = true;
+	StateInfo st;
+	pos.do_move(move, st);
+	if (is_anti_win(pos)) {
+		val = -1;
+		dtz = 1;
+	}
+	else if (pos.is_anti_loss()) {
+		val = 1;
+		dtz = 1;
+	}
+	else
+	{
+		int16_t child_val = DRAW;
+		uint8_t child_dtz = 0;
+		if (is_capture_or_promotion)
+		{
+			if (TB_Reader::probe_EGTB(pos, child_val, child_dtz))
+				throw runtime_error("EGTB " + board_to_name(pos) + " is not available for " + pos.fen());
+			if (child_val != DRAW) {
+				int abs_val = abs(child_val);
+				int max_val = max_external.load(memory_order_relaxed);
+				while (abs_val > max_val && !max_external.compare_exchange_weak(max_val, abs_val, memory_order_relaxed));
+			}
+		}
+		else if (is_ep_position(pos))
+		{
+			// The ep capture is possible, so all the moves are captures
+			auto children = fixed_children(pos);
+			if (children.has_internal)
+				throw logic_error("quiet moves in the ep position " + pos.fen());
+			auto value = choose(children, DRAW);
+			child_val = value.val;
+			child_dtz = value.dtz;
+		}
+		else
+		{
+			is_fixed = false;
+		}
+		if (is_fixed)
+		{
+			val = (child_val == DRAW) ? DRAW : (child_val < 0) ? (-child_val + 1) : (-child_val - 1);
+			dtz = (child_val == DRAW) ? 0 : 1;
+		}
+	}
+	pos.undo_move(move);
+	return is_fixed;
+}
+
+TB_Generator::Value TB_Generator::evaluate(Position& pos, Children children, int limit)
+{
+	// The fixed children are in the summary, so only the quiet moves to the positions of the table are looked up
+	for (const auto& move_i : MoveList<LEGAL>(pos))
+	{
+		Move move = move_i.move;
+		if (pos.capture_or_promotion(move))
+			continue;
+		bool is_zeroing = type_of(pos.moved_piece(move)) == PAWN;
+		StateInfo st;
+		pos.do_move(move, st);
+		if (!is_ep_position(pos))
+		{
+			uint32_t entry = entries[tbtable->get_idx(pos)].load(memory_order_relaxed);
+			int16_t child_val = unpack_val(entry);
+			uint8_t child_dtz = unpack_dtz(entry);
+			if (child_val == EMPTY) {
+				if (!is_anti_win(pos))
+					throw logic_error("broken index of " + pos.fen());
+			}
+			// Only the values found in the previous passes, so that the values of each pass are of the same length
+			else if (child_val == NONE || (child_val != DRAW && abs(child_val) >= limit)) {
+				children.has_unknown = true;
+			}
+			else if (child_val == DRAW) {
+				add_child(children, DRAW, 0);
+			}
+			else {
+				int16_t val = (child_val < 0) ? (-child_val + 1) : (-child_val - 1);
+				add_child(children, val, is_zeroing ? 1 : (child_dtz + 1));
+			}
+		}
+		pos.undo_move(move);
+	}
+	return choose(children, limit);
+}
+
+bool TB_Generator::save_checkpoint(int pass, string& error_text) const
+{
+	CheckpointHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	h.version = CHECKPOINT_VERSION;
+	h.num_entries = num_entries;
+	h.pass = pass;
+	h.max_external = max_external;
+	h.quiet_passes = quiet_passes;
+
+	string path = (TB_Reader::egtb_path / (tb_name + CHECKPOINT_EXTENSION)).generic_string();
+	string tmp_path = path + ".tmp";
+	{
+		ofstream file(tmp_path, ios::binary | ios::trunc);
+		file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		vector<uint32_t> buffer(BLOCK_SIZE * 256);
+		for (uint64_t begin = 0; begin < num_entries && file; begin += buffer.size())
+		{
+			size_t n = static_cast<size_t>(min<uint64_t>(buffer.size(), num_entries - begin));
+			for (size_t i = 0; i < n; i++)
+				buffer[i] = entries[begin + i].load(memory_order_relaxed);
+			file.write(reinterpret_cast<const char*>(buffer.data()), n * sizeof(uint32_t));
+		}
+		if (!file) {
+			error_text = "can't write " + tmp_path;
+			return false;
+		}
+	}
+	remove(path.c_str());
+	if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+		error_text = "can't rename " + tmp_path;
+		return false;
+	}
+	return true;
+}
+
+int TB_Generator::load_checkpoint()
+{
+	string path = (TB_Reader::egtb_path / (tb_name + CHECKPOINT_EXTENSION)).generic_string();
+	ifstream file(path, ios::binary);
+	CheckpointHeader h;
+	if (!file || !file.read(reinterpret_cast<char*>(&h), sizeof(h)))
+		return -1;
+	if (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || h.version != CHECKPOINT_VERSION || h.num_entries != num_entries)
+		return -1;
+	vector<uint32_t> buffer(BLOCK_SIZE * 256);
+	for (uint64_t begin = 0; begin < num_entries; begin += buffer.size())
+	{
+		size_t n = static_cast<size_t>(min<uint64_t>(buffer.size(), num_entries - begin));
+		if (!file.read(reinterpret_cast<char*>(buffer.data()), n * sizeof(uint32_t)))
+			return -1;
+		for (size_t i = 0; i < n; i++)
+			entries[begin + i].store(buffer[i], memory_order_relaxed);
+	}
+	max_external = h.max_external;
+	quiet_passes = h.quiet_passes;
+	return h.pass;
+}
+
+bool TB_Generator::write_table(string& error_text) const
+{
+	// Header | (DTZ, VAL big-endian) for each index; the draws, the broken indices and the stalemates are zeros
+	vector<char> data(static_cast<size_t>(data_size()));
+	copy(idx_header.begin(), idx_header.end(), data.begin());
+	char* p = data.data() + idx_header.size();
+	for (uint64_t idx = 0; idx < num_entries; idx++, p += 3)
+	{
+		uint32_t entry = entries[idx].load(memory_order_relaxed);
+		int16_t val = unpack_val(entry);
+		uint8_t dtz = unpack_dtz(entry);
+		if (val == NONE || val == EMPTY || val == DRAW)
+			val = dtz = 0;
+		uint16_t uval = static_cast<uint16_t>(val);
+		p[0] = static_cast<char>(dtz);
+		p[1] = static_cast<char>(uval >> 8);
+		p[2] = static_cast<char>(uval & 0xFF);
+	}
+
+	uint16_t flags = EGTB_IS_COMPRESSED | EGTB_HAS_DTZ | EGTB_VAL_BIG;
+	if (DTZ101_AS_DRAW)
+		flags |= EGTB_DTZ101_AS_DRAW;
+	string file_name = tb_name + TB_Reader::file_extension_compressed;
+	string path = (TB_Reader::egtb_path / file_name).generic_string();
+	string tmp_path = path + ".tmp";
+	if (dz_pack(data.data(), static_cast<unsigned long>(data.size()), tmp_path.c_str(), file_name.c_str(), 0, flags) != 0) {
+		remove(tmp_path.c_str());
+		error_text = "can't compress " + file_name;
+		return false;
+	}
+	remove(path.c_str());
+	if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+		error_text = "can't rename " + tmp_path;
+		return false;
+	}
+	return true;
+}
+
+} // namespace egtb
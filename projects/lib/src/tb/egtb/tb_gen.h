@@ -0,0 +1,122 @@
+#ifndef _TB_GEN_H_
+#define _TB_GEN_H_
+
+#include "../position.h"
+#include "tb_idx.h"
+#include "tb_reader.h"
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+#ifdef USE_FAIRY_SF
+using namespace Stockfish;
+#endif
+
+namespace egtb
+{
+	struct TB_GenOptions
+	{
+		size_t num_threads = 0;          // 0 = all the cores
+		size_t max_memory = 0;           // bytes for the values of the table being generated, 0 = no limit
+		size_t checkpoint_seconds = 600; // 0 = no checkpoints
+	};
+
+	struct TB_GenProgress
+	{
+		std::string tb_name;
+		int pass;               // 0 = the initial pass that finds the broken indices and the stalemates and probes the fixed children
+		uint64_t num_entries;
+		uint64_t num_resolved;  // including the broken indices
+		uint64_t num_new;       // wins and losses found in this pass
+		double seconds;
+	};
+
+	/// DTW generator of the antichess tables in the format read by TB_Reader.
+	/// It isn't retrograde: the table is solved by forward passes over the index range up to a fixed point.
+	/// Pass n resolves the positions that are won or lost in n plies, looking up the children of the same material
+	/// in the table being generated. The children that don't depend on the table (captures, promotions, ep positions
+	/// and the ends of the game) are probed once in pass 0: a position with only such children gets its value there,
+	/// and the other positions keep their summary for the next passes. The positions that are still unresolved
+	/// when no more values can appear are draws. A win or loss that needs more than 100 plies without a zeroing move
+	/// is stored as a draw (DTZ101_AS_DRAW), and the choice between the moves is the same as in TB_Reader::probe_ep.
+	class TB_Generator
+	{
+	public:
+		using Progress = std::function<void(const TB_GenProgress& progress)>;
+
+		/// Names of all the tables with the given number of pieces in the order of generation:
+		/// the tables with fewer pawns go first, since the promotions lead to them.
+		static std::vector<std::string> all_tables(size_t num_pieces);
+		/// Index header of a generated table: the order of the pieces and the groups, as read by TBTable
+		static std::vector<char> make_idx_header(const std::string& tb_name);
+
+	public:
+		TB_Generator(const std::string& tb_name, const TB_GenOptions& options = TB_GenOptions());
+
+		size_t memory_required() const;
+		uint64_t data_size() const; // of the uncompressed table
+		/// Generates the table into TB_Reader::egtb_path. It's resumed from the checkpoint if there's one.
+		bool generate(std::string& error_text, const Progress& progress = nullptr);
+
+	protected:
+		struct Value
+		{
+			bool is_known;
+			int16_t val;
+			uint8_t dtz;
+		};
+
+		/// The values of the children of a position as they are chosen from, from the point of view of the position
+		struct Children
+		{
+			int16_t win_val = 0;
+			uint8_t win_dtz = DTZ_NO_WIN;
+			int16_t loss_val = 0;
+			uint8_t loss_dtz = DTZ_NO_WIN;
+			int16_t max_val = 0;       // the longest win or loss, known only in the passes after it
+			bool has_draw = false;
+			bool has_unknown = false;
+			bool has_internal = false; // some children are in the table being generated
+		};
+
+		void run_pass(int pass, bool is_resumed = false);
+		void init_entry(uint64_t idx, Position& pos, StateInfo& st, bool is_resumed, std::vector<std::pair<uint64_t, Children>>& summaries);
+		bool set_position(uint64_t idx, Position& pos, StateInfo& st) const;
+		static void add_child(Children& children, int16_t val, uint8_t dtz);
+		static Value choose(const Children& children, int limit);
+		Children fixed_children(Position& pos);
+		bool fixed_child(Position& pos, Move move, int16_t& val, uint8_t& dtz);
+		Value evaluate(Position& pos, Children children, int limit);
+
+		bool save_checkpoint(int pass, std::string& error_text) const;
+		int load_checkpoint();
+		bool write_table(std::string& error_text) const;
+
+	protected:
+		std::string tb_name;
+		TB_GenOptions options;
+		std::vector<char> idx_header;
+		std::unique_ptr<TBTable> tbtable;
+		std::unique_ptr<TBDecoder> decoder;
+		uint64_t num_entries;
+
+		std::unique_ptr<std::atomic<uint32_t>[]> entries; // val | dtz << 16
+		std::vector<std::pair<uint64_t, Children>> summaries; // of the fixed children of the unresolved positions that have them, by index
+		std::atomic<uint64_t> next_idx;
+		std::atomic<uint64_t> num_new;
+		std::atomic<int> max_external; // the longest win or loss of the children in the other tables
+		uint64_t num_resolved;
+		int quiet_passes;
+
+		std::mutex mtx_summaries;
+		std::mutex mtx_error;
+		std::string thread_error;
+	};
+
+} // namespace egtb
+#endif
@@ -0,0 +1,85 @@
+// Generates the missing antichess tables (.an2) with the given number of pieces, or the given tables.
+// The tables they depend on (captures and promotions) must be in the same directory.
+// Usage: egtb_generate <egtb_dir> [-n num_pieces] [-t threads] [-m max_memory_GB] [-c checkpoint_minutes] [-b] [tb_name ...]
+
+#include "tb_api.h"
+#include "tb_reader.h"
+#include "tb_gen.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+using namespace std;
+using namespace egtb;
+
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <egtb_dir> [-n num_pieces] [-t threads] [-m max_memory_GB] [-c checkpoint_minutes] [-b] [tb_name ...]" << endl;
+		cerr << "  -b  also write the random-access format (" << TB_Reader::file_extension_blocks << ")" << endl;
+		return 1;
+	}
+	if (antichess_tb_init() != 0) {
+		cerr << "Failed to initialize" << endl;
+		return 1;
+	}
+	string egtb_path = argv[1];
+	TB_Reader::init(egtb_path);
+
+	size_t num_pieces = 5;
+	bool to_write_blocks = false;
+	TB_GenOptions options;
+	vector<string> tb_names;
+	for (int i = 2; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if (arg == "-n" && has_value)
+			num_pieces = stoul(argv[++i]);
+		else if (arg == "-t" && has_value)
+			options.num_threads = stoul(argv[++i]);
+		else if (arg == "-m" && has_value)
+			options.max_memory = static_cast<size_t>(stod(argv[++i]) * 1024 * 1024 * 1024);
+		else if (arg == "-c" && has_value)
+			options.checkpoint_seconds = static_cast<size_t>(stod(argv[++i]) * 60);
+		else if (arg == "-b")
+			to_write_blocks = true;
+		else
+			tb_names.push_back(arg);
+	}
+	if (num_pieces < 2 || num_pieces > 5) {
+		cerr << "Wrong number of pieces: " << num_pieces << endl;
+		return 1;
+	}
+	if (tb_names.empty()) {
+		for (const auto& tb_name : TB_Generator::all_tables(num_pieces))
+			if (!fs::exists(fs::path(egtb_path) / (tb_name + TB_Reader::file_extension_compressed))
+			    && !fs::exists(fs::path(egtb_path) / (tb_name + TB_Reader::file_extension_blocks)))
+				tb_names.push_back(tb_name);
+	}
+
+	int num_errors = 0;
+	for (const auto& tb_name : tb_names)
+	{
+		TB_Generator generator(tb_name, options);
+		cout << tb_name << ": " << (generator.memory_required() / (1024 * 1024)) << " MB" << endl;
+		string error_text;
+		bool is_ok = generator.generate(error_text, [](const TB_GenProgress& progress)
+		{
+			cout << progress.tb_name << ": pass " << setw(3) << progress.pass
+			     << "  resolved " << fixed << setprecision(1) << (100.0 * progress.num_resolved / progress.num_entries) << "%"
+			     << "  new " << progress.num_new
+			     << "  " << setprecision(0) << progress.seconds << " s" << endl;
+		});
+		if (is_ok && to_write_blocks)
+			is_ok = TB_Reader::convert_to_blocks(tb_name, DEFAULT_BLOCK_SIZE, true, error_text);
+		if (!is_ok) {
+			cerr << tb_name << ": " << error_text << endl;
+			num_errors++;
+		}
+	}
+	cout << "Generated " << (tb_names.size() - num_errors) << " of " << tb_names.size() << " tables" << endl;
+	return num_errors ? 2 : 0;
+}
@@ -26,6 +26,7 @@
 #include <filesystem>
 #include <sstream>
 #include <array>
+#include <functional>
 
 #include "tb_idx.h"
 
@@ -47,6 +48,7 @@ inline Square operator^=(Square& s, int i) { return s = Square(int(s) ^ i); }
 inline Square operator^(Square s, int i) { return Square(int(s) ^ i); }
 
 int MapPawns[SQUARE_NB];
+Square InvMapPawns[48];
 int MapB1H1H7[SQUARE_NB];
 int MapA1D1D4[SQUARE_NB];
 
@@ -372,6 +374,171 @@ void TBTable_init(TBTable& e, const Position& pos, const uint8_t*& data)
     }
 }
 
+// Encode the leading group of the pieces (the tables without pawns). The squares
+// are mapped in place to the canonical part of the board as a side effect.
+uint64_t leading_pieces_idx(const TBTable* entry, const PairsData* d, Square* squares, int size)
+{
+    uint64_t idx;
+
+    // Already done by get_idx(), but not for the placements enumerated by TBDecoder
+    if (file_of(squares[0]) > FILE_D)
+        for (int i = 0; i < size; ++i)
+            squares[i] ^= 7; // Horizontal flip: SQ_H1 -> SQ_A1
+
+    // In positions withouth pawns, we further flip the squares to ensure leading
+    // piece is below RANK_5.
+    if (rank_of(squares[0]) > RANK_4)
+        for (int i = 0; i < size; ++i)
+            squares[i] ^= 070; // Vertical flip: SQ_A8 -> SQ_A1
+
+    // Look for the first piece of the leading group not on the A1-D4 diagonal
+    // and ensure it is mapped below the diagonal.
+    for (int i = 0; i < d->groupLen[0]; ++i) {
+        if (!off_A1H8(squares[i]))
+            continue;
+
+        if (off_A1H8(squares[i]) > 0) // A1-H8 diagonal flip: SQ_A3 -> SQ_C3
+            for (int j = i; j < size; ++j)
+                squares[j] = flipdiag(squares[j]);
+        break;
+    }
+
+    // Encode the leading group.
+    //
+    // Suppose we have KRvK. Let's say the pieces are on square numbers wK, wR
+    // and bK (each 0...63). The simplest way to map this position to an index
+    // is like this:
+    //
+    //   index = wK * 64 * 64 + wR * 64 + bK;
+    //
+    // But this way the TB is going to have 64*64*64 = 262144 positions, with
+    // lots of positions being equivalent (because they are mirrors of each
+    // other) and lots of positions being invalid (two pieces on one square,
+    // adjacent kings, etc.).
+    // Usually the first step is to take the wK and bK together. There are just
+    // 462 ways legal and not-mirrored ways to place the wK and bK on the board.
+    // Once we have placed the wK and bK, there are 62 squares left for the wR
+    // Mapping its square from 0..63 to available squares 0..61 can be done like:
+    //
+    //   wR -= (wR > wK) + (wR > bK);
+    //
+    // In words: if wR "comes later" than wK, we deduct 1, and the same if wR
+    // "comes later" than bK. In case of two same pieces like KRRvK we want to
+    // place the two Rs "together". If we have 62 squares left, we can place two
+    // Rs "together" in 62 * 61 / 2 ways (we divide by 2 because rooks can be
+    // swapped and still get the same position.)
+    //
+    // In case we have at least 3 unique pieces (inlcuded kings) we encode them
+    // together.
+    if (entry->numUniquePieces >= 3)
+    {
+        int adjust1 = squares[1] > squares[0];
+        int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+
+        // First piece is below a1-h8 diagonal. MapA1D1D4[] maps the b1-d1-d3
+        // triangle to 0...5. There are 63 squares for second piece and and 62
+        // (mapped to 0...61) for the third.
+        if (off_A1H8(squares[0]))
+            idx = (   MapA1D1D4[squares[0]]  * 63
+                   + (squares[1] - adjust1)) * 62
+                   + squares[2] - adjust2;
+
+        // First piece is on a1-h8 diagonal, second below: map this occurence to
+        // 6 to differentiate from the above case, rank_of() maps a1-d4 diagonal
+        // to 0...3 and finally MapB1H1H7[] maps the b1-h1-h7 triangle to 0..27.
+        else if (off_A1H8(squares[1]))
+            idx = (  6 * 63 + rank_of(squares[0]) * 28
+                   + MapB1H1H7[squares[1]])       * 62
+                   + squares[2] - adjust2;
+
+        // First two pieces are on a1-h8 diagonal, third below
+        else if (off_A1H8(squares[2]))
+            idx = 6 * 63 * 62 + 4 * 28 * 62
+            + rank_of(squares[0]) * 7 * 28
+            + (rank_of(squares[1]) - adjust1) * 28
+            + MapB1H1H7[squares[2]];
+
+        // All 3 pieces on the diagonal a1-h8
+        else
+            idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28
+            + rank_of(squares[0]) * 7 * 6
+            + (rank_of(squares[1]) - adjust1) * 6
+            + (rank_of(squares[2]) - adjust2);
+    }
+    else if (entry->numUniquePieces == 2)
+    {
+        int adjust = squares[1] > squares[0];
+
+        if (off_A1H8(squares[0]))
+            idx = MapA1D1D4[squares[0]] * 63
+            + (squares[1] - adjust);
+
+        else if (off_A1H8(squares[1]))
+            idx = 6 * 63
+            + rank_of(squares[0]) * 28
+            + MapB1H1H7[squares[1]];
+
+        else
+            idx = 6 * 63 + 4 * 28
+            + rank_of(squares[0]) * 7
+            + (rank_of(squares[1]) - adjust);
+    }
+    else if (entry->minLikeMan == 2)
+    {
+        if (Triangle[squares[0]] > Triangle[squares[1]])
+            std::swap(squares[0], squares[1]);
+
+        if (file_of(squares[0]) > FILE_D)
+            for (int i = 0; i < size; ++i)
+                squares[i] ^= 7;
+
+        if (rank_of(squares[0]) > RANK_4)
+            for (int i = 0; i < size; ++i)
+                squares[i] ^= 070;
+
+        if (off_A1H8(squares[0]) > 0 || (off_A1H8(squares[0]) == 0 && off_A1H8(squares[1]) > 0))
+            for (int i = 0; i < size; ++i)
+                squares[i] = flipdiag(squares[i]);
+
+        if ((Test45 & squares[1]) && Triangle[squares[0]] == Triangle[squares[1]]) {
+            std::swap(squares[0], squares[1]);
+            for (int i = 0; i < size; ++i)
+                squares[i] = flipdiag(squares[i] ^ 070);
+        }
+
+        idx = MapPP[Triangle[squares[0]]][squares[1]];
+    }
+    else {
+        for (int i = 1; i < d->groupLen[0]; ++i)
+            if (Triangle[squares[0]] > Triangle[squares[i]])
+                std::swap(squares[0], squares[i]);
+
+        if (file_of(squares[0]) > FILE_D)
+            for (int i = 0; i < size; ++i)
+                squares[i] ^= 7;
+
+        if (rank_of(squares[0]) > RANK_4)
+            for (int i = 0; i < size; ++i)
+                squares[i] ^= 070;
+
+        if (off_A1H8(squares[0]) > 0)
+            for (int i = 0; i < size; ++i)
+                squares[i] = flipdiag(squares[i]);
+
+        for (int i = 1; i < d->groupLen[0]; i++)
+            for (int j = i + 1; j < d->groupLen[0]; j++)
+                if (MultTwist[squares[i]] > MultTwist[squares[j]])
+                    std::swap(squares[i], squares[j]);
+
+        idx = MultIdx[d->groupLen[0] - 1][Triangle[squares[0]]];
+
+        for (int i = 1; i < d->groupLen[0]; ++i)
+            idx += Binomial[i][MultTwist[squares[i]]];
+    }
+
+    return idx;
+}
+
 }
 
 TBTable::TBTable(const std::string& code, const char* data)
@@ -533,156 +700,7 @@ uint64_t TBTable::get_idx(const Position& pos/*, bool* is_inversion*/) const
         goto encode_remaining; // With pawns we have finished special treatments
     }
 
-    // In positions withouth pawns, we further flip the squares to ensure leading
-    // piece is below RANK_5.
-    if (rank_of(squares[0]) > RANK_4)
-        for (int i = 0; i < size; ++i)
-            squares[i] ^= 070; // Vertical flip: SQ_A8 -> SQ_A1
-
-    // Look for the first piece of the leading group not on the A1-D4 diagonal
-    // and ensure it is mapped below the diagonal.
-    for (int i = 0; i < d->groupLen[0]; ++i) {
-        if (!off_A1H8(squares[i]))
-            continue;
-
-        if (off_A1H8(squares[i]) > 0) // A1-H8 diagonal flip: SQ_A3 -> SQ_C3
-            for (int j = i; j < size; ++j)
-                squares[j] = flipdiag(squares[j]);
-        break;
-    }
-
-    // Encode the leading group.
-    //
-    // Suppose we have KRvK. Let's say the pieces are on square numbers wK, wR
-    // and bK (each 0...63). The simplest way to map this position to an index
-    // is like this:
-    //
-    //   index = wK * 64 * 64 + wR * 64 + bK;
-    //
-    // But this way the TB is going to have 64*64*64 = 262144 positions, with
-    // lots of positions being equivalent (because they are mirrors of each
-    // other) and lots of positions being invalid (two pieces on one square,
-    // adjacent kings, etc.).
-    // Usually the first step is to take the wK and bK together. There are just
-    // 462 ways legal and not-mirrored ways to place the wK and bK on the board.
-    // Once we have placed the wK and bK, there are 62 squares left for the wR
-    // Mapping its square from 0..63 to available squares 0..61 can be done like:
-    //
-    //   wR -= (wR > wK) + (wR > bK);
-    //
-    // In words: if wR "comes later" than wK, we deduct 1, and the same if wR
-    // "comes later" than bK. In case of two same pieces like KRRvK we want to
-    // place the two Rs "together". If we have 62 squares left, we can place two
-    // Rs "together" in 62 * 61 / 2 ways (we divide by 2 because rooks can be
-    // swapped and still get the same position.)
-    //
-    // In case we have at least 3 unique pieces (inlcuded kings) we encode them
-    // together.
-    if (entry->numUniquePieces >= 3)
-    {
-        int adjust1 = squares[1] > squares[0];
-        int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
-
-        // First piece is below a1-h8 diagonal. MapA1D1D4[] maps the b1-d1-d3
-        // triangle to 0...5. There are 63 squares for second piece and and 62
-        // (mapped to 0...61) for the third.
-        if (off_A1H8(squares[0]))
-            idx = (   MapA1D1D4[squares[0]]  * 63
-                   + (squares[1] - adjust1)) * 62
-                   + squares[2] - adjust2;
-
-        // First piece is on a1-h8 diagonal, second below: map this occurence to
-        // 6 to differentiate from the above case, rank_of() maps a1-d4 diagonal
-        // to 0...3 and finally MapB1H1H7[] maps the b1-h1-h7 triangle to 0..27.
-        else if (off_A1H8(squares[1]))
-            idx = (  6 * 63 + rank_of(squares[0]) * 28
-                   + MapB1H1H7[squares[1]])       * 62
-                   + squares[2] - adjust2;
-
-        // First two pieces are on a1-h8 diagonal, third below
-        else if (off_A1H8(squares[2]))
-            idx = 6 * 63 * 62 + 4 * 28 * 62
-            + rank_of(squares[0]) * 7 * 28
-            + (rank_of(squares[1]) - adjust1) * 28
-            + MapB1H1H7[squares[2]];
-
-        // All 3 pieces on the diagonal a1-h8
-        else
-            idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28
-            + rank_of(squares[0]) * 7 * 6
-            + (rank_of(squares[1]) - adjust1) * 6
-            + (rank_of(squares[2]) - adjust2);
-    }
-    else if (entry->numUniquePieces == 2)
-    {
-        int adjust = squares[1] > squares[0];
-
-        if (off_A1H8(squares[0]))
-            idx = MapA1D1D4[squares[0]] * 63
-            + (squares[1] - adjust);
-
-        else if (off_A1H8(squares[1]))
-            idx = 6 * 63
-            + rank_of(squares[0]) * 28
-            + MapB1H1H7[squares[1]];
-
-        else
-            idx = 6 * 63 + 4 * 28
-            + rank_of(squares[0]) * 7
-            + (rank_of(squares[1]) - adjust);
-    }
-    else if (entry->minLikeMan == 2)
-    {
-        if (Triangle[squares[0]] > Triangle[squares[1]])
-            std::swap(squares[0], squares[1]);
-
-        if (file_of(squares[0]) > FILE_D)
-            for (int i = 0; i < size; ++i)
-                squares[i] ^= 7;
-
-        if (rank_of(squares[0]) > RANK_4)
-            for (int i = 0; i < size; ++i)
-                squares[i] ^= 070;
-
-        if (off_A1H8(squares[0]) > 0 || (off_A1H8(squares[0]) == 0 && off_A1H8(squares[1]) > 0))
-            for (int i = 0; i < size; ++i)
-                squares[i] = flipdiag(squares[i]);
-
-        if ((Test45 & squares[1]) && Triangle[squares[0]] == Triangle[squares[1]]) {
-            std::swap(squares[0], squares[1]);
-            for (int i = 0; i < size; ++i)
-                squares[i] = flipdiag(squares[i] ^ 070);
-        }
-
-        idx = MapPP[Triangle[squares[0]]][squares[1]];
-    }
-    else {
-        for (int i = 1; i < d->groupLen[0]; ++i)
-            if (Triangle[squares[0]] > Triangle[squares[i]])
-                std::swap(squares[0], squares[i]);
-
-        if (file_of(squares[0]) > FILE_D)
-            for (int i = 0; i < size; ++i)
-                squares[i] ^= 7;
-
-        if (rank_of(squares[0]) > RANK_4)
-            for (int i = 0; i < size; ++i)
-                squares[i] ^= 070;
-
-        if (off_A1H8(squares[0]) > 0)
-            for (int i = 0; i < size; ++i)
-                squares[i] = flipdiag(squares[i]);
-
-        for (int i = 1; i < d->groupLen[0]; i++)
-            for (int j = i + 1; j < d->groupLen[0]; j++)
-                if (MultTwist[squares[i]] > MultTwist[squares[j]])
-                    std::swap(squares[i], squares[j]);
-
-        idx = MultIdx[d->groupLen[0] - 1][Triangle[squares[0]]];
-
-        for (int i = 1; i < d->groupLen[0]; ++i)
-            idx += Binomial[i][MultTwist[squares[i]]];
-    }
+    idx = leading_pieces_idx(entry, d, squares, size);
 
 encode_remaining:
     idx *= d->groupIdx[0];
@@ -777,6 +795,196 @@ std::string TBTable::size_info() const
 }
 
 
+namespace {
+
+int num_groups(const PairsData* d)
+{
+    return int(std::find(d->groupLen, d->groupLen + 7, 0) - d->groupLen);
+}
+
+// Number of the values of a group: the ratio of its start index to the next one
+uint64_t group_size(const PairsData* d, int g)
+{
+    int n = num_groups(d);
+    uint64_t next = d->groupIdx[n];
+    for (int k = 0; k < n; ++k)
+        if (d->groupIdx[k] > d->groupIdx[g] && d->groupIdx[k] < next)
+            next = d->groupIdx[k];
+    return next / d->groupIdx[g];
+}
+
+// Inverse of n = Binomial[1][x[0]] + Binomial[2][x[1]] + ... + Binomial[k][x[k - 1]]
+// with x[0] < x[1] < ... < x[k - 1].
+void decode_binomial(uint64_t n, int k, int* x)
+{
+    for (int i = k; i > 0; --i)
+    {
+        int v = SQUARE_NB - 1;
+        while (v > 0 && uint64_t(Binomial[i][v]) > n)
+            --v;
+        x[i - 1] = v;
+        n -= Binomial[i][v];
+    }
+}
+
+}
+
+TBDecoder::TBDecoder(const TBTable& table)
+    : table(table)
+{
+    if (table.hasPawns)
+        return;
+
+    // Encode all the placements of the leading group and keep the first one of each index
+    const int sides = (table.key != table.key2) ? TBTable::Sides : 1;
+    for (int stm = 0; stm < sides; ++stm)
+    {
+        const PairsData* d = table.get(stm, FILE_A);
+        const int len = d->groupLen[0];
+        Leading none;
+        none.squares.fill(SQ_NONE);
+        none.b1 = SQ_NONE;
+        leading[stm].assign(group_size(d, 0), none);
+
+        Squares sq;
+        std::function<void(int)> place = [&](int i)
+        {
+            if (i == len)
+            {
+                // SQ_B1 follows the group to record the symmetry, as the squares
+                // of the remaining pieces would
+                Squares canonical = sq;
+                canonical[len] = SQ_B1;
+                uint64_t idx = leading_pieces_idx(&table, d, canonical.data(), len + 1);
+                if (idx < leading[stm].size() && leading[stm][idx].b1 == SQ_NONE)
+                    leading[stm][idx] = { canonical, canonical[len] };
+                return;
+            }
+            // The encoding of the pieces of the same type depends on their order when they're
+            // on symmetric squares, so all the orders are placed to reach every index probed
+            for (Square s = SQ_A1; s <= SQ_H8; ++s)
+                if (std::find(sq.begin(), sq.begin() + i, s) == sq.begin() + i)
+                {
+                    sq[i] = s;
+                    place(i + 1);
+                }
+        };
+        place(0);
+    }
+}
+
+bool TBDecoder::decode(uint64_t idx, Piece* pieces, Square* squares, Color& stm) const
+{
+    const uint64_t size = table.size();
+    int half = 0;
+    if (idx >= size)
+    {
+        if (table.key == table.key2 || idx >= 2 * size)
+            return false;
+        idx -= size;
+        half = 1;
+    }
+    stm = Color(half ^ (table.lead_color == BLACK));
+
+    // Tables with pawns are split by the file of the leading pawn
+    int f = FILE_A;
+    const PairsData* d = table.get(stm, f);
+    if (table.hasPawns)
+        for (;; ++f)
+        {
+            if (f > FILE_D)
+                return false;
+            d = table.get(stm, f);
+            uint64_t fileSize = d->groupIdx[num_groups(d)];
+            if (idx < fileSize)
+                break;
+            idx -= fileSize;
+        }
+
+    std::copy(d->pieces, d->pieces + table.pieceCount, pieces);
+
+    // Leading group
+    const int len = d->groupLen[0];
+    uint64_t leadIdx = idx / d->groupIdx[0] % group_size(d, 0);
+    int x[PairsData::TBPIECES];
+    const Leading* lead = nullptr;
+    if (table.hasPawns)
+    {
+        Square leadSq = SQ_NONE;
+        for (Rank r = RANK_2; r <= RANK_7; ++r)
+        {
+            Square sq = make_square(File(f), r);
+            if (uint64_t(LeadPawnIdx[len][sq]) <= leadIdx)
+                leadSq = sq;
+        }
+        leadIdx -= LeadPawnIdx[len][leadSq];
+        if (leadIdx >= uint64_t(Binomial[len - 1][MapPawns[leadSq]]))
+            return false;
+        squares[0] = leadSq;
+        decode_binomial(leadIdx, len - 1, x);
+        for (int i = 1; i < len; ++i)
+            squares[i] = InvMapPawns[x[i - 1]];
+    }
+    else
+    {
+        lead = &leading[stm % TBTable::Sides][leadIdx];
+        if (lead->b1 == SQ_NONE)
+            return false;
+        std::copy(lead->squares.begin(), lead->squares.begin() + len, squares);
+    }
+
+    // Remaining pawns then pieces: the x-th square not taken by the previous groups
+    bool remainingPawns = table.hasPawns && table.pawnCount[1];
+    int numSquares = len;
+    for (int g = 1; d->groupLen[g]; ++g)
+    {
+        decode_binomial(idx / d->groupIdx[g] % group_size(d, g), d->groupLen[g], x);
+        for (int i = 0; i < d->groupLen[g]; ++i)
+        {
+            Square s = remainingPawns ? SQ_A2 : SQ_A1;
+            for (int free = x[i]; ; ++s)
+            {
+                if (s > (remainingPawns ? SQ_H7 : SQ_H8))
+                    return false;
+                if (std::find(squares, squares + numSquares, s) != squares + numSquares)
+                    continue;
+                if (free-- == 0)
+                    break;
+            }
+            squares[numSquares + i] = s;
+        }
+        numSquares += d->groupLen[g];
+        remainingPawns = false;
+    }
+
+    // Undo the symmetry of the leading group, so that encoding the position
+    // transforms the remaining pieces back to the decoded squares
+    if (lead && lead->b1 != SQ_B1)
+        for (int op = 1; op < 8; ++op)
+        {
+            auto transform = [op](Square s) {
+                if (op & 1) s = Square(s ^ 7);
+                if (op & 2) s = Square(s ^ 070);
+                if (op & 4) s = flipdiag(s);
+                return s;
+            };
+            if (transform(SQ_B1) != lead->b1)
+                continue;
+            // Each flip is an involution, so the inverse applies them in reverse order
+            for (int i = 0; i < numSquares; ++i)
+            {
+                Square s = squares[i];
+                if (op & 4) s = flipdiag(s);
+                if (op & 2) s = Square(s ^ 070);
+                if (op & 1) s = Square(s ^ 7);
+                squares[i] = s;
+            }
+            break;
+        }
+    return true;
+}
+
+
 /// Tablebases_init() is called at startup and after every change to
 /// "SyzygyPath" UCI option to (re)create the various tables. It is not thread
 /// safe, nor it needs to be.
@@ -851,6 +1059,8 @@ void Tablebases_init()
                 {
                     MapPawns[sq] = availableSquares--;
                     MapPawns[sq ^ 7] = availableSquares--; // Horizontal flip
+                    InvMapPawns[MapPawns[sq]] = sq;
+                    InvMapPawns[MapPawns[sq ^ 7]] = sq ^ 7;
                 }
                 LeadPawnIdx[leadPawnsCnt][sq] = idx;
                 idx += Binomial[leadPawnsCnt - 1][MapPawns[sq]];
@@ -27,6 +27,8 @@
 #include "../position.h"
 
 #include <string>
+#include <vector>
+#include <array>
 
 
 #ifdef USE_FAIRY_SF
@@ -79,6 +81,32 @@ struct TBTable
     std::string size_info() const;
 };
 
+// struct TBDecoder maps an index of a TBTable back to a position, the inverse of
+// TBTable::get_idx(). It's used to generate the tables index by index. The leading
+// group of the tables without pawns is looked up in a table built by encoding all
+// its placements; the leading pawns and the remaining groups are decoded directly.
+struct TBDecoder
+{
+    explicit TBDecoder(const TBTable& table);
+
+    // Returns false if the index doesn't encode any position. The squares are in
+    // the order of the pieces and may be mirrored compared to the encoded position.
+    bool decode(uint64_t idx, Piece* pieces, Square* squares, Color& stm) const;
+
+private:
+    using Squares = std::array<Square, PairsData::TBPIECES>;
+
+    // Encoded placement of the leading group and the image of SQ_B1 under the
+    // symmetry applied by the encoding, which the remaining groups are relative to
+    struct Leading {
+        Squares squares;
+        Square b1;
+    };
+
+    const TBTable& table;
+    std::vector<Leading> leading[TBTable::Sides]; // [stm][leading idx]
+};
+
 void Tablebases_init();
 
 #endif
@@ -10,6 +10,12 @@ extern "C" {
 #include <list>
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
 
 using namespace std;
 using namespace std::placeholders;
@@ -19,8 +25,12 @@ namespace egtb
 {
 fs::path TB_Reader::egtb_path;
 string TB_Reader::file_extension_compressed = DTZ101_AS_DRAW ? ".an2" : ALWAYS_SAVE_DTZ ? ".an0" : ".an1";
+string TB_Reader::file_extension_blocks = DTZ101_AS_DRAW ? ".ab2" : ALWAYS_SAVE_DTZ ? ".ab0" : ".ab1";
 map<string, shared_ptr<TB_Reader>> TB_Reader::tb_cache;
-bool TB_Reader::auto_load = true;
+shared_mutex TB_Reader::mtx_cache;
+atomic<bool> TB_Reader::auto_load(true);
+map<string, unique_ptr<ProbeStats>> TB_Reader::tb_probe_stats;
+mutex TB_Reader::mtx_stats;
 
 
 void TB_Reader::init(const string& tb_path, bool load_all)
@@ -29,6 +39,7 @@ void TB_Reader::init(const string& tb_path, bool load_all)
 	Tablebases_init();
 	if (load_all)
 	{
+		unique_lock<shared_mutex> lock(mtx_cache);
 		auto_load = false;
 		tb_cache.clear();
 		for (const auto& entry : fs::directory_iterator(egtb_path))
@@ -37,11 +48,13 @@ void TB_Reader::init(const string& tb_path, bool load_all)
 			{
 				const auto& path = entry.path();
 				string extension = path.extension().generic_string();
-				if (extension == file_extension_compressed)
+				if (extension == file_extension_compressed || extension == file_extension_blocks)
 				{
 					string tb_name = path.stem().generic_string();
+					if (tb_cache.count(tb_name))
+						continue; // both formats are present
 					auto tb = make_shared<TB_Reader>(tb_name);
-					if (dz_is_open(tb->dz_header)) {
+					if (tb->is_open()) {
 						tb_cache[tb_name] = tb;
 					}
 					else {
@@ -62,6 +75,7 @@ void TB_Reader::init(const string& tb_path, bool load_all)
 
 void TB_Reader::print_EGTB_info()
 {
+	shared_lock<shared_mutex> lock(mtx_cache);
 	size_t num = 0;
 	stringstream ss;
 	for (const auto& [tb_name, tb] : tb_cache)
@@ -83,12 +97,139 @@ void TB_Reader::print_EGTB_info()
 
 void TB_Reader::discard_tb(const string& tb_name)
 {
-	tb_cache[tb_name] = nullptr;
+	shared_ptr<TB_Reader> tb;
+	{
+		unique_lock<shared_mutex> lock(mtx_cache);
+		tb = std::move(tb_cache[tb_name]);
+	}
+	// Probes that are still running keep their own references, and the last one closes the file
+}
+
+void TB_Reader::reopen_tb(const string& tb_name)
+{
+	auto tb = make_shared<TB_Reader>(tb_name);
+	if (!tb->is_open())
+		tb = nullptr;
+	{
+		unique_lock<shared_mutex> lock(mtx_cache);
+		swap(tb, tb_cache[tb_name]);
+	}
+	// Probes that are still running keep the old reader
+}
+
+size_t TB_Reader::num_tbs()
+{
+	shared_lock<shared_mutex> lock(mtx_cache);
+	return tb_cache.size();
+}
+
+void TB_Reader::set_cache_size(size_t bytes)
+{
+	ChunkCache::instance().set_budget(bytes);
+}
+
+vector<TB_CacheStats> TB_Reader::cache_stats()
+{
+	shared_lock<shared_mutex> lock(mtx_cache);
+	vector<TB_CacheStats> stats;
+	for (const auto& [tb_name, tb] : tb_cache)
+	{
+		if (!tb)
+			continue;
+		const auto& s = tb->chunk_stats;
+		stats.push_back({ tb_name, s.hits, s.misses, s.inflate_ns, s.inflated_bytes });
+	}
+	return stats;
+}
+
+vector<TB_ProbeStats> TB_Reader::probe_stats()
+{
+	vector<TB_ProbeStats> stats;
+	{
+		shared_lock<shared_mutex> lock_cache(mtx_cache);
+		lock_guard<mutex> lock(mtx_stats);
+		for (const auto& [tb_name, s] : tb_probe_stats)
+		{
+			auto it_tb = tb_cache.find(tb_name);
+			const TB_Reader* tb = (it_tb == tb_cache.end()) ? nullptr : it_tb->second.get();
+			uint64_t probes = s->probes.load(memory_order_relaxed);
+			stats.push_back({ tb_name, tb != nullptr, probes, s->errors.load(memory_order_relaxed),
+			                  probes ? s->total_ns.load(memory_order_relaxed) / 1000.0 / probes : 0.0,
+			                  s->percentile(0.5) / 1000.0, s->percentile(0.99) / 1000.0,
+			                  tb ? tb->chunk_stats.hits.load() : 0, tb ? tb->chunk_stats.misses.load() : 0,
+			                  tb ? tb->chunk_stats.inflated_bytes.load() : 0,
+			                  s->engine_ms.load(memory_order_relaxed) / 1000.0 });
+		}
+	}
+	sort(stats.begin(), stats.end(), [](const TB_ProbeStats& a, const TB_ProbeStats& b)
+	{
+		return make_tuple(a.engine_seconds, a.errors, a.probes) > make_tuple(b.engine_seconds, b.errors, b.probes);
+	});
+	return stats;
+}
+
+void TB_Reader::reset_probe_stats()
+{
+	shared_lock<shared_mutex> lock_cache(mtx_cache);
+	lock_guard<mutex> lock(mtx_stats);
+	for (auto& [tb_name, s] : tb_probe_stats)
+		s->reset();
+	for (auto& [tb_name, tb] : tb_cache)
+	{
+		if (!tb)
+			continue;
+		tb->chunk_stats.hits = 0;
+		tb->chunk_stats.misses = 0;
+		tb->chunk_stats.inflate_ns = 0;
+		tb->chunk_stats.inflated_bytes = 0;
+	}
+}
+
+bool TB_Reader::save_probe_stats(const string& path, string& error_text)
+{
+	auto stats = probe_stats();
+	string tmp_path = path + ".tmp";
+	{
+		ofstream file(tmp_path, ios::trunc);
+		file << "tb_name,available,probes,errors,mean_us,p50_us,p99_us,cache_hits,cache_misses,inflated_bytes,engine_s\n";
+		file << fixed << setprecision(3);
+		for (const auto& s : stats)
+			file << s.tb_name << "," << s.is_available << "," << s.probes << "," << s.errors << ","
+			     << s.mean_us << "," << s.p50_us << "," << s.p99_us << ","
+			     << s.cache_hits << "," << s.cache_misses << "," << s.inflated_bytes << "," << s.engine_seconds << "\n";
+		if (!file) {
+			error_text = "can't write " + tmp_path;
+			return false;
+		}
+	}
+	remove(path.c_str());
+	if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+		error_text = "can't rename " + tmp_path;
+		return false;
+	}
+	return true;
+}
+
+void TB_Reader::add_engine_time(const string& tb_name, double seconds)
+{
+	stats_of(tb_name).engine_ms.fetch_add(static_cast<uint64_t>(seconds * 1000), memory_order_relaxed);
+}
+
+ProbeStats& TB_Reader::stats_of(const string& tb_name)
+{
+	lock_guard<mutex> lock(mtx_stats);
+	auto& s = tb_probe_stats[tb_name];
+	if (!s)
+		s = make_unique<ProbeStats>();
+	return *s;
 }
 
 TB_Reader::TB_Reader(const string& tb_name)
 {
+	static atomic<uint32_t> last_table_id(0);
+	this->table_id = ++last_table_id;
 	this->tb_name = tb_name;
+	this->tb_stats = &stats_of(tb_name);
 	/// Pawn TB?
 	this->has_pawns = (tb_name.find('P') != string::npos);
 	/// Is symmetrical
@@ -104,32 +245,55 @@ TB_Reader::TB_Reader(const string& tb_name)
 			}
 		}
 	}
-	/// Compression file
-	fs::path path = egtb_path / (tb_name + file_extension_compressed);
-	//wstring_convert<codecvt_utf8_utf16<wchar_t>, wchar_t> convert;
-	//string utf8_string = convert.to_bytes(path);
-	//this->tb_path = path.generic_string();
-	this->dz_header = dz_open(path.generic_string().c_str());
+	/// Compression file: the random-access format is preferred if the table has been converted
+	this->dz_header = nullptr;
+	this->p_ram_data = nullptr;
+	this->orig_length = 0;
+	this->chunk_length = 0;
+	fs::path blocks_path = egtb_path / (tb_name + file_extension_blocks);
+	if (fs::exists(blocks_path)) {
+		this->block_file = make_unique<BlockFile>(blocks_path.generic_string());
+		if (block_file->is_open()) {
+			this->orig_length = block_file->orig_length();
+			this->chunk_length = block_file->block_size();
+		}
+		else {
+			error("can't open " + blocks_path.generic_string(), false);
+			this->block_file.reset();
+		}
+	}
+	if (!block_file) {
+		fs::path path = egtb_path / (tb_name + file_extension_compressed);
+		//wstring_convert<codecvt_utf8_utf16<wchar_t>, wchar_t> convert;
+		//string utf8_string = convert.to_bytes(path);
+		//this->tb_path = path.generic_string();
+		this->dz_header = dz_open(path.generic_string().c_str());
+		this->orig_length = dz_get_orig_length(dz_header);
+		this->chunk_length = dz_get_chunk_length(dz_header);
+	}
 
 	/// Sizes
 	this->size = 0;
 	this->size2 = 0;
+	this->num_entries = 0;
 	/// Idx
 	vector<char> idx_data(MAX_IDX_SIZE);
-	if (dz_is_open(dz_header))
+	if (is_open())
 	{
-		auto length = dz_get_orig_length(dz_header);
-		if (length) {
-			int err = dz_read(dz_header, 0, MAX_IDX_SIZE, idx_data.data());
-			if (err != 0)
+		if (orig_length) {
+			if (block_file)
+				read_bytes(0, min<size_t>(MAX_IDX_SIZE, orig_length), idx_data.data());
+			else if (dz_read(dz_header, 0, MAX_IDX_SIZE, idx_data.data()) != 0)
 				error("can't load data from the file: " + tb_name);
 		}
 		else {
 			error("corrupted file");
 		}
-		this->tb_flags = read_flags(dz_header, true);
+		this->tb_flags = read_flags(block_file ? block_file->flags() : dz_get_flags(dz_header), true);
 		this->has_dtz = tb_flags & EGTB_HAS_DTZ;
 		init_idx(idx_data);
+		if (tb_flags & EGTB_VAL_DTZ_SEPARATED)
+			this->num_entries = (orig_length - tbtable->header_size) / 3;
 	}
 }
 
@@ -138,7 +302,9 @@ TB_Reader::~TB_Reader()
 #ifdef UCI_INFO_OUTPUT
 	cout << "info string Discarding EGTB " << tb_name << endl;
 #endif
-	dz_close(this->dz_header);
+	ChunkCache::instance().discard(table_id);
+	if (dz_header)
+		dz_close(dz_header);
 }
 
 void TB_Reader::init_idx(const vector<char>& idx_data)
@@ -155,14 +321,13 @@ void TB_Reader::init_idx(const vector<char>& idx_data)
 	this->size2 = is_symmetrical ? size : 2 * size;
 }
 
-bool TB_Reader::is_dz_open() const
+bool TB_Reader::is_open() const
 {
-	return dz_is_open(dz_header);
+	return block_file ? block_file->is_open() : dz_is_open(dz_header);
 }
 
-uint16_t TB_Reader::read_flags(DZ_Header header, bool is_compressed) const
+uint16_t TB_Reader::read_flags(uint16_t flags, bool is_compressed) const
 {
-	uint16_t flags = dz_get_flags(header);
 	if (!(flags & EGTB_IS_COMPRESSED) != !is_compressed)
 		error("read_flags: the file has an incorrect compression format");
 	if (!is_compressed && !(flags & EGTB_HAS_DTZ))
@@ -220,10 +385,63 @@ void TB_Reader::read_val_12bit(char* p_bytes, size_t key, const char* p_data) co
 	}
 }
 
-val_dtz TB_Reader::read_one(size_t key, bool is_compressed)
+void TB_Reader::read_bytes(size_t start, size_t size, char* buffer, ChunkCursor* cursor)
 {
-	if (!dz_is_open(dz_header))
-		error("read_one: DZ header not open");
+	const char* p_data = p_ram_data.load(memory_order_acquire);
+	if (p_data) {
+		memcpy(buffer, p_data + start, size);
+		return;
+	}
+	if (!chunk_length) {
+		// Neither a dzip nor a random-access file => nothing to inflate
+		lock_guard<mutex> lock(mtx_dz);
+		if (dz_read(dz_header, (unsigned long)start, (unsigned long)size, buffer) != 0)
+			error("Can't read data from the file");
+		return;
+	}
+	while (size)
+	{
+		auto chunk_id = static_cast<uint32_t>(start / chunk_length);
+		size_t offset = start % chunk_length;
+		auto load_chunk = [this, chunk_id](vector<char>& chunk)
+		{
+			if (block_file)
+				return block_file->read_block(chunk_id, chunk);
+			chunk.resize(chunk_length);
+			unsigned long count = 0;
+			if (dz_read_chunk(dz_header, thread_inflate_stream(), chunk_id, chunk.data(), &count) != 0)
+				return false;
+			chunk.resize(count);
+			chunk.shrink_to_fit();
+			return true;
+		};
+		Chunk chunk;
+		if (cursor) {
+			for (const auto& [cursor_chunk_id, cursor_chunk] : cursor->chunks)
+				if (cursor_chunk && cursor_chunk_id == chunk_id)
+					chunk = cursor_chunk;
+		}
+		if (!chunk) {
+			chunk = ChunkCache::instance().get(table_id, chunk_id, load_chunk, chunk_stats);
+			if (cursor) {
+				cursor->chunks[cursor->next] = { chunk_id, chunk };
+				cursor->next ^= 1;
+			}
+		}
+		if (!chunk || offset >= chunk->size())
+			error("Can't read data from the file");
+		size_t n = min(size, chunk->size() - offset);
+		memcpy(buffer, chunk->data() + offset, n);
+		buffer += n;
+		start += n;
+		size -= n;
+	}
+}
+
+val_dtz TB_Reader::read_one(size_t key, bool is_compressed, ChunkCursor* cursor)
+{
+	if (!is_open())
+		error("read_one: the file is not open");
 	if (!(tb_flags & EGTB_IS_COMPRESSED) != !is_compressed)
 		error("read_one: the file has an incorrect compression format");
 	if (!(tb_flags & EGTB_HAS_DTZ) != !has_dtz)
@@ -238,32 +456,21 @@ val_dtz TB_Reader::read_one(size_t key, bool is_compressed)
 	size_t i = val_12bit ? key * (has_dtz ? 5 : 3) / 2 : key * num_bytes;
 	char tb_bytes[3];
 	assert(sizeof(tb_bytes) >= num_bytes);
-	{
-		lock_guard<mutex> lock(mtx_dz);
-		if (tbtable->header_size + i + num_bytes > dz_get_orig_length(dz_header))
-			error("read_one: wrong size");
-		if ((num_bytes > 1) && (tb_flags & EGTB_VAL_DTZ_SEPARATED)) {
-			if (num_bytes != 3 || !val_big)
-				error("read_one: VAL_DTZ_Separated format doesn't support 1-byte VAL");
-			int err = dz_read(dz_header, (unsigned long)(tbtable->header_size + key * 2), 2, &tb_bytes[1]);
-			if (err != 0)
-				error("read_one: can't read VAL from the file");
-			err = dz_read(dz_header, (unsigned long)(tbtable->header_size + 2 * size2 + key), 1, &tb_bytes[0]);
-			if (err != 0)
-				error("read_one: can't read DTZ from the file");
-		}
-		else if (val_12bit) {
-			char data[3];
-			int err = dz_read(dz_header, (unsigned long)(tbtable->header_size + i), num_bytes, data);
-			if (err != 0)
-				error("Can't read data from the file");
-			read_val_12bit(tb_bytes, key, data);
-		}
-		else {
-			int err = dz_read(dz_header, (unsigned long)(tbtable->header_size + i), num_bytes, tb_bytes);
-			if (err != 0)
-				error("Can't read data from the file");
-		}
+	if (tbtable->header_size + i + num_bytes > orig_length)
+		error("read_one: wrong size");
+	if ((num_bytes > 1) && (tb_flags & EGTB_VAL_DTZ_SEPARATED)) {
+		if (num_bytes != 3 || !val_big)
+			error("read_one: VAL_DTZ_Separated format doesn't support 1-byte VAL");
+		read_bytes(tbtable->header_size + key * 2, 2, &tb_bytes[1], cursor);
+		read_bytes(tbtable->header_size + 2 * num_entries + key, 1, &tb_bytes[0], cursor);
+	}
+	else if (val_12bit) {
+		char data[3];
+		read_bytes(tbtable->header_size + i, num_bytes, data, cursor);
+		read_val_12bit(tb_bytes, key, data);
+	}
+	else {
+		read_bytes(tbtable->header_size + i, num_bytes, tb_bytes, cursor);
 	}
 	auto val_dtz = load_one(tb_bytes, is_compressed, val_big);
 	if ((tb_flags & EGTB_DTZ101_AS_DRAW) && get<uint8_t>(val_dtz) >= DTZ_MAX)
@@ -342,46 +549,195 @@ val_dtz TB_Reader::probe_one(Position& board)
 	return read_one(index);
 }
 
-tuple<bool, int16_t, uint8_t> TB_Reader::probe_tb(Position& board)
+bool TB_Reader::load_to_ram()
 {
-	if (is_anti_win(board))
-		return { false, 0, 0 };
-	assert(!is_anti_loss(board));
+	if (p_ram_data.load(memory_order_acquire))
+		return true;
+	vector<char> data(orig_length);
+	if (block_file) {
+		vector<char> block;
+		for (uint32_t i = 0; i < block_file->num_blocks(); i++)
+		{
+			if (!block_file->read_block(i, block))
+				return false;
+			copy(block.begin(), block.end(), data.begin() + static_cast<size_t>(i) * chunk_length);
+		}
+	}
+	else {
+		// A separate header, so that the probes of this table aren't affected
+		fs::path path = egtb_path / (tb_name + file_extension_compressed);
+		DZ_Header header = dz_open(path.generic_string().c_str());
+		int err = dz_read(header, 0, static_cast<unsigned long>(data.size()), data.data());
+		dz_close(header);
+		if (err != 0)
+			return false;
+	}
+	ram_data.swap(data);
+	p_ram_data.store(ram_data.data(), memory_order_release);
+	ChunkCache::instance().discard(table_id);
+	return true;
+}
 
-	string tb_name = board_to_name(board);
-	auto it_tb = tb_cache.find(tb_name);
-	shared_ptr<TB_Reader> p_tb;
-	if (it_tb == tb_cache.end())
+vector<TB_PreloadInfo> TB_Reader::preload(size_t max_pieces, size_t num_threads)
+{
+	/// Tables to load
+	vector<string> tb_names;
+	for (const auto& entry : fs::directory_iterator(egtb_path))
 	{
-		if (!auto_load)
-			return { true, 0, 0 };
-		auto next_tb = make_shared<TB_Reader>(tb_name);
-		if (!next_tb->is_dz_open()) {
-			discard_tb(tb_name);
-			return { true, 0, 0 };
+		if (!entry.is_regular_file())
+			continue;
+		const auto& path = entry.path();
+		string extension = path.extension().generic_string();
+		if (extension != file_extension_compressed && extension != file_extension_blocks)
+			continue;
+		string tb_name = path.stem().generic_string();
+		size_t num_pieces = tb_name.length() - count(tb_name.begin(), tb_name.end(), 'v');
+		if (num_pieces <= max_pieces && find(tb_names.begin(), tb_names.end(), tb_name) == tb_names.end())
+			tb_names.push_back(tb_name);
+	}
+
+	/// Load them in parallel
+	vector<TB_PreloadInfo> infos(tb_names.size());
+	atomic<size_t> next(0);
+	auto load = [&]()
+	{
+		for (size_t i = next++; i < tb_names.size(); i = next++)
+		{
+			auto t0 = chrono::steady_clock::now();
+			auto tb = get_tb(tb_names[i]);
+			bool is_ok = false;
+			try
+			{
+				is_ok = tb && tb->load_to_ram();
+			}
+			catch (const exception&)
+			{}
+			chrono::duration<double> t = chrono::steady_clock::now() - t0;
+			infos[i] = { tb_names[i], is_ok ? tb->ram_data.size() : 0, t.count(), is_ok };
 		}
-		tb_cache[tb_name] = next_tb;
-		p_tb = next_tb;
+	};
+	if (num_threads == 0)
+		num_threads = max(1u, thread::hardware_concurrency());
+	vector<thread> threads;
+	for (size_t i = 1; i < min(num_threads, tb_names.size()); i++)
+		threads.emplace_back(load);
+	load();
+	for (auto& t : threads)
+		t.join();
+	return infos;
+}
+
+bool TB_Reader::convert_to_blocks(const string& tb_name, uint32_t block_size, bool separate_planes, string& error_text)
+{
+	fs::path path = egtb_path / (tb_name + file_extension_compressed);
+	DZ_Header header = dz_open(path.generic_string().c_str());
+	if (!dz_is_open(header)) {
+		error_text = "can't open " + path.generic_string();
+		return false;
+	}
+	vector<char> data(dz_get_orig_length(header));
+	uint16_t flags = dz_get_flags(header);
+	int err = dz_read(header, 0, static_cast<unsigned long>(data.size()), data.data());
+	dz_close(header);
+	if (err != 0 || data.size() < MAX_IDX_SIZE) {
+		error_text = "can't read " + path.generic_string();
+		return false;
 	}
-	else
+
+	/// Separate planes: VAL is stored first for all the positions, then DTZ
+	if (separate_planes && (flags & EGTB_HAS_DTZ) && (flags & EGTB_VAL_BIG) && !(flags & EGTB_VAL_12BIT)
+	    && !(flags & EGTB_VAL_DTZ_SEPARATED))
 	{
-		p_tb = it_tb->second;
-		if (p_tb == nullptr)
-			return { true, 0, 0 };
+		TBTable tbtable(tb_name, data.data());
+		size_t header_size = tbtable.header_size;
+		size_t n = (data.size() - header_size) / 3;
+		if (header_size + 3 * n != data.size()) {
+			error_text = "unexpected data size of " + tb_name;
+			return false;
+		}
+		vector<char> planes(data.size());
+		copy(data.begin(), data.begin() + header_size, planes.begin());
+		char* val = planes.data() + header_size;
+		char* dtz = val + 2 * n;
+		const char* p = data.data() + header_size;
+		for (size_t i = 0; i < n; i++, p += 3)
+		{
+			dtz[i] = p[0];
+			val[2 * i] = p[1];
+			val[2 * i + 1] = p[2];
+		}
+		data.swap(planes);
+		flags |= EGTB_VAL_DTZ_SEPARATED;
+	}
 
+	fs::path out_path = egtb_path / (tb_name + file_extension_blocks);
+	if (!BlockFile::write(out_path.generic_string(), data, flags, block_size, error_text))
+		return false;
+
+	/// Verify
+	BlockFile block_file(out_path.generic_string());
+	vector<char> block;
+	bool is_ok = block_file.is_open() && block_file.orig_length() == data.size();
+	for (uint32_t i = 0; is_ok && i < block_file.num_blocks(); i++)
+	{
+		size_t start = static_cast<size_t>(i) * block_size;
+		is_ok = block_file.read_block(i, block) && equal(block.begin(), block.end(), data.begin() + start);
+	}
+	if (!is_ok) {
+		error_text = "verification failed for " + out_path.generic_string();
+		return false;
+	}
+	return true;
+}
+
+shared_ptr<TB_Reader> TB_Reader::get_tb(const string& tb_name)
+{
+	{
+		shared_lock<shared_mutex> lock(mtx_cache);
+		auto it_tb = tb_cache.find(tb_name);
+		if (it_tb != tb_cache.end())
+			return it_tb->second;
+		if (!auto_load)
+			return nullptr;
+	}
+	unique_lock<shared_mutex> lock(mtx_cache);
+	auto it_tb = tb_cache.find(tb_name);
+	if (it_tb != tb_cache.end())
+		return it_tb->second; // opened by another thread meanwhile
+	auto next_tb = make_shared<TB_Reader>(tb_name);
+	if (!next_tb->is_open())
+		next_tb = nullptr;
+	tb_cache[tb_name] = next_tb;
+	return next_tb;
+}
+
+tuple<bool, int16_t, uint8_t> TB_Reader::probe_tb(Position& board)
+{
+	if (is_anti_win(board))
+		return { false, 0, 0 };
+	assert(!is_anti_loss(board));
+
+	string tb_name = board_to_name(board);
+	auto p_tb = get_tb(tb_name);
+	if (p_tb == nullptr) {
+		stats_of(tb_name).errors.fetch_add(1, memory_order_relaxed);
+		return { true, 0, 0 };
 	}
 	bool is_ep = is_ep_position(board);
 	if (!DO_EP_POSITIONS && is_ep)
 		return { true, 0, 0 };
+	auto t0 = chrono::steady_clock::now();
 	try
 	{
 		if (is_ep)
 			return p_tb->probe_ep(board);
 		auto [val, dtz] = p_tb->probe_one(board);
+		p_tb->tb_stats->add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
 		return { false, val, dtz };
 	}
 	catch (const exception&)
 	{
+		p_tb->tb_stats->errors.fetch_add(1, memory_order_relaxed);
 		discard_tb(tb_name);
 		return { true, 0, 0 };
 	}
@@ -400,6 +756,8 @@ tuple<bool, int16_t, uint8_t> TB_Reader::probe_ep(Position& board)
 		error("probe_ep: no moves for " + board.fen());
 	vector<int16_t> vals(moves.size(), NONE);
 	vector<uint8_t> dtzs(moves.size(), 0);
+	vector<TB_Child> children;
+	probe_children(board, children);
 	static const int None = numeric_limits<int>::max();
 	size_t i = 0;
 	for (const auto& move_i : moves)
@@ -432,17 +790,17 @@ tuple<bool, int16_t, uint8_t> TB_Reader::probe_ep(Position& board)
 		{
 			if (is_ep_position(board))
 				error("probe_ep: is_ep_position for " + board.fen());
+			const auto& child = children[i];
+			if (child.is_error)
+				return { true, 0, 0 };
+			val = child.val;
+			dtz = child.dtz;
 			if (is_capture_or_promotion)
 			{
-				bool is_error;
-				tie(is_error, val, dtz) = probe_tb(board);
-				if (is_error)
-					return { true, 0, 0 };
 				dtz = 1;
 			}
 			else
 			{
-				tie(val, dtz) = probe_one(board);
 				if (is_zeroing)
 					dtz = 1;
 				else
@@ -525,6 +883,75 @@ tuple<bool, int16_t, uint8_t> TB_Reader::probe_ep(Position& board)
 	return { false, best_val, best_dtz };
 }
 
+void TB_Reader::probe_children(Position& board, vector<TB_Child>& children)
+{
+	struct Pending
+	{
+		TB_Reader* tb;
+		size_t key;
+		size_t child;
+	};
+	children.clear();
+	vector<Pending> pending;
+	vector<pair<string, shared_ptr<TB_Reader>>> tbs; // the children land in a few tables
+	for (const auto& move_i : MoveList<LEGAL>(board))
+	{
+		const Move& m = move_i.move;
+		children.push_back({ m, 0, 0, false });
+		auto& child = children.back();
+		StateInfo st;
+		board.do_move(m, st);
+		if (!is_anti_win(board) && !is_anti_loss(board))
+		{
+			string tb_name = board_to_name(board);
+			auto it_tb = find_if(tbs.begin(), tbs.end(), [&tb_name](const auto& tb) { return tb.first == tb_name; });
+			if (it_tb == tbs.end())
+				it_tb = tbs.emplace(tbs.end(), tb_name, get_tb(tb_name));
+			const auto& tb = it_tb->second;
+			bool is_ep = is_ep_position(board);
+			if (!tb)
+				stats_of(tb_name).errors.fetch_add(1, memory_order_relaxed);
+			if (!tb || (!DO_EP_POSITIONS && is_ep))
+				child.is_error = true;
+			else if (is_ep || (tb->tb_flags & EGTB_SKIP_ONLY_MOVES))
+				tie(child.is_error, child.val, child.dtz) = probe_tb(board); // needs a search
+			else
+				pending.push_back({ tb.get(), tb->board_to_key(board), children.size() - 1 });
+		}
+		board.undo_move(m);
+	}
+
+	/// Read the values table by table in the order of the keys, so that each chunk is looked up once
+	sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) { return a.tb != b.tb ? a.tb < b.tb : a.key < b.key; });
+	for (size_t i = 0; i < pending.size(); )
+	{
+		TB_Reader* tb = pending[i].tb;
+		ChunkCursor cursor;
+		size_t j = i;
+		auto t0 = chrono::steady_clock::now();
+		try
+		{
+			for (; j < pending.size() && pending[j].tb == tb; j++)
+			{
+				auto& child = children[pending[j].child];
+				tie(child.val, child.dtz) = tb->read_one(pending[j].key, true, &cursor);
+			}
+			// The probes of the batch share its time
+			uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count();
+			tb->tb_stats->add(ns / (j - i), j - i);
+		}
+		catch (const exception&)
+		{
+			for (; j < pending.size() && pending[j].tb == tb; j++) {
+				children[pending[j].child].is_error = true;
+				tb->tb_stats->errors.fetch_add(1, memory_order_relaxed);
+			}
+			discard_tb(tb->tb_name);
+		}
+		i = j;
+	}
+}
+
 bool TB_Reader::probe_EGTB(Position& board, int16_t& val, uint8_t& dtz)
 {
 	bool is_error;
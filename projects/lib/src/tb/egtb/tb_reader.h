@@ -3,13 +3,19 @@
 
 #include "../position.h"
 #include "tb_idx.h"
+#include "chunk_cache.h"
+#include "probe_stats.h"
+#include "tb_blocks.h"
 
 #include <memory>
 #include <vector>
 #include <string>
 #include <map>
+#include <array>
 #include <functional>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
 #include <filesystem>
 
 #ifdef USE_FAIRY_SF
@@ -49,20 +55,88 @@ namespace egtb
 	using DZ_Header = void*;
 	using val_dtz = std::tuple<int16_t, uint8_t>;
 
+	struct TB_CacheStats
+	{
+		std::string tb_name;
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t inflate_ns;
+		uint64_t inflated_bytes;
+	};
+
+	struct TB_ProbeStats
+	{
+		std::string tb_name;
+		bool is_available;
+		uint64_t probes;
+		uint64_t errors;        // probes that found no table
+		double mean_us;
+		double p50_us;
+		double p99_us;
+		uint64_t cache_hits;
+		uint64_t cache_misses;
+		uint64_t inflated_bytes;
+		double engine_seconds;  // spent by the engine where the table was missing
+	};
+
+	struct TB_Child
+	{
+		Move move;
+		int16_t val;
+		uint8_t dtz;
+		bool is_error;
+	};
+
+	/// Chunks kept at hand by a batch of reads in the order of the keys (two for the VAL and DTZ planes)
+	struct ChunkCursor
+	{
+		std::array<std::pair<uint32_t, Chunk>, 2> chunks;
+		size_t next = 0;
+	};
+
+	struct TB_PreloadInfo
+	{
+		std::string tb_name;
+		size_t bytes;
+		double seconds;
+		bool is_ok;
+	};
+
 	class TB_Reader
 	{
 	public:
 		static fs::path egtb_path;
 		static std::string file_extension_compressed;
-		static std::map<std::string, std::shared_ptr<TB_Reader>> tb_cache;
+		static std::string file_extension_blocks;
 	protected:
-		static bool auto_load;
+		static std::map<std::string, std::shared_ptr<TB_Reader>> tb_cache;
+		static std::shared_mutex mtx_cache;
+		static std::atomic<bool> auto_load;
+		static std::map<std::string, std::unique_ptr<ProbeStats>> tb_probe_stats; // kept when a table is discarded or reopened
+		static std::mutex mtx_stats;
 
 	public:
 		static void init(const std::string& tb_path, bool load_all = false);
 		static bool probe_EGTB(Position& board, int16_t& val, uint8_t& dtz);
+		/// Probes all the legal moves of the position (in the order of MoveList<LEGAL>) at once: the same as probe_EGTB for each child.
+		/// The children that end the game aren't probed (val = dtz = 0).
+		static void probe_children(Position& board, std::vector<TB_Child>& children);
 		static void print_EGTB_info();
 		static void discard_tb(const std::string& tb_name);
+		/// Opens the file of the table again (e.g. once it's generated)
+		static void reopen_tb(const std::string& tb_name);
+		static size_t num_tbs();
+		static void set_cache_size(size_t bytes);
+		static std::vector<TB_CacheStats> cache_stats();
+		/// Statistics of all the tables probed since the start or the last reset, including the missing ones;
+		/// sorted by the engine time, then by the number of failed probes and then by the number of probes
+		static std::vector<TB_ProbeStats> probe_stats();
+		static void reset_probe_stats();
+		static bool save_probe_stats(const std::string& path, std::string& error_text);
+		/// Engine time spent on a position because its table is missing
+		static void add_engine_time(const std::string& tb_name, double seconds);
+		static std::vector<TB_PreloadInfo> preload(size_t max_pieces, size_t num_threads = 0);
+		static bool convert_to_blocks(const std::string& tb_name, uint32_t block_size, bool separate_planes, std::string& error_text);
 
 	public:
 		TB_Reader(const std::string& tb_name);
@@ -70,19 +144,23 @@ namespace egtb
 
 	protected:
 		void init_idx(const std::vector<char>& idx_data);
-		bool is_dz_open() const;
-		uint16_t read_flags(DZ_Header header, bool is_compressed) const;
+		bool is_open() const;
+		uint16_t read_flags(uint16_t flags, bool is_compressed) const;
 		void error(const std::string& text, bool throw_exception = true) const;
 
 		std::tuple<size_t, bool> board_to_index(const Position& board) const;
 		size_t board_to_key(const Position& board, bool is_ep = false) const;
 		void read_val_12bit(char* p_bytes, size_t key, const char* p_data) const;
-		val_dtz read_one(size_t key, bool is_compressed = true);
+		void read_bytes(size_t start, size_t size, char* buffer, ChunkCursor* cursor = nullptr);
+		bool load_to_ram();
+		val_dtz read_one(size_t key, bool is_compressed = true, ChunkCursor* cursor = nullptr);
 		val_dtz load_one(const char* tb_bytes, bool is_compressed, bool val_big) const;
 
 		val_dtz probe_one(Position& board);
 		std::tuple<bool, int16_t, uint8_t> probe_ep(Position& board);
 		static std::tuple<bool, int16_t, uint8_t> probe_tb(Position& board);
+		static std::shared_ptr<TB_Reader> get_tb(const std::string& tb_name);
+		static ProbeStats& stats_of(const std::string& tb_name);
 
 	protected:
 		std::string tb_name;
@@ -91,12 +169,21 @@ namespace egtb
 		bool is_symmetrical;
 		
 		DZ_Header dz_header;
+		std::unique_ptr<BlockFile> block_file; // if the table is in the random-access format
+		uint64_t orig_length;
 		uint16_t tb_flags;
-		std::mutex mtx_dz;
+		std::vector<char> ram_data;
+		std::atomic<const char*> p_ram_data; // set once the whole table is in ram_data
+		std::mutex mtx_dz; // for the files that aren't in dzip format
+		uint32_t table_id;
+		size_t chunk_length;
+		ChunkStats chunk_stats;
+		ProbeStats* tb_stats; // in tb_probe_stats
 		
 		std::shared_ptr<TBTable> tbtable;
 		size_t size;
 		size_t size2;
+		size_t num_entries;
 	};
 
 } // namespace egtb
@@ -0,0 +1,214 @@
+#ifndef VERIFY_MEMO_H
+#define VERIFY_MEMO_H
+
+#include "positioninfo.h"
+#include "flathash.h"
+
+#include <QString>
+
+#include <vector>
+#include <deque>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <iterator>
+#include <cstdint>
+
+
+/*
+ * What the book verifier found in a position: counters, messages and the positions with our turn it reached.
+ * The workers verify the positions in different orders, so nothing is reported right away. The events are kept
+ * with the positions and replayed at the end in the order of a sequential walk, so the report doesn't depend
+ * on the number of workers. Most positions report nothing, so the positions reached are kept apart as keys and
+ * each event only records how many of them come before it.
+ */
+struct VerifyEvent
+{
+	enum class Type : uint8_t
+	{
+		tb_needed,       // text is the EGTB name
+		stop_score,      // text is the move stack
+		stop_TB_score,   // text is the move stack
+		message,         // emit Message()
+		counted_message  // emit_message()
+	};
+
+	Type type;
+	MessageType message_type;
+	int16_t value;
+	uint32_t num_positions; // reached before the event
+	QString text;
+};
+
+struct VerifyLog
+{
+	struct Mark
+	{
+		size_t num_positions;
+		size_t num_events;
+		int num_analysed;
+		size_t num_TBs;
+		size_t num_overridden_TBs;
+	};
+
+	int num_analysed = 0;
+	size_t num_TBs = 0;
+	size_t num_overridden_TBs = 0;
+	std::vector<uint64_t> positions; // saved in the memo, their events are replayed the first time they're reached
+	std::vector<VerifyEvent> events;
+
+	void add(VerifyEvent::Type type, int16_t value, const QString& text = QString())
+	{
+		events.push_back({ type, MessageType::std, value, static_cast<uint32_t>(positions.size()), text });
+	}
+	void add_position(uint64_t key)
+	{
+		positions.push_back(key);
+	}
+	void add_message(const QString& message, MessageType type = MessageType::std, bool is_counted = false)
+	{
+		auto event_type = is_counted ? VerifyEvent::Type::counted_message : VerifyEvent::Type::message;
+		events.push_back({ event_type, type, 0, static_cast<uint32_t>(positions.size()), message });
+	}
+
+	void append(VerifyLog&& log)
+	{
+		num_analysed += log.num_analysed;
+		num_TBs += log.num_TBs;
+		num_overridden_TBs += log.num_overridden_TBs;
+		auto num_positions = static_cast<uint32_t>(positions.size());
+		for (auto& event : log.events)
+			event.num_positions += num_positions;
+		if (positions.empty())
+			positions = std::move(log.positions);
+		else
+			positions.insert(positions.end(), log.positions.begin(), log.positions.end());
+		if (events.empty())
+			events = std::move(log.events);
+		else
+			events.insert(events.end(), std::make_move_iterator(log.events.begin()), std::make_move_iterator(log.events.end()));
+	}
+
+	Mark mark() const { return { positions.size(), events.size(), num_analysed, num_TBs, num_overridden_TBs }; }
+
+	// Moves everything added after the mark to a new log, without spare capacity as it's kept in the memo
+	VerifyLog split(const Mark& m)
+	{
+		VerifyLog log;
+		log.num_analysed = num_analysed - m.num_analysed;
+		log.num_TBs = num_TBs - m.num_TBs;
+		log.num_overridden_TBs = num_overridden_TBs - m.num_overridden_TBs;
+		log.positions.assign(positions.begin() + m.num_positions, positions.end());
+		log.events.assign(std::make_move_iterator(events.begin() + m.num_events), std::make_move_iterator(events.end()));
+		for (auto& event : log.events)
+			event.num_positions -= static_cast<uint32_t>(m.num_positions);
+		positions.resize(m.num_positions);
+		events.resize(m.num_events);
+		num_analysed = m.num_analysed;
+		num_TBs = m.num_TBs;
+		num_overridden_TBs = m.num_overridden_TBs;
+		return log;
+	}
+};
+
+
+/*
+ * Memo of the verified positions with our turn, shared by the verifier workers.
+ * The keys are split into shards, each with its own lock. The first result saved for a key is kept:
+ * the workers that happen to verify the same position at once get the same result anyway.
+ * A small lossy table of the positions being verified lets a worker leave them to the others
+ * and come back to them later (ABDADA), so the workers spread over the book.
+ */
+class VerifyMemo
+{
+public:
+	struct Node
+	{
+		int16_t score;
+		uint32_t num_nodes;
+		VerifyLog log;
+		bool is_replayed = false;
+	};
+
+public:
+	VerifyMemo() : busy(new std::atomic<uint64_t>[BUSY_SIZE]) { clear(); }
+
+	void clear()
+	{
+		for (auto& shard : shards)
+		{
+			shard.index.clear();
+			shard.nodes.clear();
+		}
+		for (size_t i = 0; i < BUSY_SIZE; i++)
+			busy[i].store(0, std::memory_order_relaxed);
+	}
+
+	bool find(uint64_t key, int16_t& score, uint32_t& num_nodes) const
+	{
+		auto& shard = shard_of(key);
+		std::lock_guard<std::mutex> lock(shard.mtx);
+		auto it = shard.index.find(key);
+		if (it == shard.index.end())
+			return false;
+		auto& node = shard.nodes[it->second];
+		score = node.score;
+		num_nodes = node.num_nodes;
+		return true;
+	}
+
+	void insert(uint64_t key, Node&& node)
+	{
+		auto& shard = shard_of(key);
+		std::lock_guard<std::mutex> lock(shard.mtx);
+		if (!shard.index.insert({ key, static_cast<uint32_t>(shard.nodes.size()) }).second)
+			return;
+		shard.nodes.push_back(std::move(node));
+	}
+
+	// Only when no worker is running
+	Node* node(uint64_t key)
+	{
+		auto& shard = shard_of(key);
+		auto it = shard.index.find(key);
+		return (it == shard.index.end()) ? nullptr : &shard.nodes[it->second];
+	}
+
+	void set_busy(uint64_t key, bool is_busy)
+	{
+		auto& slot = busy[key & (BUSY_SIZE - 1)];
+		if (is_busy) {
+			slot.store(key, std::memory_order_relaxed);
+		}
+		else {
+			uint64_t expected = key;
+			slot.compare_exchange_strong(expected, 0, std::memory_order_relaxed);
+		}
+	}
+
+	bool is_busy(uint64_t key) const
+	{
+		return busy[key & (BUSY_SIZE - 1)].load(std::memory_order_relaxed) == key;
+	}
+
+private:
+	struct Shard
+	{
+		mutable std::mutex mtx;
+		FlatHashMap<uint32_t> index;
+		std::deque<Node> nodes;
+	};
+
+	Shard& shard_of(uint64_t key) { return shards[(key >> 58) & (NUM_SHARDS - 1)]; }
+	const Shard& shard_of(uint64_t key) const { return shards[(key >> 58) & (NUM_SHARDS - 1)]; }
+
+private:
+	constexpr static size_t NUM_SHARDS = 64;
+	constexpr static size_t BUSY_SIZE = 1 << 16;
+
+	std::array<Shard, NUM_SHARDS> shards;
+	std::unique_ptr<std::atomic<uint64_t>[]> busy;
+};
+
+#endif // VERIFY_MEMO_H
@@ -8,12 +8,14 @@ extern "C"
 #include "board/boardfactory.h"
 
 #include <QStringList>
+#include <QSettings>
 
 #include <cstdint>
 #include <math.h>
 #include <mutex>
 #include <algorithm>
 #include <array>
+#include <stdexcept>
 
 using namespace std;
 using namespace std::chrono;
@@ -36,8 +38,10 @@ std::shared_ptr<LosingLoeser> LosingLoeser::instance()
 	return _instance;
 }
 
-LosingLoeser::LosingLoeser()
-	: board(BoardFactory::create("antichess"))
+LosingLoeser::LosingLoeser(size_t max_ram)
+	: ctx(ll_new_context(max_ram))
+	, max_ram(max_ram)
+	, board(BoardFactory::create("antichess"))
 	, max_moves(0)
 	, total_nodes(0)
 	, status(Status::idle)
@@ -45,11 +49,18 @@ LosingLoeser::LosingLoeser()
 {
 	qRegisterMetaType<LLdata>();
 	qRegisterMetaType<MessageType>();
+	if (!ctx)
+		throw runtime_error("Failed to create a LosingLoeser context.");
+}
+
+LosingLoeser::~LosingLoeser()
+{
+	ll_free_context(ctx);
 }
 
 size_t LosingLoeser::requiredRAM(int Mnodes) const
 {
-	return ll_required_ram(static_cast<uint32_t>(max(0, Mnodes) * 1'000'000));
+	return ll_required_ram(ctx, static_cast<uint32_t>(max(0, Mnodes) * 1'000'000));
 }
 
 std::vector<move_t> LosingLoeser::set_position(Chess::Board* ref_board)
@@ -92,7 +103,15 @@ void LosingLoeser::start(Chess::Board* ref_board, uint32_t total_nodes, size_t m
 		else
 		{
 			curr_result_key = 0;
-			int ec = ll_init_search(total_nodes, step_nodes, moves.data(), static_cast<uint32_t>(moves.size()));
+			ll_set_num_threads(ctx, QSettings().value("engine/threads", 2).toUInt());
+			// Beyond the available memory, the tree keeps reclaiming its solved subtrees rather than swapping
+			ll_set_max_ram(ctx, max_ram ? max_ram : get_avail_memory());
+			int ec = ll_init_search(ctx, total_nodes, step_nodes, moves.data(), static_cast<uint32_t>(moves.size()));
+			if (ec == LL_ERROR_RAM)
+			{
+				emit Message(QString("Not enough memory for LosingLoeser to search %L1 nodes.").arg(total_nodes), MessageType::warning);
+				return;
+			}
 			if (ec)
 			{
 				emit Message(QString("Failed to initialise LosingLoeser: error code %1.").arg(ec), MessageType::warning);
@@ -182,7 +201,7 @@ void LosingLoeser::run()
 				emit Finished();
 				return;
 			}
-			ll_do_search(&len_moves, move_res, static_cast<unsigned int>(max_moves),
+			ll_do_search(ctx, &len_moves, move_res, static_cast<unsigned int>(max_moves),
 			             &tb_hits, &len_main_line, main_line);
 			n += step_nodes;
 			res.time_us = duration_cast<microseconds>(steady_clock::now() - start_time).count();
@@ -256,7 +275,7 @@ std::vector<MoveResult> LosingLoeser::getResults(Chess::Board* ref_board)
 	std::vector<MoveResult> move_evals;
 	if (status != Status::idle)
 		return move_evals;
-	if (!ll_has_results() || !board || board->key() != curr_result_key)
+	if (!ll_has_results(ctx) || !board || board->key() != curr_result_key)
 		return move_evals;
 	if (!board || !is_branch(board.get(), ref_board))
 		return move_evals;
@@ -287,7 +306,7 @@ std::vector<MoveResult> LosingLoeser::getResults(Chess::Board* ref_board)
 		}
 	}
 
-	ll_get_results(&len_moves, move_res.data(), static_cast<uint32_t>(move_res.size()),
+	ll_get_results(ctx, &len_moves, move_res.data(), static_cast<uint32_t>(move_res.size()),
 	               moves.data(), static_cast<uint32_t>(moves.size()));
 	move_evals.resize(len_moves);
 	for (size_t i = 0; i < len_moves; i++)
@@ -314,7 +333,7 @@ std::vector<MoveResult> LosingLoeser::getResults(Chess::Board* ref_board)
 
 std::shared_ptr<Chess::Board> LosingLoeser::getResultsBoard()
 {
-	if (!ll_has_results() || !board || board->key() != curr_result_key)
+	if (!ll_has_results(ctx) || !board || board->key() != curr_result_key)
 		return nullptr;
 	return board;
 }
@@ -326,7 +345,7 @@ bool LosingLoeser::isBusy() const
 
 bool LosingLoeser::hasResults() const
 {
-	return ll_has_results();
+	return ll_has_results(ctx);
 }
 
 void LosingLoeser::Run()
@@ -346,7 +365,7 @@ void LosingLoeser::clear()
 	{
 		if (isBusy())
 			return;
-		ll_clear_data();
+		ll_clear_data(ctx);
 	}
 	catch (...) {}
 }
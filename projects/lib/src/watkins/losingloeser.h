@@ -19,6 +19,7 @@ namespace Chess
 {
 	class Board;
 }
+struct LL_CONTEXT;
 
 
 struct MoveResult
@@ -65,9 +66,14 @@ class LosingLoeser : public QObject
 		processing
 	};
 
-private:
-	LosingLoeser();
+public:
+	/// Each instance has its own search, limited by max_ram (0 if unlimited)
+	explicit LosingLoeser(size_t max_ram = 0);
+	~LosingLoeser();
+	LosingLoeser(const LosingLoeser&) = delete;
+	LosingLoeser& operator=(const LosingLoeser&) = delete;
 
+private:
 	static std::shared_ptr<LosingLoeser> _instance;
 
 public:
@@ -98,6 +104,8 @@ signals:
 	void Finished();
 
 private:
+	LL_CONTEXT* ctx;
+	size_t max_ram;
 	std::shared_ptr<Chess::Board> board;
 	size_t max_moves;
 	uint32_t total_nodes;
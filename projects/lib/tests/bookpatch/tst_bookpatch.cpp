@@ -0,0 +1,300 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QDir>
+#include <board/board.h>
+#include <board/boardfactory.h>
+#include <positioninfo.h>
+#include <solution.h>
+#include <solver.h>
+
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+
+
+/*
+ * The changes of the tree since the first book.
+ */
+struct TreeChanges
+{
+	std::set<quint64> moved;          // the next legal move is played instead of the default one
+	std::set<quint64> solved;         // the move has no replies, as if the position became an endgame
+	std::map<quint64, qint16> scores; // added to the scores of the leaves right below
+};
+
+struct TreeNode
+{
+	int depth;
+	quint64 key;
+	int num_moves;
+	Line line;
+};
+
+/*
+ * A solver that assembles the book from a generated tree instead of a solved one.
+ */
+class BookSolver : public Solver
+{
+	public:
+		BookSolver(std::shared_ptr<Solution> solution);
+
+		bool build(const TreeChanges& changes, int depth);
+		void change(const Line& line);
+		void setScoreLimit(qint16 score_limit);
+		const std::vector<TreeNode>& nodes() const;
+
+	private:
+		void expand(pMove& move, int depth);
+
+		const TreeChanges* m_changes;
+		int m_numOpeningPlies;
+		std::set<quint64> m_expanded;
+		std::set<quint64> m_stack;
+		std::vector<TreeNode> m_nodes;
+};
+
+BookSolver::BookSolver(std::shared_ptr<Solution> solution)
+	: Solver(solution),
+	  m_changes(nullptr)
+{
+	m_numOpeningPlies = board->MoveHistory().size();
+}
+
+bool BookSolver::build(const TreeChanges& changes, int depth)
+{
+	m_changes = &changes;
+	trans.clear();
+	m_expanded.clear();
+	m_nodes.clear();
+	auto root = std::make_shared<SolverMove>();
+	expand(root, depth);
+	return create_book(root, 1);
+}
+
+void BookSolver::change(const Line& line)
+{
+	// The data of the position is saved again, as the solver does when it changes the move or its score
+	for (const auto& move : line)
+		board->makeMove(move);
+	save_data(std::make_shared<SolverMove>(board->legalMoves().front(), board));
+	for (size_t i = 0; i < line.size(); i++)
+		board->undoMove();
+}
+
+void BookSolver::setScoreLimit(qint16 score_limit)
+{
+	s.score_limit = score_limit;
+}
+
+const std::vector<TreeNode>& BookSolver::nodes() const
+{
+	return m_nodes;
+}
+
+void BookSolver::expand(pMove& move, int depth)
+{
+	quint64 key = board->key();
+	if (depth == 0 || m_stack.count(key))
+		return;
+	if (m_expanded.count(key)) {
+		trans.insert(key);
+		return;
+	}
+	auto legal_moves = board->legalMoves();
+	if (legal_moves.isEmpty())
+		return;
+
+	// The move depends on the position, so that the lines transpose into each other
+	int i = int(key % quint64(legal_moves.size())) + int(m_changes->moved.count(key));
+	auto our_move = legal_moves[i % legal_moves.size()];
+	auto m = std::make_shared<SolverMove>(our_move, board, qint16(MATE_VALUE - 10), 0);
+	move->moves.push_back(m);
+	Line line;
+	const auto& history = board->MoveHistory();
+	for (int j = m_numOpeningPlies; j < history.size(); j++)
+		line.push_back(history[j].move);
+	m_nodes.push_back({ depth, key, int(legal_moves.size()), line });
+
+	m_stack.insert(key);
+	if (!m_changes->solved.count(key))
+	{
+		auto it_score = m_changes->scores.find(key);
+		qint16 shift = (it_score != m_changes->scores.end()) ? it_score->second : 0;
+		board->makeMove(our_move);
+		for (const auto& reply : board->legalMoves())
+		{
+			auto r = std::make_shared<SolverMove>(reply, board);
+			board->makeMove(reply);
+			r->set_score(MATE_VALUE - 20 - qint16(board->key() % 8) + shift);
+			m->moves.push_back(r);
+			expand(r, depth - 1);
+			board->undoMove();
+		}
+		board->undoMove();
+	}
+	m_stack.erase(key);
+	m_expanded.insert(key);
+}
+
+
+class tst_BookPatch: public QObject
+{
+	Q_OBJECT
+
+	private slots:
+		void initTestCase();
+
+		void patchBook_data() const;
+		void patchBook();
+		void rebuildOnSettingsChange();
+
+	private:
+		std::shared_ptr<Solution> createSolution(const QString& dir) const;
+		QByteArray patchedBook() const;
+		QByteArray fullBook();
+
+		constexpr static int BOOK_DEPTH = 3;
+
+		QTemporaryDir m_dir;
+		QString m_patchedDir;
+		QString m_fullDir;
+		std::shared_ptr<Solution> m_solution;
+		std::unique_ptr<BookSolver> m_solver;
+		TreeChanges m_changes;
+		QStringList m_messages;
+};
+
+
+std::shared_ptr<Solution> tst_BookPatch::createSolution(const QString& dir) const
+{
+	std::shared_ptr<Chess::Board> board(Chess::BoardFactory::create("antichess"));
+	board->setFenString(board->defaultFenString());
+	Line opening;
+	for (const QString& str : { "e2e3", "e7e6" })
+	{
+		auto move = board->moveFromString(str);
+		opening.push_back(move);
+		board->makeMove(move);
+	}
+	auto data = std::make_shared<SolutionData>(opening, Line(), "", std::list<BranchToSkip>(), "", -1, dir);
+	return std::make_shared<Solution>(data);
+}
+
+QByteArray tst_BookPatch::patchedBook() const
+{
+	QFile file(m_solution->path(FileType_book_upper));
+	if (!file.open(QIODevice::ReadOnly))
+		return QByteArray();
+	return file.readAll();
+}
+
+QByteArray tst_BookPatch::fullBook()
+{
+	// A new solution has no book saved in this session, so its book is always written in full
+	auto solution = createSolution(m_fullDir);
+	BookSolver solver(solution);
+	if (!solver.build(m_changes, BOOK_DEPTH))
+		return QByteArray();
+	QFile file(solution->path(FileType_book_upper));
+	if (!file.open(QIODevice::ReadOnly))
+		return QByteArray();
+	return file.readAll();
+}
+
+void tst_BookPatch::initTestCase()
+{
+	QVERIFY(m_dir.isValid());
+	m_patchedDir = m_dir.filePath("patched");
+	m_fullDir = m_dir.filePath("full");
+	for (const auto& dir : { m_patchedDir, m_fullDir })
+	{
+		QVERIFY(QDir(dir).mkpath(Solution::DATA));
+		QVERIFY(QDir(dir).mkpath(Solution::BOOKS));
+	}
+
+	m_solution = createSolution(m_patchedDir);
+	QVERIFY(m_solution->isValid());
+	m_solver = std::make_unique<BookSolver>(m_solution);
+	connect(m_solver.get(), &Solver::Message, this, [this](const QString& message, MessageType) { m_messages.append(message); });
+	QVERIFY(m_solver->build(m_changes, BOOK_DEPTH));
+	QVERIFY(m_messages.filter("Book patched").isEmpty());
+	QVERIFY(m_messages.filter("unused transpositions").isEmpty()); // each one leads to a subtree expanded before
+}
+
+void tst_BookPatch::patchBook_data() const
+{
+	QTest::addColumn<QString>("change");
+
+	// In order, each row on top of the previous ones
+	QTest::newRow("same move") << "score";
+	QTest::newRow("changed move") << "move";
+	QTest::newRow("removed subtree") << "solved";
+}
+
+void tst_BookPatch::patchBook()
+{
+	QFETCH(QString, change);
+
+	/// A position of the current tree: one with the leaves right below for a new score, one with a subtree otherwise
+	const auto& nodes = m_solver->nodes();
+	const TreeNode* node = nullptr;
+	for (const auto& n : nodes)
+	{
+		if (n.depth != (change == "score" ? 1 : 2) || (change == "move" && n.num_moves < 2))
+			continue;
+		node = &n;
+		if (change != "solved")
+			break; // the first one, and the last one to remove its subtree
+	}
+	QVERIFY(node);
+	if (change == "score")
+		m_changes.scores[node->key] = 2;
+	else if (change == "move")
+		m_changes.moved.insert(node->key);
+	else
+		m_changes.solved.insert(node->key);
+	m_solver->change(node->line);
+
+	m_messages.clear();
+	QVERIFY(m_solver->build(m_changes, BOOK_DEPTH));
+	QCOMPARE(m_messages.filter("Book patched").size(), 1);
+	if (change == "solved")
+		QVERIFY(m_messages.filter(" 0 rows removed").isEmpty());
+	QVERIFY(!QFile::exists(Solution::ext_to_bak(m_solution->path(FileType_book_upper))));
+
+	QByteArray patched = patchedBook();
+	QByteArray full = fullBook();
+	QVERIFY(!full.isEmpty());
+	QCOMPARE(patched.size(), full.size());
+	QVERIFY(patched == full);
+}
+
+void tst_BookPatch::rebuildOnSettingsChange()
+{
+	// A setting that the tree depends on changes the fingerprint of the book, so it is written in full
+	const auto& nodes = m_solver->nodes();
+	QVERIFY(!nodes.empty());
+	m_changes.scores[nodes.back().key] += 1;
+	m_solver->change(nodes.back().line);
+	m_solver->setScoreLimit(MATE_VALUE - 10);
+
+	m_messages.clear();
+	QVERIFY(m_solver->build(m_changes, BOOK_DEPTH));
+	QVERIFY(m_messages.filter("Book patched").isEmpty());
+	QByteArray full = fullBook();
+	QVERIFY(!full.isEmpty());
+	QVERIFY(patchedBook() == full);
+
+	// The next change with the same settings is patched again
+	m_changes.scores[nodes.front().key] += 1;
+	m_solver->change(nodes.front().line);
+	m_messages.clear();
+	QVERIFY(m_solver->build(m_changes, BOOK_DEPTH));
+	QCOMPARE(m_messages.filter("Book patched").size(), 1);
+	QVERIFY(patchedBook() == fullBook());
+}
+
+QTEST_MAIN(tst_BookPatch)
+#include "tst_bookpatch.moc"
@@ -0,0 +1,337 @@
+#include <QtTest/QtTest>
+#include <QDir>
+#include <QTemporaryDir>
+#include <tb/egtb/tb_api.h>
+#include <tb/egtb/chunk_cache.h>
+#include <tb/egtb/tb_gen.h>
+
+#include <thread>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <array>
+#include <vector>
+
+
+/*
+ * The index of a table being generated, as the generator decodes and encodes it.
+ */
+class TableIndex : public egtb::TB_Generator
+{
+	public:
+		using TB_Generator::TB_Generator;
+
+		uint64_t size() const { return num_entries; }
+		bool position(uint64_t idx, Position& pos, StateInfo& st) const { return set_position(idx, pos, st); }
+		uint64_t index(const Position& pos) const { return tbtable->get_idx(pos); }
+};
+
+
+class tst_Egtb: public QObject
+{
+	Q_OBJECT
+
+	private slots:
+		void initTestCase();
+
+		void chunkCache();
+		void chunkCacheConcurrent();
+
+		void concurrentProbes();
+		void probeThroughput_data() const;
+		void probeThroughput();
+
+		void decodeIndices_data() const;
+		void decodeIndices();
+		void generateTables();
+
+	private:
+		struct TbPosition
+		{
+			int white_squares[2];
+			int white_pieces[2];
+			int black_squares[2];
+			int black_pieces[2];
+			int side_to_move;
+		};
+
+		std::vector<std::vector<int>> probe_all(int num_threads, size_t num_probes, bool to_keep_results = false) const;
+
+		bool m_tbAvailable = false;
+		std::vector<TbPosition> m_positions;
+		std::vector<int> m_expected;
+};
+
+
+void tst_Egtb::initTestCase()
+{
+	const auto path = qEnvironmentVariable("EGTB_PATH", QLatin1String("egtb_path"));
+	if (!QDir(path).exists())
+		return;
+	QCOMPARE(antichess_tb_init(), 0);
+	auto egtb_path = path.toStdString();
+	if (antichess_tb_add_path(egtb_path.c_str(), egtb_path.size()) < -700)
+		return;
+	m_tbAvailable = true;
+
+	// Random 4-piece positions without pawns, so that any placement on empty squares is legal
+	std::mt19937 rng(20230101);
+	std::uniform_int_distribution<int> square(0, 63);
+	std::uniform_int_distribution<int> piece(2, 6); // KNIGHT..KING
+	while (m_positions.size() < 20000)
+	{
+		TbPosition p;
+		int squares[4];
+		for (int i = 0; i < 4; i++)
+		{
+			do
+				squares[i] = square(rng);
+			while (std::find(squares, squares + i, squares[i]) != squares + i);
+		}
+		for (int i = 0; i < 2; i++)
+		{
+			p.white_squares[i] = squares[i];
+			p.white_pieces[i] = piece(rng);
+			p.black_squares[i] = squares[i + 2];
+			p.black_pieces[i] = piece(rng);
+		}
+		p.side_to_move = static_cast<int>(rng() & 1);
+		m_positions.push_back(p);
+	}
+	m_expected = probe_all(1, m_positions.size(), true).front();
+}
+
+std::vector<std::vector<int>> tst_Egtb::probe_all(int num_threads, size_t num_probes, bool to_keep_results) const
+{
+	std::vector<std::vector<int>> results(num_threads);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++)
+	{
+		threads.emplace_back([this, t, num_probes, to_keep_results, &results]()
+		{
+			// Every thread starts at its own place, so the threads hit both the same and different chunks
+			auto& res = results[t];
+			if (to_keep_results)
+				res.assign(m_positions.size(), 0);
+			size_t start = t * m_positions.size() / 7;
+			for (size_t i = 0; i < num_probes; i++)
+			{
+				size_t n = (start + i) % m_positions.size();
+				const auto& p = m_positions[n];
+				int dtw = 0;
+				int ret = antichess_tb_probe_dtw(p.white_squares, p.white_pieces, 2,
+				                                 p.black_squares, p.black_pieces, 2,
+				                                 p.side_to_move, 0, &dtw);
+				if (to_keep_results)
+					res[n] = (ret < 0) ? ret : (ret * 10000 + dtw);
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	return results;
+}
+
+void tst_Egtb::chunkCache()
+{
+	auto& cache = egtb::ChunkCache::instance();
+	auto budget = cache.budget();
+	cache.clear();
+	cache.set_budget(16 * 4096);
+	egtb::ChunkStats stats;
+	int num_loads = 0;
+	auto loader = [&num_loads](std::vector<char>& chunk)
+	{
+		num_loads++;
+		chunk.assign(1024, 'x');
+		return true;
+	};
+	for (int r = 0; r < 2; r++)
+		for (uint32_t i = 0; i < 32; i++)
+			QVERIFY(cache.get(1, i, loader, stats) != nullptr);
+	QVERIFY(num_loads >= 32);
+	QCOMPARE(stats.hits + stats.misses, uint64_t(64));
+	QVERIFY(cache.memory_usage() <= cache.budget());
+
+	cache.discard(1);
+	QCOMPARE(cache.memory_usage(), size_t(0));
+	QVERIFY(cache.get(1, 0, [](std::vector<char>&) { return false; }, stats) == nullptr);
+	cache.set_budget(budget);
+}
+
+void tst_Egtb::chunkCacheConcurrent()
+{
+	auto& cache = egtb::ChunkCache::instance();
+	cache.clear();
+	egtb::ChunkStats stats;
+	std::atomic<bool> is_ok(true);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 8; t++)
+	{
+		threads.emplace_back([&cache, &stats, &is_ok, t]()
+		{
+			for (uint32_t i = 0; i < 20000; i++)
+			{
+				uint32_t table_id = 100 + (i + t) % 3;
+				uint32_t chunk_id = (i * 7919 + t) % 200;
+				auto chunk = cache.get(table_id, chunk_id, [table_id, chunk_id](std::vector<char>& chunk)
+				{
+					chunk.assign(256, static_cast<char>(table_id * 31 + chunk_id));
+					return true;
+				}, stats);
+				if (!chunk || chunk->size() != 256 || (*chunk)[255] != static_cast<char>(table_id * 31 + chunk_id))
+					is_ok = false;
+				if (t == 0 && i % 1000 == 0)
+					cache.discard(100);
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	QVERIFY(is_ok);
+	QCOMPARE(stats.hits + stats.misses, uint64_t(8 * 20000));
+	cache.clear();
+}
+
+void tst_Egtb::concurrentProbes()
+{
+	if (!m_tbAvailable)
+		QSKIP("Antichess tablebases not available");
+
+	int num_threads = std::max(2, QThread::idealThreadCount());
+	auto results = probe_all(num_threads, m_positions.size(), true);
+	for (const auto& res : results)
+		for (size_t i = 0; i < m_positions.size(); i++)
+			QCOMPARE(res[i], m_expected[i]);
+}
+
+void tst_Egtb::probeThroughput_data() const
+{
+	QTest::addColumn<int>("threads");
+
+	for (int n = 1; n < QThread::idealThreadCount(); n *= 2)
+		QTest::newRow(qPrintable(QString("%1 threads").arg(n))) << n;
+	QTest::newRow(qPrintable(QString("%1 threads").arg(QThread::idealThreadCount()))) << QThread::idealThreadCount();
+}
+
+void tst_Egtb::probeThroughput()
+{
+	if (!m_tbAvailable)
+		QSKIP("Antichess tablebases not available");
+
+	QFETCH(int, threads);
+	const size_t num_probes = 100000;
+	auto t0 = std::chrono::steady_clock::now();
+	QBENCHMARK_ONCE {
+		probe_all(threads, num_probes);
+	}
+	std::chrono::duration<double> t = std::chrono::steady_clock::now() - t0;
+	qInfo("%d threads: %.0f probes/s", threads, threads * num_probes / t.count());
+}
+
+void tst_Egtb::decodeIndices_data() const
+{
+	QTest::addColumn<QString>("tbName");
+
+	QTest::newRow("unique pieces") << "KQRvKN";
+	QTest::newRow("pairs of pieces") << "KKNNvB";
+	QTest::newRow("pawns of one side") << "KPPvKN";
+	QTest::newRow("pawns of both sides") << "KPPvPP";
+}
+
+void tst_Egtb::decodeIndices()
+{
+	QFETCH(QString, tbName);
+	QCOMPARE(antichess_tb_init(), 0);
+	Tablebases_init();
+	TableIndex table(tbName.toStdString());
+	QVERIFY(table.size() > 0);
+
+	// A decoded position is encoded to an index, maybe another one for the same pieces, that decodes to it again
+	// or to its mirror, which is encoded to the first index in turn
+	const uint64_t step = table.size() / 20000 + 1;
+	uint64_t num_decoded = 0;
+	uint64_t num_same = 0;
+	StateInfo st, st_i;
+	Position pos, pos_i;
+	for (uint64_t idx = 0; idx < table.size(); idx += step)
+	{
+		if (!table.position(idx, pos, st))
+			continue;
+		num_decoded++;
+		uint64_t idx_i = table.index(pos);
+		QVERIFY(idx_i < table.size());
+		num_same += (idx_i == idx);
+		QVERIFY(table.position(idx_i, pos_i, st_i));
+		uint64_t idx_ii = table.index(pos_i);
+		QVERIFY(idx_ii == idx_i || idx_ii == idx);
+		QCOMPARE(pos_i.side_to_move(), pos.side_to_move());
+		QCOMPARE(pos_i.material_key(), pos.material_key());
+	}
+	QVERIFY(num_decoded > 0);
+	QVERIFY(num_same > 0);
+}
+
+void tst_Egtb::generateTables()
+{
+	// A 3-piece table of the tablebases, if there are any, is generated again from the 2-piece tables
+	const int white_pieces[2] = { 6, 2 }; // KNvK
+	const int black_piece = 6;
+	std::vector<std::array<int, 4>> positions; // the squares and the side to move
+	std::vector<int> expected;
+	if (m_tbAvailable)
+	{
+		std::mt19937 rng(20240101);
+		while (positions.size() < 5000)
+		{
+			std::array<int, 4> p = { int(rng() % 64), int(rng() % 64), int(rng() % 64), int(rng() & 1) };
+			if (p[0] == p[1] || p[0] == p[2] || p[1] == p[2])
+				continue;
+			positions.push_back(p);
+		}
+	}
+	auto probe_all = [&](std::vector<int>& results)
+	{
+		for (const auto& p : positions)
+		{
+			int dtw = 0;
+			int ret = antichess_tb_probe_dtw(p.data(), white_pieces, 2, &p[2], &black_piece, 1, p[3], 0, &dtw);
+			results.push_back((ret < 0) ? ret : (ret * 10000 + dtw));
+		}
+	};
+	probe_all(expected);
+
+	// Switches the tablebases to a new directory, so it goes last
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	auto path = dir.path().toStdString();
+	QCOMPARE(antichess_tb_init(), 0);
+	antichess_tb_add_path(path.c_str(), path.size());
+	for (const auto& tb_name : egtb::TB_Generator::all_tables(2))
+		QCOMPARE(antichess_tb_generate(tb_name.c_str(), tb_name.size(), 2), 0);
+	if (m_tbAvailable)
+	{
+		QCOMPARE(antichess_tb_generate("KNvK", 4, 2), 0);
+		std::vector<int> results;
+		probe_all(results);
+		QCOMPARE(results, expected);
+	}
+
+	auto probe = [](int white_square, int white_piece, int black_square, int black_piece, int& dtw)
+	{
+		return antichess_tb_probe_dtw(&white_square, &white_piece, 1, &black_square, &black_piece, 1, 0, 0, &dtw);
+	};
+	const int a1 = 0, b1 = 1, a2 = 8, a3 = 16;
+	const int bishop = 3, king = 6;
+	int dtw = 0;
+	QCOMPARE(probe(a1, king, a2, king, dtw), 0); // the capture is forced and gives away the last piece
+	QCOMPARE(dtw, -1);
+	QCOMPARE(probe(a1, king, a3, king, dtw), 0); // Ka2 or Kb2 forces the capture
+	QCOMPARE(dtw, 2);
+	QCOMPARE(probe(a1, bishop, b1, bishop, dtw), 2); // the bishops never meet
+}
+
+QTEST_MAIN(tst_Egtb)
+#include "tst_egtb.moc"
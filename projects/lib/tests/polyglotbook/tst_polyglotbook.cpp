@@ -72,6 +72,20 @@ void tst_PolyglotBook::startPos()
 
 	entries = this->entries(&book, &board);
 	QCOMPARE(entries, expect);
+
+	// Batched lookup with direct disk access
+	auto batch = book.entries(QVector<quint64>{ 1234, board.key(), 1234 });
+	QCOMPARE(batch.size(), 3);
+	QVERIFY(batch[0].isEmpty());
+	QCOMPARE(batch[1].size(), expect.size());
+	QVERIFY(batch[2].isEmpty());
+
+	// Same test with a memory-mapped book
+	book = PolyglotBook(OpeningBook::Mmap);
+	QVERIFY(book.read(QStringLiteral(CUTECHESS_TEST_DATA_DIR).append("/book_small.bin")));
+
+	entries = this->entries(&book, &board);
+	QCOMPARE(entries, expect);
 }
 
 QTEST_MAIN(tst_PolyglotBook)
@@ -0,0 +1,184 @@
+#include <QtTest/QtTest>
+#include <board/board.h>
+#include <board/boardfactory.h>
+#include <positioninfo.h>
+#include <tb/bitboard.h>
+#include <tb/position.h>
+#include <tb/thread.h>
+#include <tb/uci.h>
+
+#include <memory>
+#include <deque>
+
+namespace PSQT {
+	void init();
+}
+
+
+class tst_PositionInfo: public QObject
+{
+	Q_OBJECT
+
+	private slots:
+		void initTestCase();
+
+		void positionKeys_data() const;
+		void positionKeys();
+		void positionTracker();
+
+		void savedEndgameMove_data() const;
+		void savedEndgameMove();
+
+		void cleanupTestCase();
+};
+
+
+void tst_PositionInfo::initTestCase()
+{
+	UCI::init(Options);
+	PSQT::init();
+	Bitboards::init();
+	Position::init();
+	Threads.set(1);
+}
+
+void tst_PositionInfo::cleanupTestCase()
+{
+	Threads.set(0);
+}
+
+void tst_PositionInfo::positionKeys_data() const
+{
+	QTest::addColumn<QString>("fen");
+	QTest::addColumn<QString>("moves");
+
+	QTest::newRow("startpos")
+		<< "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w - - 0 1"
+		<< "e2e3 b7b5 e3e4 b5b4 a2a4 b4a3 b2a3";
+	QTest::newRow("en passant")
+		<< "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w - - 0 1"
+		<< "e2e4 a7a6 e4e5 d7d5 e5d6 c7d6";
+	QTest::newRow("black en passant")
+		<< "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w - - 0 1"
+		<< "a2a3 e7e5 a3a4 e5e4 d2d4 e4d3";
+	QTest::newRow("no en passant capture")
+		<< "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w - - 0 1"
+		<< "e2e4 h7h5 e4e5 a7a5";
+	QTest::newRow("promotion to king")
+		<< "8/P7/8/8/8/8/7p/k7 w - - 0 1"
+		<< "a7a8k h2h1n";
+}
+
+void tst_PositionInfo::positionKeys()
+{
+	QFETCH(QString, fen);
+	QFETCH(QString, moves);
+
+	std::shared_ptr<Chess::Board> board(Chess::BoardFactory::create("antichess"));
+	QVERIFY(board != nullptr);
+	QVERIFY(board->setFenString(fen));
+	// The key of the Position has to match the board, which has the keys of the books, after every move,
+	// both when it is set up from the FEN and when the move is made on it
+	auto [pos, st] = boardToPosition(board);
+	QCOMPARE(position_key(*pos), board->key());
+	std::deque<StateInfo> states;
+	for (const auto& str : moves.split(' ', Qt::SkipEmptyParts))
+	{
+		auto move = board->moveFromString(str);
+		QVERIFY2(!move.isNull(), qPrintable(str));
+		board->makeMove(move);
+		auto [pos_i, st_i] = boardToPosition(board);
+		QCOMPARE(position_key(*pos_i), board->key());
+
+		std::string uci = str.toStdString();
+		::Move pos_move = UCI::to_move(*pos, uci);
+		QVERIFY2(pos_move != MOVE_NONE, qPrintable(str));
+		states.emplace_back();
+		pos->do_move(pos_move, states.back());
+		QCOMPARE(position_key(*pos), board->key());
+	}
+}
+
+void tst_PositionInfo::positionTracker()
+{
+	std::shared_ptr<Chess::Board> board(Chess::BoardFactory::create("antichess"));
+	QVERIFY(board != nullptr);
+	board->setFenString(board->defaultFenString());
+	auto make_moves = [&board](const QString& moves)
+	{
+		for (const auto& str : moves.split(' ', Qt::SkipEmptyParts))
+			board->makeMove(board->moveFromString(str));
+	};
+
+	// Forward, back and into another line, with en passant captures on both sides of the turn
+	PositionTracker tracker;
+	QCOMPARE(position_key(tracker.sync(board)), board->key());
+	make_moves("e2e4 a7a6 e4e5 d7d5 e5d6");
+	QCOMPARE(position_key(tracker.sync(board)), board->key());
+	board->undoMove();
+	board->undoMove();
+	make_moves("f7f5 e5f6 g7f6");
+	Position& pos = tracker.sync(board);
+	QCOMPARE(position_key(pos), board->key());
+	QCOMPARE(QString::fromStdString(pos.fen()), board->fenString());
+	make_moves("a2a4 b7b5 a4b5");
+	QCOMPARE(position_key(tracker.sync(board)), board->key());
+
+	// Another board in the same position
+	std::shared_ptr<Chess::Board> other(board->copy());
+	QCOMPARE(position_key(tracker.sync(other)), other->key());
+}
+
+
+void tst_PositionInfo::savedEndgameMove_data() const
+{
+	QTest::addColumn<int>("savedClock");
+	QTest::addColumn<int>("clock");
+	QTest::addColumn<int>("dtz");
+	QTest::addColumn<bool>("isReused");
+
+	QTest::newRow("same clock")
+		<< 0 << 0 << 30 << true;
+	QTest::newRow("later clock")
+		<< 0 << 60 << 30 << true;
+	QTest::newRow("clock at the limit")
+		<< 0 << 70 << 30 << false;
+	QTest::newRow("earlier clock")
+		<< 60 << 0 << 30 << false;
+	QTest::newRow("high clock, immediate zeroing")
+		<< 95 << 95 << 100 << true;
+	QTest::newRow("high clock, short dtz")
+		<< 90 << 95 << 4 << true;
+}
+
+void tst_PositionInfo::savedEndgameMove()
+{
+	QFETCH(int, savedClock);
+	QFETCH(int, clock);
+	QFETCH(int, dtz);
+	QFETCH(bool, isReused);
+
+	// The same endgame position with the move saved at one halfmove clock and reached again at another one
+	const QString position = "8/8/8/2k5/8/8/1R6/1N1K4 w - - %1 60";
+	std::shared_ptr<Chess::Board> board(Chess::BoardFactory::create("antichess"));
+	QVERIFY(board != nullptr);
+	QVERIFY(board->setFenString(position.arg(savedClock)));
+	auto legal_moves = board->legalMoves();
+	QVERIFY(!legal_moves.isEmpty());
+	SolverMove move(legal_moves.front(), board, MATE_VALUE - 20, (quint32(dtz) << 16) | 3);
+	constexpr uint8_t tb_dtz = 31;
+	auto saved = SolverMove(to_saved_endgame_move(move, tb_dtz, board).toBytes());
+
+	QVERIFY(board->setFenString(position.arg(clock)));
+	auto [reused, reused_dtz] = from_saved_endgame_move(saved, board);
+	QCOMPARE(!reused.isNull(), isReused);
+	if (!isReused)
+		return;
+	QCOMPARE(reused.pgMove, move.pgMove);
+	QCOMPARE(reused.score(), move.score());
+	QCOMPARE(reused.depth_time(), move.depth_time());
+	QCOMPARE(reused_dtz, tb_dtz);
+}
+
+QTEST_MAIN(tst_PositionInfo)
+#include "tst_positioninfo.moc"
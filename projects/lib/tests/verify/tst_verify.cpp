@@ -0,0 +1,142 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <board/board.h>
+#include <board/boardfactory.h>
+#include <positioninfo.h>
+#include <solution.h>
+#include <solverresults.h>
+
+#include <map>
+#include <memory>
+#include <algorithm>
+
+
+class tst_Verify: public QObject
+{
+	Q_OBJECT
+
+	private slots:
+		void initTestCase();
+
+		void parallelReport_data() const;
+		void parallelReport();
+
+	private:
+		qint16 addEntries(std::shared_ptr<Chess::Board> board, int depth);
+		QStringList verify(int numThreads);
+
+		constexpr static qint16 STOP_SCORE = 30000;
+		constexpr static int BOOK_DEPTH = 3;
+
+		QTemporaryDir m_dir;
+		std::shared_ptr<Solution> m_solution;
+		std::map<quint64, EntryRow> m_rows;
+		std::map<quint64, qint16> m_scores;
+		QStringList m_report;
+};
+
+
+void tst_Verify::initTestCase()
+{
+	QVERIFY(m_dir.isValid());
+	QVERIFY(QDir(m_dir.path()).mkpath(Solution::DATA));
+	QVERIFY(QDir(m_dir.path()).mkpath(Solution::BOOKS));
+
+	std::shared_ptr<Chess::Board> board(Chess::BoardFactory::create("antichess"));
+	board->setFenString(board->defaultFenString());
+	Line opening;
+	for (const QString& str : { "e2e3", "e7e6" })
+	{
+		auto move = board->moveFromString(str);
+		QVERIFY(!move.isNull());
+		opening.push_back(move);
+		board->makeMove(move);
+	}
+	auto data = std::make_shared<SolutionData>(opening, Line(), "", std::list<BranchToSkip>(), "", -1, m_dir.path());
+	m_solution = std::make_shared<Solution>(data);
+	QVERIFY(m_solution->isValid());
+
+	// A book of all the replies down to the STOP moves, with the scores the verifier expects
+	addEntries(board, BOOK_DEPTH);
+	QFile file(m_solution->path(FileType_book));
+	QVERIFY(file.open(QIODevice::WriteOnly));
+	for (const auto& [key, row] : m_rows)
+		QCOMPARE(file.write(row.data(), row.size()), qint64(row.size()));
+	file.close();
+
+	m_report = verify(1);
+	QVERIFY(!m_report.filter("STOP move").isEmpty());
+}
+
+qint16 tst_Verify::addEntries(std::shared_ptr<Chess::Board> board, int depth)
+{
+	quint64 key = board->key();
+	auto it = m_scores.find(key);
+	if (it != m_scores.end())
+		return it->second;
+
+	qint16 score = STOP_SCORE;
+	if (depth == 0)
+	{
+		m_rows[key] = entry_to_bytes(key, 0, score, 0);
+	}
+	else
+	{
+		// The move depends on the position, so that the lines transpose into each other
+		auto legal_moves = board->legalMoves();
+		auto move = legal_moves[int(key % quint64(legal_moves.size()))];
+		SolverMove book_move(move, board);
+		board->makeMove(move);
+		qint16 worst_score = MATE_VALUE;
+		for (const auto& reply : board->legalMoves())
+		{
+			board->makeMove(reply);
+			worst_score = std::min(worst_score, addEntries(board, depth - 1));
+			board->undoMove();
+		}
+		board->undoMove();
+		score = worst_score - 1;
+		m_rows[key] = entry_to_bytes(key, book_move.pgMove, score, 0);
+	}
+	m_scores[key] = score;
+	return score;
+}
+
+QStringList tst_Verify::verify(int numThreads)
+{
+	QStringList report;
+	SolverResults solver(m_solution);
+	connect(&solver, &Solver::Message, this, [&report](const QString& message, MessageType type)
+	{
+		report.append(QString("%1 %2").arg(static_cast<int>(type)).arg(message));
+	});
+	solver.verify(FileType_book, numThreads);
+	return report;
+}
+
+void tst_Verify::parallelReport_data() const
+{
+	QTest::addColumn<int>("numThreads");
+
+	QTest::newRow("1 thread") << 1;
+	QTest::newRow("2 threads") << 2;
+	QTest::newRow("4 threads") << 4;
+	QTest::newRow("8 threads") << 8;
+}
+
+void tst_Verify::parallelReport()
+{
+	QFETCH(int, numThreads);
+
+	// The workers verify the positions in different orders, but the report is replayed in the order of a sequential walk
+	QStringList report = verify(numThreads);
+	QCOMPARE(report.size(), m_report.size());
+	for (int i = 0; i < report.size(); i++)
+		QCOMPARE(report[i], m_report[i]);
+}
+
+QTEST_MAIN(tst_Verify)
+#include "tst_verify.moc"